@@ -0,0 +1,160 @@
+/*! \file
+ * Encoding and decoding of allocation traces.  See alloctrace.h for the
+ * format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloctrace.h"
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int put_varint(unsigned char *buf, unsigned long long value);
+int get_varint(FILE *f, unsigned long long *value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Writes a value as a varint, and returns the number of bytes written. */
+int put_varint(unsigned char *buf, unsigned long long value) {
+    int n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char) value;
+    return n;
+}
+
+
+/* Reads a varint, and returns zero if the file ends in the middle of it. */
+int get_varint(FILE *f, unsigned long long *value) {
+    int c, shift = 0;
+
+    *value = 0;
+    do {
+        c = getc(f);
+        if (c == EOF || shift > 63)
+            return 0;
+        *value |= (unsigned long long) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 1;
+}
+
+
+int trace_encode(unsigned char *buf, const trace_event *event,
+                 unsigned int num_ids) {
+    int n = 0;
+
+    buf[n++] = (unsigned char) event->op;
+
+    if (event->op == TRACE_FREE || event->op == TRACE_REALLOC)
+        n += put_varint(buf + n, num_ids - 1 - event->id);
+    if (event->op == TRACE_ALIGNED)
+        n += put_varint(buf + n, event->alignment);
+    if (event->op != TRACE_FREE)
+        n += put_varint(buf + n, event->size);
+
+    return n;
+}
+
+
+alloc_trace * trace_load(const char *filename) {
+    FILE *f;
+    alloc_trace *trace;
+    trace_event e;
+    char magic[TRACE_MAGIC_SIZE];
+    unsigned long long age;
+    int op, capacity = 1024, ok = 1;
+
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        perror(filename);
+        return NULL;
+    }
+
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, f) != TRACE_MAGIC_SIZE ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        fprintf(stderr, "%s: not an allocation trace\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    trace = (alloc_trace *) malloc(sizeof(alloc_trace));
+    if (trace != NULL)
+        trace->events = (trace_event *) malloc(capacity * sizeof(trace_event));
+    if (trace == NULL || trace->events == NULL) {
+        fprintf(stderr, "real memory system out of memory.\n");
+        abort();
+    }
+    trace->num_events = 0;
+    trace->num_ids = 0;
+
+    while (ok && (op = getc(f)) != EOF) {
+        memset(&e, 0, sizeof(e));
+        e.op = op;
+
+        switch (op) {
+        case TRACE_ALLOC:
+        case TRACE_CALLOC:
+            ok = get_varint(f, &e.size);
+            e.id = trace->num_ids++;
+            break;
+
+        case TRACE_ALIGNED:
+            ok = get_varint(f, &e.alignment) && get_varint(f, &e.size);
+            e.id = trace->num_ids++;
+            break;
+
+        case TRACE_FREE:
+        case TRACE_REALLOC:
+            ok = get_varint(f, &age) && age < trace->num_ids &&
+                 (op == TRACE_FREE || get_varint(f, &e.size));
+            e.id = trace->num_ids - 1 - (unsigned int) age;
+            break;
+
+        default:
+            ok = 0;
+        }
+
+        if (!ok)
+            break;
+
+        if (trace->num_events == capacity) {
+            capacity *= 2;
+            trace->events = (trace_event *) realloc(trace->events,
+                capacity * sizeof(trace_event));
+        }
+        if (trace->events == NULL) {
+            fprintf(stderr, "real memory system out of memory.\n");
+            abort();
+        }
+        trace->events[trace->num_events++] = e;
+    }
+
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "%s: corrupt event %d\n", filename, trace->num_events);
+        trace_release(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+
+void trace_release(alloc_trace *trace) {
+    free(trace->events);
+    free(trace);
+}
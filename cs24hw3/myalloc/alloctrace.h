@@ -0,0 +1,91 @@
+/*! \file
+ * Declarations for allocation traces: compact binary records of the
+ * allocations, frees and reallocations a program makes, which can be
+ * recorded from real programs with the libtracealloc.so shim, and replayed
+ * against any of the allocators with replay.
+ *
+ * A trace file starts with the TRACE_MAGIC bytes, followed by one record per
+ * event.  A record is an opcode byte followed by its operands, each an
+ * unsigned LEB128 varint: 7 bits per byte, least significant first, with
+ * the high bit set on every byte but the last.
+ *
+ *     TRACE_ALLOC    size
+ *     TRACE_CALLOC   size
+ *     TRACE_ALIGNED  alignment size
+ *     TRACE_FREE     age
+ *     TRACE_REALLOC  age size
+ *
+ * Blocks aren't identified by address, which would mean nothing when the
+ * trace is replayed.  Instead, every allocation event gives its block the
+ * next id, counting from 0, and a block keeps its id when it is reallocated.
+ * The other events name their block by its age, the number of blocks
+ * allocated after it, so that the short-lived blocks most programs are full
+ * of take one byte.
+ */
+
+#ifndef ALLOCTRACE_H
+#define ALLOCTRACE_H
+
+#include <stdio.h>
+
+
+/* The bytes that every trace file starts with. */
+#define TRACE_MAGIC "ALLOCTR1"
+#define TRACE_MAGIC_SIZE 8
+
+/* Event opcodes. */
+#define TRACE_ALLOC 1
+#define TRACE_CALLOC 2
+#define TRACE_ALIGNED 3
+#define TRACE_FREE 4
+#define TRACE_REALLOC 5
+
+/* The largest number of bytes that one encoded event can take. */
+#define TRACE_MAX_RECORD (1 + 3 * 10)
+
+
+/* One event of a trace. */
+typedef struct trace_event {
+    int op;
+
+    /* The id of the block the event is about. */
+    unsigned int id;
+
+    /* The requested size, for everything but frees. */
+    unsigned long long size;
+
+    /* The requested alignment, for TRACE_ALIGNED. */
+    unsigned long long alignment;
+} trace_event;
+
+
+/* A whole trace, read into memory so it can be replayed without any I/O. */
+typedef struct alloc_trace {
+    trace_event *events;
+    int num_events;
+
+    /* The number of blocks the trace allocates, and so of ids it uses. */
+    unsigned int num_ids;
+} alloc_trace;
+
+
+/*
+ * Encodes an event into buf, which must have room for TRACE_MAX_RECORD
+ * bytes, and returns the number of bytes written.  num_ids is the number of
+ * blocks allocated before the event.
+ */
+int trace_encode(unsigned char *buf, const trace_event *event,
+                 unsigned int num_ids);
+
+
+/*
+ * Reads a whole trace file.  Returns NULL, after printing why, if it can't
+ * be read or isn't a valid trace.
+ */
+alloc_trace * trace_load(const char *filename);
+
+
+/* Releases a trace returned by trace_load(). */
+void trace_release(alloc_trace *trace);
+
+#endif /* ALLOCTRACE_H */
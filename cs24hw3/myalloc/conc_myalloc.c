@@ -0,0 +1,802 @@
+/*! \file
+ * Implementation of a thread-safe memory allocator, with the same interface
+ * as the allocator in myalloc.c.  Any number of threads may call myalloc()
+ * and myfree() at once, and a block may be freed by a different thread from
+ * the one that allocated it.  init_myalloc(), close_myalloc() and
+ * sanity_check() must not be called while other threads are using the
+ * allocator.
+ *
+ * The allocator has three tiers:
+ *
+ *  - Each thread has a cache of freed small blocks for each small size class,
+ *    so most small allocations and frees don't take a lock at all.
+ *
+ *  - Caches refill from, and overflow into, a central list for each small
+ *    size class, in batches.  Each central list has its own lock, so threads
+ *    working with different sizes don't contend.
+ *
+ *  - Underneath is the boundary-tag heap with segregated free lists from
+ *    myalloc.c, behind a single lock.  Large blocks come straight from it,
+ *    and small blocks are carved from it a batch at a time.
+ *
+ * A small block freed by a thread other than the one that allocated it is
+ * pushed onto a lock-free queue belonging to the allocating thread, which
+ * moves it into its cache the next time that cache runs dry.  This keeps
+ * each thread's cache holding blocks that it has recently used, and means
+ * that a cache is only ever modified by its own thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include "myalloc.h"
+
+
+/*!
+ * These variables are used to specify the size and address of the memory pool
+ * that the allocator works against; see myalloc.c.
+ */
+int MEMORY_SIZE;
+unsigned char *mem;
+
+
+/*
+ * Every block has a header and a footer holding its size, negative if the
+ * block is allocated, as in myalloc.c.  After the header is an info word
+ * (see block_info below).  With the info word, the data of every block
+ * starts on an ALIGNMENT boundary.
+ */
+#define HEADER 4
+#define INFO 4
+#define FOOTER 4
+#define DATA_OFFSET (HEADER + INFO)
+#define ALIGNMENT 8
+
+/* The owner of a large block, which always goes back to the heap. */
+#define OWNER_NONE -1
+
+/*
+ * The owner of a small block that has been freed, and is sitting in a cache,
+ * a central list or a remote-free queue.  This lets myfree() catch small
+ * blocks being freed twice.
+ */
+#define OWNER_CACHED -2
+
+/*
+ * A free heap block holds the links of its free list after its info word,
+ * so every block must have room for a header, an info word, two pointers
+ * and a footer.
+ */
+#define MIN_BLOCK_SIZE 32
+
+/* Free heap blocks are kept on segregated free lists, as in myalloc.c. */
+#define EXACT_CLASS_LIMIT 256
+#define EXACT_CLASS_LOG 8
+#define CLASSES_PER_DOUBLING 4
+#define NUM_HEAP_CLASSES 128
+#define BITMAP_BITS 64
+
+/*
+ * Requests of up to SMALL_MAX bytes are small, and are rounded up to a
+ * multiple of SMALL_STEP bytes to find their size class.
+ */
+#define SMALL_STEP 16
+#define NUM_SMALL_CLASSES 16
+#define SMALL_MAX (SMALL_STEP * NUM_SMALL_CLASSES)
+
+/*
+ * A thread cache holds at most TCACHE_MAX blocks of each class.  Blocks move
+ * between a cache and the central lists TCACHE_BATCH at a time, and a
+ * central list holds at most CENTRAL_MAX blocks before blocks overflow back
+ * into the heap.
+ */
+#define TCACHE_MAX 32
+#define TCACHE_BATCH 16
+#define CENTRAL_MAX 512
+
+/* The most threads that can use the allocator at once. */
+#define MAX_THREADS 64
+
+
+/*
+ * The info word of an allocated block.  For a small block, owner is the index
+ * of the thread cache it belongs to, which lets myfree() send the block back
+ * to the thread that allocated it.  The class is recorded when the block is
+ * carved from the heap, since the heap may hand out a block slightly larger
+ * than the class needs rather than leave a sliver too small to be a block.
+ */
+typedef struct block_info {
+    short owner;
+    short cls;
+} block_info;
+
+
+/* The links stored in a free heap block, just after its info word. */
+typedef struct heap_links {
+    unsigned char *prev;
+    unsigned char *next;
+} heap_links;
+
+
+/*
+ * A thread's cache of freed small blocks.  Each cache has its own cache
+ * lines, so that threads don't slow each other down by using their caches.
+ */
+typedef struct thread_cache {
+    /* The cached blocks of each small class, linked through their data. */
+    unsigned char *lists[NUM_SMALL_CLASSES];
+    int counts[NUM_SMALL_CLASSES];
+
+    /*
+     * Blocks of this cache's thread that other threads have freed, linked
+     * through their data.  Other threads push blocks on with compare-and-
+     * swap, and the owning thread takes the whole queue at once with an
+     * atomic exchange, so there is no ABA problem.
+     */
+    unsigned char *remote_frees;
+
+    /* Nonzero if the cache belongs to a thread. */
+    int in_use;
+} __attribute__((aligned(64))) thread_cache;
+
+
+/* The central list of freed blocks of one small class. */
+typedef struct central_list {
+    pthread_mutex_t lock;
+    unsigned char *head;
+    int count;
+} __attribute__((aligned(64))) central_list;
+
+
+/* The first block header, and the end of the last block in the pool. */
+static unsigned char *heap_start;
+static unsigned char *heap_end;
+
+/* The heap's segregated free lists, and the bitmap of non-empty classes. */
+static unsigned char *heap_lists[NUM_HEAP_CLASSES];
+static unsigned long long nonempty_classes[NUM_HEAP_CLASSES / BITMAP_BITS];
+
+/* Held while using the heap. */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static central_list central[NUM_SMALL_CLASSES];
+static thread_cache caches[MAX_THREADS];
+
+/* Releases a thread's cache when the thread exits. */
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/* The calling thread's cache, or NULL if it doesn't have one yet. */
+static __thread thread_cache *my_cache;
+
+
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int block_size(unsigned char *block);
+void set_block(unsigned char *block, int size);
+block_info * info(unsigned char *block);
+unsigned char ** cached_next(unsigned char *block);
+
+heap_links * links(unsigned char *block);
+int heap_class(int size);
+void heap_add_free(unsigned char *block, int size);
+void heap_remove_free(unsigned char *block, int size);
+unsigned char * heap_find(int size);
+unsigned char * heap_alloc(int size);
+void heap_free(unsigned char *block);
+
+int small_class(int size);
+int small_block_size(int cls);
+
+void create_cache_key(void);
+void release_cache(void *cache);
+thread_cache * get_cache(void);
+void cache_push(thread_cache *tc, int cls, unsigned char *block);
+void flush_cache(thread_cache *tc, int cls, int n);
+void drain_remote_frees(thread_cache *tc);
+int refill_cache(thread_cache *tc, int cls);
+void reclaim_memory(thread_cache *tc);
+void remote_free(unsigned char *block, int owner_index);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the signed size stored in a block's header. */
+int block_size(unsigned char *block) {
+    return *((int *) block);
+}
+
+
+/* Writes a block's header and footer; size is negative if it is allocated. */
+void set_block(unsigned char *block, int size) {
+    *((int *) block) = size;
+    *((int *) (block + abs(size) - FOOTER)) = size;
+}
+
+
+/* Returns a pointer to a block's info word. */
+block_info * info(unsigned char *block) {
+    return (block_info *) (block + HEADER);
+}
+
+
+/* Returns the link of a small block in a cache, central list or queue. */
+unsigned char ** cached_next(unsigned char *block) {
+    return (unsigned char **) (block + DATA_OFFSET);
+}
+
+
+/* Returns the free-list links stored in the body of a free heap block. */
+heap_links * links(unsigned char *block) {
+    return (heap_links *) (block + DATA_OFFSET);
+}
+
+
+/* Returns the heap size class of a block of the specified size. */
+int heap_class(int size) {
+    int log, cls;
+
+    if (size < EXACT_CLASS_LIMIT)
+        return size / ALIGNMENT;
+
+    log = 31 - __builtin_clz((unsigned int) size);
+    cls = EXACT_CLASS_LIMIT / ALIGNMENT +
+          (log - EXACT_CLASS_LOG) * CLASSES_PER_DOUBLING +
+          ((size >> (log - 2)) & (CLASSES_PER_DOUBLING - 1));
+
+    return cls < NUM_HEAP_CLASSES ? cls : NUM_HEAP_CLASSES - 1;
+}
+
+
+/* Marks a heap block as free, and pushes it onto its class's list.  The
+ * heap lock must be held, as for all of the heap functions.
+ */
+void heap_add_free(unsigned char *block, int size) {
+    int cls = heap_class(size);
+    unsigned char *head = heap_lists[cls];
+
+    set_block(block, size);
+    links(block)->prev = NULL;
+    links(block)->next = head;
+    if (head != NULL)
+        links(head)->prev = block;
+
+    heap_lists[cls] = block;
+    nonempty_classes[cls / BITMAP_BITS] |= 1ULL << (cls % BITMAP_BITS);
+}
+
+
+/* Unlinks a free heap block of the specified size from its class's list. */
+void heap_remove_free(unsigned char *block, int size) {
+    int cls = heap_class(size);
+    heap_links *l = links(block);
+
+    if (l->prev != NULL)
+        links(l->prev)->next = l->next;
+    else
+        heap_lists[cls] = l->next;
+
+    if (l->next != NULL)
+        links(l->next)->prev = l->prev;
+
+    if (heap_lists[cls] == NULL)
+        nonempty_classes[cls / BITMAP_BITS] &= ~(1ULL << (cls % BITMAP_BITS));
+}
+
+
+/* Finds the best-fitting free heap block for a block of the specified size,
+ * or returns NULL if there isn't one; see find_free_block() in myalloc.c.
+ */
+unsigned char * heap_find(int size) {
+    unsigned char *block, *best = NULL;
+    unsigned long long bits;
+    int cls, word, best_size = INT_MAX;
+
+    cls = heap_class(size);
+    for (block = heap_lists[cls]; block != NULL; block = links(block)->next) {
+        if (block_size(block) >= size && block_size(block) < best_size) {
+            best = block;
+            best_size = block_size(block);
+            if (best_size == size)
+                break;
+        }
+    }
+    if (best != NULL)
+        return best;
+
+    cls++;
+    for (word = cls / BITMAP_BITS; word < NUM_HEAP_CLASSES / BITMAP_BITS;
+         word++) {
+        bits = nonempty_classes[word];
+        if (word == cls / BITMAP_BITS && cls % BITMAP_BITS != 0)
+            bits &= ~0ULL << (cls % BITMAP_BITS);
+        if (bits == 0)
+            continue;
+
+        cls = word * BITMAP_BITS + __builtin_ctzll(bits);
+        for (block = heap_lists[cls]; block != NULL;
+             block = links(block)->next) {
+            if (block_size(block) < best_size) {
+                best = block;
+                best_size = block_size(block);
+            }
+        }
+        return best;
+    }
+
+    return NULL;
+}
+
+
+/* Allocates a heap block of the specified size, which must be a multiple of
+ * ALIGNMENT, splitting a larger free block if there is enough left over.
+ * Returns NULL if no free block is large enough.
+ */
+unsigned char * heap_alloc(int size) {
+    unsigned char *block;
+    int block_space;
+
+    block = heap_find(size);
+    if (block == NULL)
+        return NULL;
+
+    block_space = block_size(block);
+    heap_remove_free(block, block_space);
+
+    if (block_space - size < MIN_BLOCK_SIZE) {
+        set_block(block, -block_space);
+    }
+    else {
+        set_block(block, -size);
+        heap_add_free(block + size, block_space - size);
+    }
+
+    return block;
+}
+
+
+/* Returns a block to the heap, coalescing it with any free neighbors. */
+void heap_free(unsigned char *block) {
+    unsigned char *right;
+    int free_space = -block_size(block), neighbor_space;
+
+    assert(free_space > 0);
+
+    right = block + free_space;
+    if (right < heap_end) {
+        neighbor_space = block_size(right);
+        if (neighbor_space > 0) {
+            heap_remove_free(right, neighbor_space);
+            free_space += neighbor_space;
+        }
+    }
+
+    if (block > heap_start) {
+        neighbor_space = *((int *) (block - FOOTER));
+        if (neighbor_space > 0) {
+            block -= neighbor_space;
+            heap_remove_free(block, neighbor_space);
+            free_space += neighbor_space;
+        }
+    }
+
+    heap_add_free(block, free_space);
+}
+
+
+/* Returns the small size class for a request of the specified size. */
+int small_class(int size) {
+    return size == 0 ? 0 : (size + SMALL_STEP - 1) / SMALL_STEP - 1;
+}
+
+
+/* Returns the size of the heap blocks used for a small size class. */
+int small_block_size(int cls) {
+    return ((cls + 1) * SMALL_STEP + DATA_OFFSET + FOOTER + ALIGNMENT - 1) /
+           ALIGNMENT * ALIGNMENT;
+}
+
+
+/* Creates the thread-specific key whose destructor releases caches. */
+void create_cache_key(void) {
+    pthread_key_create(&cache_key, release_cache);
+}
+
+
+/* Empties the cache of a thread that is exiting into the central lists, and
+ * releases the cache for another thread to use.  Blocks that are freed onto
+ * the cache's remote-free queue after this are picked up by the next thread
+ * to use the cache.
+ */
+void release_cache(void *cache) {
+    thread_cache *tc = (thread_cache *) cache;
+    int cls;
+
+    drain_remote_frees(tc);
+    for (cls = 0; cls < NUM_SMALL_CLASSES; cls++)
+        flush_cache(tc, cls, tc->counts[cls]);
+
+    STORE_RELEASE(&tc->in_use, 0);
+}
+
+
+/* Returns the calling thread's cache, claiming a free one the first time the
+ * thread uses the allocator.
+ */
+thread_cache * get_cache(void) {
+    int i;
+
+    if (my_cache != NULL)
+        return my_cache;
+
+    pthread_once(&cache_once, create_cache_key);
+
+    for (i = 0; i < MAX_THREADS; i++) {
+        if (__sync_bool_compare_and_swap(&caches[i].in_use, 0, 1)) {
+            my_cache = caches + i;
+            pthread_setspecific(cache_key, my_cache);
+            return my_cache;
+        }
+    }
+
+    fprintf(stderr, "myalloc: more than %d threads are using the allocator\n",
+            MAX_THREADS);
+    abort();
+}
+
+
+/* Pushes a freed small block onto a cache, moving a batch of blocks to the
+ * central list if the cache is full.
+ */
+void cache_push(thread_cache *tc, int cls, unsigned char *block) {
+    *cached_next(block) = tc->lists[cls];
+    tc->lists[cls] = block;
+    tc->counts[cls]++;
+
+    if (tc->counts[cls] > TCACHE_MAX)
+        flush_cache(tc, cls, TCACHE_BATCH);
+}
+
+
+/* Moves n blocks of a class from a cache to the central list, or back into
+ * the heap if the central list is full.
+ */
+void flush_cache(thread_cache *tc, int cls, int n) {
+    unsigned char *first, *last, *next;
+    int i;
+
+    if (n == 0)
+        return;
+
+    /* Detach the first n blocks of the cache's list. */
+    first = last = tc->lists[cls];
+    for (i = 1; i < n; i++)
+        last = *cached_next(last);
+    tc->lists[cls] = *cached_next(last);
+    tc->counts[cls] -= n;
+
+    pthread_mutex_lock(&central[cls].lock);
+    if (central[cls].count + n <= CENTRAL_MAX) {
+        *cached_next(last) = central[cls].head;
+        central[cls].head = first;
+        central[cls].count += n;
+        pthread_mutex_unlock(&central[cls].lock);
+        return;
+    }
+    pthread_mutex_unlock(&central[cls].lock);
+
+    *cached_next(last) = NULL;
+    pthread_mutex_lock(&heap_lock);
+    for (; first != NULL; first = next) {
+        next = *cached_next(first);
+        heap_free(first);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+
+/* Moves the blocks that other threads have freed onto a cache's remote-free
+ * queue into the cache.
+ */
+void drain_remote_frees(thread_cache *tc) {
+    unsigned char *block, *next;
+
+    block = __atomic_exchange_n(&tc->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    for (; block != NULL; block = next) {
+        next = *cached_next(block);
+        cache_push(tc, info(block)->cls, block);
+    }
+}
+
+
+/* Refills an empty cache list, first from the cache's remote-free queue, then
+ * with a batch from the central list, and then with a batch carved from the
+ * heap.  Returns zero if no blocks could be found.
+ */
+int refill_cache(thread_cache *tc, int cls) {
+    central_list *cl = central + cls;
+    unsigned char *block;
+    int i, size;
+
+    drain_remote_frees(tc);
+    if (tc->lists[cls] != NULL)
+        return 1;
+
+    pthread_mutex_lock(&cl->lock);
+    for (i = 0; i < TCACHE_BATCH && cl->head != NULL; i++) {
+        block = cl->head;
+        cl->head = *cached_next(block);
+        cl->count--;
+
+        *cached_next(block) = tc->lists[cls];
+        tc->lists[cls] = block;
+        tc->counts[cls]++;
+    }
+    pthread_mutex_unlock(&cl->lock);
+    if (tc->lists[cls] != NULL)
+        return 1;
+
+    size = small_block_size(cls);
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < TCACHE_BATCH; i++) {
+        block = heap_alloc(size);
+        if (block == NULL)
+            break;
+
+        info(block)->owner = OWNER_CACHED;
+        info(block)->cls = cls;
+        *cached_next(block) = tc->lists[cls];
+        tc->lists[cls] = block;
+        tc->counts[cls]++;
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    return tc->lists[cls] != NULL;
+}
+
+
+/* Returns every block in the calling thread's cache and in the central lists
+ * to the heap, so that they can be coalesced.  This is done when the heap
+ * can't satisfy a request, before giving up.  Blocks in other threads'
+ * caches are left alone.
+ */
+void reclaim_memory(thread_cache *tc) {
+    unsigned char *block, *next;
+    int cls;
+
+    drain_remote_frees(tc);
+
+    pthread_mutex_lock(&heap_lock);
+    for (cls = 0; cls < NUM_SMALL_CLASSES; cls++) {
+        for (block = tc->lists[cls]; block != NULL; block = next) {
+            next = *cached_next(block);
+            heap_free(block);
+        }
+        tc->lists[cls] = NULL;
+        tc->counts[cls] = 0;
+
+        pthread_mutex_lock(&central[cls].lock);
+        for (block = central[cls].head; block != NULL; block = next) {
+            next = *cached_next(block);
+            heap_free(block);
+        }
+        central[cls].head = NULL;
+        central[cls].count = 0;
+        pthread_mutex_unlock(&central[cls].lock);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+
+/* Pushes a small block onto the remote-free queue of the cache that owns
+ * it.
+ */
+void remote_free(unsigned char *block, int owner_index) {
+    thread_cache *tc = caches + owner_index;
+    unsigned char *head;
+
+    head = __atomic_load_n(&tc->remote_frees, __ATOMIC_RELAXED);
+    do {
+        *cached_next(block) = head;
+    } while (!__atomic_compare_exchange_n(&tc->remote_frees, &head, block, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+/*!
+ * This function initializes both the allocator state, and the memory pool.
+ * It must be called before myalloc() or myfree() will work at all, and must
+ * not be called while other threads are using the allocator.
+ */
+void init_myalloc(void) {
+    int cls, size;
+
+    mem = (unsigned char *) malloc(MEMORY_SIZE);
+    if (mem == 0) {
+        fprintf(stderr,
+                "init_myalloc: could not get %d bytes from the system\n",
+                MEMORY_SIZE);
+        abort();
+    }
+
+    for (cls = 0; cls < NUM_HEAP_CLASSES; cls++)
+        heap_lists[cls] = NULL;
+    for (cls = 0; cls < NUM_HEAP_CLASSES / BITMAP_BITS; cls++)
+        nonempty_classes[cls] = 0;
+
+    for (cls = 0; cls < NUM_SMALL_CLASSES; cls++) {
+        pthread_mutex_init(&central[cls].lock, NULL);
+        central[cls].head = NULL;
+        central[cls].count = 0;
+    }
+
+    /* The pool from malloc() is aligned, so every block's data is too. */
+    heap_start = mem;
+    size = MEMORY_SIZE / ALIGNMENT * ALIGNMENT;
+    if (size < MIN_BLOCK_SIZE)
+        size = 0;
+    heap_end = heap_start + size;
+
+    if (size > 0)
+        heap_add_free(heap_start, size);
+}
+
+
+/*!
+ * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
+ * allocation fails.  Small requests are served from the calling thread's
+ * cache, which only takes a lock when it has to be refilled.  Large requests
+ * are served from the heap.  If the heap has no room, the calling thread's
+ * cache and the central lists are returned to it before giving up.
+ */
+unsigned char *myalloc(int size) {
+    thread_cache *tc;
+    unsigned char *block;
+    int cls, needed;
+
+    if (size < 0 || size > INT_MAX - DATA_OFFSET - FOOTER - ALIGNMENT) {
+        fprintf(stderr, "myalloc: cannot service request of size %d\n", size);
+        return NULL;
+    }
+
+    tc = get_cache();
+
+    if (size <= SMALL_MAX) {
+        cls = small_class(size);
+        if (tc->lists[cls] == NULL && !refill_cache(tc, cls)) {
+            reclaim_memory(tc);
+            if (!refill_cache(tc, cls))
+                goto fail;
+        }
+
+        block = tc->lists[cls];
+        tc->lists[cls] = *cached_next(block);
+        tc->counts[cls]--;
+
+        info(block)->owner = tc - caches;
+        return block + DATA_OFFSET;
+    }
+
+    needed = (size + DATA_OFFSET + FOOTER + ALIGNMENT - 1) / ALIGNMENT *
+             ALIGNMENT;
+
+    pthread_mutex_lock(&heap_lock);
+    block = heap_alloc(needed);
+    pthread_mutex_unlock(&heap_lock);
+
+    if (block == NULL) {
+        reclaim_memory(tc);
+        pthread_mutex_lock(&heap_lock);
+        block = heap_alloc(needed);
+        pthread_mutex_unlock(&heap_lock);
+        if (block == NULL)
+            goto fail;
+    }
+
+    info(block)->owner = OWNER_NONE;
+    return block + DATA_OFFSET;
+
+fail:
+    fprintf(stderr, "myalloc: cannot service request of size %d with"
+            " %d byte pool\n", size, MEMORY_SIZE);
+    return NULL;
+}
+
+
+/*!
+ * Free a previously allocated pointer.  oldptr should be an address returned
+ * by myalloc().  A small block goes into the calling thread's cache if the
+ * thread allocated it, or onto the remote-free queue of the thread that did.
+ * A large block goes straight back to the heap.
+ */
+void myfree(unsigned char *oldptr) {
+    unsigned char *block = oldptr - DATA_OFFSET;
+    thread_cache *tc;
+    int current_header, block_owner;
+
+    current_header = block_size(block);
+    block_owner = info(block)->owner;
+    if (current_header > 0 || block_owner == OWNER_CACHED) {
+        fprintf(stderr, "value: %d myalloc: cannot free memory address "
+            "previously freed.\n", current_header);
+        exit(EXIT_FAILURE);
+    }
+
+    if (block_owner == OWNER_NONE) {
+        pthread_mutex_lock(&heap_lock);
+        heap_free(block);
+        pthread_mutex_unlock(&heap_lock);
+        return;
+    }
+
+    info(block)->owner = OWNER_CACHED;
+
+    tc = get_cache();
+    if (tc - caches == block_owner)
+        cache_push(tc, info(block)->cls, block);
+    else
+        remote_free(block, block_owner);
+}
+
+
+/*!
+ * Clean up the allocator state, by freeing the memory pool and emptying every
+ * cache, including the caches of threads that are still running.  No other
+ * thread may be using the allocator.
+ */
+void close_myalloc(void) {
+    int i, cls;
+
+    for (i = 0; i < MAX_THREADS; i++) {
+        for (cls = 0; cls < NUM_SMALL_CLASSES; cls++) {
+            caches[i].lists[cls] = NULL;
+            caches[i].counts[cls] = 0;
+        }
+        caches[i].remote_frees = NULL;
+    }
+
+    for (cls = 0; cls < NUM_SMALL_CLASSES; cls++)
+        pthread_mutex_destroy(&central[cls].lock);
+
+    free(mem);
+}
+
+
+/*
+ * Implements basic verification code to ensure heap is managed correctly, as
+ * in myalloc.c.  Blocks sitting in caches and central lists are allocated as
+ * far as the heap is concerned.  No other thread may be using the allocator.
+ */
+void sanity_check(void) {
+    unsigned char *iterator;
+    int total_space = 0;
+    int num_blocks = 0;
+
+    iterator = heap_start;
+    while (iterator < heap_end) {
+        int block_space = abs(block_size(iterator));
+        total_space += block_space;
+        num_blocks++;
+
+        assert(block_size(iterator) ==
+               *((int *) (iterator + block_space - FOOTER)));
+
+        printf("Block %d: %d. ", num_blocks, block_size(iterator));
+        iterator += block_space;
+    }
+
+    printf("Total space used: %d.\n", total_space);
+
+    assert(total_space + (mem + MEMORY_SIZE - heap_end) == MEMORY_SIZE);
+    return;
+}
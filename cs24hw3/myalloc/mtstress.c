@@ -0,0 +1,357 @@
+/*! \file
+ * A multithreaded stress test and benchmark for the thread-safe allocator in
+ * conc_myalloc.c.  Each thread runs a random mix of allocations and frees
+ * against its own table of blocks, filling each block with a pattern and
+ * checking the pattern when the block is freed.  Some blocks are handed to
+ * the next thread over, which frees them, so that cross-thread frees are
+ * exercised too.
+ *
+ * The same workload is run with 1, 2, 4, ... threads, up to the maximum, and
+ * the throughput of each run is reported along with its speedup over the
+ * single-threaded run.  Built with -DGLOBAL_LOCK, the test instead runs
+ * against myalloc.c with every call made under one global lock, as a
+ * baseline to compare the scaling against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "myalloc.h"
+
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_OPS 1000000
+#define DEFAULT_RANDOM_SEED 1
+
+// the number of blocks each thread keeps at a time
+#define SLOTS 1024
+
+// the number of blocks that can wait to be freed by the next thread
+#define MAILBOX_SIZE 256
+
+// one allocation in LARGE_ONE_IN is large, the rest are small
+#define SMALL_MAX 256
+#define LARGE_MAX 4096
+#define LARGE_ONE_IN 20
+
+// one free in HANDOFF_ONE_IN is handed to the next thread instead
+#define HANDOFF_ONE_IN 8
+
+#define POOL_SIZE (256 * 1024 * 1024)
+
+
+#ifdef GLOBAL_LOCK
+
+// myalloc.c isn't thread-safe, so every call is made under one lock
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned char *stress_alloc(int size) {
+  unsigned char *result;
+  pthread_mutex_lock(&global_lock);
+  result = myalloc(size);
+  pthread_mutex_unlock(&global_lock);
+  return result;
+}
+
+void stress_free(unsigned char *ptr) {
+  pthread_mutex_lock(&global_lock);
+  myfree(ptr);
+  pthread_mutex_unlock(&global_lock);
+}
+
+#define ALLOCATOR_NAME "myalloc.c under a global lock"
+
+#else
+
+#define stress_alloc myalloc
+#define stress_free myfree
+
+#define ALLOCATOR_NAME "conc_myalloc.c"
+
+#endif
+
+
+// a block in a thread's table, along with the byte it was filled with
+typedef struct block {
+  unsigned char *ptr;
+  int size;
+  unsigned char fill;
+} block;
+
+// blocks handed to a thread for it to free
+typedef struct mailbox {
+  pthread_mutex_t lock;
+  block blocks[MAILBOX_SIZE];
+  int count;
+} mailbox;
+
+// the state of one thread in a run
+typedef struct stress_thread {
+  pthread_t thread;
+  int index;
+  int num_threads;
+  int ops;
+  unsigned int seed;
+  block slots[SLOTS];
+
+  // results
+  long long completed_ops;
+  int failed_allocs;
+  int corrupt_blocks;
+} stress_thread;
+
+
+stress_thread *threads;
+mailbox *mailboxes;
+pthread_barrier_t start_barrier;
+
+
+// some random numbers, from a per-thread seed...
+
+int random_int(unsigned int *seed, int max) {
+  return 1 + (int) ((long long) max * (long long) rand_r(seed) /
+                    ((long long) RAND_MAX + 1));
+}
+
+
+int random_block_size(unsigned int *seed) {
+  if (random_int(seed, LARGE_ONE_IN) == 1)
+    return SMALL_MAX + random_int(seed, LARGE_MAX - SMALL_MAX);
+  return random_int(seed, SMALL_MAX);
+}
+
+
+double current_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// check that a block still holds its fill byte, then free it
+int check_and_free(block *b) {
+  int i;
+  int corrupt = 0;
+
+  for (i = 0; i < b->size; i++) {
+    if (b->ptr[i] != b->fill) {
+      corrupt = 1;
+      break;
+    }
+  }
+
+  stress_free(b->ptr);
+  b->ptr = NULL;
+  return corrupt;
+}
+
+
+// free every block that other threads have handed to this one
+void empty_mailbox(stress_thread *t) {
+  mailbox *box = mailboxes + t->index;
+  block waiting[MAILBOX_SIZE];
+  int count, i;
+
+  pthread_mutex_lock(&box->lock);
+  count = box->count;
+  memcpy(waiting, box->blocks, count * sizeof(block));
+  box->count = 0;
+  pthread_mutex_unlock(&box->lock);
+
+  for (i = 0; i < count; i++)
+    t->corrupt_blocks += check_and_free(waiting + i);
+}
+
+
+// hand a block to the next thread to free; returns 0 if its mailbox is full
+int hand_off(stress_thread *t, block *b) {
+  mailbox *box = mailboxes + (t->index + 1) % t->num_threads;
+  int sent = 0;
+
+  pthread_mutex_lock(&box->lock);
+  if (box->count < MAILBOX_SIZE) {
+    box->blocks[box->count++] = *b;
+    sent = 1;
+  }
+  pthread_mutex_unlock(&box->lock);
+
+  if (sent)
+    b->ptr = NULL;
+  return sent;
+}
+
+
+void *run_thread(void *arg) {
+  stress_thread *t = (stress_thread *) arg;
+  block *b;
+  int op, i;
+
+  pthread_barrier_wait(&start_barrier);
+
+  for (op = 0; op < t->ops; op++) {
+    b = t->slots + random_int(&t->seed, SLOTS) - 1;
+
+    if (b->ptr == NULL) {      // allocate a block
+      b->size = random_block_size(&t->seed);
+      b->fill = (unsigned char) random_int(&t->seed, 256);
+      b->ptr = stress_alloc(b->size);
+      if (b->ptr == NULL) {
+        t->failed_allocs++;
+        continue;
+      }
+      memset(b->ptr, b->fill, b->size);
+    }
+    else {    // free it, here or in the next thread
+      if (t->num_threads == 1 || random_int(&t->seed, HANDOFF_ONE_IN) != 1 ||
+          !hand_off(t, b)) {
+        t->corrupt_blocks += check_and_free(b);
+      }
+    }
+
+    if (op % 64 == 0)
+      empty_mailbox(t);
+
+    t->completed_ops++;
+  }
+
+  // wait for every thread to stop handing blocks off before cleaning up
+  pthread_barrier_wait(&start_barrier);
+  empty_mailbox(t);
+
+  for (i = 0; i < SLOTS; i++) {
+    if (t->slots[i].ptr != NULL)
+      t->corrupt_blocks += check_and_free(t->slots + i);
+  }
+
+  return NULL;
+}
+
+
+// run the workload with the given number of threads; returns ops per second
+double run_stress(int num_threads, int ops, int seed, int *failures) {
+  double start, elapsed;
+  long long total_ops = 0;
+  int failed_allocs = 0, corrupt_blocks = 0;
+  int i;
+
+#ifdef GLOBAL_LOCK
+  // myalloc.c starts with an empty pool, and grows it as the threads need
+  MEMORY_SIZE = 0;
+  MEMORY_LIMIT = POOL_SIZE;
+#else
+  MEMORY_SIZE = POOL_SIZE;
+#endif
+  init_myalloc();
+
+  threads = calloc(num_threads, sizeof(stress_thread));
+  mailboxes = calloc(num_threads, sizeof(mailbox));
+  if (threads == NULL || mailboxes == NULL) {
+    fprintf(stderr, "real memory system out of memory.\n");
+    abort();
+  }
+
+  // the main thread waits at the barrier too, to start the clock
+  pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+
+  for (i = 0; i < num_threads; i++) {
+    pthread_mutex_init(&mailboxes[i].lock, NULL);
+    threads[i].index = i;
+    threads[i].num_threads = num_threads;
+    threads[i].ops = ops;
+    threads[i].seed = seed * 7919 + i;
+    pthread_create(&threads[i].thread, NULL, run_thread, threads + i);
+  }
+
+  pthread_barrier_wait(&start_barrier);
+  start = current_time();
+
+  // the threads finish their operations, then wait again before cleaning up
+  pthread_barrier_wait(&start_barrier);
+  elapsed = current_time() - start;
+
+  for (i = 0; i < num_threads; i++) {
+    pthread_join(threads[i].thread, NULL);
+    total_ops += threads[i].completed_ops;
+    failed_allocs += threads[i].failed_allocs;
+    corrupt_blocks += threads[i].corrupt_blocks;
+    pthread_mutex_destroy(&mailboxes[i].lock);
+  }
+
+  if (failed_allocs > 0)
+    printf("\t%d allocations failed.\n", failed_allocs);
+  if (corrupt_blocks > 0)
+    printf("\t%d blocks were corrupted.\n", corrupt_blocks);
+  *failures += corrupt_blocks;
+
+  pthread_barrier_destroy(&start_barrier);
+  free(threads);
+  free(mailboxes);
+  close_myalloc();
+
+  return total_ops / elapsed;
+}
+
+
+void usage(char *program) {
+  printf("usage: %s [-t max_threads] [-o ops_per_thread] [-s seed]\n",
+         program);
+}
+
+
+int main(int argc, char *argv[]) {
+  int max_threads = DEFAULT_MAX_THREADS;
+  int ops = DEFAULT_OPS;
+  int seed = DEFAULT_RANDOM_SEED;
+  int failures = 0;
+  int num_threads, opt;
+  double throughput, base_throughput = 0;
+
+  while ((opt = getopt(argc, argv, "t:o:s:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'o':
+      ops = atoi(optarg);
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (max_threads < 1 || ops < 1) {
+    printf("ERROR:  max_threads and ops_per_thread must be positive\n");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  printf("Stress testing %s with %d operations per thread "
+         "(%ld processors online).\n", ALLOCATOR_NAME, ops,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %14s %8s\n", "threads", "ops/sec", "speedup");
+
+  for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    throughput = run_stress(num_threads, ops, seed, &failures);
+    if (num_threads == 1)
+      base_throughput = throughput;
+
+    printf("%8d %14.0f %7.2fx\n", num_threads, throughput,
+           throughput / base_throughput);
+  }
+
+  if (failures > 0) {
+    printf("FAILED:  %d blocks were corrupted.\n", failures);
+    return 1;
+  }
+
+  printf("Passed.\n");
+  return 0;
+}
@@ -3,335 +3,1666 @@
  * pool of memory, provides memory chunks on request, and reintegrates freed
  * memory back into the pool.
  *
+ * The allocator has two tiers.  Small requests are served from slabs:
+ * aligned pages carved from the pool, each holding objects of one size, with
+ * a bitmap of which objects are free and no header on the objects
+ * themselves.  Everything else, including the slab pages, is a block in a
+ * boundary-tag heap with segregated free lists.
+ *
  * Adapted from Andre DeHon's CS24 2004, 2006 material.
  * Copyright (C) California Institute of Technology, 2004-2010.
  * All rights reserved.
  */
 
+/* For mremap(). */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "myalloc.h"
 
 
 /*!
  * These variables are used to specify the size and address of the memory pool
- * that the simple allocator works against.  The memory pool is allocated 
- * within init_myalloc(), and then myalloc() and free() work against this 
+ * that the simple allocator works against.  The memory pool is allocated
+ * within init_myalloc(), and then myalloc() and free() work against this
  * pool of memory that mem points to.
  */
 int MEMORY_SIZE;
 unsigned char *mem;
 
+/*!
+ * If this is larger than MEMORY_SIZE, the pool starts out with MEMORY_SIZE
+ * bytes, and grows as needed up to this many bytes.  Otherwise, the pool is
+ * fixed at MEMORY_SIZE bytes, and requests fail once it is full.
+ */
+int MEMORY_LIMIT;
+
 
-/* 
- * Size of the header and footer (bytes). They will store the block sizes as 
+/*
+ * Size of the header and footer (bytes). They will store the block sizes as
  * ints with the sign of the int signifying whether it is free or allocated.
- * A negative value indicates that the block is allocated while a positive 
- * value indicates that the block is free. 
+ * A negative value indicates that the block is allocated while a positive
+ * value indicates that the block is free.
  */
 static unsigned const int HEADER = sizeof(int);
 static unsigned const int FOOTER = sizeof(int);
 
+/*
+ * Every block size is a multiple of ALIGNMENT, so that headers, footers and
+ * free-list links are always aligned ints.
+ */
+#define ALIGNMENT 4
+
+/*
+ * A free block holds the links of its free list in its body, so every block
+ * must be large enough to hold a header, two links and a footer, even if it
+ * is allocated to hold less.
+ */
+#define MIN_BLOCK_SIZE 16
+
+/* The free-list link value that means "no block". */
+#define NO_BLOCK -1
+
+/*
+ * Free blocks are kept on segregated free lists, one per size class.  Blocks
+ * smaller than EXACT_CLASS_LIMIT bytes have a class for each multiple of
+ * ALIGNMENT.  Above that, each power of 2 is split into CLASSES_PER_DOUBLING
+ * classes, so the blocks in one class differ in size by at most 25%.
+ */
+#define EXACT_CLASS_LIMIT 128
+#define EXACT_CLASS_LOG 7
+#define CLASSES_PER_DOUBLING 4
+#define NUM_CLASSES 128
+
+/* The number of bits in each word of the bitmap of non-empty classes. */
+#define BITMAP_BITS 64
+
+/*
+ * Slab pages are SLAB_SIZE bytes, and start on a multiple of SLAB_SIZE from
+ * the start of the pool, so the page holding any object can be found from
+ * its address.  Requests of up to SLAB_MAX bytes are served from slabs.
+ */
+#define SLAB_SIZE 1024
+#define SLAB_MAX 128
+#define NUM_SLAB_CLASSES 7
+
+/*
+ * A new slab is only carved for a class that has at least SLAB_PROMOTE
+ * objects live.  A mostly-empty slab holds a whole page, so sizes that are
+ * rare are better off in the heap.
+ */
+#define SLAB_PROMOTE 8
+
+/*
+ * A growable pool is a range of address space reserved up front, so that
+ * free-list offsets and coalescing work across the whole pool.  It grows by
+ * mapping whole regions of REGION_SIZE bytes onto the end of the heap.  Free
+ * blocks of at least RELEASE_SIZE bytes give their pages back to the system,
+ * and requests of at least HUGE_SIZE bytes get mappings of their own, with a
+ * HUGE_HEADER in front of the data.
+ */
+#define REGION_SIZE (64 * 1024)
+#define RELEASE_SIZE (4 * REGION_SIZE)
+#define HUGE_SIZE (256 * 1024)
+#define HUGE_HEADER 16
+
+/* The free bitmap of a slab has a bit for each object. */
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / 8 / 32)
+
+
+/*
+ * The links stored in the body of a free block, just after its header.  The
+ * lists are doubly linked so that a free block can be unlinked in constant
+ * time when it is coalesced with a neighbor that is being freed.  Links are
+ * the offsets of blocks from the start of the pool, which take half the
+ * space of pointers and only need the alignment of an int.
+ */
+typedef struct free_links {
+    int prev;
+    int next;
+} free_links;
+
+
+/*
+ * The header of a slab, which sits just in front of its page, so that the
+ * whole page holds objects.  Slabs with free objects are kept on a doubly-
+ * linked list for their class, linked by the offsets of their headers from
+ * the start of the pool.
+ */
+typedef struct slab {
+    int cls;
+    int free_count;
+    int prev;
+    int next;
+
+    /* Bit i is set when object i is free. */
+    unsigned int free_bits[SLAB_BITMAP_WORDS];
+} slab;
+
+
+/* The object size of each slab class. */
+static const int slab_sizes[NUM_SLAB_CLASSES] = {
+    8, 16, 32, 48, 64, 96, 128
+};
+
+/* The slab class for each request size, in multiples of 8 bytes. */
+static int slab_class_of[SLAB_MAX / 8 + 1];
+
+/* The first slab with free objects in each class, or NO_BLOCK. */
+static int partial_slabs[NUM_SLAB_CLASSES];
+
+/*
+ * The number of live objects in each slab class, counting both slab objects
+ * and heap blocks whose data would fit in the class.  Heap blocks are
+ * counted by block size both when they are allocated and when they are
+ * freed, so the counts stay exact.
+ */
+static int live_objects[NUM_SLAB_CLASSES];
+
+/*
+ * One entry for each SLAB_SIZE page of the pool, which is nonzero if the page
+ * is a slab.  This lives outside the pool, and costs a byte per page.
+ */
+static unsigned char *slab_map;
+
+
+/* The header in front of the data of a huge request's own mapping. */
+typedef struct huge_header {
+    size_t length;
+    int size;
+} huge_header;
+
+
+/* The first block header, and the end of the last block in the pool. */
+static unsigned char *heap_start;
+static unsigned char *heap_end;
+
+/*
+ * The end of the highest block that has been allocated since the memory
+ * above it was mapped.  Memory from the system is zeroed, and the only
+ * things the allocator writes above this point are the header and links of
+ * a free block starting exactly here, and the footer of the last free block,
+ * so mycalloc() barely has to clear a block that starts at or above it.
+ */
+static unsigned char *heap_touched;
+
+/*
+ * The bytes of address space reserved for the pool, starting at mem, and
+ * whether the heap may grow into all of it.
+ */
+static size_t pool_reserved;
+static int pool_growable;
+
+/* The number of huge mappings, and the bytes requested and mapped for them. */
+static int huge_blocks;
+static int huge_bytes;
+static size_t huge_mapped;
+
+/* The first free block in each size class, or NO_BLOCK if it is empty. */
+static int free_lists[NUM_CLASSES];
+
+/*
+ * Bit c of this bitmap is set when free_lists[c] is non-empty, so that the
+ * smallest non-empty class above a given one can be found without looking
+ * at every list.
+ */
+static unsigned long long nonempty_classes[NUM_CLASSES / BITMAP_BITS];
+
 /* Pointer that is used by many functions to traverse the blocks of memory. */
 static unsigned char *iterator;
 
 
+#if NUM_CLASSES != MYALLOC_SIZE_BUCKETS
+#error "the size histograms must have a bucket for each size class"
+#endif
+
+/*
+ * The counters of the statistics; see myalloc_stats.  They are updated by
+ * the public functions rather than the tiers, so that chunks the allocator
+ * carves or moves for itself, such as slab pages and the copies made by
+ * myrealloc(), aren't counted.  Everything about free blocks is found by
+ * walking the free lists when the statistics are taken.
+ */
+static myalloc_stats stats;
+
+/*
+ * Sampled call sites, in a table with open addressing keyed on the return
+ * address.  One slot is always left empty so that probing stops; sites
+ * beyond the first MAX_SITES - 1 aren't recorded.  The sampling interval
+ * outlives init_myalloc(), so that it can be set before the pool exists.
+ */
+#define MAX_SITES 256
+static myalloc_site sites[MAX_SITES];
+static int num_sites;
+static int sample_interval;
+static int sample_countdown;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int block_size(unsigned char *block);
+void set_block(unsigned char *block, int size);
+free_links * links(unsigned char *block);
+unsigned char * block_at(int offset);
+
+int block_needed(int size);
+int size_class(int size);
+void count_heap_block(int size, int delta);
+void add_free_block(unsigned char *block, int size);
+void remove_free_block(unsigned char *block, int size);
+unsigned char * find_free_block(int size);
+unsigned char * take_free_block(unsigned char *block, int size);
+void trim_block(unsigned char *block, int size);
+unsigned char * find_aligned_block(int size, int alignment, int offset);
+
+unsigned char * coalesce_free_block(unsigned char *block, int size);
+int grow_heap(int size);
+void release_pages(unsigned char *block);
+int in_pool(unsigned char *ptr);
+unsigned char * huge_alloc(int size);
+unsigned char * huge_realloc(unsigned char *ptr, int size);
+void huge_free(unsigned char *ptr);
+
+slab * slab_of(unsigned char *ptr);
+slab * slab_of_block(unsigned char *block);
+int heap_slab_class(int size);
+int slab_capacity(int cls);
+unsigned char * slab_object(slab *s, int index);
+void push_partial_slab(slab *s);
+void remove_partial_slab(slab *s);
+slab * new_slab(int cls);
+unsigned char * slab_alloc(int cls);
+void slab_free(slab *s, unsigned char *ptr);
+
+int chunk_size(unsigned char *ptr);
+void note_request(unsigned char *ptr, int size, long long *counter,
+                  void *site);
+void sample_site(void *site, int size);
+int compare_sites(const void *a, const void *b);
+void dump_histogram(FILE *out, const char *name, long long *counts);
+
+unsigned char * allocate_chunk(int size, int *p_fresh);
+void free_chunk(unsigned char *ptr);
+unsigned char * resize_chunk(unsigned char *oldptr, int size);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the signed size stored in a block's header. */
+int block_size(unsigned char *block) {
+    return *((int *) block);
+}
+
+
+/* Writes a block's header and footer; size is negative if it is allocated. */
+void set_block(unsigned char *block, int size) {
+    *((int *) block) = size;
+    *((int *) (block + abs(size) - FOOTER)) = size;
+}
+
+
+/* Returns the free-list links stored in the body of a free block. */
+free_links * links(unsigned char *block) {
+    return (free_links *) (block + HEADER);
+}
+
+
+/* Returns the block at a free-list link, or NULL for NO_BLOCK. */
+unsigned char * block_at(int offset) {
+    return offset == NO_BLOCK ? NULL : mem + offset;
+}
+
+
+/*
+ * Returns the size of the block needed for a request of the specified size:
+ * the request plus a header and footer, rounded up to a multiple of
+ * ALIGNMENT, and with room for the free links.
+ */
+int block_needed(int size) {
+    int needed;
+
+    needed = (size + HEADER + FOOTER + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    return needed < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : needed;
+}
+
+
+/*
+ * Returns the size class of a block of the specified size.  Classes below
+ * EXACT_CLASS_LIMIT hold one size each; above that, the class is found from
+ * the position of the highest set bit and the two bits below it.
+ */
+int size_class(int size) {
+    int log, cls;
+
+    if (size < EXACT_CLASS_LIMIT)
+        return size / ALIGNMENT;
+
+    log = 31 - __builtin_clz((unsigned int) size);
+    cls = EXACT_CLASS_LIMIT / ALIGNMENT +
+          (log - EXACT_CLASS_LOG) * CLASSES_PER_DOUBLING +
+          ((size >> (log - 2)) & (CLASSES_PER_DOUBLING - 1));
+
+    return cls < NUM_CLASSES ? cls : NUM_CLASSES - 1;
+}
+
+
+/*
+ * Adds delta to the count of live objects in the slab class that the data of
+ * an allocated heap block of the specified size would fit in, if any.  See
+ * live_objects.
+ */
+void count_heap_block(int size, int delta) {
+    int cls = heap_slab_class(size);
+
+    if (cls >= 0)
+        live_objects[cls] += delta;
+}
+
+
+/* Marks a block as free, and pushes it onto the front of its class's list. */
+void add_free_block(unsigned char *block, int size) {
+    int cls = size_class(size);
+    unsigned char *head = block_at(free_lists[cls]);
+
+    set_block(block, size);
+    links(block)->prev = NO_BLOCK;
+    links(block)->next = free_lists[cls];
+    if (head != NULL)
+        links(head)->prev = block - mem;
+
+    free_lists[cls] = block - mem;
+    nonempty_classes[cls / BITMAP_BITS] |= 1ULL << (cls % BITMAP_BITS);
+}
+
+
+/* Unlinks a free block of the specified size from its class's list. */
+void remove_free_block(unsigned char *block, int size) {
+    int cls = size_class(size);
+    free_links *l = links(block);
+
+    if (l->prev != NO_BLOCK)
+        links(mem + l->prev)->next = l->next;
+    else
+        free_lists[cls] = l->next;
+
+    if (l->next != NO_BLOCK)
+        links(mem + l->next)->prev = l->prev;
+
+    if (free_lists[cls] == NO_BLOCK)
+        nonempty_classes[cls / BITMAP_BITS] &= ~(1ULL << (cls % BITMAP_BITS));
+}
+
+
+/*
+ * Finds the free block that myalloc() should use for a block of the specified
+ * size, or returns NULL if there isn't one.  Blocks in the request's own class
+ * may be too small, so that class's list is searched for the best fit.  If
+ * nothing there fits, every block in the next non-empty class does, and the
+ * best fit within that class is used.  Only one list is ever searched, and
+ * the lists are short because each class covers a narrow range of sizes.
+ */
+unsigned char * find_free_block(int size) {
+    unsigned char *block, *best = NULL;
+    unsigned long long bits;
+    int cls, word, best_size = INT_MAX;
+
+    stats.searches++;
+
+    cls = size_class(size);
+    for (block = block_at(free_lists[cls]); block != NULL;
+         block = block_at(links(block)->next)) {
+        stats.blocks_scanned++;
+        if (block_size(block) >= size && block_size(block) < best_size) {
+            best = block;
+            best_size = block_size(block);
+            if (best_size == size)
+                break;
+        }
+    }
+    if (best != NULL)
+        return best;
+
+    /* Find the lowest non-empty class above cls using the bitmap. */
+    cls++;
+    for (word = cls / BITMAP_BITS; word < NUM_CLASSES / BITMAP_BITS; word++) {
+        bits = nonempty_classes[word];
+        if (word == cls / BITMAP_BITS && cls % BITMAP_BITS != 0)
+            bits &= ~0ULL << (cls % BITMAP_BITS);
+        if (bits == 0)
+            continue;
+
+        cls = word * BITMAP_BITS + __builtin_ctzll(bits);
+        for (block = block_at(free_lists[cls]); block != NULL;
+             block = block_at(links(block)->next)) {
+            stats.blocks_scanned++;
+            if (block_size(block) < best_size) {
+                best = block;
+                best_size = block_size(block);
+            }
+        }
+        return best;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Allocates a block of the specified size from a free block, which must be
+ * at least that large.  If the rest of the free block is too small to be a
+ * block on its own, the whole block is handed out.  Otherwise, we split, and
+ * the second block goes back onto a free list.
+ */
+unsigned char * take_free_block(unsigned char *block, int size) {
+    int block_space = block_size(block);
+
+    remove_free_block(block, block_space);
+
+    if (block_space - size < MIN_BLOCK_SIZE) {
+        set_block(block, -block_space);
+    }
+    else {
+        set_block(block, -size);
+        add_free_block(block + size, block_space - size);
+    }
+
+    count_heap_block(-block_size(block), 1);
+    if (block - block_size(block) > heap_touched)
+        heap_touched = block - block_size(block);
+
+    return block;
+}
+
+
+/*
+ * Shrinks an allocated block to the specified size, if what is left over is
+ * large enough to be a block on its own.  The rest is freed, and coalesced
+ * with the block after it if that is free.
+ */
+void trim_block(unsigned char *block, int size) {
+    int block_space = -block_size(block);
+
+    if (block_space - size < MIN_BLOCK_SIZE)
+        return;
+
+    count_heap_block(block_space, -1);
+    count_heap_block(size, 1);
+
+    set_block(block, -size);
+    set_block(block + size, -(block_space - size));
+    release_pages(coalesce_free_block(block + size, block_space - size));
+}
+
+
+/*
+ * Allocates a block of the specified size with the byte offset bytes into
+ * its data a multiple of alignment bytes from the start of the pool, or
+ * returns NULL if no free block has room for one.  Any space in front of the
+ * aligned block goes back onto a free list, so it must be empty or large
+ * enough to be a block.  The free lists are searched from the smallest class
+ * that could fit, taking the first block that works, so this takes time
+ * linear in the number of free blocks; it is only used to carve slab pages,
+ * which is rare, and for myalloc_aligned().
+ */
+unsigned char * find_aligned_block(int size, int alignment, int offset) {
+    unsigned char *block, *data;
+    int cls, block_space, lead;
+
+    stats.searches++;
+
+    for (cls = size_class(size); cls < NUM_CLASSES; cls++) {
+        if (!(nonempty_classes[cls / BITMAP_BITS] &
+              (1ULL << (cls % BITMAP_BITS))))
+            continue;
+
+        for (block = block_at(free_lists[cls]); block != NULL;
+             block = block_at(links(block)->next)) {
+            stats.blocks_scanned++;
+            block_space = block_size(block);
+
+            /* Find the first aligned address that leaves a usable gap. */
+            data = mem + ((block + HEADER + offset - mem) + alignment - 1) /
+                   alignment * alignment;
+            lead = data - offset - HEADER - block;
+            while (lead > 0 && lead < MIN_BLOCK_SIZE) {
+                data += alignment;
+                lead += alignment;
+            }
+
+            if (lead + size > block_space)
+                continue;
+
+            /* Split off the gap as a free block of its own. */
+            if (lead > 0) {
+                remove_free_block(block, block_space);
+                add_free_block(block, lead);
+                add_free_block(block + lead, block_space - lead);
+                block += lead;
+            }
+
+            return take_free_block(block, size);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Marks a block as free, merging it with any free neighbors, and puts the
+ * result on the free list for its size.  Returns the merged block.  This is
+ * a constant time operation because we have headers and footers to help us
+ * look at the right block and left block, respectively.  More specifically,
+ * for coalescing to the right, we simply look at the header of the
+ * right/next block and check its sign to see if we can merge it with the
+ * current block. For coalescing to the left, we look at the footer of the
+ * left/previous block and check its sign to see if we can merge it with the
+ * current block.  A free neighbor is unlinked from its free list before
+ * merging, which is also constant time since the lists are doubly linked.
+ */
+unsigned char * coalesce_free_block(unsigned char *block, int size) {
+    unsigned char *right;
+    int neighbor_space;
+
+    /* Coalesce with the right neighbor, unless this is the last block. */
+    right = block + size;
+    if (right < heap_end) {
+        neighbor_space = block_size(right);
+        if (neighbor_space > 0) {
+            remove_free_block(right, neighbor_space);
+            size += neighbor_space;
+        }
+    }
+
+    /* Coalesce with the left neighbor, unless this is the first block. */
+    if (block > heap_start) {
+        neighbor_space = *((int *) (block - FOOTER));
+        if (neighbor_space > 0) {
+            block -= neighbor_space;
+            remove_free_block(block, neighbor_space);
+            size += neighbor_space;
+        }
+    }
+
+    add_free_block(block, size);
+    return block;
+}
+
+
+/*
+ * Grows a growable heap by enough whole regions to hold a block of the
+ * specified size, merging them with a free block at the end of the heap if
+ * there is one.  Returns zero if the heap can't grow that far.
+ */
+int grow_heap(int size) {
+    unsigned char *block, *old_end = heap_end;
+    size_t amount;
+
+    if (!pool_growable)
+        return 0;
+
+    amount = ((size_t) size + REGION_SIZE - 1) / REGION_SIZE * REGION_SIZE;
+    if (amount > (size_t) (mem + pool_reserved - heap_end))
+        return 0;
+
+    if (mmap(heap_end, amount, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+        return 0;
+
+    block = heap_end;
+    heap_end += amount;
+
+    /*
+     * If the new space was merged with a free block at the old end of the
+     * heap, that block's footer is left in the middle of the merged block.
+     * Clear it, so that only the places described at heap_touched are dirty.
+     */
+    if (coalesce_free_block(block, (int) amount) < old_end)
+        *((int *) (old_end - FOOTER)) = 0;
+    return 1;
+}
+
+
+/*
+ * Gives the pages of a large free block in a growable heap back to the
+ * system.  At the end of the heap, whole regions are given back and the heap
+ * shrinks, keeping a region or two as slack so that a program that frees and
+ * allocates in turn doesn't map and unmap over and over.  The regions are
+ * mapped again with no access rather than unmapped, so that nothing else
+ * can be mapped into the pool's address space.  Elsewhere, the pages inside
+ * the block are dropped with madvise(), and come back zeroed when touched.
+ * This costs a system call, so it is only done for blocks of at least
+ * RELEASE_SIZE bytes.
+ */
+void release_pages(unsigned char *block) {
+    int size = block_size(block);
+    size_t page = sysconf(_SC_PAGESIZE);
+    unsigned char *end, *start;
+
+    if (!pool_growable || size < RELEASE_SIZE)
+        return;
+
+    if (block + size == heap_end) {
+        end = mem + ((block - mem) + 2 * REGION_SIZE - 1) / REGION_SIZE *
+              REGION_SIZE;
+
+        mmap(end, heap_end - end, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+
+        remove_free_block(block, size);
+        heap_end = end;
+        add_free_block(block, heap_end - block);
+        if (heap_touched > heap_end)
+            heap_touched = heap_end;
+    }
+    else {
+        /* Keep the header, links and footer; drop the pages in between. */
+        start = mem + ((block + HEADER + sizeof(free_links) - mem) + page - 1) /
+                page * page;
+        end = mem + ((block + size - FOOTER) - mem) / page * page;
+        madvise(start, end - start, MADV_DONTNEED);
+    }
+}
+
+
+/* Returns nonzero if an address is in the pool, rather than a huge mapping. */
+int in_pool(unsigned char *ptr) {
+    return ptr >= mem && ptr < mem + pool_reserved;
+}
+
+
+/*
+ * Serves a huge request with a mapping of its own, which goes straight back
+ * to the system when it is freed.  Returns NULL if the mapping fails.
+ */
+unsigned char * huge_alloc(int size) {
+    huge_header *h;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = ((size_t) size + HUGE_HEADER + page - 1) / page * page;
+
+    h = (huge_header *) mmap(NULL, length, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (h == MAP_FAILED)
+        return NULL;
+
+    h->length = length;
+    h->size = size;
+
+    huge_blocks++;
+    huge_bytes += size;
+    huge_mapped += length;
+    return (unsigned char *) h + HUGE_HEADER;
+}
+
+
+/*
+ * Resizes the mapping of a huge request with mremap(), which lets the kernel
+ * move its pages rather than copying them.  Returns NULL, leaving the
+ * mapping alone, if the mapping can't be resized.
+ */
+unsigned char * huge_realloc(unsigned char *ptr, int size) {
+    huge_header *h = (huge_header *) (ptr - HUGE_HEADER);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length = ((size_t) size + HUGE_HEADER + page - 1) / page * page;
+    size_t old_length = h->length;
+
+    if (length != old_length) {
+        h = (huge_header *) mremap(h, old_length, length, MREMAP_MAYMOVE);
+        if (h == MAP_FAILED)
+            return NULL;
+    }
+
+    huge_bytes += size - h->size;
+    huge_mapped += length - old_length;
+    h->length = length;
+    h->size = size;
+    return (unsigned char *) h + HUGE_HEADER;
+}
+
+
+/* Unmaps the mapping of a huge request. */
+void huge_free(unsigned char *ptr) {
+    huge_header *h = (huge_header *) (ptr - HUGE_HEADER);
+
+    huge_blocks--;
+    huge_bytes -= h->size;
+    huge_mapped -= h->length;
+    munmap(h, h->length);
+}
+
+
+/* Returns the slab holding an address, or NULL if it isn't in a slab. */
+slab * slab_of(unsigned char *ptr) {
+    int page = (ptr - mem) / SLAB_SIZE;
+
+    if (!slab_map[page])
+        return NULL;
+
+    return (slab *) (mem + page * SLAB_SIZE) - 1;
+}
+
+
+/* Returns the slab that an allocated heap block holds, or NULL if it holds
+ * something else.
+ */
+slab * slab_of_block(unsigned char *block) {
+    if (-block_size(block) < (int) (HEADER + sizeof(slab) + SLAB_SIZE + FOOTER))
+        return NULL;
+
+    return slab_of(block + HEADER + sizeof(slab));
+}
+
+
+/* Returns the slab class that the data of a heap block of the specified size
+ * would fit in, or -1 if it is too large for a slab.
+ */
+int heap_slab_class(int size) {
+    if (size - HEADER - FOOTER > SLAB_MAX)
+        return -1;
+
+    return slab_class_of[(size - HEADER - FOOTER + 7) / 8];
+}
+
+
+/* Returns the number of objects in a slab of the specified class. */
+int slab_capacity(int cls) {
+    return SLAB_SIZE / slab_sizes[cls];
+}
+
+
+/* Returns the address of an object in a slab. */
+unsigned char * slab_object(slab *s, int index) {
+    return (unsigned char *) (s + 1) + index * slab_sizes[s->cls];
+}
+
+
+/* Pushes a slab onto the front of its class's list of partial slabs. */
+void push_partial_slab(slab *s) {
+    int offset = (unsigned char *) s - mem;
+
+    s->prev = NO_BLOCK;
+    s->next = partial_slabs[s->cls];
+    if (s->next != NO_BLOCK)
+        ((slab *) (mem + s->next))->prev = offset;
+    partial_slabs[s->cls] = offset;
+}
+
+
+/* Unlinks a slab from its class's list of partial slabs. */
+void remove_partial_slab(slab *s) {
+    if (s->prev != NO_BLOCK)
+        ((slab *) (mem + s->prev))->next = s->next;
+    else
+        partial_slabs[s->cls] = s->next;
+
+    if (s->next != NO_BLOCK)
+        ((slab *) (mem + s->next))->prev = s->prev;
+}
+
+
+/*
+ * Carves a new slab of the specified class from the heap, with every object
+ * free, or returns NULL if there is no room for one.  The slab header and
+ * page are the data of an ordinary allocated heap block.
+ */
+slab * new_slab(int cls) {
+    unsigned char *block;
+    slab *s;
+    int i, capacity = slab_capacity(cls);
+
+    block = find_aligned_block(HEADER + sizeof(slab) + SLAB_SIZE + FOOTER,
+                               SLAB_SIZE, sizeof(slab));
+    if (block == NULL)
+        return NULL;
+
+    s = (slab *) (block + HEADER);
+    s->cls = cls;
+    s->free_count = capacity;
+    for (i = 0; i < SLAB_BITMAP_WORDS; i++) {
+        if (capacity >= 32 * (i + 1))
+            s->free_bits[i] = ~0U;
+        else if (capacity > 32 * i)
+            s->free_bits[i] = (1U << (capacity - 32 * i)) - 1;
+        else
+            s->free_bits[i] = 0;
+    }
+
+    slab_map[(slab_object(s, 0) - mem) / SLAB_SIZE] = 1;
+    push_partial_slab(s);
+    return s;
+}
+
+
+/*
+ * Allocates an object of the specified slab class, or returns NULL if the
+ * class has no free objects and no new slab can be carved, or if the class
+ * isn't used enough to be worth a new slab.  The object is
+ * the lowest free one in the first partial slab, found with one count-
+ * trailing-zeros per bitmap word.
+ */
+unsigned char * slab_alloc(int cls) {
+    slab *s;
+    int word, bit;
+
+    if (partial_slabs[cls] == NO_BLOCK) {
+        if (live_objects[cls] < SLAB_PROMOTE || new_slab(cls) == NULL)
+            return NULL;
+    }
+
+    s = (slab *) (mem + partial_slabs[cls]);
+    for (word = 0; s->free_bits[word] == 0; word++)
+        ;
+    bit = __builtin_ctz(s->free_bits[word]);
+    s->free_bits[word] &= ~(1U << bit);
+
+    s->free_count--;
+    if (s->free_count == 0)
+        remove_partial_slab(s);
+    live_objects[cls]++;
+
+    return slab_object(s, word * 32 + bit);
+}
+
+
+/*
+ * Frees an object in a slab.  A slab that becomes entirely free goes back to
+ * the heap straight away, so that its page can be coalesced and reused for
+ * anything.
+ */
+void slab_free(slab *s, unsigned char *ptr) {
+    int index = (ptr - slab_object(s, 0)) / slab_sizes[s->cls];
+    unsigned int bit = 1U << (index % 32);
+
+    if (s->free_bits[index / 32] & bit) {
+        fprintf(stderr, "myalloc: cannot free memory address "
+            "previously freed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    s->free_bits[index / 32] |= bit;
+    s->free_count++;
+    live_objects[s->cls]--;
+    if (s->free_count == 1)
+        push_partial_slab(s);
+
+    if (s->free_count == slab_capacity(s->cls)) {
+        remove_partial_slab(s);
+        slab_map[(slab_object(s, 0) - mem) / SLAB_SIZE] = 0;
+        free_chunk((unsigned char *) s);
+    }
+}
+
+
+/*
+ * Returns the bytes of an allocated chunk that callers can use, counted the
+ * same way as in myalloc_tiers().
+ */
+int chunk_size(unsigned char *ptr) {
+    slab *s;
+
+    if (!in_pool(ptr))
+        return ((huge_header *) (ptr - HUGE_HEADER))->size;
+
+    s = slab_of(ptr);
+    if (s != NULL)
+        return slab_sizes[s->cls];
+
+    return -block_size(ptr - HEADER) - HEADER - FOOTER;
+}
+
+
+/*
+ * Updates the statistics for a request of the specified size, which returned
+ * ptr, or NULL if it failed.  A successful request adds one to the counter
+ * and its chunk to the live bytes, and may be sampled; site is the address
+ * that the public function was called from.
+ */
+void note_request(unsigned char *ptr, int size, long long *counter,
+                  void *site) {
+    long long footprint;
+
+    if (size >= 0)
+        stats.request_sizes[size_class(size)]++;
+
+    if (ptr == NULL) {
+        stats.failed++;
+        return;
+    }
+
+    (*counter)++;
+    stats.live_bytes += chunk_size(ptr);
+    if (stats.live_bytes > stats.peak_live_bytes)
+        stats.peak_live_bytes = stats.live_bytes;
+
+    /* The pool only grows while serving a request, so this catches peaks. */
+    footprint = (heap_end - heap_start) + (long long) huge_mapped;
+    if (footprint > stats.peak_footprint)
+        stats.peak_footprint = footprint;
+
+    if (sample_interval > 0 && --sample_countdown <= 0) {
+        sample_countdown = sample_interval;
+        sample_site(site, size);
+    }
+}
+
+
+/* Adds a sampled allocation of the specified size to its call site's entry. */
+void sample_site(void *site, int size) {
+    int i = (int) (((unsigned long) site >> 2) % MAX_SITES);
+
+    while (sites[i].site != NULL && sites[i].site != site)
+        i = (i + 1) % MAX_SITES;
+
+    if (sites[i].site == NULL) {
+        if (num_sites == MAX_SITES - 1)
+            return;
+        sites[i].site = site;
+        num_sites++;
+    }
+
+    sites[i].samples++;
+    sites[i].bytes += size;
+}
+
+
 /*!
- * This function initializes both the allocator state, and the memory pool. 
+ * This function initializes both the allocator state, and the memory pool.
  * It must be called before myalloc() or myfree() will work at all.
  *
- * Note that we allocate the entire memory pool using malloc().  This is so we
- * can create different memory-pool sizes for testing.  Obviously, in a real
- * allocator, this memory pool would either be a fixed memory region, or the
- * allocator would request a memory region from the operating system (see the
- * C standard function sbrk(), for example).
+ * The pool's address space is reserved with mmap(), which also aligns it to
+ * a page, so that slab objects are as aligned as their sizes allow.  A fixed
+ * pool is mapped in full straight away.  A growable pool reserves
+ * MEMORY_LIMIT bytes of address space without using any memory, and maps
+ * the first MEMORY_SIZE bytes of it, rounded up to whole regions.
  */
 void init_myalloc(void) {
+    int cls, size, heap_size;
+    size_t page = sysconf(_SC_PAGESIZE);
 
-    /*
-     * Allocate the entire memory pool, from which our simple allocator will
-     * serve allocation requests.
-     */
-    mem = (unsigned char *) malloc(MEMORY_SIZE);
-    if (mem == 0) {
+    pool_growable = MEMORY_LIMIT > MEMORY_SIZE;
+    if (pool_growable) {
+        pool_reserved = (size_t) MEMORY_LIMIT / REGION_SIZE * REGION_SIZE;
+        heap_size = ((size_t) MEMORY_SIZE + REGION_SIZE - 1) / REGION_SIZE *
+                    REGION_SIZE;
+        if (heap_size > pool_reserved)
+            heap_size = pool_reserved;
+    }
+    else {
+        pool_reserved = ((size_t) MEMORY_SIZE + page - 1) / page * page;
+        if (pool_reserved == 0)
+            pool_reserved = page;
+        heap_size = pool_reserved;
+    }
+
+    mem = (unsigned char *) mmap(NULL, pool_reserved, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED ||
+        (heap_size > 0 && mmap(mem, heap_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)) {
         fprintf(stderr,
-                "init_myalloc: could not get %d bytes from the system\n", 
+                "init_myalloc: could not get %d bytes from the system\n",
                 MEMORY_SIZE);
         abort();
     }
 
-    /*
-     * Initializes the header and footer of our memory pool. This is an O(1)
-     * operation given that we have the pointer to the beginning of our 
-     * memory pool. Note that our block sizes include the HEADER and FOOTER
-     * size as wel as the actual data size.
-     */
-    *((int *) mem) = MEMORY_SIZE;
-    *((int *) (mem + MEMORY_SIZE - FOOTER)) = MEMORY_SIZE;
+    slab_map = (unsigned char *) calloc(pool_reserved / SLAB_SIZE + 1, 1);
+    if (slab_map == 0) {
+        fprintf(stderr, "init_myalloc: could not allocate the slab map\n");
+        abort();
+    }
 
-}
+    huge_blocks = 0;
+    huge_bytes = 0;
+    huge_mapped = 0;
 
+    memset(&stats, 0, sizeof(stats));
+    memset(sites, 0, sizeof(sites));
+    num_sites = 0;
+    sample_countdown = sample_interval;
 
-/*!
- * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
- * allocation fails. This uses a "best fit" strategy to allocate chunks
- * of memory meaning that a linear traversal of all the blocks is required
- * to find the smallest free block that can fit this new chunk of memory. 
- * Thus, the time complexity is O(N) where N is the number of blocks 
- * previously allocated in our memory pool.
- */
-unsigned char *myalloc(int size) {
+    for (cls = 0; cls < NUM_CLASSES; cls++)
+        free_lists[cls] = NO_BLOCK;
+    for (cls = 0; cls < NUM_CLASSES / BITMAP_BITS; cls++)
+        nonempty_classes[cls] = 0;
 
-    iterator = mem;
-    int remaining_space;
-    unsigned char *return_ptr = NULL;
+    for (cls = 0; cls < NUM_SLAB_CLASSES; cls++) {
+        partial_slabs[cls] = NO_BLOCK;
+        live_objects[cls] = 0;
+    }
+    for (cls = 0, size = 0; size <= SLAB_MAX; size += 8) {
+        while (slab_sizes[cls] < size)
+            cls++;
+        slab_class_of[size / 8] = cls;
+    }
 
-    /* 
-     * This stores the size of the smallest free block seen which can fit 
-     * our new chunk of memory. 
+    /*
+     * Any bytes at the end of a fixed pool that don't make up a whole
+     * multiple of ALIGNMENT are left unused.
      */
-    int min_block_size = INT_MAX;
+    heap_start = mem;
+    if (!pool_growable)
+        heap_size = MEMORY_SIZE / ALIGNMENT * ALIGNMENT;
+    if (heap_size < MIN_BLOCK_SIZE)
+        heap_size = 0;
+    heap_end = heap_start + heap_size;
+    heap_touched = heap_start;
 
-    /* Linearly traverse all blocks to find "best fit". */
-    while (iterator < (mem + MEMORY_SIZE)) {
-        remaining_space = *((int *) iterator);
+    /* The whole pool starts out as a single free block. */
+    if (heap_size > 0)
+        add_free_block(heap_start, heap_size);
+}
 
-        /* Find the smallest free block that can fit the chunk of memory. */
-        if (remaining_space > 0 && remaining_space >= (HEADER + FOOTER 
-            + size) && remaining_space < min_block_size) {
 
-            min_block_size = remaining_space;
-            return_ptr = iterator;
-        }
+/*
+ * Allocates a chunk of memory of "size" bytes from whichever tier should
+ * serve it; see myalloc().  If p_fresh isn't NULL, it is set to nonzero if
+ * the chunk is known to be zero apart from the first sizeof(free_links)
+ * bytes, since it comes from memory that hasn't been used since it was
+ * mapped.
+ */
+unsigned char * allocate_chunk(int size, int *p_fresh) {
+    unsigned char *block;
+    int needed, fresh = 0;
 
-        /* This moves our iterator onto the next block header. */
-        iterator += abs(remaining_space);
-    }
-
-    /* If we have a valid block to add to, we add. Else we return 0. */
-    if (return_ptr) {
-        /* 
-         * Calculate amount of potential space for the actual data for the 
-         * second block if we were to split the block into two. The amount of 
-         * space left over is equal to the total remaining space minus the 
-         * size required for the first block (size of the first block's data
-         * + HEADER + FOOTER) minus the amount of space for the second block's
-         * header and footer.
-         */
-
-        int space_for_second = min_block_size - (size + HEADER + FOOTER) 
-            - HEADER - FOOTER;
-        /*  
-         * If we do not have space for second block, we mark the current
-         * block as full. Otherwise, we split. 
-         */
-        iterator = return_ptr;
-        if (space_for_second <= 0) {
-
-            /* Make remaining_space negative to denote it is now allocated. */
-            *((int *) iterator) = -min_block_size;
-            *((int *) (iterator + min_block_size - FOOTER)) = -min_block_size;
-
-        } else {
-
-            /* Change header of current block. */
-            *((int *) iterator) = -(size + HEADER + FOOTER);
-
-            /* Change footer of current block. */
-            iterator += (size + HEADER);
-            *((int *) iterator) = -(size + HEADER + FOOTER);
-
-            /* Initialize header of second block. */
-            iterator += FOOTER;
-            *((int *) iterator) = space_for_second + HEADER + FOOTER;
-
-            /* Initialize footer of second block. */
-            iterator += (HEADER + space_for_second);
-            *((int *) iterator) = space_for_second + HEADER + FOOTER;
-            
+    if (size < 0 || size > INT_MAX - HEADER - FOOTER - ALIGNMENT) {
+        fprintf(stderr, "myalloc: cannot service request of size %d\n", size);
+        return NULL;
+    }
+
+    if (size <= SLAB_MAX) {
+        block = slab_alloc(slab_class_of[(size + 7) / 8]);
+        if (block != NULL)
+            goto done;
+    }
+    else if (pool_growable && size >= HUGE_SIZE) {
+        block = huge_alloc(size);
+        if (block != NULL) {
+            fresh = 1;
+            goto done;
         }
+    }
 
-        /* 
-         * Set the return pointer to where the data starts for the block
-         * inserted (move past the HEADER).
-         */
-        return_ptr += HEADER; 
+    needed = block_needed(size);
 
-    } else {
+    block = find_free_block(needed);
+    if (block == NULL && grow_heap(needed))
+        block = find_free_block(needed);
+    if (block == NULL) {
         fprintf(stderr, "myalloc: cannot service request of size %d with"
-                " %lx bytes allocated\n", size, (iterator - mem));
+                " %d byte pool\n", size, (int) (heap_end - heap_start));
         return NULL;
     }
 
-    return return_ptr;
+    fresh = block >= heap_touched;
+    take_free_block(block, needed);
+
+    /* Return the address just past the header, where the data starts. */
+    block += HEADER;
+
+done:
+    if (p_fresh != NULL)
+        *p_fresh = fresh;
+    return block;
+}
+
+
+/*!
+ * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
+ * allocation fails.  Requests of up to SLAB_MAX bytes are served from a slab
+ * of the smallest class that fits, in constant time; if no slab can be
+ * carved, they fall through to the heap like everything else.  In a growable
+ * pool, huge requests get mappings of their own, and the heap grows when no
+ * free block is large enough.
+ *
+ * For the heap, the request is rounded up to a block size, and a free
+ * block is taken from the segregated free lists; see find_free_block().  If
+ * the block is large enough, it is split and the rest of it goes back onto
+ * the free list for its size.  With the bitmap of non-empty classes, the
+ * time taken depends only on the length of one class's list, and not on the
+ * number of blocks in the pool.
+ */
+unsigned char *myalloc(int size) {
+    unsigned char *ptr = allocate_chunk(size, NULL);
+
+    note_request(ptr, size, &stats.allocs, __builtin_return_address(0));
+    return ptr;
 }
 
 
 /*!
- * Free a previously allocated pointer.  oldptr should be an address returned 
- * by myalloc(). This is a constant time deallocation because we have headers
- * and footers to help us look at the right block and left block, respectively
- * for coalescing. More specifically, for coalescing to the right, we simply
- * look at the header of the right/next block and check its sign to see if we
- * can merge it with the current block. For coalescing to the left, we look at 
- * the footer of the left/previous block and check its sign to see if we can
- * merge it with the current block. 
+ * Free a previously allocated pointer.  oldptr should be an address returned
+ * by myalloc().  Heap blocks are coalesced with their free neighbors in
+ * constant time; see coalesce_free_block().  In a growable pool, a large
+ * enough free block then gives its pages back to the system.
  */
 void myfree(unsigned char *oldptr) {
-    
-    /* 
-     * oldptr signifies where the data starts, so we need to backtrack to get 
-     * the header. 
+    stats.frees++;
+    stats.live_bytes -= chunk_size(oldptr);
+    free_chunk(oldptr);
+}
+
+
+/*
+ * Frees a chunk from any tier, without updating the statistics; see myfree().
+ */
+void free_chunk(unsigned char *oldptr) {
+    unsigned char *block;
+    slab *s;
+    int current_header;
+
+    /* Anything outside the pool is a huge request's own mapping. */
+    if (!in_pool(oldptr)) {
+        huge_free(oldptr);
+        return;
+    }
+
+    /* Objects in slabs have no header, and are freed into their slab. */
+    s = slab_of(oldptr);
+    if (s != NULL) {
+        slab_free(s, oldptr);
+        return;
+    }
+
+    /*
+     * oldptr signifies where the data starts, so we need to backtrack to get
+     * the header.
      */
-    iterator = oldptr;
-    iterator -= HEADER;
+    block = oldptr - HEADER;
 
-    /* 
+    /*
      * If block was previously freed, meaning its header value is positive,
      * then throw an error and exit.
-     */ 
-
-    int current_header = *((int *) iterator);
-    if (current_header > 0) 
-    {
+     */
+    current_header = block_size(block);
+    if (current_header > 0) {
         fprintf(stderr, "value: %d myalloc: cannot free memory address "
             "previously freed.\n", current_header);
         exit(EXIT_FAILURE);
     }
 
-    /*
-     * This will store how much free space will exist after deallocation 
-     * and coalescing. It will start off to just hold the value of the block
-     * to be freed, but will be added to in cases of coalescing.
-     */
+    count_heap_block(-current_header, -1);
 
-    int free_space = abs(current_header);
+    block = coalesce_free_block(block, -current_header);
+    release_pages(block);
+}
 
-    /* 
-     * Check the right adjacent block to see if coalescing is possible. Note 
-     * that having the header allows us direct access to the adjacent right 
-     * block, meaning coalescing to the right is an O(1) time operation.
-     */
-    iterator += free_space;
-
-    /* Make sure we are not checking the right block of the last block. */
-    if (iterator < (mem + MEMORY_SIZE)) {
-        int right_block_space = *((int *) iterator);
-        /* 
-         * Positive header means the block is free, and so we can coalesce. 
-         * Do not forget to add in the header and footer size as well because
-         * merging blocks means one less header and footer.
-         */
-        if (right_block_space > 0) {
-            free_space += right_block_space;
-        }       
-    }
-    
-    /* 
-     * Check the left adjacent block to see if coalescing is possible. Note 
-     * that having the footer allows us direct access to the adjacent left 
-     * block, meaning coalescing to the left is also an O(1) time operation.
-     */
 
-    /* Get to the footer of the block to the left. */
-    iterator = oldptr - HEADER - FOOTER;
-    
-    /* 
-     * This boolean will represent whether or not we coalece to the left. 
-     * This will affect which block's header we modify.
-     */
+/*!
+ * Resize a previously allocated chunk to "size" bytes, keeping its contents
+ * up to the smaller of the old and new sizes.  Returns the chunk's new
+ * address, or 0 if it can't be resized, in which case the old chunk is left
+ * alone.  If oldptr is 0, this is the same as myalloc().
+ *
+ * A heap block shrinks in place, freeing what it no longer needs.  It grows
+ * in place if the block after it is free and large enough, absorbing as
+ * much of that block as it needs; if it is the last block in a growable
+ * pool, the heap is grown under it first.  A slab object stays put as long
+ * as the new size fits its class.  A huge mapping is resized by the kernel.
+ * Only when none of these work is a new chunk allocated and the contents
+ * copied.  The new chunk need not keep the alignment of one from
+ * myalloc_aligned().
+ */
+unsigned char *myrealloc(unsigned char *oldptr, int size) {
+    unsigned char *newptr;
+    int old_size;
 
-    int is_left_free = 0;
+    if (oldptr == NULL) {
+        newptr = allocate_chunk(size, NULL);
+        note_request(newptr, size, &stats.allocs, __builtin_return_address(0));
+        return newptr;
+    }
 
-    /* 
-     * This will store the size of the left block, so we can change the
-     * left block's header if we end up coalescing to the left. 
-     */
-    int left_block_space = 0;
+    old_size = chunk_size(oldptr);
+    newptr = resize_chunk(oldptr, size);
+    if (newptr != NULL)
+        stats.live_bytes -= old_size;
 
-    /* Make sure we are not checking the left block of the first block. */
-    if (iterator > mem) {
-        left_block_space = *((int *) iterator);
-        /* 
-         * Positive footer means the left block is free, and so we can 
-         * coalesce. Again, merging blocks means we have additional space
-         * from one less header and footer.
-         */
-        if (left_block_space > 0) {
-            is_left_free = 1;
-            free_space += left_block_space;
-        } 
+    note_request(newptr, size, &stats.reallocs, __builtin_return_address(0));
+    return newptr;
+}
+
+
+/*
+ * Resizes a chunk from any tier, without updating the statistics; see
+ * myrealloc().
+ */
+unsigned char * resize_chunk(unsigned char *oldptr, int size) {
+    unsigned char *block, *right, *newptr;
+    slab *s;
+    int block_space, right_space, needed, old_size;
+
+    if (size < 0 || size > INT_MAX - HEADER - FOOTER - ALIGNMENT) {
+        fprintf(stderr, "myalloc: cannot service request of size %d\n", size);
+        return NULL;
     }
 
-    if (is_left_free) {    
+    if (!in_pool(oldptr))
+        return huge_realloc(oldptr, size);
 
-        /* Move iterator to start of header of left block. */
-        iterator = oldptr - HEADER - left_block_space;
-        *((int *) iterator) = free_space;
+    s = slab_of(oldptr);
+    if (s != NULL) {
+        old_size = slab_sizes[s->cls];
+        if (size <= old_size)
+            return oldptr;
+        goto move;
+    }
 
-        /* Move iterator along to set the footer. */
-        iterator += (free_space - FOOTER);
-        *((int *) iterator) = free_space;
+    block = oldptr - HEADER;
+    block_space = block_size(block);
+    if (block_space > 0) {
+        fprintf(stderr, "value: %d myalloc: cannot resize memory address "
+            "previously freed.\n", block_space);
+        exit(EXIT_FAILURE);
     }
-    else {
-        /* 
-         * In this case, we account for the scenarios of either coalescing to
-         * the right or not colaescing to the right. Note that free_space
-         * determines where we mark the footer so if we can coalesce to 
-         * the right, then free_space would be larger to account for that.
-         */
+    block_space = -block_space;
+    old_size = block_space - HEADER - FOOTER;
 
-        /* Change header of current block to be freed. */
-        *((int *) (oldptr - HEADER)) = free_space;
+    needed = block_needed(size);
+    if (needed <= block_space) {
+        trim_block(block, needed);
+        return oldptr;
+    }
+
+    right = block + block_space;
+    if (right == heap_end)
+        grow_heap(needed - block_space);
 
-        /* Change footer of current block to be freed. */
-        *((int *) (oldptr - HEADER + free_space - FOOTER)) = free_space;            
+    if (right < heap_end && block_size(right) > 0 &&
+        block_space + block_size(right) >= needed) {
+        right_space = block_size(right);
+        remove_free_block(right, right_space);
 
+        count_heap_block(block_space, -1);
+        count_heap_block(block_space + right_space, 1);
+        set_block(block, -(block_space + right_space));
+        trim_block(block, needed);
+
+        if (block - block_size(block) > heap_touched)
+            heap_touched = block - block_size(block);
+        return oldptr;
     }
 
-    return;
+move:
+    newptr = allocate_chunk(size, NULL);
+    if (newptr == NULL)
+        return NULL;
+
+    memcpy(newptr, oldptr, old_size < size ? old_size : size);
+    free_chunk(oldptr);
+    return newptr;
+}
+
+
+/*!
+ * Allocate a zeroed chunk of memory for an array of nmemb elements of "size"
+ * bytes each.  Return 0 if allocation fails, or if the array is too large.
+ * Memory that hasn't been used since it was mapped is already zero, so
+ * chunks carved from it only need their first few bytes cleared; see
+ * heap_touched.
+ */
+unsigned char *mycalloc(int nmemb, int size) {
+    unsigned char *ptr;
+    int total, fresh;
+
+    if (nmemb < 0 || size < 0 || (size > 0 && nmemb > INT_MAX / size)) {
+        fprintf(stderr, "myalloc: cannot service request of %d elements of "
+                "size %d\n", nmemb, size);
+        return NULL;
+    }
+    total = nmemb * size;
+
+    ptr = allocate_chunk(total, &fresh);
+    note_request(ptr, total, &stats.allocs, __builtin_return_address(0));
+    if (ptr == NULL)
+        return NULL;
+
+    if (!fresh)
+        memset(ptr, 0, total);
+    else if (total > 0)
+        memset(ptr, 0, total < (int) sizeof(free_links) ?
+                       total : (int) sizeof(free_links));
+
+    return ptr;
+}
+
+
+/*!
+ * Allocate a chunk of memory of "size" bytes starting at a multiple of
+ * "alignment" bytes, which must be a power of 2 no larger than a page.
+ * Return 0 if allocation fails.  The chunk is always a heap block, carved
+ * from the first free block with room for an aligned block in it; see
+ * find_aligned_block().  It is freed with myfree() like any other chunk.
+ */
+unsigned char *myalloc_aligned(int alignment, int size) {
+    unsigned char *block;
+    int needed;
+
+    if (alignment <= 0 || (alignment & (alignment - 1)) != 0 ||
+        alignment > sysconf(_SC_PAGESIZE)) {
+        fprintf(stderr, "myalloc: cannot align to %d bytes\n", alignment);
+        return NULL;
+    }
+
+    if (size < 0 ||
+        size > INT_MAX - HEADER - FOOTER - 2 * alignment - MIN_BLOCK_SIZE) {
+        fprintf(stderr, "myalloc: cannot service request of size %d\n", size);
+        return NULL;
+    }
+
+    if (alignment <= ALIGNMENT) {
+        block = allocate_chunk(size, NULL);
+    }
+    else {
+        needed = block_needed(size);
+
+        block = find_aligned_block(needed, alignment, 0);
+        if (block == NULL && grow_heap(needed + alignment + MIN_BLOCK_SIZE))
+            block = find_aligned_block(needed, alignment, 0);
+        if (block == NULL) {
+            fprintf(stderr, "myalloc: cannot service request of size %d "
+                    "aligned to %d bytes with %d byte pool\n", size,
+                    alignment, (int) (heap_end - heap_start));
+        }
+        else {
+            block += HEADER;
+        }
+    }
+
+    note_request(block, size, &stats.allocs, __builtin_return_address(0));
+    return block;
 }
 
 /*!
  * Clean up the allocator state.
- * All this really has to do is free the user memory pool. This function 
- * mostly ensures that the test program doesn't leak memory, so it's easy to 
- * check if the allocator does.
+ * All this really has to do is unmap the user memory pool. This function
+ * mostly ensures that the test program doesn't leak memory, so it's easy to
+ * check if the allocator does.  Huge requests that are still allocated are
+ * left mapped, since there is no list of them.
  */
 void close_myalloc(void) {
-    free(mem);
+    free(slab_map);
+    munmap(mem, pool_reserved);
+}
+
+
+/*!
+ * Reports how much of the pool each tier of the allocator is holding, and
+ * how much of that is usable by callers.  Slab objects are counted at their
+ * class size, heap blocks at their size less the header and footer, and
+ * huge requests at their requested size.
+ */
+int myalloc_tiers(myalloc_tier *tiers, int max_tiers) {
+    myalloc_tier t[3] = {
+        { "slab", 0, 0, 0 },
+        { "heap", 0, 0, 0 },
+        { "huge", 0, 0, 0 }
+    };
+    slab *s;
+    int live, i;
+
+    for (iterator = heap_start; iterator < heap_end;
+         iterator += abs(block_size(iterator))) {
+        if (block_size(iterator) > 0)
+            continue;
+
+        s = slab_of_block(iterator);
+        if (s != NULL) {
+            live = slab_capacity(s->cls) - s->free_count;
+            t[0].blocks += live;
+            t[0].live_bytes += live * slab_sizes[s->cls];
+            t[0].held_bytes += -block_size(iterator);
+        }
+        else {
+            t[1].blocks++;
+            t[1].live_bytes += -block_size(iterator) - HEADER - FOOTER;
+            t[1].held_bytes += -block_size(iterator);
+        }
+    }
+
+    t[2].blocks = huge_blocks;
+    t[2].live_bytes = huge_bytes;
+    t[2].held_bytes = (int) huge_mapped;
+
+    for (i = 0; i < 3 && i < max_tiers; i++)
+        tiers[i] = t[i];
+    return 3;
 }
 
-/* 
- * Implements basic verification code to ensure heap is managed correctly. 
- * We do this by traversing all blocks in heap and computing the sum of 
- * allocated and free space; this sum should match the pool size. In addition,
- * we output each block and its corresponding size. 
+/*!
+ * Fills in the allocator's statistics.  The counters are kept as the
+ * allocator runs, at the cost of a few additions per call; the footprint and
+ * everything about free blocks are found here, by walking the free lists, so
+ * this takes time linear in the number of free blocks.  The free objects in
+ * slabs aren't free blocks, and are left out.
+ */
+void myalloc_get_stats(myalloc_stats *out) {
+    unsigned char *block;
+    int cls, size;
+
+    *out = stats;
+    out->footprint = (heap_end - heap_start) + (long long) huge_mapped;
+
+    for (cls = 0; cls < NUM_CLASSES; cls++) {
+        for (block = block_at(free_lists[cls]); block != NULL;
+             block = block_at(links(block)->next)) {
+            size = block_size(block);
+            out->free_blocks++;
+            out->free_bytes += size;
+            out->free_block_sizes[cls]++;
+            if (size > out->largest_free_block)
+                out->largest_free_block = size;
+        }
+    }
+
+    out->fragmentation = out->free_bytes == 0 ? 0.0 :
+        1.0 - (double) out->largest_free_block / (double) out->free_bytes;
+}
+
+
+/*!
+ * Returns the smallest size in a bucket of the size histograms.  The buckets
+ * are the size classes of the free lists; see size_class().
+ */
+int myalloc_bucket_size(int bucket) {
+    int log;
+
+    if (bucket < EXACT_CLASS_LIMIT / ALIGNMENT)
+        return bucket * ALIGNMENT;
+
+    bucket -= EXACT_CLASS_LIMIT / ALIGNMENT;
+    log = EXACT_CLASS_LOG + bucket / CLASSES_PER_DOUBLING;
+    return (1 << log) + (bucket % CLASSES_PER_DOUBLING) * (1 << (log - 2));
+}
+
+
+/*!
+ * Records the call site of one allocation in every "interval", or turns
+ * sampling off if interval is 0.  Sampling costs a hash table probe per
+ * sampled allocation, and nothing when it is off.
+ */
+void myalloc_sample_every(int interval) {
+    sample_interval = interval > 0 ? interval : 0;
+    sample_countdown = sample_interval;
+}
+
+
+/*!
+ * Fills in up to max_sites of the sampled call sites, in no particular
+ * order, and returns the number of sites seen.
+ */
+int myalloc_get_sites(myalloc_site *out, int max_sites) {
+    int i, n = 0;
+
+    for (i = 0; i < MAX_SITES && n < max_sites; i++) {
+        if (sites[i].site != NULL)
+            out[n++] = sites[i];
+    }
+
+    return num_sites;
+}
+
+
+/* Orders call sites by the number of samples, most first, for qsort(). */
+int compare_sites(const void *a, const void *b) {
+    long long sa = ((const myalloc_site *) a)->samples;
+    long long sb = ((const myalloc_site *) b)->samples;
+
+    return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+
+/* Writes the non-empty buckets of a size histogram as a JSON array. */
+void dump_histogram(FILE *out, const char *name, long long *counts) {
+    int i, first = 1;
+
+    fprintf(out, "  \"%s\": [", name);
+    for (i = 0; i < MYALLOC_SIZE_BUCKETS; i++) {
+        if (counts[i] == 0)
+            continue;
+
+        fprintf(out, "%s\n    {\"min\": %d, \"max\": %d, \"count\": %lld}",
+                first ? "" : ",", myalloc_bucket_size(i),
+                i + 1 < MYALLOC_SIZE_BUCKETS ?
+                    myalloc_bucket_size(i + 1) - 1 : INT_MAX,
+                counts[i]);
+        first = 0;
+    }
+    fprintf(out, "%s]", first ? "" : "\n  ");
+}
+
+
+/*!
+ * Writes the allocator's statistics, the usage of each tier, and the sampled
+ * call sites, most sampled first, as one JSON object.
+ */
+void myalloc_dump_stats(FILE *out) {
+    myalloc_stats st;
+    myalloc_tier tiers[3];
+    myalloc_site sorted[MAX_SITES];
+    int i, num_tiers, n;
+
+    myalloc_get_stats(&st);
+    num_tiers = myalloc_tiers(tiers, 3);
+    n = myalloc_get_sites(sorted, MAX_SITES);
+    qsort(sorted, n, sizeof(myalloc_site), compare_sites);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"allocs\": %lld,\n  \"frees\": %lld,\n", st.allocs,
+            st.frees);
+    fprintf(out, "  \"reallocs\": %lld,\n  \"failed\": %lld,\n",
+            st.reallocs, st.failed);
+    fprintf(out, "  \"live_bytes\": %lld,\n  \"peak_live_bytes\": %lld,\n",
+            st.live_bytes, st.peak_live_bytes);
+    fprintf(out, "  \"footprint\": %lld,\n  \"peak_footprint\": %lld,\n",
+            st.footprint, st.peak_footprint);
+    fprintf(out, "  \"searches\": %lld,\n  \"blocks_scanned\": %lld,\n",
+            st.searches, st.blocks_scanned);
+    fprintf(out, "  \"avg_blocks_scanned\": %.3f,\n", st.searches == 0 ?
+            0.0 : (double) st.blocks_scanned / (double) st.searches);
+    fprintf(out, "  \"free_blocks\": %d,\n  \"free_bytes\": %lld,\n",
+            st.free_blocks, st.free_bytes);
+    fprintf(out, "  \"largest_free_block\": %d,\n", st.largest_free_block);
+    fprintf(out, "  \"fragmentation\": %.4f,\n", st.fragmentation);
+
+    fprintf(out, "  \"tiers\": [");
+    for (i = 0; i < num_tiers; i++) {
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"blocks\": %d, "
+                "\"live_bytes\": %d, \"held_bytes\": %d}", i == 0 ? "" : ",",
+                tiers[i].name, tiers[i].blocks, tiers[i].live_bytes,
+                tiers[i].held_bytes);
+    }
+    fprintf(out, "\n  ],\n");
+
+    dump_histogram(out, "request_sizes", st.request_sizes);
+    fprintf(out, ",\n");
+    dump_histogram(out, "free_block_sizes", st.free_block_sizes);
+    fprintf(out, ",\n");
+
+    fprintf(out, "  \"sample_interval\": %d,\n  \"sites\": [",
+            sample_interval);
+    for (i = 0; i < n && i < MAX_SITES; i++) {
+        fprintf(out, "%s\n    {\"site\": \"%p\", \"samples\": %lld, "
+                "\"bytes\": %lld}", i == 0 ? "" : ",", sorted[i].site,
+                sorted[i].samples, sorted[i].bytes);
+    }
+    fprintf(out, "%s]\n}\n", n == 0 ? "" : "\n  ");
+}
+
+/*
+ * Implements basic verification code to ensure heap is managed correctly.
+ * We do this by traversing all blocks in heap and computing the sum of
+ * allocated and free space; this sum should match the size of the heap, which
+ * must fit in the pool's address space. In addition, we output each block and
+ * its corresponding size, and check that every free block is on the free
+ * list for its size.
  */
 void sanity_check(void) {
     /* Start at the beginning of memory pool. */
-    iterator = mem;
     int total_space = 0;
     int num_blocks = 0;
+    int free_blocks = 0;
+    int listed_blocks = 0;
+    int cls, i, free_objects;
+    slab *s;
 
-    while (iterator < (mem + MEMORY_SIZE)) {
+    iterator = heap_start;
+    while (iterator < heap_end) {
         /* Look at header and get the block size. */
-        int block_size = abs(*((int *) iterator));
-        total_space += block_size;        
+        int block_space = abs(block_size(iterator));
+        total_space += block_space;
         num_blocks++;
 
+        /* The header and footer must agree, and free blocks can't touch. */
+        assert(block_size(iterator) ==
+               *((int *) (iterator + block_space - FOOTER)));
+        if (block_size(iterator) > 0) {
+            free_blocks++;
+            assert(iterator + block_space == heap_end ||
+                   block_size(iterator + block_space) < 0);
+        }
+
+        /* A slab's bitmap must agree with its count of free objects. */
+        s = slab_of_block(iterator);
+        if (s != NULL) {
+            assert(block_size(iterator) < 0);
+            free_objects = 0;
+            for (i = 0; i < SLAB_BITMAP_WORDS; i++)
+                free_objects += __builtin_popcount(s->free_bits[i]);
+            assert(free_objects == s->free_count);
+            assert(s->free_count < slab_capacity(s->cls));
+        }
+
         /* Print block number and header information for each block. */
-        printf("Block %d: %d. ", num_blocks, *((int *) iterator));
+        printf("Block %d: %d. ", num_blocks, block_size(iterator));
 
         /* Move iterator to the next header. */
-        iterator += (block_size);
+        iterator += block_space;
     }
 
     printf("Total space used: %d.\n", total_space);
 
+    for (cls = 0; cls < NUM_CLASSES; cls++) {
+        for (iterator = block_at(free_lists[cls]); iterator != NULL;
+             iterator = block_at(links(iterator)->next)) {
+            assert(block_size(iterator) > 0);
+            assert(size_class(block_size(iterator)) == cls);
+            listed_blocks++;
+        }
+    }
+
     /* Make sure that the space usage adds up. */
-    assert(total_space == MEMORY_SIZE);
+    assert(total_space == heap_end - heap_start);
+    assert(heap_end <= mem + pool_reserved);
+    assert(listed_blocks == free_blocks);
     return;
 }
@@ -8,10 +8,18 @@
  * All rights reserved.
  */
 
+#include <stdio.h>
+
 
 /*! Specifies the size of the memory pool the allocator has to work with. */
 extern int MEMORY_SIZE;
 
+/*!
+ * If larger than MEMORY_SIZE, the memory pool starts at MEMORY_SIZE bytes and
+ * grows on demand up to this many bytes.  Only myalloc.c supports growing.
+ */
+extern int MEMORY_LIMIT;
+
 
 /* Initializes allocator state, and memory pool state too. */
 void init_myalloc(void);
@@ -25,9 +33,144 @@ unsigned char * myalloc(int size);
 void myfree(unsigned char *oldptr);
 
 
+/*
+ * Resize a previously allocated chunk, in place if possible.  This and the
+ * next two functions are only provided by myalloc.c.
+ */
+unsigned char * myrealloc(unsigned char *oldptr, int size);
+
+
+/* Allocate a zeroed chunk for an array of nmemb elements of "size" bytes. */
+unsigned char * mycalloc(int nmemb, int size);
+
+
+/* Allocate a chunk of "size" bytes starting at a multiple of alignment. */
+unsigned char * myalloc_aligned(int alignment, int size);
+
+
 /* Clean up the allocator and memory pool state. */
 void close_myalloc(void);
 
 
 /* Performs basic verification of memory pool. Used for debugging purposes. */
 void sanity_check(void);
+
+
+/*!
+ * How much of the memory pool one tier of an allocator is holding.  The
+ * fragmentation of the tier is the fraction of held_bytes that callers can't
+ * use: headers, footers, padding and free objects.
+ */
+typedef struct myalloc_tier {
+    const char *name;
+
+    /* The number of allocated blocks in the tier. */
+    int blocks;
+
+    /* The bytes of those blocks that callers can use. */
+    int live_bytes;
+
+    /* The bytes of the pool the tier is holding, including its overhead. */
+    int held_bytes;
+} myalloc_tier;
+
+
+/*
+ * Fills in up to max_tiers entries describing the allocator's tiers, and
+ * returns the number of tiers.  Allocators without tiers need not define
+ * this; see utilization_test() in testalloc.c.
+ */
+int myalloc_tiers(myalloc_tier *tiers, int max_tiers);
+
+
+/* The number of buckets in the size histograms of myalloc_stats. */
+#define MYALLOC_SIZE_BUCKETS 128
+
+
+/*!
+ * Statistics kept by an allocator, for tuning it against real workloads.
+ * Counts of operations are cumulative since init_myalloc(); everything else
+ * describes the allocator at the moment the statistics are taken.  Chunks
+ * are counted by the bytes callers can use, as in myalloc_tier.
+ */
+typedef struct myalloc_stats {
+    /* Successful allocations (including callocs), frees and reallocs. */
+    long long allocs;
+    long long frees;
+    long long reallocs;
+
+    /* Requests that couldn't be served. */
+    long long failed;
+
+    /* The bytes of all allocated chunks, now and at their highest. */
+    long long live_bytes;
+    long long peak_live_bytes;
+
+    /* The bytes of memory the allocator holds, now and at their highest. */
+    long long footprint;
+    long long peak_footprint;
+
+    /* Free-list searches, and the free blocks looked at in all of them. */
+    long long searches;
+    long long blocks_scanned;
+
+    /* The free blocks in the heap, their total size and the largest. */
+    int free_blocks;
+    long long free_bytes;
+    int largest_free_block;
+
+    /*
+     * The external fragmentation index, 1 - largest_free_block / free_bytes:
+     * 0 when all the free space is in one block, and near 1 when it is
+     * scattered in pieces too small for large requests.
+     */
+    double fragmentation;
+
+    /*
+     * Histograms of the sizes of requests, and of the whole sizes of the
+     * free blocks in the heap.  Bucket i starts at myalloc_bucket_size(i)
+     * bytes.
+     */
+    long long request_sizes[MYALLOC_SIZE_BUCKETS];
+    long long free_block_sizes[MYALLOC_SIZE_BUCKETS];
+} myalloc_stats;
+
+
+/*
+ * One call site seen by the allocation sampler, with the number of sampled
+ * allocations made from it and their total size.
+ */
+typedef struct myalloc_site {
+    void *site;
+    long long samples;
+    long long bytes;
+} myalloc_site;
+
+
+/*
+ * Fills in the allocator's statistics.  This and the next four functions
+ * are only provided by myalloc.c.
+ */
+void myalloc_get_stats(myalloc_stats *stats);
+
+
+/* Returns the smallest size in a bucket of the size histograms. */
+int myalloc_bucket_size(int bucket);
+
+
+/*
+ * Records the call site of one allocation in every "interval", or turns
+ * sampling off if interval is 0.
+ */
+void myalloc_sample_every(int interval);
+
+
+/*
+ * Fills in up to max_sites of the sampled call sites, and returns the number
+ * of sites seen.
+ */
+int myalloc_get_sites(myalloc_site *sites, int max_sites);
+
+
+/* Writes the allocator's statistics and sampled call sites as JSON. */
+void myalloc_dump_stats(FILE *out);
@@ -121,7 +121,7 @@ unsigned char *myalloc(int size) {
          */
         iterator = return_ptr;
         if (space_for_second <= 0) {
-            *((int *) iterator) = -remaining_space;
+            *((int *) iterator) = -min_block_size;
         } else {
             *((int *) iterator) = -size;
             iterator += (size + HEADER);
@@ -0,0 +1,281 @@
+/*! \file
+ * Replays an allocation trace, recorded from a real program with the
+ * libtracealloc.so shim, against whichever allocator this is linked with:
+ * replay_myalloc, replay_firstfit or replay_bestfit.  See alloctrace.h for
+ * the format of traces.
+ *
+ * The whole trace is read into memory first, so that only the allocator is
+ * timed.  While it runs, the replay samples the live bytes and the extent of
+ * the pool in use, which is the end of the highest live chunk; the
+ * fragmentation at each sample is the fraction of the extent that isn't
+ * live.  The footprint is the highest the extent ever gets.  Since the extent
+ * is measured from the chunks themselves, it means the same thing for every
+ * allocator, whatever it keeps in its own headers.
+ *
+ * Allocators without realloc, calloc or aligned allocation have them replayed
+ * with myalloc(), memcpy() and memset().  Requests the allocator can't serve
+ * are counted and skipped, along with everything else that happens to their
+ * blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "myalloc.h"
+#include "alloctrace.h"
+
+#define DEFAULT_POOL_SIZE (256 * 1024 * 1024)
+#define DEFAULT_SAMPLES 20
+
+// only myalloc.c defines the realloc, calloc and aligned allocation functions
+#pragma weak myrealloc
+#pragma weak mycalloc
+#pragma weak myalloc_aligned
+
+
+// the allocator's memory pool
+extern unsigned char *mem;
+
+
+// the chunk each block in the trace currently has, if any
+typedef struct replay_block {
+  unsigned char *ptr;
+  int size;
+} replay_block;
+
+
+replay_block *blocks;
+
+long long live_bytes;
+long long peak_live_bytes;
+long long peak_extent;
+int failed_requests;
+
+
+double current_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// the end of a chunk, as an offset from the start of the pool
+long long chunk_end(replay_block *b) {
+  if (b->ptr < mem || b->ptr >= mem + MEMORY_SIZE)
+    return 0;     // a mapping of its own, outside the pool
+  return b->ptr + b->size - mem;
+}
+
+
+// the end of the highest live chunk
+long long current_extent(unsigned int num_ids) {
+  long long extent = 0, end;
+  unsigned int id;
+
+  for (id = 0; id < num_ids; id++) {
+    if (blocks[id].ptr != NULL) {
+      end = chunk_end(blocks + id);
+      if (end > extent)
+        extent = end;
+    }
+  }
+  return extent;
+}
+
+
+// resize a chunk, with myrealloc() if the allocator has it
+unsigned char *replay_realloc(replay_block *b, int size) {
+  unsigned char *ptr;
+
+  if (myrealloc != NULL)
+    return myrealloc(b->ptr, size);
+
+  ptr = myalloc(size);
+  if (ptr != NULL) {
+    memcpy(ptr, b->ptr, b->size < size ? b->size : size);
+    myfree(b->ptr);
+  }
+  return ptr;
+}
+
+
+// replay one event of the trace
+void replay_event(trace_event *e) {
+  replay_block *b = blocks + e->id;
+  unsigned char *ptr = NULL;
+  int size = (int) e->size;
+  long long end;
+
+  if (e->op == TRACE_FREE) {
+    if (b->ptr != NULL) {
+      myfree(b->ptr);
+      live_bytes -= b->size;
+      b->ptr = NULL;
+    }
+    return;
+  }
+
+  if (e->size > INT_MAX || e->alignment > INT_MAX) {
+    failed_requests++;
+    return;
+  }
+
+  switch (e->op) {
+  case TRACE_ALLOC:
+    ptr = myalloc(size);
+    break;
+
+  case TRACE_CALLOC:
+    if (mycalloc != NULL) {
+      ptr = mycalloc(1, size);
+    }
+    else {
+      ptr = myalloc(size);
+      if (ptr != NULL)
+        memset(ptr, 0, size);
+    }
+    break;
+
+  case TRACE_ALIGNED:
+    if (myalloc_aligned != NULL)
+      ptr = myalloc_aligned((int) e->alignment, size);
+    else
+      ptr = myalloc(size);
+    break;
+
+  case TRACE_REALLOC:
+    // a block whose allocation failed is still skipped
+    if (b->ptr == NULL)
+      return;
+    ptr = replay_realloc(b, size);
+    if (ptr != NULL)
+      live_bytes -= b->size;
+    break;
+  }
+
+  if (ptr == NULL) {
+    failed_requests++;
+    return;
+  }
+
+  b->ptr = ptr;
+  b->size = size;
+
+  live_bytes += size;
+  if (live_bytes > peak_live_bytes)
+    peak_live_bytes = live_bytes;
+
+  end = chunk_end(b);
+  if (end > peak_extent)
+    peak_extent = end;
+}
+
+
+// print one sample of the live bytes and fragmentation
+void print_sample(int events, unsigned int num_ids) {
+  long long extent = current_extent(num_ids);
+
+  printf("%12d %14lld %14lld %14f\n", events, live_bytes, extent,
+         extent == 0 ? 0.0 : 1.0 - (double) live_bytes / (double) extent);
+}
+
+
+void usage(char *program) {
+  printf("usage: %s [-p pool_size] [-n samples] trace_file\n", program);
+  printf("\tReplays an allocation trace against the allocator.\n\n");
+  printf("\t-p pool_size sets the size of the allocator's memory pool\n\n");
+  printf("\t-n samples sets how many times the fragmentation is reported\n\n");
+}
+
+
+int main(int argc, char *argv[]) {
+  alloc_trace *trace;
+  int pool_size = DEFAULT_POOL_SIZE;
+  int samples = DEFAULT_SAMPLES;
+  int interval, i, next, c;
+  double start, elapsed = 0;
+
+  while ((c = getopt(argc, argv, "p:n:h")) != -1) {
+    switch (c) {
+      case 'p':    /* Size of the memory pool */
+        pool_size = atoi(optarg);
+        if (pool_size <= 0) {
+          printf("ERROR:  Pool size must be positive.\n");
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+
+      case 'n':    /* Number of fragmentation samples */
+        samples = atoi(optarg);
+        if (samples <= 0) {
+          printf("ERROR:  Number of samples must be positive.\n");
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    printf("ERROR:  Expected one trace file.\n");
+    usage(argv[0]);
+    return 1;
+  }
+
+  trace = trace_load(argv[optind]);
+  if (trace == NULL)
+    return 1;
+
+  blocks = calloc(trace->num_ids + 1, sizeof(replay_block));
+  if (blocks == NULL) {
+    fprintf(stderr, "real memory system out of memory.\n");
+    abort();
+  }
+
+  MEMORY_SIZE = pool_size;
+  init_myalloc();
+
+  printf("Replaying %d events on %u blocks from %s with a %d byte pool.\n",
+         trace->num_events, trace->num_ids, argv[optind], pool_size);
+  printf("%12s %14s %14s %14s\n", "events", "live_bytes", "extent",
+         "fragmentation");
+
+  // time the replay in stretches between samples, leaving the samples out
+  interval = (trace->num_events + samples - 1) / samples;
+  if (interval < 1)
+    interval = 1;
+
+  for (i = 0; i < trace->num_events; i = next) {
+    next = i + interval < trace->num_events ? i + interval : trace->num_events;
+
+    start = current_time();
+    for (; i < next; i++)
+      replay_event(trace->events + i);
+    elapsed += current_time() - start;
+
+    print_sample(next, trace->num_ids);
+  }
+
+  printf("Replayed %d events in %f seconds: %.0f ops/sec\n",
+         trace->num_events, elapsed,
+         elapsed > 0 ? trace->num_events / elapsed : 0.0);
+  printf("Peak live bytes: %lld\n", peak_live_bytes);
+  printf("Peak footprint: %lld bytes (%f live at the peak of live bytes)\n",
+         peak_extent, peak_extent == 0 ? 0.0 :
+         (double) peak_live_bytes / (double) peak_extent);
+  printf("Failed requests: %d\n", failed_requests);
+
+  close_myalloc();
+  free(blocks);
+  trace_release(trace);
+  return 0;
+}
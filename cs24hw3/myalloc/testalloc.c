@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 
 #include "errno.h"
@@ -21,6 +22,31 @@
 #define DEFAULT_MAX_ALLOCATION 16000
 #define DEFAULT_RANDOM_SEED 1
 
+#define MAX_TIERS 8
+
+#define STATS_CHUNKS 16
+#define STATS_SAMPLE_INTERVAL 16
+
+#define SLAB_CHUNKS 64
+#define SLAB_CHUNK_SIZE 32
+
+#define GROW_CHUNKS 64
+#define GROW_CHUNK_SIZE 4000
+#define HUGE_CHUNK_SIZE (512 * 1024)
+
+// allocators that don't have tiers don't define myalloc_tiers(), and only
+//  myalloc.c defines the realloc, calloc and aligned allocation functions
+//  and a MEMORY_LIMIT to grow the pool up to
+#pragma weak MEMORY_LIMIT
+#pragma weak myalloc_tiers
+#pragma weak myrealloc
+#pragma weak mycalloc
+#pragma weak myalloc_aligned
+#pragma weak myalloc_get_stats
+#pragma weak myalloc_sample_every
+#pragma weak myalloc_get_sites
+#pragma weak myalloc_dump_stats
+
 // some random numbers...
 
 int random_int(int max) {
@@ -354,6 +380,357 @@ done:
 
 }
 
+// A basic test of myrealloc(), mycalloc() and myalloc_aligned(), for the
+//  allocators that provide them.
+void realloc_test() {
+  unsigned char * a;
+  unsigned char * b;
+  unsigned char * c;
+  int i;
+  int failure = 0;
+
+  if (myrealloc == NULL || mycalloc == NULL || myalloc_aligned == NULL) {
+    printf("Skipping realloc test; the allocator doesn't support it.\n");
+    return;
+  }
+
+  printf("Performing a basic test of realloc, calloc and aligned "
+         "allocation.\n");
+
+  MEMORY_SIZE = 4096;
+  init_myalloc();
+
+  // Growing into a free right neighbor, then shrinking, both in place
+  a = myalloc(400);
+  b = myalloc(400);
+  c = myalloc(400);
+  if (a == NULL || b == NULL || c == NULL) {
+    printf("Couldn't allocate three blocks of size 400 in a 4096 byte pool.\n");
+    failure = 1;
+    goto done;
+  }
+  for (i = 0; i < 400; i++)
+    a[i] = (unsigned char) i;
+  myfree(b);
+
+  b = myrealloc(a, 700);
+  if (b != a) {
+    printf("Failed to grow a block into its free neighbor in place.\n");
+    failure = 1;
+    goto done;
+  }
+  b = myrealloc(a, 100);
+  if (b != a) {
+    printf("Failed to shrink a block in place.\n");
+    failure = 1;
+    goto done;
+  }
+  for (i = 0; i < 100; i++) {
+    if (a[i] != (unsigned char) i) {
+      printf("Contents were lost when resizing a block.\n");
+      failure = 1;
+      goto done;
+    }
+  }
+  myfree(a);
+  myfree(c);
+
+  // Zeroed allocation, after the pool has been dirtied
+  a = myalloc(1000);
+  for (i = 0; i < 1000; i++)
+    a[i] = 0xff;
+  myfree(a);
+  a = mycalloc(250, 4);
+  if (a == NULL) {
+    printf("Couldn't calloc 250 elements of size 4 in a 4096 byte pool.\n");
+    failure = 1;
+    goto done;
+  }
+  for (i = 0; i < 1000; i++) {
+    if (a[i] != 0) {
+      printf("mycalloc returned memory that wasn't zeroed.\n");
+      failure = 1;
+      goto done;
+    }
+  }
+  myfree(a);
+
+  // Aligned allocation
+  for (i = 8; i <= 1024; i *= 2) {
+    a = myalloc_aligned(i, 100);
+    if (a == NULL || (unsigned long) a % i != 0) {
+      printf("Failed to allocate a block aligned to %d bytes.\n", i);
+      failure = 1;
+      goto done;
+    }
+    myfree(a);
+  }
+
+done:
+  if (!failure) {
+    printf("Passed realloc test.\n");
+  }
+  close_myalloc();
+}
+
+// A basic test of the statistics that myalloc.c keeps: live and peak
+//  bytes, the histogram of request sizes, and the sampled call sites.
+void stats_test() {
+  myalloc_stats stats;
+  myalloc_site site;
+  unsigned char * chunks[STATS_CHUNKS];
+  long long requests = 0;
+  int total = 0;
+  int i;
+  int failure = 0;
+
+  if (myalloc_get_stats == NULL) {
+    printf("Skipping stats test; the allocator doesn't keep statistics.\n");
+    return;
+  }
+
+  printf("Performing a basic test of allocator statistics.\n");
+
+  MEMORY_SIZE = 65536;
+  init_myalloc();
+  myalloc_sample_every(1);
+
+  // every chunk is allocated from this one call site
+  for (i = 0; i < STATS_CHUNKS; i++) {
+    chunks[i] = myalloc(24 + 40 * i);
+    total += 24 + 40 * i;
+  }
+
+  myalloc_get_stats(&stats);
+  for (i = 0; i < MYALLOC_SIZE_BUCKETS; i++)
+    requests += stats.request_sizes[i];
+  if (stats.allocs != STATS_CHUNKS || requests != STATS_CHUNKS) {
+    printf("Counted %lld allocations and %lld requests instead of %d.\n",
+           stats.allocs, requests, STATS_CHUNKS);
+    failure = 1;
+  }
+  if (stats.live_bytes < total || stats.peak_live_bytes != stats.live_bytes) {
+    printf("Counted %lld live bytes, peak %lld, for %d bytes requested.\n",
+           stats.live_bytes, stats.peak_live_bytes, total);
+    failure = 1;
+  }
+  if (myalloc_get_sites(&site, 1) != 1 || site.samples != STATS_CHUNKS ||
+      site.bytes != total) {
+    printf("Failed to attribute every sampled allocation to its call site.\n");
+    failure = 1;
+  }
+
+  for (i = 0; i < STATS_CHUNKS; i++)
+    myfree(chunks[i]);
+
+  // with everything freed, the pool is one free block again
+  myalloc_get_stats(&stats);
+  if (stats.frees != STATS_CHUNKS || stats.live_bytes != 0 ||
+      stats.peak_live_bytes < total) {
+    printf("Counted %lld frees and %lld live bytes after freeing "
+           "everything.\n", stats.frees, stats.live_bytes);
+    failure = 1;
+  }
+  if (stats.free_blocks != 1 || stats.fragmentation != 0.0) {
+    printf("Found %d free blocks and fragmentation %f in an empty pool.\n",
+           stats.free_blocks, stats.fragmentation);
+    failure = 1;
+  }
+
+  if (!failure) {
+    printf("Passed stats test.\n");
+  }
+  myalloc_sample_every(0);
+  close_myalloc();
+}
+
+// returns the tier with the given name, or NULL if the allocator doesn't
+//  report its tiers or has no such tier
+myalloc_tier *find_tier(myalloc_tier *tiers, char *name) {
+  int num_tiers, i;
+
+  if (myalloc_tiers == NULL)
+    return NULL;
+
+  num_tiers = myalloc_tiers(tiers, MAX_TIERS);
+  for (i = 0; i < num_tiers && i < MAX_TIERS; i++) {
+    if (strcmp(tiers[i].name, name) == 0)
+      return &tiers[i];
+  }
+  return NULL;
+}
+
+// A basic test of the slab tier: enough small chunks of one size promote
+//  their class to slabs, and the slabs go back to the heap once empty.
+void slab_test() {
+  myalloc_tier tiers[MAX_TIERS];
+  myalloc_tier *slab;
+  myalloc_stats stats;
+  unsigned char * chunks[SLAB_CHUNKS];
+  int i;
+  int failure = 0;
+
+  if (myalloc_get_stats == NULL) {
+    printf("Skipping slab test; the allocator doesn't keep statistics.\n");
+    return;
+  }
+
+  MEMORY_SIZE = 65536;
+  init_myalloc();
+
+  if (find_tier(tiers, "slab") == NULL) {
+    printf("Skipping slab test; the allocator doesn't have slabs.\n");
+    close_myalloc();
+    return;
+  }
+
+  printf("Performing a basic test of the slab tier.\n");
+
+  for (i = 0; i < SLAB_CHUNKS; i++) {
+    chunks[i] = myalloc(SLAB_CHUNK_SIZE);
+    if (chunks[i] == NULL) {
+      printf("Couldn't allocate %d chunks of size %d in a 65536 byte pool.\n",
+             SLAB_CHUNKS, SLAB_CHUNK_SIZE);
+      failure = 1;
+      goto done;
+    }
+    memset(chunks[i], i, SLAB_CHUNK_SIZE);
+  }
+
+  slab = find_tier(tiers, "slab");
+  if (slab->blocks == 0 || slab->held_bytes == 0) {
+    printf("No chunks were served from slabs after %d of size %d.\n",
+           SLAB_CHUNKS, SLAB_CHUNK_SIZE);
+    failure = 1;
+  }
+  for (i = 0; i < SLAB_CHUNKS; i++) {
+    if (chunks[i][0] != (unsigned char) i ||
+        chunks[i][SLAB_CHUNK_SIZE - 1] != (unsigned char) i) {
+      printf("Contents of slab chunks overlapped.\n");
+      failure = 1;
+      break;
+    }
+  }
+
+  for (i = 0; i < SLAB_CHUNKS; i++)
+    myfree(chunks[i]);
+
+  // empty slabs give their pages back, so the pool is one free block again
+  slab = find_tier(tiers, "slab");
+  myalloc_get_stats(&stats);
+  if (slab->blocks != 0 || slab->held_bytes != 0) {
+    printf("Slabs still hold %d bytes after freeing everything.\n",
+           slab->held_bytes);
+    failure = 1;
+  }
+  if (stats.free_blocks != 1) {
+    printf("Found %d free blocks in an empty pool.\n", stats.free_blocks);
+    failure = 1;
+  }
+
+done:
+  if (!failure) {
+    printf("Passed slab test.\n");
+  }
+  close_myalloc();
+}
+
+// A basic test of a growable pool: the heap grows past its initial size,
+//  huge chunks get mappings of their own, and the heap shrinks back once
+//  everything is freed.
+void grow_test() {
+  myalloc_tier tiers[MAX_TIERS];
+  myalloc_tier *huge;
+  myalloc_stats stats;
+  unsigned char * chunks[GROW_CHUNKS];
+  unsigned char * a;
+  long long grown;
+  int i;
+  int failure = 0;
+
+  if (&MEMORY_LIMIT == NULL || myalloc_get_stats == NULL) {
+    printf("Skipping growth test; the allocator's pool can't grow.\n");
+    return;
+  }
+
+  printf("Performing a basic test of a growable pool.\n");
+
+  MEMORY_SIZE = 65536;
+  MEMORY_LIMIT = 16 * 1024 * 1024;
+  init_myalloc();
+
+  // more than the initial size, in chunks too small to be huge
+  for (i = 0; i < GROW_CHUNKS; i++) {
+    chunks[i] = myalloc(GROW_CHUNK_SIZE);
+    if (chunks[i] == NULL) {
+      printf("Couldn't grow the pool to hold %d chunks of size %d.\n",
+             GROW_CHUNKS, GROW_CHUNK_SIZE);
+      failure = 1;
+      goto done;
+    }
+    memset(chunks[i], i, GROW_CHUNK_SIZE);
+  }
+
+  myalloc_get_stats(&stats);
+  grown = stats.footprint;
+  if (grown < GROW_CHUNKS * GROW_CHUNK_SIZE) {
+    printf("The pool only grew to %lld bytes for %d bytes of chunks.\n",
+           grown, GROW_CHUNKS * GROW_CHUNK_SIZE);
+    failure = 1;
+  }
+
+  a = myalloc(HUGE_CHUNK_SIZE);
+  if (a == NULL) {
+    printf("Couldn't allocate a huge chunk of size %d.\n", HUGE_CHUNK_SIZE);
+    failure = 1;
+    goto done;
+  }
+  memset(a, 0xff, HUGE_CHUNK_SIZE);
+  huge = find_tier(tiers, "huge");
+  if (huge != NULL &&
+      (huge->blocks != 1 || huge->live_bytes != HUGE_CHUNK_SIZE)) {
+    printf("The huge tier holds %d chunks of %d bytes instead of one.\n",
+           huge->blocks, huge->live_bytes);
+    failure = 1;
+  }
+  myfree(a);
+
+  // the huge chunk's mapping goes straight back to the system
+  myalloc_get_stats(&stats);
+  if (stats.footprint != grown ||
+      stats.peak_footprint < grown + HUGE_CHUNK_SIZE) {
+    printf("Footprint was %lld, peak %lld, after freeing a huge chunk.\n",
+           stats.footprint, stats.peak_footprint);
+    failure = 1;
+  }
+
+  for (i = 0; i < GROW_CHUNKS; i++) {
+    if (chunks[i][0] != (unsigned char) i ||
+        chunks[i][GROW_CHUNK_SIZE - 1] != (unsigned char) i) {
+      printf("Contents were lost when the pool grew.\n");
+      failure = 1;
+      break;
+    }
+  }
+  for (i = 0; i < GROW_CHUNKS; i++)
+    myfree(chunks[i]);
+
+  // with everything freed, the heap gives back all but some slack
+  myalloc_get_stats(&stats);
+  if (stats.footprint >= grown || stats.free_blocks != 1) {
+    printf("Footprint was %lld in %d free blocks after freeing everything, "
+           "from %lld.\n", stats.footprint, stats.free_blocks, grown);
+    failure = 1;
+  }
+
+done:
+  if (!failure) {
+    printf("Passed growth test.\n");
+  }
+  close_myalloc();
+  MEMORY_LIMIT = 0;
+}
+
 // Allocates chunks of the given size until unable to anymore, then
 // deallocates all of them - returns the number of chunks allocated.
 int uniform_chunks(int chunk_size, int memory_size) {
@@ -419,13 +796,56 @@ int uniform_chunk_test() {
 }
 
 
+// print how much of the pool each tier of the allocator holds, and how
+//  much of that is unusable, if the allocator reports its tiers
+void print_tiers() {
+  myalloc_tier tiers[MAX_TIERS];
+  int num_tiers, i;
+
+  if (myalloc_tiers == NULL)
+    return;
+
+  num_tiers = myalloc_tiers(tiers, MAX_TIERS);
+  if (num_tiers > MAX_TIERS)
+    num_tiers = MAX_TIERS;
+
+  for (i = 0; i < num_tiers; i++) {
+    printf("Tier %s: %d blocks, %d/%d bytes usable, fragmentation %f\n",
+           tiers[i].name, tiers[i].blocks, tiers[i].live_bytes,
+           tiers[i].held_bytes, tiers[i].held_bytes == 0 ? 0.0 :
+           1.0 - (double) tiers[i].live_bytes / (double) tiers[i].held_bytes);
+  }
+}
+
+
+// write the allocator's statistics to a file as JSON, if it keeps them
+void write_stats(char *filename) {
+  FILE *f;
+
+  if (myalloc_dump_stats == NULL) {
+    printf("Not writing stats; the allocator doesn't keep statistics.\n");
+    return;
+  }
+
+  f = fopen(filename, "w");
+  if (f == NULL) {
+    printf("ERROR:  Couldn't open %s to write stats.\n", filename);
+    return;
+  }
+  myalloc_dump_stats(f);
+  fclose(f);
+  printf("Wrote allocator stats to %s\n", filename);
+}
+
+
 /* This test runs a series of random allocations and deallocations,
  * to see how much overhead is required by the allocator in question
  * for a certain number of bytes to be allocated.  During the test,
  * the allocated regions are verified to not overlap with each other,
- * and so forth.
+ * and so forth.  If stats_file isn't NULL, the statistics of the final
+ * run are written to it.
  */
-void utilization_test(int max_allocation) {
+void utilization_test(int max_allocation, char *stats_file) {
   int max_used_memory;
   int allocation_factor;
   int memory_required;
@@ -456,7 +876,14 @@ void utilization_test(int max_allocation) {
 
     // run it one more time at the identified size.
     // this makes sure that the data is set from a successful run.
+    if (stats_file != NULL && myalloc_sample_every != NULL)
+      myalloc_sample_every(STATS_SAMPLE_INTERVAL);
     if (try_sequence(test_sequence, memory_required)) {
+      // report the fragmentation of each tier while the blocks are live
+      print_tiers();
+      if (stats_file != NULL)
+        write_stats(stats_file);
+
       // check if data contents are intact
       if (check_data(test_sequence)) {
         printf("Data integrity FAIL.\n");
@@ -482,11 +909,14 @@ void utilization_test(int max_allocation) {
 
 
 void usage(char *program) {
-  printf("usage: %s [-s seed] [-m max_allocation]\n", program);
+  printf("usage: %s [-s seed] [-m max_allocation] [-j stats_file]\n",
+         program);
   printf("\tRuns the myalloc tester.\n\n");
   printf("\t-s seed sets the tester to use a specific random seed\n\n");
   printf("\t-m max_allocation sets the maximum number of bytes that the\n");
   printf("\ttester should try to allocate during utilization tests\n\n");
+  printf("\t-j stats_file writes the allocator's statistics at the end of\n");
+  printf("\tthe utilization test to stats_file as JSON\n\n");
 }
 
 
@@ -494,20 +924,26 @@ void usage(char *program) {
 int main(int argc, char *argv[]) {
   unsigned int seed = DEFAULT_RANDOM_SEED;
   int max_allocation = DEFAULT_MAX_ALLOCATION;
+  char *stats_file = NULL;
   int c;
 
-  while ((c = getopt(argc, argv, "s:m:")) != -1) {
+  while ((c = getopt(argc, argv, "s:m:j:")) != -1) {
     switch (c) {
       case 's':    /* Random seed */
         seed = atoi(optarg);
         break;
 
-      case 'p':
+      case 'm':    /* Maximum allocation for the utilization test */
         max_allocation = atoi(optarg);
-        if (max_allocation < 0)
+        if (max_allocation < 0) {
           printf("ERROR:  Max allocation must be nonnegative.\n");
           usage(argv[0]);
           return 1;
+        }
+        break;
+
+      case 'j':    /* File to write the allocator's statistics to */
+        stats_file = optarg;
         break;
 
       case 'h':
@@ -525,12 +961,28 @@ int main(int argc, char *argv[]) {
   coalesce_test();
   printf("\n");
 
+  // Do the basic test of resizing, zeroing and aligning blocks
+  realloc_test();
+  printf("\n");
+
+  // Do the basic test of the allocator's statistics
+  stats_test();
+  printf("\n");
+
+  // Do the basic test of promoting small chunks to slabs
+  slab_test();
+  printf("\n");
+
+  // Do the basic test of growing and shrinking the pool
+  grow_test();
+  printf("\n");
+
   // Do the basic test with repeated allocation of many uniform chunks
   uniform_chunk_test();
   printf("\n");
 
   // Do the memory utilization test to see how efficient the allocator is
-  utilization_test(max_allocation);
+  utilization_test(max_allocation, stats_file);
 
   return 0;
 }
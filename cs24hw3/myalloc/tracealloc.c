@@ -0,0 +1,569 @@
+/*! \file
+ * An LD_PRELOAD shim that records an allocation trace of any program, for
+ * replaying against the allocators here with replay:
+ *
+ *     LD_PRELOAD=./libtracealloc.so TRACEALLOC_FILE=prog.trace prog args...
+ *
+ * The trace goes to TRACEALLOC_FILE, or tracealloc.out if it isn't set.  A
+ * "%p" in the name is replaced with the process id; without one, a program
+ * that runs other programs gets the trace of whichever one exits last, since
+ * LD_PRELOAD is passed on to them.  A child forked without exec'ing stops
+ * recording, so that it doesn't write the parent's buffered events again.
+ *
+ * malloc(), calloc(), realloc(), free(), posix_memalign(), aligned_alloc()
+ * and memalign() are recorded; they are passed on to the C library's own
+ * versions, found with dlsym().  Each allocated block is given an id, kept
+ * in a hash table keyed on its address.  The events are buffered, and the
+ * buffer is written out whenever it fills and when the program exits.
+ * Events still in the buffer are lost if the program dies instead, or
+ * leaves with _exit().
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloctrace.h"
+
+
+#define DEFAULT_TRACE_FILE "tracealloc.out"
+
+/* The bytes of events buffered before they are written out. */
+#define BUFFER_SIZE (64 * 1024)
+
+/* The initial number of slots in the table of live blocks; a power of 2. */
+#define INITIAL_SLOTS (1 << 16)
+
+/*
+ * dlsym() may allocate memory before the C library's allocator has been
+ * found, so those requests come from this much static memory, and aren't
+ * recorded.
+ */
+#define BOOTSTRAP_SIZE (64 * 1024)
+
+/* Values of trace_fd before the file is open, and after recording stops. */
+#define TRACE_NOT_OPEN -1
+#define TRACE_STOPPED -2
+
+
+/* An entry in the table of live blocks; ptr is NULL if the slot is empty. */
+typedef struct slot {
+    void *ptr;
+    unsigned int id;
+} slot;
+
+
+/* The C library's versions of the functions the shim replaces. */
+static void * (*real_malloc)(size_t);
+static void * (*real_calloc)(size_t, size_t);
+static void * (*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void * (*real_aligned_alloc)(size_t, size_t);
+static void * (*real_memalign)(size_t, size_t);
+
+/* Nonzero while the real functions are being looked up. */
+static int resolving;
+
+static unsigned char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrap_used;
+
+/*
+ * The lock guards everything below.  busy is set while a thread is inside
+ * the shim, so that anything the shim itself allocates isn't recorded.
+ */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int busy;
+
+static int trace_fd = TRACE_NOT_OPEN;
+static unsigned char buffer[BUFFER_SIZE];
+static int buffered;
+
+/* The number of blocks allocated so far, which is the next block's id. */
+static unsigned int num_ids;
+
+/* The table of live blocks, with open addressing and linear probing. */
+static slot *slots;
+static size_t num_slots;
+static size_t used_slots;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+void complain(const char *message);
+void resolve_functions(void);
+void *bootstrap_alloc(size_t size);
+int in_bootstrap(void *ptr);
+
+int open_trace(void);
+void flush_trace(void);
+void write_event(const trace_event *event);
+
+size_t slot_of(void *ptr);
+void grow_table(void);
+void table_insert(void *ptr, unsigned int id);
+int table_remove(void *ptr, unsigned int *p_id);
+
+void record_alloc(int op, void *ptr, size_t size, size_t alignment);
+void record_free(void *ptr);
+
+void stop_in_child(void);
+void lock_trace(void);
+void unlock_trace(void);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Prints an error message without allocating any memory. */
+void complain(const char *message) {
+    if (write(STDERR_FILENO, "tracealloc: ", 12) < 0 ||
+        write(STDERR_FILENO, message, strlen(message)) < 0 ||
+        write(STDERR_FILENO, "\n", 1) < 0)
+        return;
+}
+
+
+/* Finds the C library's versions of the functions the shim replaces. */
+void resolve_functions(void) {
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    resolving = 0;
+
+    if (real_malloc == NULL || real_free == NULL) {
+        complain("can't find malloc");
+        abort();
+    }
+}
+
+
+/* Serves a request made while the real functions are being looked up. */
+void *bootstrap_alloc(size_t size) {
+    void *ptr;
+
+    size = (size + 15) / 16 * 16;
+    if (size > BOOTSTRAP_SIZE - bootstrap_used)
+        return NULL;
+
+    ptr = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return ptr;
+}
+
+
+/* Returns nonzero if a pointer came from bootstrap_alloc(). */
+int in_bootstrap(void *ptr) {
+    return (unsigned char *) ptr >= bootstrap &&
+           (unsigned char *) ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+
+/*
+ * Opens the trace file and writes its magic bytes, the first time an event
+ * is recorded.  Returns zero if there is nowhere to record to.
+ */
+int open_trace(void) {
+    char name[4096];
+    const char *pattern = getenv("TRACEALLOC_FILE");
+    char pid[24];
+    int n = 0, len, i, p;
+
+    if (trace_fd != TRACE_NOT_OPEN)
+        return trace_fd >= 0;
+
+    if (pattern == NULL)
+        pattern = DEFAULT_TRACE_FILE;
+
+    /* Copy the name, replacing each %p with the process id. */
+    for (i = 0; pattern[i] != '\0' && n < (int) sizeof(name) - 1; i++) {
+        if (pattern[i] == '%' && pattern[i + 1] == 'p') {
+            p = getpid();
+            len = 0;
+            do {
+                pid[len++] = '0' + p % 10;
+                p /= 10;
+            } while (p > 0);
+            while (len > 0 && n < (int) sizeof(name) - 1)
+                name[n++] = pid[--len];
+            i++;
+        }
+        else {
+            name[n++] = pattern[i];
+        }
+    }
+    name[n] = '\0';
+
+    trace_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        complain("can't open the trace file");
+        trace_fd = TRACE_STOPPED;
+        return 0;
+    }
+
+    memcpy(buffer, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    buffered = TRACE_MAGIC_SIZE;
+    return 1;
+}
+
+
+/* Writes out the buffered events. */
+void flush_trace(void) {
+    ssize_t written;
+    int done = 0;
+
+    while (trace_fd >= 0 && done < buffered) {
+        written = write(trace_fd, buffer + done, buffered - done);
+        if (written <= 0) {
+            trace_fd = TRACE_STOPPED;
+            break;
+        }
+        done += written;
+    }
+
+    buffered = 0;
+}
+
+
+/* Adds an event to the buffer, writing the buffer out first if it's full. */
+void write_event(const trace_event *event) {
+    if (!open_trace())
+        return;
+
+    if (buffered + TRACE_MAX_RECORD > BUFFER_SIZE)
+        flush_trace();
+    buffered += trace_encode(buffer + buffered, event, num_ids);
+}
+
+
+/* Returns the slot a pointer hashes to. */
+size_t slot_of(void *ptr) {
+    uint64_t h = ((uintptr_t) ptr >> 4) * 0x9e3779b97f4a7c15ULL;
+
+    return (size_t) (h >> 32) & (num_slots - 1);
+}
+
+
+/*
+ * Doubles the size of the table of live blocks, or makes the first one.  The
+ * table is mapped directly, so that it doesn't come from the allocator being
+ * traced.
+ */
+void grow_table(void) {
+    slot *old = slots;
+    size_t old_slots = num_slots, i, j;
+
+    num_slots = old_slots == 0 ? INITIAL_SLOTS : 2 * old_slots;
+    slots = mmap(NULL, num_slots * sizeof(slot), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        complain("out of memory");
+        abort();
+    }
+
+    for (i = 0; i < old_slots; i++) {
+        if (old[i].ptr == NULL)
+            continue;
+        for (j = slot_of(old[i].ptr); slots[j].ptr != NULL;
+             j = (j + 1) & (num_slots - 1))
+            ;
+        slots[j] = old[i];
+    }
+
+    if (old != NULL)
+        munmap(old, old_slots * sizeof(slot));
+}
+
+
+/* Adds a live block to the table, which is kept at most half full. */
+void table_insert(void *ptr, unsigned int id) {
+    size_t i;
+
+    if (2 * (used_slots + 1) > num_slots)
+        grow_table();
+
+    for (i = slot_of(ptr); slots[i].ptr != NULL && slots[i].ptr != ptr;
+         i = (i + 1) & (num_slots - 1))
+        ;
+
+    if (slots[i].ptr == NULL)
+        used_slots++;
+    slots[i].ptr = ptr;
+    slots[i].id = id;
+}
+
+
+/*
+ * Removes a block from the table, and returns zero if it wasn't there.  The
+ * entries after it in its run are shifted back into the gap, so that the
+ * table needs no tombstones.
+ */
+int table_remove(void *ptr, unsigned int *p_id) {
+    size_t i, j, home;
+
+    if (num_slots == 0)
+        return 0;
+
+    for (i = slot_of(ptr); slots[i].ptr != ptr; i = (i + 1) & (num_slots - 1)) {
+        if (slots[i].ptr == NULL)
+            return 0;
+    }
+    *p_id = slots[i].id;
+
+    for (j = (i + 1) & (num_slots - 1); slots[j].ptr != NULL;
+         j = (j + 1) & (num_slots - 1)) {
+        /* An entry can fill the gap if its home isn't between the two. */
+        home = slot_of(slots[j].ptr);
+        if (((j - home) & (num_slots - 1)) >= ((j - i) & (num_slots - 1))) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i].ptr = NULL;
+    used_slots--;
+    return 1;
+}
+
+
+/* Records the allocation of a new block. */
+void record_alloc(int op, void *ptr, size_t size, size_t alignment) {
+    trace_event e;
+
+    if (ptr == NULL || busy)
+        return;
+
+    busy = 1;
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != TRACE_STOPPED) {
+        e.op = op;
+        e.id = num_ids;
+        e.size = size;
+        e.alignment = alignment;
+        write_event(&e);
+
+        table_insert(ptr, num_ids);
+        num_ids++;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    busy = 0;
+}
+
+
+/*
+ * Records the freeing of a block, before it is freed, so that nothing else
+ * can be given its address until it is out of the table.  Blocks allocated
+ * before the shim was loaded, or by the shim itself, aren't in the table,
+ * and aren't recorded.
+ */
+void record_free(void *ptr) {
+    trace_event e;
+
+    if (busy)
+        return;
+
+    busy = 1;
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != TRACE_STOPPED && table_remove(ptr, &e.id)) {
+        e.op = TRACE_FREE;
+        e.size = 0;
+        e.alignment = 0;
+        write_event(&e);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    busy = 0;
+}
+
+
+/* Stops recording in a child process that was forked without exec'ing. */
+void stop_in_child(void) {
+    trace_fd = TRACE_STOPPED;
+    buffered = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+/* Holds the lock across a fork, so that the child's state is consistent. */
+void lock_trace(void) {
+    pthread_mutex_lock(&trace_lock);
+}
+
+
+void unlock_trace(void) {
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+__attribute__((constructor))
+static void start_tracing(void) {
+    if (real_malloc == NULL)
+        resolve_functions();
+    pthread_atfork(lock_trace, unlock_trace, stop_in_child);
+}
+
+
+__attribute__((destructor))
+static void finish_tracing(void) {
+    pthread_mutex_lock(&trace_lock);
+    flush_trace();
+    if (trace_fd >= 0)
+        close(trace_fd);
+    trace_fd = TRACE_STOPPED;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+
+void *malloc(size_t size) {
+    void *ptr;
+
+    if (real_malloc == NULL) {
+        if (resolving)
+            return bootstrap_alloc(size);
+        resolve_functions();
+    }
+
+    ptr = real_malloc(size);
+    record_alloc(TRACE_ALLOC, ptr, size, 0);
+    return ptr;
+}
+
+
+void *calloc(size_t nmemb, size_t size) {
+    void *ptr;
+
+    if (real_calloc == NULL) {
+        if (resolving)
+            return bootstrap_alloc(nmemb * size);    /* already zero */
+        resolve_functions();
+    }
+
+    ptr = real_calloc(nmemb, size);
+    record_alloc(TRACE_CALLOC, ptr, nmemb * size, 0);
+    return ptr;
+}
+
+
+/*
+ * The lock is held across the real realloc(), so that no other thread can be
+ * given the old address and record it before the old address is out of the
+ * table.
+ */
+void *realloc(void *ptr, size_t size) {
+    void *result;
+    trace_event e;
+    int known;
+
+    if (real_realloc == NULL)
+        resolve_functions();
+
+    if (ptr == NULL)
+        return malloc(size);
+
+    if (in_bootstrap(ptr)) {
+        result = malloc(size);
+        if (result != NULL) {
+            memcpy(result, ptr, (size_t) (bootstrap + BOOTSTRAP_SIZE -
+                   (unsigned char *) ptr) < size ? (size_t) (bootstrap +
+                   BOOTSTRAP_SIZE - (unsigned char *) ptr) : size);
+        }
+        return result;
+    }
+
+    if (busy)
+        return real_realloc(ptr, size);
+
+    busy = 1;
+    pthread_mutex_lock(&trace_lock);
+
+    known = trace_fd != TRACE_STOPPED && table_remove(ptr, &e.id);
+    result = real_realloc(ptr, size);
+
+    if (known) {
+        e.size = size;
+        e.alignment = 0;
+        if (result != NULL) {
+            e.op = TRACE_REALLOC;
+            write_event(&e);
+            table_insert(result, e.id);
+        }
+        else if (size == 0) {
+            e.op = TRACE_FREE;      /* realloc(ptr, 0) freed the block */
+            write_event(&e);
+        }
+        else {
+            table_insert(ptr, e.id);    /* it failed, so ptr is still live */
+        }
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+    busy = 0;
+
+    /* A block from before the shim was loaded is new to the trace. */
+    if (!known && result != NULL)
+        record_alloc(TRACE_ALLOC, result, size, 0);
+    return result;
+}
+
+
+void free(void *ptr) {
+    if (ptr == NULL || in_bootstrap(ptr))
+        return;
+
+    if (real_free == NULL)
+        resolve_functions();
+
+    record_free(ptr);
+    real_free(ptr);
+}
+
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    int result;
+
+    if (real_posix_memalign == NULL)
+        resolve_functions();
+
+    result = real_posix_memalign(memptr, alignment, size);
+    if (result == 0)
+        record_alloc(TRACE_ALIGNED, *memptr, size, alignment);
+    return result;
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    void *ptr;
+
+    if (real_aligned_alloc == NULL)
+        resolve_functions();
+
+    ptr = real_aligned_alloc(alignment, size);
+    record_alloc(TRACE_ALIGNED, ptr, size, alignment);
+    return ptr;
+}
+
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr;
+
+    if (real_memalign == NULL)
+        resolve_functions();
+
+    ptr = real_memalign(alignment, size);
+    record_alloc(TRACE_ALIGNED, ptr, size, alignment);
+    return ptr;
+}
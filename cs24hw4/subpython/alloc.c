@@ -28,6 +28,15 @@
 static int MEMORY_SIZE;
 
 
+/*!
+ * The nursery gets 1/NURSERY_FRACTION of the pool, up to MAX_NURSERY_SIZE
+ * bytes.  A small nursery keeps minor collections short, and most values die
+ * before it fills up.
+ */
+#define NURSERY_FRACTION 4
+#define MAX_NURSERY_SIZE (256 * 1024)
+
+
 /*!
  * This is the starting address of the memory pool used in the implicit
  * allocator.  The pool is allocated within init_alloc().
@@ -35,14 +44,68 @@ static int MEMORY_SIZE;
 static unsigned char *mem;
 
 
+/*!
+ * The pool holds two generations.  The old space runs from the start of the
+ * pool to the start of the nursery, and the nursery runs from there to the
+ * end of the pool.  New values are allocated in the nursery.  When it fills
+ * up, a minor collection copies the values in it that are still reachable
+ * onto the end of the old space, and empties it.  Only when the old space
+ * fills up is the whole pool marked and compacted by collect_garbage().
+ */
+static unsigned char *nursery;
+
+
+/*!
+ * Where the nursery usually starts.  A value too big for the old space can
+ * take over the nursery's space while the nursery is empty, which moves the
+ * start of the nursery up; it moves back down once a full collection makes
+ * room below this point again.
+ */
+static unsigned char *nursery_base;
+
+
 /*!
  * The implicit allocator uses an external "free-pointer" to track where free
- * memory starts.  We can get away with this approach because our allocator
- * compacts memory towards the start of the pool during garbage collection.
+ * memory starts in the old space.  We can get away with this approach
+ * because our allocator compacts memory towards the start of the pool during
+ * garbage collection.
  */
 static unsigned char *freeptr;
 
 
+/*! The free-pointer of the nursery. */
+static unsigned char *nursery_freeptr;
+
+
+/*!
+ * The "remembered set": the References of old values that may refer to
+ * values in the nursery.  A minor collection doesn't look at the rest of the
+ * old space, so these are its roots along with the globals.  Values are
+ * added by write_barrier() when they are written to, and have the REMEMBERED
+ * flag set so that they are only added once.
+ */
+static Reference *remembered;
+static int num_remembered;
+static int max_remembered;
+
+
+/*!
+ * The References of every value allocated while the current statement is
+ * evaluated.  The evaluator holds these in C local variables, where the
+ * collector can't see them, so they are treated as roots until the next
+ * statement begins; see release_temporaries().
+ */
+static Reference *temp_roots;
+static int num_temp_roots;
+static int max_temp_roots;
+
+
+/*! The References that mark() has yet to follow. */
+static Reference *mark_stack;
+static int num_mark_stack;
+static int max_mark_stack;
+
+
 /*!
  * This is the "reference table."  However, it is really just an array that
  * records where each Value starts in the pool.  References are just indexes
@@ -61,12 +124,34 @@ static int num_refs;
 /*! This is the actual size of the ref_table. */
 static int max_refs;
 
+/*!
+ * The unused slots below num_refs, kept as a stack so that make_reference()
+ * can find one without searching the table.  Slots are pushed as the
+ * collector frees them.  A full collection rebuilds the stack from the
+ * table, lowest slot on top, so that new values fill the table from the
+ * bottom and the top of it can be given back.
+ */
+static Reference *free_refs;
+static int num_free_refs;
+static int max_free_refs;
+
 
 //// LOCAL HELPER FUNCTIONS ////
 
 
 Reference make_reference();
 
+bool in_nursery(void *addr);
+void add_root(Reference **roots, int *num, int *max, Reference ref);
+void remember(Value *value);
+int value_children(Value *value, Reference *children);
+void promote(Reference ref);
+void promote_children(Value *value);
+void promote_global(const char *name, Reference ref);
+bool collect_nursery(void);
+void rebuild_free_refs(void);
+void dump_values(unsigned char *start, unsigned char *end);
+
 
 //// FUNCTION DEFINITIONS ////
 
@@ -82,6 +167,8 @@ Reference make_reference();
  * C standard function sbrk(), for example).
  */
 void init_alloc(int memory_size) {
+    int nursery_size;
+
     /*
      * Allocate the entire memory pool, from which our simple allocator will
      * serve allocation requests.
@@ -97,12 +184,36 @@ void init_alloc(int memory_size) {
         abort();
     }
 
+    /* Split the pool into the old space and the nursery. */
+    nursery_size = MEMORY_SIZE / NURSERY_FRACTION;
+    if (nursery_size > MAX_NURSERY_SIZE)
+        nursery_size = MAX_NURSERY_SIZE;
+    nursery_base = mem + MEMORY_SIZE - nursery_size;
+    nursery = nursery_base;
+
     freeptr = mem;
+    nursery_freeptr = nursery;
 
     /* Start out with no references in our reference-table. */
     ref_table = NULL;
     num_refs = 0;
     max_refs = 0;
+
+    free_refs = NULL;
+    num_free_refs = 0;
+    max_free_refs = 0;
+
+    remembered = NULL;
+    num_remembered = 0;
+    max_remembered = 0;
+
+    temp_roots = NULL;
+    num_temp_roots = 0;
+    max_temp_roots = 0;
+
+    mark_stack = NULL;
+    num_mark_stack = 0;
+    max_mark_stack = 0;
 }
 
 
@@ -113,15 +224,84 @@ bool is_pool_address(void *addr) {
 }
 
 
-/*! Returns true if the pool has the requested amount of space available. */
+/*! Returns true if the specified address is within the nursery. */
+bool in_nursery(void *addr) {
+    return ((unsigned char *) addr >= nursery &&
+            (unsigned char *) addr < mem + MEMORY_SIZE);
+}
+
+
+/*!
+ * Returns true if the old space has the requested amount of space
+ * available.
+ */
 bool has_space_available(int requested) {
-    return (freeptr + requested <= mem + MEMORY_SIZE);
+    return (freeptr + requested <= nursery);
+}
+
+
+/*! Returns true if the nursery has the requested amount of space available. */
+bool nursery_has_space(int requested) {
+    return (nursery_freeptr + requested <= mem + MEMORY_SIZE);
+}
+
+
+/*! Appends a Reference to a growable array of roots. */
+void add_root(Reference **roots, int *num, int *max, Reference ref) {
+    Reference *new_roots;
+
+    if (*num == *max) {
+        *max = (*max == 0) ? INITIAL_SIZE : *max * 2;
+        new_roots = realloc(*roots, sizeof(Reference) * *max);
+        if (new_roots == NULL) {
+            error(-1, "%s", "Allocation failed!");
+        }
+        *roots = new_roots;
+    }
+
+    (*roots)[(*num)++] = ref;
+}
+
+
+/*! Adds an old value to the remembered set, if it isn't already there. */
+void remember(Value *value) {
+    if (value->marked & REMEMBERED)
+        return;
+
+    value->marked |= REMEMBERED;
+    add_root(&remembered, &num_remembered, &max_remembered, value->ref);
+}
+
+
+/*!
+ * This must be called on a value before a Reference is stored into it, so
+ * that an old value that comes to refer to a young one is found by the next
+ * minor collection.  Stores into young values need no record.
+ */
+void write_barrier(Value *value) {
+    if (value != NULL && !in_nursery(value))
+        remember(value);
+}
+
+
+/*!
+ * Forgets the values allocated by the previous statement, so that the
+ * collector no longer keeps them alive unless they are reachable.
+ */
+void release_temporaries(void) {
+    num_temp_roots = 0;
 }
 
 
 /*!
  * Attempt to allocate a chunk of memory of "size" bytes.  Return 0 if
- * allocation fails.
+ * allocation fails.  Values are allocated in the nursery, with a minor
+ * collection to empty it when it is full.  Values too large for the nursery,
+ * and values that don't fit once it has been collected, are allocated in the
+ * old space instead.  Such a value is initialized without a write barrier,
+ * so it goes straight into the remembered set.  When the nursery is empty,
+ * the old space can grow into it, so a value can be as big as the whole
+ * pool.
  */
 Value * alloc(ValueType type, int data_size) {
     if (type == VAL_FLOAT)
@@ -137,16 +317,47 @@ Value * alloc(ValueType type, int data_size) {
 
     int requested = sizeof(struct Value) + data_size;
     Value *new_value = NULL;
+    bool pretenured = false;
+    bool collected = false;
 
-    // If we don't have space, this might work.
-    if (!has_space_available(requested))
-        collect_garbage();
+    if (requested <= MEMORY_SIZE - (nursery - mem)) {
+        // If we don't have space, emptying the nursery might work.
+        if (!nursery_has_space(requested))
+            collected = collect_nursery();
+
+        if (nursery_has_space(requested)) {
+            new_value = (Value *) nursery_freeptr;
+            nursery_freeptr += requested;
+        }
+    }
+
+    if (new_value == NULL) {
+        // If we don't have space, this might work, unless emptying the
+        // nursery already did a full collection.
+        if (!has_space_available(requested) && !collected)
+            collect_garbage();
+
+        // The old space can take over an empty nursery's space.
+        if (!has_space_available(requested) && nursery_freeptr == nursery &&
+            freeptr + requested <= mem + MEMORY_SIZE) {
+            nursery = freeptr + requested;
+            nursery_freeptr = nursery;
+        }
 
-    if (has_space_available(requested)) {
+        if (has_space_available(requested)) {
+            new_value = (Value *) freeptr;
+            freeptr += requested;
+            pretenured = true;
+        }
+    }
 
-        /* Initialize the new Value in the bytes beginning at freeptr. */
-        new_value = (Value *) freeptr;
+    // A full collection may have left room in the nursery after all.
+    if (new_value == NULL && nursery_has_space(requested)) {
+        new_value = (Value *) nursery_freeptr;
+        nursery_freeptr += requested;
+    }
 
+    if (new_value != NULL) {
         /* Assign a Reference to it; the Value will know its Reference. */
         make_reference(new_value);
 
@@ -158,11 +369,14 @@ Value * alloc(ValueType type, int data_size) {
         /* Set the data area to a pattern so that it's easier to debug. */
         memset(new_value + 1, 0xCC, data_size);
 
-        /* Update the free pointer to point past the new Value. */
-        freeptr += requested;
+        add_root(&temp_roots, &num_temp_roots, &max_temp_roots,
+                 new_value->ref);
+        if (pretenured)
+            remember(new_value);
     } else {
         fprintf(stderr, "alloc: cannot service request of size %d with"
-                " %d bytes allocated\n", requested, (int) (freeptr - mem));
+                " %d bytes allocated\n", requested,
+                (int) ((freeptr - mem) + (nursery_freeptr - nursery)));
     }
 
     return new_value;
@@ -188,16 +402,13 @@ Reference make_reference(Value *value) {
         }
     }
 
-    /* Scan through the reference table to see if we have any unused slots
-     * that we can use for this value.
-     */
-    for (i = 0; i < num_refs; i++) {
-        if (ref_table[i] == NULL) {
-            ref = (Reference) i;  // Probably unnecessary, but clearer.
-            ref_table[i] = value;
-            value->ref = ref;
-            return ref;
-        }
+    /* Reuse an unused slot if the collector has freed any. */
+    if (num_free_refs > 0) {
+        ref = free_refs[--num_free_refs];
+        assert(ref_table[ref] == NULL);
+        ref_table[ref] = value;
+        value->ref = ref;
+        return ref;
     }
 
     /* If we got here, we don't have any available slots.  Find out if
@@ -255,11 +466,11 @@ Value * deref(Reference ref) {
     return pval;
 }
 
-/*! Print all allocated objects and free regions in the pool. */
-void memdump() {
-    unsigned char *curr = mem;
+/*! Print all allocated objects in one part of the pool. */
+void dump_values(unsigned char *start, unsigned char *end) {
+    unsigned char *curr = start;
 
-    while (curr < freeptr) {
+    while (curr < end) {
         Value *curr_value = (Value *) curr;
         int data_size = curr_value->data_size;
         int value_size = sizeof(Value) + data_size;
@@ -297,6 +508,15 @@ void memdump() {
                 break;
             }
 
+            case VAL_DICT_TABLE: {
+                DictTableValue *tv = (DictTableValue *) curr_value;
+                fprintf(stdout,
+                    "type = VAL_DICT_TABLE; entries = %d; capacity = %d; "
+                    "last_ref = %d\n",
+                    tv->num_entries, tv->capacity, tv->last);
+                break;
+            }
+
             default:
                 fprintf(stdout,
                         "type = UNKNOWN; the memory pool is probably "
@@ -305,8 +525,19 @@ void memdump() {
 
         curr += value_size;
     }
+}
+
+
+/*! Print all allocated objects and free regions in the pool. */
+void memdump() {
+    dump_values(mem, freeptr);
     fprintf(stdout, "Free  0x%08x; size %lu\n", (int) (freeptr - mem),
-        MEMORY_SIZE - (freeptr - mem));
+        (unsigned long) (nursery - freeptr));
+
+    fprintf(stdout, "Nursery:\n");
+    dump_values(nursery, nursery_freeptr);
+    fprintf(stdout, "Free  0x%08x; size %lu\n", (int) (nursery_freeptr - mem),
+        MEMORY_SIZE - (nursery_freeptr - mem));
 }
 
 
@@ -314,70 +545,74 @@ void memdump() {
 
 
 /*!
- * Changes the 'marked' int flag of specific value to MARKED. For DictValue
- * and ListValue, we go ahead and mark the current node and next nodes. 
+ * Stores the References held by a value in children, and returns how many
+ * there are.  Some of them may be NULL_REF.  A dictionary's hash table only
+ * refers to entries that are reachable from the dictionary's nodes anyway,
+ * so it is treated as holding none.
  */
-void mark(Value *value) {
-    if (!value) {
-        return;
-    }
-
-    Reference val, nxt, key;    // Storing listNode and dictNode members
+int value_children(Value *value, Reference *children) {
+    switch (value->type) {
+        case VAL_LIST_NODE: {
+            ListValue *lv = (ListValue *) value;
+            children[0] = lv->list_node.value;
+            children[1] = lv->list_node.next;
+            return 2;
+        }
 
-    switch (value->type)
-    {
-        case (VAL_FLOAT):
-            // Fallthrough to VAL_STRING because of same behavior
-        case (VAL_STRING):
-            value->marked = MARKED;
-            break;
+        case VAL_DICT_NODE: {
+            DictValue *dv = (DictValue *) value;
+            children[0] = dv->dict_node.key;
+            children[1] = dv->dict_node.value;
+            children[2] = dv->dict_node.next;
+            return 3;
+        }
 
-        case (VAL_LIST_NODE): {
-            ListValue *lst_val = (ListValue *) value;
-            lst_val->marked = MARKED;
-            val = lst_val->list_node.value;
-            nxt = lst_val->list_node.next;
+        default:
+            return 0;
+    }
+}
 
-            // Recursively mark value and next members. */
-            Value *list_val = deref(val);
-            Value *list_nxt = deref(nxt);
 
-            if (list_val) {
-                mark(list_val);
-            }
-            if (list_nxt) {
-                mark(list_nxt);
-            }
-            break;
-        
-        }
-        case (VAL_DICT_NODE): {
-            DictValue *dct_val = (DictValue *) value;
-            dct_val->marked = MARKED;
+/*!
+ * Changes the 'marked' int flag of a value to MARKED, along with every value
+ * reachable from it.  A value that is already marked has been reached
+ * before, so we stop there, which also keeps us from going around a cycle
+ * forever.
+ *
+ * Rather than recursing, which could overflow the C stack on a long list,
+ * the References still to be marked are kept on mark_stack.  Each value is
+ * prefetched when it is pushed, so that it is likely to be in the cache by
+ * the time it is popped.  Pushing a node's next Reference first means the
+ * value in it is marked before the walk moves on down the list, which keeps
+ * the stack short.
+ */
+void mark(Value *value) {
+    Reference children[3];
+    int i, n;
 
-            // Recursively mark key, value, next members. */
-            key = dct_val->dict_node.key;
-            val = dct_val->dict_node.value;
-            nxt = dct_val->dict_node.next;
+    if (!value || (value->marked & MARKED)) {
+        return;
+    }
 
-            Value *dict_key = deref(key);
-            Value *dict_val = deref(val);
-            Value *dict_nxt = deref(nxt);
+    num_mark_stack = 0;
+    while (true) {
+        value->marked |= MARKED;
 
-            if (dict_key) {
-                mark(dict_key);
-            }
-            if (dict_val) {
-                mark(dict_val);
+        n = value_children(value, children);
+        for (i = n - 1; i >= 0; i--) {
+            if (children[i] != NULL_REF) {
+                __builtin_prefetch(ref_table[children[i]]);
+                add_root(&mark_stack, &num_mark_stack, &max_mark_stack,
+                         children[i]);
             }
-            if (dict_nxt) {
-                mark(dict_nxt);
-            }
-            break;
         }
 
-        default:
-            printf("alloc recieved unexpected ValueType.\n");
+        /* Find the next value that isn't marked yet. */
+        do {
+            if (num_mark_stack == 0)
+                return;
+            value = deref(mark_stack[--num_mark_stack]);
+        } while (value->marked & MARKED);
     }
 }
 
@@ -396,22 +631,130 @@ void mark_globals(const char *name, Reference ref)
 
 }
 
+/*!
+ * Promotes a young value into the old space, by copying it onto the end of
+ * the old space and pointing its Reference at the copy.  Values that are
+ * already old, including those promoted earlier in the same collection, are
+ * left alone.
+ */
+void promote(Reference ref) {
+    Value *value;
+    int value_size;
+
+    if (ref == NULL_REF)
+        return;
+
+    value = ref_table[ref];
+    if (!in_nursery(value))
+        return;
+
+    value_size = sizeof(Value) + value->data_size;
+    memcpy(freeptr, value, value_size);
+    ref_table[ref] = (Value *) freeptr;
+    freeptr += value_size;
+}
+
+
+/*! Promotes every young value that a value refers to. */
+void promote_children(Value *value) {
+    Reference children[3];
+    int i, n = value_children(value, children);
+
+    for (i = 0; i < n; i++)
+        promote(children[i]);
+}
+
+
+/* Promotes the young value a global refers to, if it is young. */
+void promote_global(const char *name, Reference ref) {
+    (void)(name);
+    promote(ref);
+}
+
+
+/*!
+ * A minor collection, which empties the nursery by promoting every value in
+ * it that is still reachable into the old space.  The roots are the globals,
+ * the temporaries of the current statement, and the old values in the
+ * remembered set; the rest of the old space isn't looked at.  Promoted values
+ * are copied in the order they are found, and then the copies are scanned in
+ * the same order for the values they refer to, so no recursion is needed.
+ * Whatever is left in the nursery is garbage.
+ *
+ * If the old space might not have room for everything in the nursery, a full
+ * collection is done instead.  Returns true if it was, so that the caller
+ * doesn't do another one.
+ */
+bool collect_nursery(void) {
+    unsigned char *scan, *curr;
+    Value *value;
+    int i;
+
+    if (!has_space_available(nursery_freeptr - nursery)) {
+        collect_garbage();
+        return true;
+    }
+
+    /* Promote the values the roots refer to. */
+    scan = freeptr;
+    foreach_global(promote_global);
+    for (i = 0; i < num_temp_roots; i++)
+        promote(temp_roots[i]);
+
+    for (i = 0; i < num_remembered; i++) {
+        value = ref_table[remembered[i]];
+        value->marked &= ~REMEMBERED;
+        promote_children(value);
+    }
+    num_remembered = 0;
+
+    /* Promote everything the promoted values refer to, in turn. */
+    while (scan < freeptr) {
+        value = (Value *) scan;
+        promote_children(value);
+        scan += sizeof(Value) + value->data_size;
+    }
+
+    /* Any value whose Reference still points into the nursery is garbage. */
+    curr = nursery;
+    while (curr < nursery_freeptr) {
+        value = (Value *) curr;
+        if (ref_table[value->ref] == value) {
+            ref_table[value->ref] = NULL;
+            add_root(&free_refs, &num_free_refs, &max_free_refs, value->ref);
+        }
+        curr += sizeof(Value) + value->data_size;
+    }
+
+    nursery_freeptr = nursery;
+    return false;
+}
+
+
 /* 
  * This function employs the "mark and sweep" method to garbage collect 
  * the memory pool. We ensure that all non-garbage comes before the freeptr
  * (at the beginning of memory pool) and that all garbage comes after freeptr.
+ * This is the full collection, which covers both generations; it only runs
+ * when the old space fills up, or when the program asks for it.
  */
 
 int collect_garbage(void) {
 
-    int reclaimed;
+    int reclaimed, i;
+    int used = (int) ((freeptr - mem) + (nursery_freeptr - nursery));
+    Reference children[3];
+    int n;
     printf("Collecting garbage.\n");
     /*
      * First phase: Mark all reachable objects. 
      * We mark the global objects first which then recursively mark the 
-     * objects that are reachable from them.
+     * objects that are reachable from them.  The temporaries of the current
+     * statement are reachable too.
      */
     foreach_global(mark_globals);
+    for (i = 0; i < num_temp_roots; i++)
+        mark(deref(temp_roots[i]));
 
     /* 
      * Second phase: Reclaim any unreachable objects.
@@ -430,6 +773,9 @@ int collect_garbage(void) {
      * 
      * If not marked, we 1) move read_head onto the next value. 2) Set its
      * reference to be NULL.
+     *
+     * Unmarking also clears the REMEMBERED flag, since the remembered set is
+     * rebuilt at the end.
      */ 
 
     /* read_head marks where we read values from as we iterate. */
@@ -447,7 +793,7 @@ int collect_garbage(void) {
         int value_size = sizeof(Value) + data_size;
         Reference ref = curr_value->ref;
 
-        if (curr_value->marked == MARKED){
+        if (curr_value->marked & MARKED){
 
             /* Unmark for next time we garbage collect. */
             curr_value->marked = UNMARKED;
@@ -473,19 +819,117 @@ int collect_garbage(void) {
     }
 
     fprintf(stdout, "Free  0x%08x; size %lu\n", (int) (freeptr - mem),
-        MEMORY_SIZE - (freeptr - mem));
+        (unsigned long) (nursery - freeptr));
+    freeptr = write_head;
+
+    /*
+     * Third phase: Empty the nursery the same way.  Marked values are moved
+     * onto the end of the old space while there is room, and slid down to
+     * the start of the nursery once there isn't.
+     */
+    unsigned char *nursery_write_head = nursery;
+
+    read_head = nursery;
+    while (read_head < nursery_freeptr) {
+        Value *curr_value = (Value *) read_head;
+        int value_size = sizeof(Value) + curr_value->data_size;
+        Reference ref = curr_value->ref;
+
+        if (curr_value->marked & MARKED) {
+            curr_value->marked = UNMARKED;
+
+            if (has_space_available(value_size)) {
+                memcpy(freeptr, read_head, value_size);
+                ref_table[ref] = (Value *) freeptr;
+                freeptr += value_size;
+            } else {
+                memmove(nursery_write_head, read_head, value_size);
+                ref_table[ref] = (Value *) nursery_write_head;
+                nursery_write_head += value_size;
+            }
+        } else {
+            ref_table[ref] = NULL;
+        }
+
+        read_head += value_size;
+    }
+    nursery_freeptr = nursery_write_head;
+
+    /*
+     * Once the nursery is empty, it goes back to its usual place, unless the
+     * old space still reaches past that.
+     */
+    if (nursery_freeptr == nursery) {
+        nursery = (freeptr > nursery_base) ? freeptr : nursery_base;
+        nursery_freeptr = nursery;
+    }
+
+    /*
+     * If anything is left in the nursery, find the old values that refer to
+     * it, since the remembered set is out of date.
+     */
+    num_remembered = 0;
+    if (nursery_freeptr > nursery) {
+        for (read_head = mem; read_head < freeptr;
+             read_head += sizeof(Value) + ((Value *) read_head)->data_size) {
+            n = value_children((Value *) read_head, children);
+            for (i = 0; i < n; i++) {
+                if (children[i] != NULL_REF &&
+                    in_nursery(ref_table[children[i]])) {
+                    remember((Value *) read_head);
+                    break;
+                }
+            }
+        }
+    }
+
+    rebuild_free_refs();
+
     /*
      * Ths will report how many bytes we were able to free in this garbage
      * collection pass. Data after write_head is considered "garbage."
      */
     
-    reclaimed = (int) (freeptr - write_head);
-    freeptr = write_head;
+    reclaimed = used - (int) ((freeptr - mem) + (nursery_freeptr - nursery));
     printf("Reclaimed %d bytes of garbage.\n", reclaimed);
     return reclaimed;
 }
 
 
+/*!
+ * Rebuilds the stack of unused Reference slots after a full collection.
+ * Unused slots at the top of the table are dropped from it, and once the
+ * table is less than a quarter full it is shrunk to half its size, but no
+ * smaller than INITIAL_SIZE.  References in use never change, so only the
+ * top of the table can be given back.
+ */
+void rebuild_free_refs(void) {
+    Value **new_table;
+    int i, new_max = max_refs;
+
+    while (num_refs > 0 && ref_table[num_refs - 1] == NULL)
+        num_refs--;
+
+    while (new_max > INITIAL_SIZE && num_refs < new_max / 4)
+        new_max /= 2;
+
+    if (new_max < max_refs) {
+        new_table = realloc(ref_table, sizeof(Value *) * new_max);
+        if (new_table != NULL) {
+            ref_table = new_table;
+            max_refs = new_max;
+        }
+    }
+
+    /* Push the highest slots first, so the lowest are reused first. */
+    num_free_refs = 0;
+    for (i = num_refs - 1; i >= 0; i--) {
+        if (ref_table[i] == NULL)
+            add_root(&free_refs, &num_free_refs, &max_free_refs, i);
+    }
+}
+
+
 //// END GARBAGE COLLECTOR ////
 
 
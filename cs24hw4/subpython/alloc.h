@@ -23,6 +23,12 @@ bool is_pool_address(void *addr);
 /* Attempt to allocate a value from the implicit allocator. */
 Value * alloc(ValueType type, int data_size);
 
+/* Records that a Reference is about to be stored into a Value. */
+void write_barrier(Value *value);
+
+/* Lets the values allocated by the previous statement be collected. */
+void release_temporaries(void);
+
 /* Dereference a Reference into its corresponding Value. */
 Value * deref(Reference ref);
 
@@ -8,6 +8,14 @@
 
 #define MAX_DEPTH 4
 
+/*!
+ * A dictionary gets a hash table once a search has to walk past this many
+ * entries; smaller dictionaries are just searched.  Tables are kept at most
+ * half full, and never have fewer than DICT_TABLE_MIN_CAPACITY slots.
+ */
+#define DICT_TABLE_MIN_ENTRIES 8
+#define DICT_TABLE_MIN_CAPACITY 16
+
 struct GlobalVariable {
     char *name;
     Reference ref;
@@ -33,10 +41,16 @@ Reference make_reference_float(float f);
 Reference make_reference_string(char *c);
 Reference make_reference_list_node(Reference next, Reference value);
 Reference make_reference_dict_node(Reference next, Reference key, Reference value);
+Reference make_reference_dict_table(Reference dict);
 
 bool key_equals(Reference a, Reference b);
+unsigned int key_hash(Reference ref);
 Reference key_clone(Reference ref);
 
+DictSlot * find_dict_slot(DictTableValue *table, Reference key,
+                          unsigned int hash);
+DictValue * get_indexed_dict_entry(Reference ref, Reference key, bool create);
+
 
 //// HELPER FUNCTIONS ////
 
@@ -69,6 +83,20 @@ DictValue * deref_to_dict_value(Reference ref) {
 }
 
 
+DictTableValue * to_dict_table_value(Value *v) {
+    DictTableValue *tv = NULL;
+    if (v) {
+        assert(v->type == VAL_DICT_TABLE);
+        tv = (DictTableValue *) v;
+    }
+    return tv;
+}
+
+DictTableValue * deref_to_dict_table_value(Reference ref) {
+    return to_dict_table_value(deref(ref));
+}
+
+
 /*!
  * Returns the element of the list at index idx, or reports an error if the
  * list doesn't have an element at that index.
@@ -107,20 +135,34 @@ ListValue * get_list_elem(Reference ref, int idx) {
 }
 
 
+/*!
+ * Returns the entry of the dictionary with the given key.  If there isn't
+ * one, then a new entry is added to the end of the dictionary if create is
+ * true, or an error is reported if it isn't.  The new entry has the key, but
+ * its value is left for the caller to set.
+ *
+ * Small dictionaries are searched entry by entry.  Once a search walks past
+ * DICT_TABLE_MIN_ENTRIES entries, the dictionary is given a hash table, and
+ * get_indexed_dict_entry() is used from then on.
+ */
 DictValue * get_dict_entry(Reference ref, Reference key, bool create) {
 
     /* The first node in a dictionary is always a dummy value, so we can
-     * ignore it.  (Also, verify that it actually doesn't hold anything.)
+     * ignore it.  (Also, verify that it actually doesn't hold a key.)  Its
+     * value is the dictionary's hash table, if it has one.
      */
     DictValue *start = deref_to_dict_value(ref);
     DictValue *entry = start;
-    DictValue *prev;
+    Reference prev, found;
+    int walked = 0;
     assert(start->dict_node.key == NULL_REF);
-    assert(start->dict_node.value == NULL_REF);
+
+    if (start->dict_node.value != NULL_REF)
+        return get_indexed_dict_entry(ref, key, create);
 
     /* Move past the first entry. */
+    prev = ref;
     entry = deref_to_dict_value(entry->dict_node.next);
-    prev = start;
 
     /* Iterate until we find our key, or until we reach the end of the
      * dictionary's entries. */
@@ -129,8 +171,9 @@ DictValue * get_dict_entry(Reference ref, Reference key, bool create) {
             break;
         }
 
-        prev = entry;
+        prev = entry->ref;
         entry = deref_to_dict_value(entry->dict_node.next);
+        walked++;
     }
 
     /* If we got NULL, then that means our key is missing. */
@@ -142,20 +185,111 @@ DictValue * get_dict_entry(Reference ref, Reference key, bool create) {
         else {
             /* The caller wants us to create a new entry.  Tack it onto the
              * end of the dictionary.  Set the key, but we don't know what
-             * value it should have yet.
+             * value it should have yet.  Allocating the entry may move the
+             * last entry, so it is found again from its Reference.
              */
 
             Reference entry_ref =
                 make_reference_dict_node(NULL_REF, key, NULL_REF);
+            DictValue *last = deref_to_dict_value(prev);
             entry = (DictValue *) deref(entry_ref);
 
-            assert(prev != NULL);
-            assert(prev->dict_node.next = NULL_REF);
-            prev->dict_node.next = entry_ref;
+            assert(last != NULL);
+            assert(last->dict_node.next == NULL_REF);
+            write_barrier((Value *) last);
+            last->dict_node.next = entry_ref;
+        }
+    }
+
+    /* Searching this dictionary is getting slow, so give it a table.  That
+     * allocates, so the entry is found again from its Reference.
+     */
+    found = entry->ref;
+    if (walked >= DICT_TABLE_MIN_ENTRIES)
+        make_reference_dict_table(ref);
+
+    return deref_to_dict_value(found);
+}
+
+
+/*!
+ * Returns the slot of a dictionary's hash table that holds the entry with
+ * the given key, or the empty slot where it would go if there is no such
+ * entry.
+ */
+DictSlot * find_dict_slot(DictTableValue *table, Reference key,
+                          unsigned int hash) {
+    int mask = table->capacity - 1;
+    int i = hash & mask;
+    DictSlot *slot = table->slots + i;
+
+    while (slot->entry != NULL_REF) {
+        if (slot->hash == hash &&
+            key_equals(deref_to_dict_value(slot->entry)->dict_node.key, key)) {
+            break;
         }
+
+        i = (i + 1) & mask;
+        slot = table->slots + i;
     }
 
-    return entry;
+    return slot;
+}
+
+
+/*! get_dict_entry() for a dictionary that has a hash table. */
+DictValue * get_indexed_dict_entry(Reference ref, Reference key, bool create) {
+    DictValue *start = deref_to_dict_value(ref);
+    DictTableValue *table = deref_to_dict_table_value(start->dict_node.value);
+    unsigned int hash = key_hash(key);
+    DictSlot *slot = find_dict_slot(table, key, hash);
+    DictValue *last;
+    Reference entry_ref;
+
+    if (slot->entry != NULL_REF)
+        return deref_to_dict_value(slot->entry);
+
+    if (!create) {
+        error(-1, "%s", "Key cannot be found!");
+    }
+
+    /* Keep the table at most half full.  If a bigger table can't be
+     * allocated, the old one is used until the next insert tries again; it
+     * still works as long as it has an empty slot.  Only when it would fill
+     * up is it dropped, and the dictionary searched until a search builds a
+     * new one.
+     */
+    if (2 * (table->num_entries + 1) > table->capacity &&
+        make_reference_dict_table(ref) == NULL_REF) {
+        start = deref_to_dict_value(ref);
+        table = deref_to_dict_table_value(start->dict_node.value);
+        if (table->num_entries + 1 >= table->capacity) {
+            write_barrier((Value *) start);
+            start->dict_node.value = NULL_REF;
+            return get_dict_entry(ref, key, create);
+        }
+    }
+
+    /* Allocating the entry may move the table and the last entry, so they
+     * are found again from their References.
+     */
+    entry_ref = make_reference_dict_node(NULL_REF, key, NULL_REF);
+    start = deref_to_dict_value(ref);
+    table = deref_to_dict_table_value(start->dict_node.value);
+
+    slot = find_dict_slot(table, key, hash);
+    assert(slot->entry == NULL_REF);
+    slot->hash = hash;
+    slot->entry = entry_ref;
+    table->num_entries++;
+
+    last = deref_to_dict_value(table->last);
+    assert(last->dict_node.next == NULL_REF);
+    write_barrier((Value *) last);
+    last->dict_node.next = entry_ref;
+    table->last = entry_ref;
+
+    return deref_to_dict_value(entry_ref);
 }
 
 
@@ -192,7 +326,6 @@ void print_dict(Reference ref, int depth) {
     /* The first entry is a dummy entry.  Skip it. */
     DictValue *dv = deref_to_dict_value(ref);
     assert(dv->dict_node.key == NULL_REF);
-    assert(dv->dict_node.value == NULL_REF);
     dv = deref_to_dict_value(dv->dict_node.next);
 
     while (dv != NULL) {
@@ -261,6 +394,9 @@ void print_ref_ext(Reference ref, bool newline, int depth) {
 void eval_stmt(ParseStatement *stmt) {
     Reference eval_ref;
 
+    /* The previous statement's temporaries can be collected now. */
+    release_temporaries();
+
     switch (stmt->type) {
         case STMT_DEL:
             delete_global_variable(stmt->identifier);
@@ -413,7 +549,10 @@ Reference eval_expr(ParseExpression *expr) {
 /*!
  * Evaluates an expression that can be the target of an assignment.  This is why
  * the method returns a pointer to a Reference - so that we can change the
- * Reference itself to refer to something else.
+ * Reference itself to refer to something else.  The pointer must be stored
+ * through before anything else is allocated, since the collector may move
+ * the value it points into.  Values written into this way go through the
+ * collector's write barrier.
  */
 Reference * eval_expr_lval(ParseExpression *expr) {
     Reference lhs, rhs;
@@ -429,6 +568,7 @@ Reference * eval_expr_lval(ParseExpression *expr) {
                  * (it's the best we can do... without introducing ints.) */
                 int idx = (int) eval_expect_float(expr->rhs);
                 ListValue *elem = get_list_elem(lhs, idx);
+                write_barrier((Value *) elem);
                 return &(elem->list_node.value);
             } else if (lhs_value->type == VAL_DICT_NODE) {
                 /* If we have a dict, then evaluate our rhs key.  */
@@ -439,6 +579,7 @@ Reference * eval_expr_lval(ParseExpression *expr) {
                  */
             	DictValue *lhs_dict =
                     get_dict_entry(lhs, rhs, /* create */ true);
+                write_barrier((Value *) lhs_dict);
                 return &(lhs_dict->dict_node.value);
             } else {
                 error(-1, "%s", "Can only subscript lists and dictionaries.");
@@ -449,8 +590,11 @@ Reference * eval_expr_lval(ParseExpression *expr) {
             break;
 
         case EXPR_ASSIGN: {
-            Reference *lval = eval_expr_lval(expr->lhs);
+            /* Evaluate the rhs first, since allocating can move the value
+             * that lval points into.
+             */
             rhs = eval_expr(expr->rhs);
+            Reference *lval = eval_expr_lval(expr->lhs);
             *lval = rhs;
             return lval;
         }
@@ -609,6 +753,53 @@ bool key_equals(Reference a, Reference b) {
     }
 }
 
+/*!
+ * Returns the hash of a key, which is the FNV-1a hash of its bytes.  Keys
+ * that are equal have the same hash; for floats, that means 0 and -0 have to
+ * be hashed alike.  Lists and dictionaries can't be looked up, but a
+ * dictionary literal can still use them as keys, so they all get the same
+ * hash.
+ */
+unsigned int key_hash(Reference ref) {
+    Value *v = deref(ref);
+    unsigned int hash = 2166136261u;
+    unsigned char *bytes;
+    float f;
+    int i, n;
+
+    assert(v != NULL);
+
+    switch (v->type) {
+        case VAL_FLOAT:
+            f = ((FloatValue *) v)->float_value;
+            if (f == 0)
+                f = 0;
+            bytes = (unsigned char *) &f;
+            n = sizeof(float);
+            break;
+
+        case VAL_STRING:
+            bytes = (unsigned char *) ((StringValue *) v)->string_value;
+            n = v->data_size - 1;
+            break;
+
+        case VAL_LIST_NODE:
+        case VAL_DICT_NODE:
+            bytes = NULL;
+            n = 0;
+            break;
+
+        default:
+            UNREACHABLE();
+    }
+
+    for (i = 0; i < n; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 /*! ListNode allocation helper. */
 Reference make_reference_list_node(Reference next, Reference value) {
     ListValue *lv = (ListValue *) alloc(VAL_LIST_NODE, /* ignored */ 0);
@@ -626,6 +817,89 @@ Reference make_reference_dict_node(Reference next, Reference key, Reference valu
     return dv->ref;
 }
 
+/*!
+ * Gives a dictionary a new hash table, twice the size of its old one if it
+ * has one, and big enough for its entries if it doesn't.  The table is
+ * filled from the old one if there is one, so that keys aren't hashed again;
+ * otherwise every entry is hashed, and only the first entry with each key is
+ * indexed, since that is the one that searching finds.  Returns the new
+ * table, or NULL_REF if it couldn't be allocated, in which case the
+ * dictionary keeps the table it had, if any.
+ */
+Reference make_reference_dict_table(Reference dict) {
+    DictValue *start = deref_to_dict_value(dict);
+    DictValue *entry;
+    DictTableValue *table, *old_table = NULL;
+    DictSlot *slot;
+    int i, mask, capacity = DICT_TABLE_MIN_CAPACITY, num_entries = 0;
+    unsigned int hash;
+
+    if (start->dict_node.value != NULL_REF) {
+        old_table = deref_to_dict_table_value(start->dict_node.value);
+        capacity = old_table->capacity * 2;
+    } else {
+        for (entry = deref_to_dict_value(start->dict_node.next);
+             entry != NULL;
+             entry = deref_to_dict_value(entry->dict_node.next)) {
+            num_entries++;
+        }
+        while (capacity < 2 * (num_entries + 1))
+            capacity *= 2;
+    }
+
+    table = (DictTableValue *) alloc(VAL_DICT_TABLE,
+        sizeof(DictTableValue) - sizeof(Value) + capacity * sizeof(DictSlot));
+
+    /* Allocating may have moved the dictionary and its old table. */
+    start = deref_to_dict_value(dict);
+    if (table == NULL)
+        return NULL_REF;
+
+    table->num_entries = 0;
+    table->capacity = capacity;
+    table->last = dict;
+    for (i = 0; i < capacity; i++) {
+        table->slots[i].hash = 0;
+        table->slots[i].entry = NULL_REF;
+    }
+
+    if (start->dict_node.value != NULL_REF) {
+        /* Every key in the old table is different, so each entry just goes
+         * in the first empty slot from its hash.
+         */
+        old_table = deref_to_dict_table_value(start->dict_node.value);
+        mask = capacity - 1;
+        for (i = 0; i < old_table->capacity; i++) {
+            if (old_table->slots[i].entry == NULL_REF)
+                continue;
+
+            hash = old_table->slots[i].hash;
+            while (table->slots[hash & mask].entry != NULL_REF)
+                hash++;
+            table->slots[hash & mask] = old_table->slots[i];
+        }
+        table->num_entries = old_table->num_entries;
+        table->last = old_table->last;
+    } else {
+        for (entry = deref_to_dict_value(start->dict_node.next);
+             entry != NULL;
+             entry = deref_to_dict_value(entry->dict_node.next)) {
+            hash = key_hash(entry->dict_node.key);
+            slot = find_dict_slot(table, entry->dict_node.key, hash);
+            if (slot->entry == NULL_REF) {
+                slot->hash = hash;
+                slot->entry = entry->ref;
+                table->num_entries++;
+            }
+            table->last = entry->ref;
+        }
+    }
+
+    write_barrier((Value *) start);
+    start->dict_node.value = table->ref;
+    return table->ref;
+}
+
 /*! Assigns a float to a new reference in the ref_table. */
 Reference make_reference_float(float f) {
     FloatValue *fv = (FloatValue *) alloc(VAL_FLOAT, /* ignored */ 0);
@@ -14,8 +14,13 @@ typedef int Reference;
 /*! This value is used to represent a "null" reference. */
 #define NULL_REF (-1)
 
-/* Values used for the "marked" flag. 1 for yes. 0 for no.*/
+/*
+ * Flags kept in the "marked" field.  MARKED is set on values found to be
+ * reachable during a full collection.  REMEMBERED is set on old values that
+ * are in the collector's remembered set.  UNMARKED clears both.
+ */
 #define MARKED 1
+#define REMEMBERED 2
 #define UNMARKED 0
 
 /*!
@@ -25,7 +30,8 @@ typedef enum ValueType {
     VAL_FLOAT,          /*!< A float value */
     VAL_STRING,         /*!< A string value */
     VAL_LIST_NODE,      /*!< A node in a list */
-    VAL_DICT_NODE       /*!< A node (key/value pair) in a dictionary */
+    VAL_DICT_NODE,      /*!< A node (key/value pair) in a dictionary */
+    VAL_DICT_TABLE      /*!< The hash table that indexes a dictionary */
 } ValueType;
 
 
@@ -52,6 +58,16 @@ typedef struct DictNode {
 } DictNode;
 
 
+/*! This is a single slot in a dictionary's hash table. */
+typedef struct DictSlot {
+    /*! The hash of the entry's key, so that keys are only hashed once. */
+    unsigned int hash;
+
+    /*! The entry in this slot, or NULL_REF if the slot is empty. */
+    Reference entry;
+} DictSlot;
+
+
 /*!
  * A Value type that represents all possible kinds of values used within the
  * interpreter.
@@ -61,7 +77,10 @@ typedef struct DictNode {
  *  - Lists are represented as a singly-linked list of ListNode values,
  *    which are themselves allocated from the memory pool
  *  - Dictionaries are represented as a singly-linked list of DictNode
- *    key-value pairs, which are themselves allocated from the memory pool
+ *    key-value pairs, which are themselves allocated from the memory pool.
+ *    Once a dictionary grows past a few entries, the value of its dummy
+ *    first node refers to a hash table of its entries, which is also
+ *    allocated from the memory pool.
  */
 typedef struct Value {
 
@@ -232,4 +251,47 @@ typedef struct DictValue {
 } DictValue;
 
 
+/*!
+ * A "dictionary table value" type that represents the hash table of a
+ * dictionary.  It is a subtype of Value.  The table is open-addressed with
+ * linear probing, and its capacity is always a power of two.  It refers to
+ * the entries of the dictionary, but they are all reachable from the
+ * dictionary's list of nodes as well, so the collector treats the table as
+ * if it held no References.
+ */
+typedef struct DictTableValue {
+    /* Tag for whether or not node is reachable. 1 if yes, 0 if no.*/
+    int marked;
+
+    /*!
+     * Every Value knows the Reference associated with it, so that we don't
+     * have to search for what reference goes with a particular value in the
+     * reference table.
+     */
+    Reference ref;
+
+    /*! This specifies what kind of value is actually represented. */
+    ValueType type;
+
+    /*!
+     * This is the size of the data in the value.  For fixed-size types, this
+     * is as expected - e.g. floats are 4 bytes, and so forth.  For tables,
+     * this is the size of the counts and the slots.
+     */
+    int data_size;
+
+    /*! The number of slots that hold an entry. */
+    int num_entries;
+
+    /*! The number of slots in the table. */
+    int capacity;
+
+    /*! The last entry in the dictionary, which new entries are linked to. */
+    Reference last;
+
+    /*! The slots of the table. */
+    DictSlot slots[];
+} DictTableValue;
+
+
 #endif /* TYPES_H */
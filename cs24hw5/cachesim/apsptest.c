@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "cmdline.h"
 #include "memory.h"
 #include "cache.h"
+#include "walltime.h"
 
 
 /* This is the number of nodes to have in the graph. */
@@ -25,74 +28,541 @@
 #define SEED 54321098
 
 
+/* This is the default edge-length of the tiles used by the blocked kernel,
+ * and of the base case of the recursive kernel.  16 ints are 64 bytes.
+ */
+#define DEFAULT_TILE_SIZE 16
+
+
+/* The different ways the all-points shortest paths can be computed. */
+typedef enum {
+    /* Textbook Floyd-Warshall:  k, i, j loops over the entire matrix. */
+    KERNEL_NAIVE,
+
+    /* Tiled Floyd-Warshall:  each k-tile updates the diagonal tile, then the
+     * tiles in the same row and column, then all remaining tiles.
+     */
+    KERNEL_BLOCKED,
+
+    /* Cache-oblivious Floyd-Warshall:  the matrix is recursively split into
+     * quadrants until they are no larger than the tile size.
+     */
+    KERNEL_RECURSIVE
+} apsp_kernel;
+
+
 typedef struct {
     int num_nodes;
 
+    /* The simulated memory that holds the matrices, in simulated mode. */
     membase_t *p_mem;
+
+    /* The matrices themselves, in native mode.  These are NULL when the
+     * simulated memory is being used.
+     */
+    int *weights;
+    int *paths;
+
+    /* The edge-length of a tile, for the blocked and recursive kernels. */
+    int tile_size;
+
+    /* The number of threads to use.  Always 1 in simulated mode, since a
+     * simulated memory may only be accessed from one thread.
+     */
+    int num_threads;
+
+    /* The number of recursion levels of the recursive kernel that still
+     * run their independent calls in parallel.
+     */
+    int parallel_depth;
 } shortest_path_info;
 
 
 int get_weight(shortest_path_info *info, int row, int col) {
+    if (info->weights != NULL)
+        return info->weights[row * info->num_nodes + col];
+
     return read_int(info->p_mem, row * info->num_nodes + col);
 }
 
 
 void set_weight(shortest_path_info *info, int row, int col, int weight) {
+    if (info->weights != NULL) {
+        info->weights[row * info->num_nodes + col] = weight;
+        return;
+    }
+
     write_int(info->p_mem, row * info->num_nodes + col, weight);
 }
 
 
 int get_path(shortest_path_info *info, int row, int col) {
     int nodes = info->num_nodes;
+
+    if (info->paths != NULL)
+        return info->paths[row * nodes + col];
+
     return read_int(info->p_mem, nodes * nodes + row * nodes + col);
 }
 
 
 void set_path(shortest_path_info *info, int row, int col, int node) {
     int nodes = info->num_nodes;
+
+    if (info->paths != NULL) {
+        info->paths[row * nodes + col] = node;
+        return;
+    }
+
     write_int(info->p_mem, nodes * nodes + row * nodes + col, node);
 }
 
 
-void compute_shortest_paths(shortest_path_info *info) {
-    int nodes = info->num_nodes;
+/*---------------------------------------------------------------------------
+ * PARALLEL HELPERS
+ */
+
+
+/* The state shared by the threads of a parallel_for() call. */
+typedef struct {
+    shortest_path_info *info;
+    void (*body)(shortest_path_info *info, int item, void *arg);
+    void *arg;
+    int num_items;
+    int next_item;
+} parallel_for_state;
+
+
+void * parallel_for_worker(void *p) {
+    parallel_for_state *state = (parallel_for_state *) p;
+    int item;
+
+    while ((item = __sync_fetch_and_add(&state->next_item, 1)) <
+           state->num_items) {
+        state->body(state->info, item, state->arg);
+    }
+
+    return NULL;
+}
+
+
+/* Calls body(info, item, arg) for every item from 0 to num_items - 1, spread
+ * across info->num_threads threads, and returns once all items are done.  The
+ * items must be independent of each other.
+ */
+void parallel_for(shortest_path_info *info, int num_items,
+                  void (*body)(shortest_path_info *info, int item, void *arg),
+                  void *arg) {
+    parallel_for_state state;
+    pthread_t *threads;
+    int num_threads, i;
+
+    num_threads = info->num_threads;
+    if (num_threads > num_items)
+        num_threads = num_items;
+
+    if (num_threads <= 1) {
+        for (i = 0; i < num_items; i++)
+            body(info, i, arg);
+        return;
+    }
+
+    state.info = info;
+    state.body = body;
+    state.arg = arg;
+    state.num_items = num_items;
+    state.next_item = 0;
+
+    /* The calling thread works on items too. */
+    threads = malloc((num_threads - 1) * sizeof(pthread_t));
+    for (i = 0; i < num_threads - 1; i++)
+        pthread_create(threads + i, NULL, parallel_for_worker, &state);
+    parallel_for_worker(&state);
+    for (i = 0; i < num_threads - 1; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+
+/*---------------------------------------------------------------------------
+ * KERNELS
+ */
+
+
+/* This is the inner loop of every kernel:  every path from a node in
+ * [i_start, i_end) to a node in [j_start, j_end) is relaxed through every
+ * node in [k_start, k_end), in increasing order of k.  The loop body is
+ * identical to the textbook algorithm, so that the kernels only differ in
+ * the order that they visit the matrix.
+ */
+void relax_block(shortest_path_info *info, int i_start, int i_end,
+                 int j_start, int j_end, int k_start, int k_end) {
     int i, j, k;
 
+    for (k = k_start; k < k_end; k++) {
+        for (i = i_start; i < i_end; i++) {
+            for (j = j_start; j < j_end; j++) {
+                int weight_ikj = get_weight(info, i, k) + get_weight(info, k, j);
+                int weight_ij = get_weight(info, i, j);
+
+                if (weight_ikj < weight_ij) {
+                    set_weight(info, i, j, weight_ikj);
+                    set_path(info, i, j, k);
+                }
+            }
+        }
+    }
+}
+
+
+/* Relaxes one band of rows of the naive kernel through node *(int *) arg.
+ * Row k and column k can't change while relaxing through k, so the bands
+ * are independent.
+ */
+void naive_rows(shortest_path_info *info, int item, void *arg) {
+    int k = *(int *) arg;
+    int nodes = info->num_nodes;
+    int rows = (nodes + info->num_threads - 1) / info->num_threads;
+    int i_start = item * rows;
+    int i_end = i_start + rows < nodes ? i_start + rows : nodes;
+
+    relax_block(info, i_start, i_end, 0, nodes, k, k + 1);
+}
+
+
+void compute_naive(shortest_path_info *info) {
+    int nodes = info->num_nodes;
+    int k;
+
+    for (k = 0; k < nodes; k++) {
+        parallel_for(info, info->num_threads, naive_rows, &k);
+        if (info->p_mem != NULL) {
+            printf(".");
+            fflush(stdout);
+        }
+    }
+    if (info->p_mem != NULL)
+        printf("\n");
+}
+
+
+/* Relaxes tile (ib, jb) through the nodes of tile kb. */
+void relax_tile(shortest_path_info *info, int ib, int jb, int kb) {
+    int nodes = info->num_nodes;
+    int tile = info->tile_size;
+
+#define TILE_END(b) ((b) * tile + tile < nodes ? (b) * tile + tile : nodes)
+
+    relax_block(info, ib * tile, TILE_END(ib), jb * tile, TILE_END(jb),
+                kb * tile, TILE_END(kb));
+
+#undef TILE_END
+}
+
+
+/* Phase 2 of the blocked kernel:  the tiles in row kb and column kb.  Items
+ * below num_tiles are row tiles; the rest are column tiles.
+ */
+void blocked_cross(shortest_path_info *info, int item, void *arg) {
+    int kb = *(int *) arg;
+    int num_tiles = (info->num_nodes + info->tile_size - 1) / info->tile_size;
+    int b = item % num_tiles;
+
+    if (b == kb)
+        return;
+
+    if (item < num_tiles)
+        relax_tile(info, kb, b, kb);
+    else
+        relax_tile(info, b, kb, kb);
+}
+
+
+/* Phase 3 of the blocked kernel:  every tile outside row and column kb. */
+void blocked_rest(shortest_path_info *info, int item, void *arg) {
+    int kb = *(int *) arg;
+    int num_tiles = (info->num_nodes + info->tile_size - 1) / info->tile_size;
+    int ib = item / num_tiles;
+    int jb = item % num_tiles;
+
+    if (ib == kb || jb == kb)
+        return;
+
+    relax_tile(info, ib, jb, kb);
+}
+
+
+void compute_blocked(shortest_path_info *info) {
+    int num_tiles = (info->num_nodes + info->tile_size - 1) / info->tile_size;
+    int kb;
+
+    for (kb = 0; kb < num_tiles; kb++) {
+        relax_tile(info, kb, kb, kb);
+        parallel_for(info, 2 * num_tiles, blocked_cross, &kb);
+        parallel_for(info, num_tiles * num_tiles, blocked_rest, &kb);
+    }
+}
+
+
+/* The arguments of one call to recursive_fw(), so that independent calls can
+ * be handed to parallel_for().
+ */
+typedef struct {
+    int i_start, i_end;
+    int j_start, j_end;
+    int k_start, k_end;
+    int depth;
+} fw_range;
+
+
+void recursive_fw(shortest_path_info *info, fw_range r);
+
+
+void recursive_pair(shortest_path_info *info, int item, void *arg) {
+    recursive_fw(info, ((fw_range *) arg)[item]);
+}
+
+
+/* Runs two independent recursive calls, in parallel if we are still near
+ * enough to the top of the recursion.
+ */
+void recursive_both(shortest_path_info *info, fw_range a, fw_range b) {
+    fw_range both[2] = { a, b };
+
+    if (a.depth <= info->parallel_depth) {
+        parallel_for(info, 2, recursive_pair, both);
+    }
+    else {
+        recursive_fw(info, a);
+        recursive_fw(info, b);
+    }
+}
+
+
+/* The cache-oblivious kernel.  Writing A for the (i, j) quadrant of the
+ * range, B for (i, k) and C for (k, j), this computes A = min(A, B + C),
+ * splitting each range in half until all of them fit in a tile.  The order of
+ * the eight sub-calls keeps the result correct when A, B and C overlap.
+ */
+void recursive_fw(shortest_path_info *info, fw_range r) {
+    int i_mid, j_mid, k_mid;
+    fw_range r11, r12, r21, r22;
+
+    if (r.i_start >= r.i_end || r.j_start >= r.j_end || r.k_start >= r.k_end)
+        return;
+
+    if (r.i_end - r.i_start <= info->tile_size &&
+        r.j_end - r.j_start <= info->tile_size &&
+        r.k_end - r.k_start <= info->tile_size) {
+        relax_block(info, r.i_start, r.i_end, r.j_start, r.j_end,
+                    r.k_start, r.k_end);
+        return;
+    }
+
+    i_mid = r.i_start + (r.i_end - r.i_start + 1) / 2;
+    j_mid = r.j_start + (r.j_end - r.j_start + 1) / 2;
+    k_mid = r.k_start + (r.k_end - r.k_start + 1) / 2;
+
+    r11 = r12 = r21 = r22 = r;
+    r11.depth = r12.depth = r21.depth = r22.depth = r.depth + 1;
+    r11.i_end = r12.i_end = i_mid;
+    r21.i_start = r22.i_start = i_mid;
+    r11.j_end = r21.j_end = j_mid;
+    r12.j_start = r22.j_start = j_mid;
+
+    /* The first half of k... */
+    r11.k_end = r12.k_end = r21.k_end = r22.k_end = k_mid;
+    recursive_fw(info, r11);
+    recursive_both(info, r12, r21);
+    recursive_fw(info, r22);
+
+    /* ...then the second half, in the reverse order. */
+    r11.k_start = r12.k_start = r21.k_start = r22.k_start = k_mid;
+    r11.k_end = r12.k_end = r21.k_end = r22.k_end = r.k_end;
+    recursive_fw(info, r22);
+    recursive_both(info, r21, r12);
+    recursive_fw(info, r11);
+}
+
+
+void compute_recursive(shortest_path_info *info) {
+    fw_range r;
+    int threads;
+
+    r.i_start = r.j_start = r.k_start = 0;
+    r.i_end = r.j_end = r.k_end = info->num_nodes;
+    r.depth = 0;
+
+    /* Each parallel level doubles the number of threads in use. */
+    info->parallel_depth = -1;
+    for (threads = 1; threads < info->num_threads; threads *= 2)
+        info->parallel_depth++;
+
+    recursive_fw(info, r);
+}
+
+
+void compute_shortest_paths(shortest_path_info *info, apsp_kernel kernel) {
+    int nodes = info->num_nodes;
+    int i, j;
+
     printf(" * Clearing the path-reconstruction state.\n");
     for (i = 0; i < nodes; i++)
         for (j = 0; j < nodes; j++)
             set_path(info, i, j, -1);
 
     printf(" * Computing the all-points shortest path results.\n");
-    for (k = 0; k < nodes; k++) {
-        for (i = 0; i < nodes; i++) {
-            for (j = 0; j < nodes; j++) {
-                int weight_ikj = get_weight(info, i, k) + get_weight(info, k, j);
-                int weight_ij = get_weight(info, i, j);
+    switch (kernel) {
+    case KERNEL_NAIVE:
+        compute_naive(info);
+        break;
+
+    case KERNEL_BLOCKED:
+        compute_blocked(info);
+        break;
+
+    case KERNEL_RECURSIVE:
+        compute_recursive(info);
+        break;
+    }
+}
 
-                if (weight_ikj < weight_ij) {
-                    set_weight(info, i, j, weight_ikj);
-                    set_path(info, i, j, k);
+
+/* Computes the shortest paths with the naive kernel directly against native
+ * memory, and checks the weights that info ended up with against them.  The
+ * paths aren't compared, since different kernels may break ties differently.
+ * Returns the number of mismatches.
+ */
+int verify_weights(shortest_path_info *info, const int *graph) {
+    shortest_path_info ref;
+    int nodes = info->num_nodes;
+    int i, j, errors;
+
+    bzero(&ref, sizeof(ref));
+    ref.num_nodes = nodes;
+    ref.num_threads = 1;
+    ref.weights = malloc(nodes * nodes * sizeof(int));
+    ref.paths = malloc(nodes * nodes * sizeof(int));
+    memcpy(ref.weights, graph, nodes * nodes * sizeof(int));
+
+    relax_block(&ref, 0, nodes, 0, nodes, 0, nodes);
+
+    errors = 0;
+    for (i = 0; i < nodes; i++) {
+        for (j = 0; j < nodes; j++) {
+            int expected = ref.weights[i * nodes + j];
+            int actual = get_weight(info, i, j);
+            if (actual != expected) {
+                if (errors < 10) {
+                    printf("ERROR:  weight[%d][%d] = %d, expected %d\n",
+                           i, j, actual, expected);
                 }
+                errors++;
             }
         }
-        printf(".");
-        fflush(stdout);
     }
-    printf("\n");
+
+    free(ref.weights);
+    free(ref.paths);
+
+    return errors;
 }
 
 
+/* Prints the options specific to this program, then the cache options. */
+void apsp_usage(const char *progname) {
+    printf("usage: %s [-k naive|blocked|recursive] [-b tile] [-n [-j threads]]\n"
+           "       [cache-options ...]\n\n", progname);
+    printf("\t-k selects the kernel used to compute the shortest paths; the\n");
+    printf("\t   default is naive.\n");
+    printf("\t-b sets the tile edge-length of the blocked and recursive\n");
+    printf("\t   kernels; the default is %d.\n", DEFAULT_TILE_SIZE);
+    printf("\t-n runs the kernel against native memory instead of the\n");
+    printf("\t   simulator, and reports the wall-clock time.  -j sets the\n");
+    printf("\t   number of threads to use in native mode; the default is 1.\n");
+    printf("\n");
+    usage(progname);
+}
+
 
 int main(int argc, const char **argv) {
-    membase_t *p_mem;
+    membase_t *p_mem = NULL;
+    mem_hierarchy_t *p_hier = NULL;
 
     shortest_path_info info;
-    int i, j;
+    apsp_kernel kernel = KERNEL_NAIVE;
+    int native = 0, num_threads = 1, tile_size = DEFAULT_TILE_SIZE;
+    const char *kernel_name = "naive";
+    int *graph;
+    int i, j, arg;
+    double start, seconds;
+
+    /* Consume our own options; the rest are handed to make_cached_memory. */
+    for (arg = 1; arg < argc; arg++) {
+        if ((strcmp(argv[arg], "-k") == 0 || strcmp(argv[arg], "-b") == 0 ||
+             strcmp(argv[arg], "-j") == 0) && arg + 1 == argc) {
+            printf("ERROR:  %s requires a value.\n", argv[arg]);
+            apsp_usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[arg], "-k") == 0) {
+            kernel_name = argv[++arg];
+            if (strcmp(kernel_name, "naive") == 0)
+                kernel = KERNEL_NAIVE;
+            else if (strcmp(kernel_name, "blocked") == 0)
+                kernel = KERNEL_BLOCKED;
+            else if (strcmp(kernel_name, "recursive") == 0)
+                kernel = KERNEL_RECURSIVE;
+            else {
+                printf("ERROR:  unknown kernel \"%s\".\n", kernel_name);
+                apsp_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-b") == 0) {
+            tile_size = atoi(argv[++arg]);
+            if (tile_size <= 0) {
+                printf("ERROR:  tile size must be positive.\n");
+                apsp_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-j") == 0) {
+            num_threads = atoi(argv[++arg]);
+            if (num_threads <= 0) {
+                printf("ERROR:  number of threads must be positive.\n");
+                apsp_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-n") == 0) {
+            native = 1;
+        }
+        else {
+            break;
+        }
+    }
 
-    /* Set up the simulated memory. */
-    p_mem = make_cached_memory(argc, argv,
-                               2 * NUM_NODES * NUM_NODES * sizeof(int));
+    bzero(&info, sizeof(info));
+    info.num_nodes = NUM_NODES;
+    info.tile_size = tile_size;
+    info.num_threads = 1;
+
+    if (native) {
+        printf("Using native memory with %d threads.\n\n", num_threads);
+        info.weights = malloc(NUM_NODES * NUM_NODES * sizeof(int));
+        info.paths = malloc(NUM_NODES * NUM_NODES * sizeof(int));
+        info.num_threads = num_threads;
+    }
+    else {
+        /* Set up the simulated memory. */
+        argv[arg - 1] = argv[0];
+        p_hier = make_cached_memory(argc - arg + 1, argv + arg - 1,
+                                    2 * NUM_NODES * NUM_NODES * sizeof(int));
+        p_mem = p_hier->top;
+        info.p_mem = p_mem;
+    }
 
     /* Generate a random graph. */
 
@@ -100,34 +570,62 @@ int main(int argc, const char **argv) {
 
     srand(SEED);
 
-    info.num_nodes = NUM_NODES;
-    info.p_mem = p_mem;
-
+    graph = malloc(NUM_NODES * NUM_NODES * sizeof(int));
     for (i = 0; i < info.num_nodes; i++) {
         for (j = 0; j < info.num_nodes; j++) {
             if (i != j) {
                 if (rand() % 100 < CONNECTED_PCT)
-                    set_weight(&info, i, j, 1 + rand() % 10);
+                    graph[i * NUM_NODES + j] = 1 + rand() % 10;
                 else
-                    set_weight(&info, i, j, INFINITY);
+                    graph[i * NUM_NODES + j] = INFINITY;
             }
             else {
-                set_weight(&info, i, j, 0);
+                graph[i * NUM_NODES + j] = 0;
             }
         }
     }
 
+    for (i = 0; i < info.num_nodes; i++)
+        for (j = 0; j < info.num_nodes; j++)
+            set_weight(&info, i, j, graph[i * NUM_NODES + j]);
+
     /* Compute the all-points shortest path of the graph. */
 
-    printf("Computing the all-points-shortest-paths of the graph.\n");
-    compute_shortest_paths(&info);
+    printf("Computing the all-points-shortest-paths of the graph using the "
+           "%s kernel.\n", kernel_name);
+    start = get_seconds();
+    compute_shortest_paths(&info, kernel);
+    seconds = get_seconds() - start;
 
     /* Print out the results of the all-points-shortest-paths computation. */
 
-    printf("\nMemory-Access Statistics:\n\n");
-    p_mem->print_stats(p_mem);
-    printf("\n");
+    if (native) {
+        printf("\nWall-clock time:  %.3f seconds\n\n", seconds);
+    }
+    else {
+        printf("\nMemory-Access Statistics:\n\n");
+        p_mem->print_stats(p_mem);
+        printf("\n");
+    }
+
+    /* Check the results.  This happens after the statistics are printed,
+     * since reading the results back perturbs the simulated caches.
+     */
+
+    printf("Checking the results against the naive kernel.\n");
+    if (verify_weights(&info, graph) != 0) {
+        printf("Some weights didn't match, aborting.\n");
+        abort();
+    }
+
+    free(graph);
+    if (native) {
+        free(info.weights);
+        free(info.paths);
+    }
+    else {
+        free_hierarchy(p_hier);
+    }
 
     return 0;
 }
-
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cmdline.h"
+#include "memory.h"
+#include "cache.h"
+#include "trace.h"
+#include "walltime.h"
+
+
+/* The largest number of cache levels a single configuration may have. */
+#define MAX_LEVELS 4
+
+/* The largest number of configurations a single sweep may expand to. */
+#define MAX_CONFIGS 4096
+
+
+/* One configuration of the sweep, along with the results of simulating the
+ * trace against it.
+ */
+typedef struct sweep_config_t {
+    /* The caches of the configuration, from the top down. */
+    int num_specs;
+    cache_spec_t specs[MAX_LEVELS];
+
+    /* The hit and miss counts of each cache level. */
+    uint64_t hits[MAX_LEVELS];
+    uint64_t misses[MAX_LEVELS];
+
+    /* The access counts against the memory itself. */
+    uint64_t mem_reads;
+    uint64_t mem_writes;
+
+    /* How long the simulation took, in seconds. */
+    double seconds;
+} sweep_config_t;
+
+
+/* The state shared by all worker threads.  Everything except next_config is
+ * read-only while the workers run; each configuration's results are only
+ * written by the worker that claimed it.
+ */
+typedef struct sweep_t {
+    const trace_file_t *p_trace;
+
+    sweep_config_t *configs;
+    int num_configs;
+
+    /* The index of the next configuration to be claimed by a worker. */
+    int next_config;
+} sweep_t;
+
+
+/* Prints the program usage. */
+void sweep_usage(const char *progname) {
+    printf("usage: %s [-j threads] tracefile config ...\n\n", progname);
+    printf("\tReplays a trace recorded with the -t option of heaptest, apsptest\n");
+    printf("\tor qsorttest against every specified cache configuration, and\n");
+    printf("\tprints a table of the results.\n\n");
+    printf("\tEach config is a comma-separated list of cache specifications in\n");
+    printf("\tthe form B:S:E, from the cache closest to the program to the cache\n");
+    printf("\tclosest to the memory.  Any of B, S or E may also be a range lo-hi,\n");
+    printf("\twhich is expanded to lo, 2*lo, 4*lo, ... up to hi.  For example,\n");
+    printf("\t32-128:256:1-4 expands to nine single-level configurations.\n\n");
+    printf("\tThe configurations are simulated in parallel on the specified\n");
+    printf("\tnumber of threads, which defaults to the number of processors.\n");
+}
+
+
+/* Parses a field of a cache specification, which may be a single value or a
+ * range lo-hi.  Returns nonzero on success.
+ */
+int parse_field(const char *field, int *p_lo, int *p_hi) {
+    char extra;
+
+    if (sscanf(field, "%d-%d%c", p_lo, p_hi, &extra) == 2)
+        return *p_lo > 0 && *p_lo <= *p_hi;
+
+    if (sscanf(field, "%d%c", p_lo, &extra) == 1) {
+        *p_hi = *p_lo;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* Expands a config argument into every configuration it describes, appending
+ * them to the sweep's array of configurations.  Returns nonzero on success;
+ * on failure, an error message is printed.
+ */
+int expand_config(sweep_t *p_sweep, const char *arg, int argno) {
+    int lo[3 * MAX_LEVELS], hi[3 * MAX_LEVELS], cur[3 * MAX_LEVELS];
+    int num_fields, num_specs, i;
+    char *copy, *level, *field, *save_level, *save_field;
+
+    /* Split the argument into levels, and each level into its fields. */
+    copy = strdup(arg);
+    num_fields = 0;
+    for (level = strtok_r(copy, ",", &save_level); level != NULL;
+         level = strtok_r(NULL, ",", &save_level)) {
+        if (num_fields == 3 * MAX_LEVELS) {
+            printf("ERROR:  argument %d:  at most %d cache levels are "
+                   "supported.\n", argno, MAX_LEVELS);
+            free(copy);
+            return 0;
+        }
+
+        for (i = 0, field = strtok_r(level, ":", &save_field); field != NULL;
+             i++, field = strtok_r(NULL, ":", &save_field)) {
+            if (i == 3 || !parse_field(field, lo + num_fields, hi + num_fields))
+                break;
+            num_fields++;
+        }
+
+        if (i != 3 || field != NULL) {
+            printf("ERROR:  argument %d isn't correctly formatted.\n", argno);
+            free(copy);
+            return 0;
+        }
+    }
+    free(copy);
+
+    num_specs = num_fields / 3;
+    if (num_specs == 0) {
+        printf("ERROR:  argument %d doesn't specify any caches.\n", argno);
+        return 0;
+    }
+
+    /* Step through the cross-product of all the ranges, odometer-style. */
+    memcpy(cur, lo, sizeof(cur));
+    while (1) {
+        sweep_config_t *p_config;
+
+        if (p_sweep->num_configs == MAX_CONFIGS) {
+            printf("ERROR:  the sweep is limited to %d configurations.\n",
+                   MAX_CONFIGS);
+            return 0;
+        }
+
+        p_config = p_sweep->configs + p_sweep->num_configs;
+        bzero(p_config, sizeof(sweep_config_t));
+        p_config->num_specs = num_specs;
+        for (i = 0; i < num_specs; i++) {
+            p_config->specs[i].block_size = cur[3 * i];
+            p_config->specs[i].num_sets = cur[3 * i + 1];
+            p_config->specs[i].lines_per_set = cur[3 * i + 2];
+
+            if (!check_cache_spec(p_config->specs + i, argno))
+                return 0;
+        }
+        p_sweep->num_configs++;
+
+        for (i = num_fields - 1; i >= 0; i--) {
+            if (cur[i] * 2 <= hi[i]) {
+                cur[i] *= 2;
+                break;
+            }
+            cur[i] = lo[i];
+        }
+
+        if (i < 0)
+            break;
+    }
+
+    return 1;
+}
+
+
+/* Builds the hierarchy for a configuration, replays the trace against it,
+ * records the results, and then releases the hierarchy again.
+ */
+void simulate_config(const trace_file_t *p_trace, sweep_config_t *p_config) {
+    mem_hierarchy_t *p_hier;
+    memory_t *p_memory;
+    double start;
+    int i;
+
+    p_hier = build_hierarchy(p_config->specs, p_config->num_specs,
+                             p_trace->mem_size);
+
+    start = get_seconds();
+    replay_trace(p_trace, p_hier->top);
+    p_config->seconds = get_seconds() - start;
+
+    for (i = 0; i < p_config->num_specs; i++) {
+        cache_t *p_cache = (cache_t *) p_hier->levels[i];
+        p_config->hits[i] = p_cache->num_hits;
+        p_config->misses[i] = p_cache->num_misses;
+    }
+
+    p_memory = (memory_t *) p_hier->levels[p_config->num_specs];
+    p_config->mem_reads = p_memory->num_reads;
+    p_config->mem_writes = p_memory->num_writes;
+
+    free_hierarchy(p_hier);
+}
+
+
+/* The body of each worker thread.  Workers repeatedly claim the next
+ * unsimulated configuration until there are none left.
+ */
+void * sweep_worker(void *arg) {
+    sweep_t *p_sweep = (sweep_t *) arg;
+    int i;
+
+    while ((i = __sync_fetch_and_add(&p_sweep->next_config, 1)) <
+           p_sweep->num_configs) {
+        simulate_config(p_sweep->p_trace, p_sweep->configs + i);
+    }
+
+    return NULL;
+}
+
+
+/* Prints a single table with one row for each configuration of the sweep,
+ * in the order the configurations were specified.
+ */
+void print_results(sweep_t *p_sweep) {
+    char buf[32 * MAX_LEVELS];
+    int i, j, len;
+
+    printf("%-40s %12s %-32s %12s %12s %9s\n", "configuration", "cache bytes",
+           "miss-rates", "mem reads", "mem writes", "seconds");
+
+    for (i = 0; i < p_sweep->num_configs; i++) {
+        sweep_config_t *p_config = p_sweep->configs + i;
+        long total_bytes = 0;
+
+        len = 0;
+        for (j = 0; j < p_config->num_specs; j++) {
+            cache_spec_t *p_spec = p_config->specs + j;
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%d:%d:%d",
+                            (j > 0 ? "," : ""), p_spec->block_size,
+                            p_spec->num_sets, p_spec->lines_per_set);
+            total_bytes += (long) p_spec->block_size * p_spec->num_sets *
+                           p_spec->lines_per_set;
+        }
+        printf("%-40s %12ld ", buf, total_bytes);
+
+        len = 0;
+        for (j = 0; j < p_config->num_specs; j++) {
+            uint64_t accesses = p_config->hits[j] + p_config->misses[j];
+            double miss_rate = accesses == 0 ? 0.0 :
+                100.0 * p_config->misses[j] / accesses;
+            len += snprintf(buf + len, sizeof(buf) - len, "%sL%d=%.2f%%",
+                            (j > 0 ? " " : ""), j + 1, miss_rate);
+        }
+        printf("%-32s %12ld %12ld %9.2f\n", buf, p_config->mem_reads,
+               p_config->mem_writes, p_config->seconds);
+    }
+}
+
+
+int main(int argc, const char **argv) {
+    const char *progname = argv[0];
+    trace_file_t trace;
+    sweep_t sweep;
+    pthread_t *threads;
+    int num_threads, i;
+
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    argc--;
+    argv++;
+
+    if (argc >= 2 && strcmp(argv[0], "-j") == 0) {
+        num_threads = atoi(argv[1]);
+        if (num_threads <= 0) {
+            printf("ERROR:  number of threads must be positive, got %s.\n",
+                   argv[1]);
+            sweep_usage(progname);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 2) {
+        sweep_usage(progname);
+        return 1;
+    }
+
+    bzero(&sweep, sizeof(sweep));
+    sweep.configs = malloc(MAX_CONFIGS * sizeof(sweep_config_t));
+    for (i = 1; i < argc; i++) {
+        if (!expand_config(&sweep, argv[i], i)) {
+            sweep_usage(progname);
+            return 1;
+        }
+    }
+
+    if (!open_trace(argv[0], &trace))
+        return 1;
+    sweep.p_trace = &trace;
+
+    if (num_threads > sweep.num_configs)
+        num_threads = sweep.num_configs;
+
+    printf("Simulating %ld trace entries against %d configurations on %d "
+           "threads.\n\n", trace.num_entries, sweep.num_configs, num_threads);
+
+    threads = malloc(num_threads * sizeof(pthread_t));
+    for (i = 0; i < num_threads; i++)
+        pthread_create(threads + i, NULL, sweep_worker, &sweep);
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    print_results(&sweep);
+
+    free(threads);
+    free(sweep.configs);
+    close_trace(&trace);
+
+    return 0;
+}
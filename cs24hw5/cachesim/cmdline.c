@@ -1,14 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cmdline.h"
 #include "memory.h"
 #include "cache.h"
+#include "trace.h"
 
 
 /* Prints the program usage. */
 void usage(const char *progname) {
-    printf("usage: %s [cache-spec ...]\n\n", progname);
+    printf("usage: %s [-t tracefile] [cache-spec ...]\n\n", progname);
     printf("\tAll arguments are cache specifications in the form B:S:E, where\n");
     printf("\tB, S and E are all positive integers with the following meanings:\n");
     printf("\t\tB = block size for the cache, in bytes (must be a power of 2)\n");
@@ -17,81 +19,173 @@ void usage(const char *progname) {
     printf("\n");
     printf("\tThe actual memory size will be fixed by the program itself, as it\n");
     printf("\tdepends on the specific tests being run against the cache simulator.\n");
+    printf("\n");
+    printf("\tIf -t is specified, every access the program makes is recorded\n");
+    printf("\tinto tracefile, so that it can be replayed by cachesweep.\n");
 }
 
 
-/* Initializes a set of caches and a memory, using the cache configuration
- * specified from command-line arguments.
- *
- * TODO:  This function doesn't provide any way to clean up the allocated
- *        memory!  Return a pointer to a struct that referenes everything
- *        else, so it can all be deallocated!
+/* Checks that a cache specification is valid.  If it isn't, an error message
+ * is printed and 0 is returned; otherwise, nonzero is returned.  The argno is
+ * only used for the error message.
  */
-membase_t * make_cached_memory(int argc, const char **argv,
-                               uint32_t mem_size) {
-    int i;
-    const char *progname;
-    membase_t **p_mems;
+int check_cache_spec(const cache_spec_t *p_spec, int argno) {
+    if (p_spec->block_size <= 0 || !is_power_of_2(p_spec->block_size)) {
+        printf("ERROR:  argument %d:  block size must be a positive "
+               "power of 2, got %d.\n", argno, p_spec->block_size);
+        return 0;
+    }
+
+    if (p_spec->num_sets <= 0 || !is_power_of_2(p_spec->num_sets)) {
+        printf("ERROR:  argument %d:  number of cache-sets must be a "
+               "positive power of 2, got %d.\n", argno, p_spec->num_sets);
+        return 0;
+    }
+
+    if (p_spec->lines_per_set <= 0) {
+        printf("ERROR:  argument %d:  number of cache-lines per set "
+               "must be a positive integer, got %d.\n", argno,
+               p_spec->lines_per_set);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* Parses a cache specification of the form B:S:E, and checks that it is
+ * valid.  If it isn't, an error message is printed and 0 is returned;
+ * otherwise, nonzero is returned.
+ */
+int parse_cache_spec(const char *arg, int argno, cache_spec_t *p_spec) {
+    int ct = sscanf(arg, "%d:%d:%d", &p_spec->block_size,
+                    &p_spec->num_sets, &p_spec->lines_per_set);
+    if (ct != 3) {
+        printf("ERROR:  argument %d isn't correctly formatted.\n", argno);
+        return 0;
+    }
+
+    return check_cache_spec(p_spec, argno);
+}
+
+
+/* Builds a memory of the specified size, with a sequence of caches in front
+ * of it.  specs[0] is the cache closest to the program, and
+ * specs[num_specs - 1] is the cache closest to the memory.  Nothing is
+ * printed, so this may be called from multiple threads at once.
+ */
+mem_hierarchy_t * build_hierarchy(const cache_spec_t *specs, int num_specs,
+                                  uint32_t mem_size) {
+    mem_hierarchy_t *p_hier;
     memory_t *p_memory;
     cache_t *p_cache;
-    
+    int i;
+
+    p_hier = malloc(sizeof(mem_hierarchy_t));
+    p_hier->num_levels = num_specs + 1;
+    p_hier->levels = malloc(p_hier->num_levels * sizeof(membase_t *));
+
+    /* Build from the bottom up, since each cache needs its next level. */
+    p_memory = malloc(sizeof(memory_t));
+    init_memory(p_memory, mem_size);
+    p_hier->levels[num_specs] = (membase_t *) p_memory;
+
+    for (i = num_specs - 1; i >= 0; i--) {
+        p_cache = malloc(sizeof(cache_t));
+        init_cache(p_cache, specs[i].block_size, specs[i].num_sets,
+                   specs[i].lines_per_set, p_hier->levels[i + 1]);
+        p_hier->levels[i] = (membase_t *) p_cache;
+    }
+
+    p_hier->top = p_hier->levels[0];
+    return p_hier;
+}
+
+
+/* Releases every level of a memory hierarchy, and the hierarchy itself.
+ * Modified data in the caches is not flushed to the memory.
+ */
+void free_hierarchy(mem_hierarchy_t *p_hier) {
+    int i;
+
+    for (i = 0; i < p_hier->num_levels; i++) {
+        membase_t *mb = p_hier->levels[i];
+        mb->free(mb);
+        free(mb);
+    }
+
+    free(p_hier->levels);
+    free(p_hier);
+}
+
+
+/* Initializes a set of caches and a memory, using the cache configuration
+ * specified from command-line arguments.  If a trace file is specified, a
+ * trace level is placed on top of the caches.  The result should be released
+ * with free_hierarchy() so that the trace file is completed.
+ */
+mem_hierarchy_t * make_cached_memory(int argc, const char **argv,
+                                     uint32_t mem_size) {
+    int i;
+    const char *progname, *tracefile = NULL;
+    cache_spec_t *specs;
+    mem_hierarchy_t *p_hier;
+    trace_t *p_trace;
+
     progname = argv[0];
     argc--;
     argv++;
-    
-    p_mems = malloc((argc + 1) * sizeof(membase_t *));
 
-    printf("Constructing memory for simulation (in reverse order):\n");
-    
-    printf(" * Building memory of size %u bytes\n", mem_size);
-    p_memory = malloc(sizeof(memory_t));
-    init_memory(p_memory, mem_size);
-    p_mems[argc] = (membase_t *) p_memory;
-    
-    for (i = argc - 1; i >= 0; i--) {
-        int block_size, num_sets, lines_per_set;
-        int ct = sscanf(argv[i], "%d:%d:%d",
-                        &block_size, &num_sets, &lines_per_set);
-        if (ct != 3) {
-            printf("ERROR:  argument %d isn't correctly formatted.\n", i + 1);
-            usage(progname);
-            exit(1);
-        }
-        
-        if (block_size <= 0 || !is_power_of_2(block_size)) {
-            printf("ERROR:  argument %d:  block size must be a positive "
-                   "power of 2, got %d.\n", i + 1, block_size);
+    if (argc >= 1 && strcmp(argv[0], "-t") == 0) {
+        if (argc < 2) {
+            printf("ERROR:  -t requires a trace filename.\n");
             usage(progname);
             exit(1);
         }
+        tracefile = argv[1];
+        argc -= 2;
+        argv += 2;
+    }
 
-        if (num_sets <= 0 || !is_power_of_2(num_sets)) {
-            printf("ERROR:  argument %d:  number of cache-sets must be a "
-                   "positive power of 2, got %d.\n", i + 1, num_sets);
-            usage(progname);
-            exit(1);
-        }
+    specs = malloc((argc + 1) * sizeof(cache_spec_t));
 
-        if (lines_per_set <= 0) {
-            printf("ERROR:  argument %d:  number of cache-lines per set "
-                   "must be a positive integer, got %d.\n", i + 1,
-                   lines_per_set);
+    for (i = 0; i < argc; i++) {
+        if (!parse_cache_spec(argv[i], i + 1, specs + i)) {
             usage(progname);
             exit(1);
         }
+    }
+
+    printf("Constructing memory for simulation (in reverse order):\n");
 
+    printf(" * Building memory of size %u bytes\n", mem_size);
+    for (i = argc - 1; i >= 0; i--) {
         printf(" * Building cache with a block-size of %d bytes, %d cache-sets,\n"
                "   and %d cache-lines per set.  Total cache size is %d bytes.\n",
-               block_size, num_sets, lines_per_set,
-               block_size * num_sets * lines_per_set);
+               specs[i].block_size, specs[i].num_sets, specs[i].lines_per_set,
+               specs[i].block_size * specs[i].num_sets * specs[i].lines_per_set);
+    }
 
-        p_cache = malloc(sizeof(cache_t));
-        init_cache(p_cache, block_size, num_sets, lines_per_set, p_mems[i + 1]);
+    p_hier = build_hierarchy(specs, argc, mem_size);
+    free(specs);
+
+    if (tracefile != NULL) {
+        printf(" * Recording all accesses into trace file %s\n", tracefile);
 
-        p_mems[i] = (membase_t *) p_cache;
+        p_trace = malloc(sizeof(trace_t));
+        if (!init_trace(p_trace, tracefile, mem_size, p_hier->top))
+            exit(1);
+
+        /* Put the trace level in front of all the others. */
+        p_hier->levels = realloc(p_hier->levels,
+                                 (p_hier->num_levels + 1) * sizeof(membase_t *));
+        memmove(p_hier->levels + 1, p_hier->levels,
+                p_hier->num_levels * sizeof(membase_t *));
+        p_hier->levels[0] = (membase_t *) p_trace;
+        p_hier->num_levels++;
+        p_hier->top = p_hier->levels[0];
     }
     printf("\n");
-    
-    return p_mems[0];
-}
 
+    return p_hier;
+}
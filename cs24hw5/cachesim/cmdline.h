@@ -1,5 +1,53 @@
+#ifndef CMDLINE_H
+#define CMDLINE_H
+
+
 #include "membase.h"
 
+
+/* This struct holds the parameters of a single cache level, as specified on
+ * the command-line in the form B:S:E.
+ */
+typedef struct cache_spec_t {
+    /* The block size of the cache, in bytes.  Must be a power of 2. */
+    int block_size;
+
+    /* The number of cache-sets in the cache.  Must be a power of 2. */
+    int num_sets;
+
+    /* The number of cache-lines in each cache-set. */
+    int lines_per_set;
+} cache_spec_t;
+
+
+/* This struct references every level of a simulated memory hierarchy, so
+ * that the entire hierarchy can be released when the program is done with
+ * it.  The levels are stored from the top down; levels[0] is the level that
+ * the program should access, and levels[num_levels - 1] is the memory.
+ */
+typedef struct mem_hierarchy_t {
+    /* The top level of the hierarchy.  This is the same as levels[0]. */
+    membase_t *top;
+
+    /* The number of levels in the hierarchy, including the memory. */
+    int num_levels;
+
+    /* All levels of the hierarchy, from the top down. */
+    membase_t **levels;
+} mem_hierarchy_t;
+
+
 void usage(const char *progname);
-membase_t * make_cached_memory(int argc, const char **argv, uint32_t mem_size);
 
+int check_cache_spec(const cache_spec_t *p_spec, int argno);
+int parse_cache_spec(const char *arg, int argno, cache_spec_t *p_spec);
+
+mem_hierarchy_t * build_hierarchy(const cache_spec_t *specs, int num_specs,
+                                  uint32_t mem_size);
+void free_hierarchy(mem_hierarchy_t *p_hier);
+
+mem_hierarchy_t * make_cached_memory(int argc, const char **argv,
+                                     uint32_t mem_size);
+
+
+#endif /* CMDLINE_H */
@@ -8,33 +8,117 @@
  * heap data structure, but are not visible outside this module.
  */
 
+void init_heap_layout(float_heap *p_heap, int max_values, heap_layout layout);
+
+uint32_t log_floor_2(uint32_t n);
+uint32_t heap_index(float_heap *p_heap, int index);
+float get_value(float_heap *p_heap, int index);
+void set_value(float_heap *p_heap, int index, float value);
+
 void sift_down(float_heap *p_heap, int index);
 void sift_up(float_heap *p_heap, int index);
 void swap_values(float_heap *p_heap, int i, int j);
 
 /*
- * For heaps stored in an array, left child and right child of a particular
- * index are calculated using these functions.  The "index" value is
- * supposed to be an integer.
+ * For heaps stored in an array, the children of a particular index are at
+ * consecutive indexes starting with FIRST_CHILD, and the parent is computed
+ * with PARENT.  The "index" value is supposed to be an integer; these are
+ * logical indexes, which heap_index() maps to a position in memory.
+ */
+#define FIRST_CHILD(p_heap, index) ((p_heap)->arity * (index) + 1)
+#define PARENT(p_heap, index) (((index) - 1) / (p_heap)->arity)
+
+
+/* The height of the subtree stored in each page of a B-heap, and the number
+ * of values in each page.  The first value of each page is unused, so that
+ * the pages are aligned.
  */
-#define  LEFT_CHILD(index) (2 * (index) + 1)
-#define RIGHT_CHILD(index) (2 * (index) + 2)
+#define BHEAP_PAGE_HEIGHT 4
+#define BHEAP_PAGE_SIZE (1 << BHEAP_PAGE_HEIGHT)
+
 
-/* Given an index, the parent index is computed as follows.
- * The "index" value is supposed to be an integer.
+/* Returns the number of floats of memory a heap of the specified layout
+ * needs, in order to hold max_values values.  This is rounded up to a whole
+ * number of 4KB pages, so that a simulated memory of this size can sit
+ * behind caches with any block size up to 4KB.
  */
-#define PARENT(index) (((index) - 1) / 2)
+uint32_t heap_memory_size(int max_values, heap_layout layout) {
+    uint32_t size, depth, row, first;
+
+    switch (layout) {
+    case HEAP_4ARY:
+    case HEAP_8ARY:
+        /* The values are shifted by arity - 1 positions. */
+        size = max_values + (layout == HEAP_4ARY ? 3 : 7);
+        break;
+
+    case HEAP_BHEAP:
+        if (max_values == 0)
+            return 0;
+
+        /* Room for every page up to and including the last row of pages. */
+        depth = log_floor_2(max_values);
+        row = depth / BHEAP_PAGE_HEIGHT;
+        first = 1U << (row * BHEAP_PAGE_HEIGHT);
+        size = ((first - 1) / (BHEAP_PAGE_SIZE - 1) + first) * BHEAP_PAGE_SIZE;
+        break;
+
+    default:
+        size = max_values;
+        break;
+    }
+
+    return (size + 1023) & ~1023U;
+}
+
+
+/* Initialize the members common to simulated and native heaps. */
+void init_heap_layout(float_heap *p_heap, int max_values, heap_layout layout) {
+    p_heap->num_values = 0;
+    p_heap->max_values = max_values;
+
+    p_heap->layout = layout;
+    switch (layout) {
+    case HEAP_4ARY:
+        p_heap->arity = 4;
+        break;
+
+    case HEAP_8ARY:
+        p_heap->arity = 8;
+        break;
 
+    default:
+        p_heap->arity = 2;
+        break;
+    }
+}
 
-/* Initialize a heap data structure. */
-void init_heap(float_heap *p_heap, membase_t *memory, int max_values) {
+
+/* Initialize a heap data structure stored in a simulated memory. */
+void init_heap(float_heap *p_heap, membase_t *memory, int max_values,
+               heap_layout layout) {
     assert(p_heap != NULL);
     assert(memory != NULL);
 
     p_heap->memory = memory;
+    p_heap->values = NULL;
 
-    p_heap->num_values = 0;
-    p_heap->max_values = max_values;
+    init_heap_layout(p_heap, max_values, layout);
+}
+
+
+/* Initialize a heap data structure stored in a native array, which must hold
+ * at least heap_memory_size(max_values, layout) floats.
+ */
+void init_native_heap(float_heap *p_heap, float *values, int max_values,
+                      heap_layout layout) {
+    assert(p_heap != NULL);
+    assert(values != NULL);
+
+    p_heap->memory = NULL;
+    p_heap->values = values;
+
+    init_heap_layout(p_heap, max_values, layout);
 }
 
 
@@ -48,7 +132,7 @@ float get_first_value(float_heap *p_heap) {
     assert(p_heap->num_values > 0);
 
     /* Smallest value is at the root - index 0. */
-    result = read_float(p_heap->memory, 0);
+    result = get_value(p_heap, 0);
 
     /* Decrease the count of how many values are in the heap.  NOTE that if
      * there was more than one value in the heap, the last value is still at
@@ -59,8 +143,8 @@ float get_first_value(float_heap *p_heap) {
     p_heap->num_values--;
     if (p_heap->num_values != 0) {
         /* Move the last value in the heap to the root. */
-        float f = read_float(p_heap->memory, p_heap->num_values);
-        write_float(p_heap->memory, 0, f);
+        float f = get_value(p_heap, p_heap->num_values);
+        set_value(p_heap, 0, f);
 
         /* Sift down the new value to position it properly in the heap. */
         sift_down(p_heap, 0);
@@ -83,7 +167,7 @@ void add_value(float_heap *p_heap, float newval) {
     /* Add the new value to the end of the heap, then sift up. */
 
     index = p_heap->num_values;
-    write_float(p_heap->memory, index, newval);
+    set_value(p_heap, index, newval);
     p_heap->num_values++;
 
     /* If the new value isn't at the root, sift up. */
@@ -97,75 +181,132 @@ void add_value(float_heap *p_heap, float newval) {
 /*==================*/
 
 
+/* For any n > 0, returns floor(log2(n)). */
+uint32_t log_floor_2(uint32_t n) {
+    assert(n > 0);
+    return 31 - __builtin_clz(n);
+}
+
+
+/*
+ * Maps a logical heap index to the position of its value in memory.  For
+ * the binary layout these are the same.  The d-ary layouts shift everything
+ * by d-1, so that the children of index i start at position d*(i+1).
+ *
+ * For the B-heap layout, the tree is cut every BHEAP_PAGE_HEIGHT levels into
+ * subtrees, and each subtree is stored in its own page.  Pages are numbered
+ * level by level, and within a page the values are stored in the usual
+ * binary-heap order, starting at position 1.
+ */
+uint32_t heap_index(float_heap *p_heap, int index) {
+    uint32_t node, depth, row, level, root, first, page, local;
+
+    switch (p_heap->layout) {
+    case HEAP_BHEAP:
+        /* Work in 1-based numbering, where the bits of the node number
+         * below the leading 1 spell out the path from the root.
+         */
+        node = index + 1;
+        depth = log_floor_2(node);
+        row = depth / BHEAP_PAGE_HEIGHT;
+        level = depth % BHEAP_PAGE_HEIGHT;
+
+        /* The root of this node's page, and which page of its row it is. */
+        root = node >> level;
+        first = 1U << (row * BHEAP_PAGE_HEIGHT);
+        page = (first - 1) / (BHEAP_PAGE_SIZE - 1) + (root - first);
+
+        local = (1U << level) | (node & ((1U << level) - 1));
+        return page * BHEAP_PAGE_SIZE + local;
+
+    case HEAP_4ARY:
+    case HEAP_8ARY:
+        return index + p_heap->arity - 1;
+
+    default:
+        return index;
+    }
+}
+
+
+/* Reads the value at a logical index of the heap. */
+float get_value(float_heap *p_heap, int index) {
+    uint32_t pos = heap_index(p_heap, index);
+
+    if (p_heap->values != NULL)
+        return p_heap->values[pos];
+
+    return read_float(p_heap->memory, pos);
+}
+
+
+/* Writes the value at a logical index of the heap. */
+void set_value(float_heap *p_heap, int index, float value) {
+    uint32_t pos = heap_index(p_heap, index);
+
+    if (p_heap->values != NULL)
+        p_heap->values[pos] = value;
+    else
+        write_float(p_heap->memory, pos, value);
+}
+
+
 /*
  * Given a heap and an index, sift_down checks to see if the value at that
  * index needs to be "sifted downward" in the heap, to preserve the heap
  * properties.  Specifically, a value needs to be moved down in the heap if
- * it is greater than either of its children's values.  (This is the "order"
+ * it is greater than any of its children's values.  (This is the "order"
  * property.)  In order to preserve the "shape" property of heaps, the value
- * is swapped with the *smaller* of its two child values.
+ * is swapped with the *smallest* of its child values.
  *
- * If a value only has a left child, then only the left child is examined
- * for the swap.
+ * If a value has fewer children than the arity of the heap, then it is at
+ * the bottom of the heap, so there is no need to sift down again after
+ * swapping.
  *
- * If a value has both left and right children, it is possible that one
- * child may be larger than the value, while the other is smaller than the
- * value.  Since we swap with the smallest child value, we preserve the
- * heap properties even in that situation.
+ * A value may be larger than some children and smaller than others.  Since
+ * we swap with the smallest child value, we preserve the heap properties
+ * even in that situation.  When children are equal, the later one is
+ * chosen, as the original binary-heap code did.
  */
 void sift_down(float_heap *p_heap, int index) {
+    int first_child, end_child, child, swap_child;
+    float index_val, child_val, swap_val;
+
     assert(p_heap != NULL);
     assert(index < p_heap->num_values);
 
-    int left_child = LEFT_CHILD(index);
-    int right_child = RIGHT_CHILD(index);
-    float index_val = read_float(p_heap->memory, index);
+    first_child = FIRST_CHILD(p_heap, index);
+    index_val = get_value(p_heap, index);
 
-    if (left_child >= p_heap->num_values) {
-        /* If the left child's index is past the end of the heap
+    if (first_child >= p_heap->num_values) {
+        /* If the first child's index is past the end of the heap
          * then this value has no children.  We're done.
          */
         return;
     }
 
-    if (right_child >= p_heap->num_values) {
-        /* Only have a left child. */
-
-        if (read_float(p_heap->memory, left_child) < index_val) {
-            /* Left child value is smaller.  Swap this value and the
-             * left child value.
-             */
-            swap_values(p_heap, index, left_child);
-
-            /* Don't need to call sift_down again, because if this
-             * node only has a left child, we are at the bottom of
-             * the heap.
-             */
+    end_child = first_child + p_heap->arity;
+    if (end_child > p_heap->num_values)
+        end_child = p_heap->num_values;
+
+    /* Find the smallest child value. */
+    swap_child = first_child;
+    swap_val = get_value(p_heap, first_child);
+    for (child = first_child + 1; child < end_child; child++) {
+        child_val = get_value(p_heap, child);
+        if (child_val <= swap_val) {
+            swap_child = child;
+            swap_val = child_val;
         }
     }
-    else {
-        /* This value has a left and right child. */
-
-        float left_val = read_float(p_heap->memory, left_child);
-        float right_val = read_float(p_heap->memory, right_child);
-        int swap_child;
-
-        if (left_val < index_val || right_val < index_val) {
-            /* Need to swap this node with one of its children.  Pick
-             * the smaller of the two children, since this is a min-heap
-             * and that will preserve the heap properties.
-             */
-            if (left_val < right_val)
-                swap_child = left_child;
-            else
-                swap_child = right_child;
-
-            /* Do the swap, then call sift_down again, in case we aren't
-             * at the bottom of the heap yet.
-             */
-            swap_values(p_heap, index, swap_child);
+
+    if (swap_val < index_val) {
+        /* Do the swap, then call sift_down again, in case we aren't
+         * at the bottom of the heap yet.
+         */
+        swap_values(p_heap, index, swap_child);
+        if (end_child - first_child == p_heap->arity)
             sift_down(p_heap, swap_child);
-        }
     }
 }
 
@@ -178,7 +319,7 @@ void sift_down(float_heap *p_heap, int index) {
  * is not affected by sifting a value up.)
  */
 void sift_up(float_heap *p_heap, int index) {
-    int parent_index = PARENT(index);
+    int parent_index = PARENT(p_heap, index);
 
     /* If the index to sift up is the root, we are done. */
     if (index == 0)
@@ -190,8 +331,7 @@ void sift_up(float_heap *p_heap, int index) {
     /* If the specified value is smaller than its parent value then
      * we have to swap the value and its parent.
      */
-    if (read_float(p_heap->memory, index) <
-        read_float(p_heap->memory, parent_index)) {
+    if (get_value(p_heap, index) < get_value(p_heap, parent_index)) {
         /* Swap the value with its parent value. */
         swap_values(p_heap, index, parent_index);
 
@@ -214,10 +354,9 @@ void swap_values(float_heap *p_heap, int i, int j) {
     assert(j >= 0 && j < p_heap->num_values);
     assert(i != j);
 
-    i_val = read_float(p_heap->memory, i);
-    j_val = read_float(p_heap->memory, j);
+    i_val = get_value(p_heap, i);
+    j_val = get_value(p_heap, j);
 
-    write_float(p_heap->memory, i, j_val);
-    write_float(p_heap->memory, j, i_val);
+    set_value(p_heap, i, j_val);
+    set_value(p_heap, j, i_val);
 }
-
@@ -5,6 +5,26 @@
 #include "membase.h"
 
 
+/* The ways that the values of a heap can be laid out in memory. */
+typedef enum {
+    /* The classic binary heap:  the children of index i are 2i+1 and 2i+2. */
+    HEAP_BINARY,
+
+    /* 4-ary and 8-ary heaps.  The array is offset so that every group of
+     * siblings starts at a multiple of the arity, so that a sift-down step
+     * touches one block when the block size is 16 or 32 bytes.
+     */
+    HEAP_4ARY,
+    HEAP_8ARY,
+
+    /* A binary heap whose values are stored in pages of 16 values (64 bytes),
+     * each holding a subtree of height 4.  A sift then only touches a new
+     * page every four levels.
+     */
+    HEAP_BHEAP
+} heap_layout;
+
+
 /* A simple heap data structure, for storing floats. */
 typedef struct {
     /* Number of values currently in the heap. */
@@ -13,13 +33,34 @@ typedef struct {
     /* The maximum number of values to be stored in the heap. */
     int max_values;
 
-    /* The values in the heap. */
+    /* The values in the heap, when they are stored in a simulated memory. */
     membase_t *memory;
+
+    /* The values in the heap, when they are stored in native memory.  This
+     * is NULL when a simulated memory is used.
+     */
+    float *values;
+
+    /* How the values are laid out, and the number of children per node. */
+    heap_layout layout;
+    int arity;
 } float_heap;
 
 
-/* Initialize a heap data structure. */
-void init_heap(float_heap *p_heap, membase_t *memory, int max_values);
+/* Returns the number of floats of memory a heap of the specified layout
+ * needs, in order to hold max_values values.
+ */
+uint32_t heap_memory_size(int max_values, heap_layout layout);
+
+/* Initialize a heap data structure stored in a simulated memory. */
+void init_heap(float_heap *p_heap, membase_t *memory, int max_values,
+               heap_layout layout);
+
+/* Initialize a heap data structure stored in a native array, which must hold
+ * at least heap_memory_size(max_values, layout) floats.
+ */
+void init_native_heap(float_heap *p_heap, float *values, int max_values,
+                      heap_layout layout);
 
 /* Returns the first (i.e. smallest) value in the heap. */
 float get_first_value(float_heap *p_heap);
@@ -28,4 +69,3 @@ float get_first_value(float_heap *p_heap);
 void add_value(float_heap *p_heap, float newval);
 
 #endif /* __HEAP_H__ */
-
@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "cmdline.h"
 #include "heap.h"
 #include "memory.h"
 #include "cache.h"
+#include "walltime.h"
 
 
 #define NUM_ELEMS 1000000
@@ -33,22 +35,89 @@ int compare_float_ptrs(const void *v1, const void *v2) {
 }
 
 
+/* The names of the heap layouts, as given to the -l option. */
+const char *layout_names[] = { "binary", "4ary", "8ary", "bheap" };
+#define NUM_LAYOUTS (sizeof(layout_names) / sizeof(layout_names[0]))
+
+
+/* Prints the options specific to this program, then the cache options. */
+void heap_usage(const char *progname) {
+    printf("usage: %s [-l binary|4ary|8ary|bheap] [-n] [cache-options ...]\n\n",
+           progname);
+    printf("\t-l selects how the heap is laid out in memory; the default is\n");
+    printf("\t   binary.\n");
+    printf("\t-n stores the heap in native memory instead of the simulator,\n");
+    printf("\t   and reports the wall-clock time of the heap operations.\n");
+    printf("\n");
+    usage(progname);
+}
+
+
 int main(int argc, const char **argv) {
-    float *inputs;
-    int i, error;
+    float *inputs, *outputs, *native_values = NULL;
+    int i, error, arg, native = 0;
+    heap_layout layout = HEAP_BINARY;
+    uint32_t heap_size;
+    double start, seconds;
 
-    membase_t *p_mem;
+    membase_t *p_mem = NULL;
+    mem_hierarchy_t *p_hier = NULL;
 
     float_heap heap;
 
-    /* Set up the simulated memory. */
-    p_mem = make_cached_memory(argc, argv, NUM_ELEMS * sizeof(int));
-    
+    /* Consume our own options; the rest are handed to make_cached_memory. */
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-l") == 0) {
+            if (arg + 1 == argc) {
+                printf("ERROR:  -l requires a heap layout.\n");
+                heap_usage(argv[0]);
+                return 1;
+            }
+            arg++;
+            for (i = 0; i < NUM_LAYOUTS; i++) {
+                if (strcmp(argv[arg], layout_names[i]) == 0)
+                    break;
+            }
+            if (i == NUM_LAYOUTS) {
+                printf("ERROR:  unknown heap layout \"%s\".\n", argv[arg]);
+                heap_usage(argv[0]);
+                return 1;
+            }
+            layout = (heap_layout) i;
+        }
+        else if (strcmp(argv[arg], "-n") == 0) {
+            native = 1;
+        }
+        else {
+            break;
+        }
+    }
+
+    heap_size = heap_memory_size(NUM_ELEMS, layout);
+
+    if (native) {
+        printf("Using native memory.\n\n");
+        /* Align the heap the way the simulated memory is aligned. */
+        if (posix_memalign((void **) &native_values, 64,
+                           heap_size * sizeof(float)) != 0) {
+            printf("ERROR:  couldn't allocate the heap.\n");
+            return 1;
+        }
+    }
+    else {
+        /* Set up the simulated memory. */
+        argv[arg - 1] = argv[0];
+        p_hier = make_cached_memory(argc - arg + 1, argv + arg - 1,
+                                    heap_size * sizeof(float));
+        p_mem = p_hier->top;
+    }
+
     /* Generate random floats to sort. */
 
     printf("Generating %d random floats to sort.\n", NUM_ELEMS);
 
     inputs = malloc(NUM_ELEMS * sizeof(float));
+    outputs = malloc(NUM_ELEMS * sizeof(float));
 
     srand48(SEED);
     for (i = 0; i < NUM_ELEMS; i++)
@@ -56,12 +125,23 @@ int main(int argc, const char **argv) {
 
     /* Use the heap to sort the sequence of floats. */
 
-    printf("Sorting numbers using the heap.\n");
+    printf("Sorting numbers using the %s heap.\n", layout_names[layout]);
+
+    start = get_seconds();
+
+    if (native)
+        init_native_heap(&heap, native_values, NUM_ELEMS, layout);
+    else
+        init_heap(&heap, p_mem, NUM_ELEMS, layout);
 
-    init_heap(&heap, p_mem, NUM_ELEMS);
     for (i = 0; i < NUM_ELEMS; i++)
         add_value(&heap, inputs[i]);
 
+    for (i = 0; i < NUM_ELEMS; i++)
+        outputs[i] = get_first_value(&heap);
+
+    seconds = get_seconds() - start;
+
     /* Sort the inputs so that we can check the heap's results. */
 
     printf("Checking the results against the sorted inputs.\n");
@@ -70,10 +150,9 @@ int main(int argc, const char **argv) {
 
     error = 0;
     for (i = 0; i < NUM_ELEMS; i++) {
-        float val = get_first_value(&heap);
-        if (val != inputs[i]) {
+        if (outputs[i] != inputs[i]) {
             printf("ERROR:  heap and sorted array don't match at "
-                   "index %d!  heap = %f, val = %f\n", i, val, inputs[i]);
+                   "index %d!  heap = %f, val = %f\n", i, outputs[i], inputs[i]);
             error = 1;
         }
     }
@@ -85,10 +164,20 @@ int main(int argc, const char **argv) {
 
     /* Print out the results of the heap sort. */
 
-    printf("\nMemory-Access Statistics:\n\n");
-    p_mem->print_stats(p_mem);
-    printf("\n");
+    if (native) {
+        printf("\nWall-clock time:  %.3f seconds\n\n", seconds);
+        free(native_values);
+    }
+    else {
+        printf("\nMemory-Access Statistics:\n\n");
+        p_mem->print_stats(p_mem);
+        printf("\n");
+
+        free_hierarchy(p_hier);
+    }
+
+    free(inputs);
+    free(outputs);
 
     return 0;
 }
-
@@ -98,9 +98,13 @@ void write_float(membase_t *mb, uint32_t index, float value) {
  * lines in order to implement an LRU replacement policy when evicting cache
  * lines.  Every call to the function advances the clock by one tick, and then
  * returns the new value of the clock.
+ *
+ * Each thread has its own clock, so that separate memory hierarchies can be
+ * simulated on separate threads.  A hierarchy must only be accessed from one
+ * thread.
  */
 uint64_t clock_tick() {
-    static uint64_t clock = 0;
+    static __thread uint64_t clock = 0;
 
     return ++clock;
 }
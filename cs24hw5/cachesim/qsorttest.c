@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
 
 #include "memory.h"
 #include "cache.h"
 #include "cmdline.h"
+#include "walltime.h"
 
 
 #define NUM_ELEMS 1000000
@@ -17,39 +19,129 @@
 #define SEED 54321098
 
 
+/* Ranges this small are finished with insertion sort by the introsort and
+ * block-partitioned kernels.
+ */
+#define INSERTION_CUTOFF 16
+
+/* The number of elements the block-partitioned kernel classifies at once. */
+#define PARTITION_BLOCK 64
+
+/* The radix sort sorts on this many bits per pass. */
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (32 / RADIX_BITS)
+
+
+/* The different sorting kernels that can be run. */
+typedef enum {
+    /* Recursive quicksort with Lomuto partitioning around the middle value. */
+    SORT_LOMUTO,
+
+    /* Recursive quicksort with Hoare partitioning around the middle value. */
+    SORT_HOARE,
+
+    /* Quicksort with median-of-3 Hoare partitioning, which switches to
+     * heapsort when the recursion gets too deep, and to insertion sort for
+     * small ranges.
+     */
+    SORT_INTROSORT,
+
+    /* Quicksort whose partitioning step classifies a block of elements at a
+     * time without branches, then swaps the misplaced ones.
+     */
+    SORT_BLOCK,
+
+    /* Least-significant-digit radix sort, through a second array. */
+    SORT_RADIX
+} sort_kernel;
+
+const char *kernel_names[] = { "lomuto", "hoare", "introsort", "block", "radix" };
+#define NUM_KERNELS (sizeof(kernel_names) / sizeof(kernel_names[0]))
+
+
+/* The array being sorted.  The values are either in the simulated memory, or
+ * in a native array.  Kernels that need scratch space use the memory after
+ * the values.
+ */
+typedef struct {
+    /* The simulated memory, or NULL in native mode. */
+    membase_t *p_mem;
+
+    /* The native array, or NULL when the simulated memory is used. */
+    int *values;
+} sort_array;
+
+
+int get_value(sort_array *arr, int i) {
+    if (arr->values != NULL)
+        return arr->values[i];
+
+    return read_int(arr->p_mem, i);
+}
+
+
+void set_value(sort_array *arr, int i, int value) {
+    if (arr->values != NULL)
+        arr->values[i] = value;
+    else
+        write_int(arr->p_mem, i, value);
+}
+
+
 /* This helper handles the task of swapping two integers in the simulated
  * memory.
  */
-void swap_values(membase_t *p_mem, int i, int j) {
-    int i_val = read_int(p_mem, i);
-    int j_val = read_int(p_mem, j);
+void swap_values(sort_array *arr, int i, int j) {
+    int i_val = get_value(arr, i);
+    int j_val = get_value(arr, j);
 
-    write_int(p_mem, i, j_val);
-    write_int(p_mem, j, i_val);
+    set_value(arr, i, j_val);
+    set_value(arr, j, i_val);
 }
 
 
+/* Returns the number of ints of memory the kernel needs in order to sort
+ * num_values values.  This is rounded up to a whole number of 4KB pages, so
+ * that any cache block size up to 4KB can be simulated.
+ */
+int sort_memory_size(sort_kernel kernel, int num_values) {
+    int size = num_values;
+
+    /* Radix sort needs a second array, and a histogram for each pass. */
+    if (kernel == SORT_RADIX)
+        size = 2 * num_values + RADIX_PASSES * RADIX_BUCKETS;
+
+    return (size + 1023) & ~1023;
+}
+
+
+/*---------------------------------------------------------------------------
+ * LOMUTO AND HOARE QUICKSORT
+ */
+
+
 /* This function partitions a range of values between the start and end
  * indexes, inclusive, and then returns the index of the pivot value.
  */
-int partition(membase_t *p_mem, int start, int end) {
+int partition(sort_array *arr, int start, int end) {
     int pivot_idx, pivot, swap_idx, i;
 
     assert(end > start);
 
     pivot_idx = (start + end) / 2;
-    pivot = read_int(p_mem, pivot_idx);
-    swap_values(p_mem, pivot_idx, end);
+    pivot = get_value(arr, pivot_idx);
+    swap_values(arr, pivot_idx, end);
 
     swap_idx = start;
     for (i = start; i < end; i++) {
-        if (read_int(p_mem, i) < pivot) {
-            swap_values(p_mem, i, swap_idx);
+        if (get_value(arr, i) < pivot) {
+            swap_values(arr, i, swap_idx);
             swap_idx++;
         }
     }
 
-    swap_values(p_mem, swap_idx, end);
+    swap_values(arr, swap_idx, end);
 
     return swap_idx;
 }
@@ -60,15 +152,363 @@ int partition(membase_t *p_mem, int start, int end) {
  * operation, and the array is sorted in-place.  The start and end indexes
  * are inclusive.
  */
-void quicksort(membase_t *p_mem, int start, int end) {
+void quicksort(sort_array *arr, int start, int end) {
     int pivot_idx;
 
     if (end <= start)
         return;
 
-    pivot_idx = partition(p_mem, start, end);
-    quicksort(p_mem, start, pivot_idx - 1);
-    quicksort(p_mem, pivot_idx + 1, end);
+    pivot_idx = partition(arr, start, end);
+    quicksort(arr, start, pivot_idx - 1);
+    quicksort(arr, pivot_idx + 1, end);
+}
+
+
+/* Partitions the inclusive range [start, end] around the specified pivot
+ * value, using Hoare's scheme of two indexes moving towards each other.
+ * Returns an index p such that every value in [start, p] is <= every value
+ * in [p + 1, end].  The pivot value must be in the range.
+ */
+int hoare_partition(sort_array *arr, int start, int end, int pivot) {
+    int i = start - 1;
+    int j = end + 1;
+
+    while (1) {
+        do {
+            i++;
+        } while (get_value(arr, i) < pivot);
+
+        do {
+            j--;
+        } while (get_value(arr, j) > pivot);
+
+        if (i >= j)
+            return j;
+
+        swap_values(arr, i, j);
+    }
+}
+
+
+/* Quicksort using Hoare partitioning around the middle value.  The start
+ * and end indexes are inclusive.
+ */
+void quicksort_hoare(sort_array *arr, int start, int end) {
+    int split;
+
+    if (end <= start)
+        return;
+
+    split = hoare_partition(arr, start, end,
+                            get_value(arr, start + (end - start) / 2));
+    quicksort_hoare(arr, start, split);
+    quicksort_hoare(arr, split + 1, end);
+}
+
+
+/*---------------------------------------------------------------------------
+ * INTROSORT
+ */
+
+
+/* Sorts the inclusive range [start, end] with insertion sort. */
+void insertion_sort(sort_array *arr, int start, int end) {
+    int i, j, value;
+
+    for (i = start + 1; i <= end; i++) {
+        value = get_value(arr, i);
+        for (j = i - 1; j >= start && get_value(arr, j) > value; j--)
+            set_value(arr, j + 1, get_value(arr, j));
+        set_value(arr, j + 1, value);
+    }
+}
+
+
+/* Sifts the value at offset root of a max-heap stored in [start, start + n)
+ * down to its proper place.
+ */
+void heap_sift_down(sort_array *arr, int start, int root, int n) {
+    int child, value, child_val;
+
+    value = get_value(arr, start + root);
+    while ((child = 2 * root + 1) < n) {
+        child_val = get_value(arr, start + child);
+        if (child + 1 < n && get_value(arr, start + child + 1) > child_val) {
+            child++;
+            child_val = get_value(arr, start + child);
+        }
+
+        if (child_val <= value)
+            break;
+
+        set_value(arr, start + root, child_val);
+        root = child;
+    }
+    set_value(arr, start + root, value);
+}
+
+
+/* Sorts the inclusive range [start, end] with heapsort. */
+void heapsort_range(sort_array *arr, int start, int end) {
+    int n = end - start + 1;
+    int i;
+
+    for (i = n / 2 - 1; i >= 0; i--)
+        heap_sift_down(arr, start, i, n);
+
+    for (i = n - 1; i > 0; i--) {
+        swap_values(arr, start, start + i);
+        heap_sift_down(arr, start, 0, i);
+    }
+}
+
+
+/* Returns the median of the first, middle and last values of the inclusive
+ * range [start, end].
+ */
+int median_of_3(sort_array *arr, int start, int end) {
+    int a = get_value(arr, start);
+    int b = get_value(arr, start + (end - start) / 2);
+    int c = get_value(arr, end);
+
+    if (a < b) {
+        if (b < c)
+            return b;
+        return a < c ? c : a;
+    }
+    else {
+        if (a < c)
+            return a;
+        return b < c ? c : b;
+    }
+}
+
+
+/* The body of introsort.  The smaller side of each partition is sorted
+ * recursively and the larger side by looping, so the native stack stays
+ * shallow; depth_limit bounds the number of partitioning steps before
+ * falling back to heapsort.
+ */
+void introsort_range(sort_array *arr, int start, int end, int depth_limit) {
+    int split;
+
+    while (end - start + 1 > INSERTION_CUTOFF) {
+        if (depth_limit == 0) {
+            heapsort_range(arr, start, end);
+            return;
+        }
+        depth_limit--;
+
+        split = hoare_partition(arr, start, end, median_of_3(arr, start, end));
+        if (split - start < end - split) {
+            introsort_range(arr, start, split, depth_limit);
+            start = split + 1;
+        }
+        else {
+            introsort_range(arr, split + 1, end, depth_limit);
+            end = split;
+        }
+    }
+
+    insertion_sort(arr, start, end);
+}
+
+
+void introsort(sort_array *arr, int num_values) {
+    int depth_limit = 0, n;
+
+    /* Allow 2 * log2(n) partitioning steps. */
+    for (n = num_values; n > 1; n >>= 1)
+        depth_limit += 2;
+
+    introsort_range(arr, 0, num_values - 1, depth_limit);
+}
+
+
+/*---------------------------------------------------------------------------
+ * BLOCK-PARTITIONED QUICKSORT
+ */
+
+
+/* Partitions the inclusive range [start, end] and returns the final index of
+ * the pivot.  PARTITION_BLOCK values from each end are classified at a time
+ * into small offset buffers, with the comparison results added into the
+ * buffer counts instead of being branched on; then the misplaced values from
+ * both ends are swapped in one pass.  The offset buffers are small enough to
+ * stay in registers and the L1 cache, so they are kept in native memory
+ * even when the values are simulated.
+ */
+int block_partition(sort_array *arr, int start, int end) {
+    int offsets_l[PARTITION_BLOCK], offsets_r[PARTITION_BLOCK];
+    int num_l = 0, num_r = 0, first_l = 0, first_r = 0;
+    int pivot, pivot_idx, l, r, i, num;
+
+    /* Move the median-of-3 pivot to the end, out of the way. */
+    pivot = median_of_3(arr, start, end);
+    if (get_value(arr, start) == pivot)
+        pivot_idx = start;
+    else if (get_value(arr, end) == pivot)
+        pivot_idx = end;
+    else
+        pivot_idx = start + (end - start) / 2;
+    swap_values(arr, pivot_idx, end);
+
+    /* Everything before l belongs on the left, and everything after r
+     * belongs on the right.
+     */
+    l = start;
+    r = end - 1;
+
+    while (r - l + 1 > 2 * PARTITION_BLOCK) {
+        if (num_l == 0) {
+            first_l = 0;
+            for (i = 0; i < PARTITION_BLOCK; i++) {
+                offsets_l[num_l] = i;
+                num_l += (get_value(arr, l + i) >= pivot);
+            }
+        }
+
+        if (num_r == 0) {
+            first_r = 0;
+            for (i = 0; i < PARTITION_BLOCK; i++) {
+                offsets_r[num_r] = i;
+                num_r += (get_value(arr, r - i) <= pivot);
+            }
+        }
+
+        num = num_l < num_r ? num_l : num_r;
+        for (i = 0; i < num; i++) {
+            swap_values(arr, l + offsets_l[first_l + i],
+                        r - offsets_r[first_r + i]);
+        }
+
+        num_l -= num;
+        num_r -= num;
+        first_l += num;
+        first_r += num;
+
+        if (num_l == 0)
+            l += PARTITION_BLOCK;
+        if (num_r == 0)
+            r -= PARTITION_BLOCK;
+    }
+
+    /* Finish whatever is left, including any half-processed block, with a
+     * simple scan.
+     */
+    for (i = l; i <= r; i++) {
+        if (get_value(arr, i) < pivot) {
+            swap_values(arr, i, l);
+            l++;
+        }
+    }
+
+    swap_values(arr, l, end);
+    return l;
+}
+
+
+void block_quicksort(sort_array *arr, int start, int end) {
+    int pivot_idx;
+
+    while (end - start + 1 > INSERTION_CUTOFF) {
+        pivot_idx = block_partition(arr, start, end);
+        if (pivot_idx - start < end - pivot_idx) {
+            block_quicksort(arr, start, pivot_idx - 1);
+            start = pivot_idx + 1;
+        }
+        else {
+            block_quicksort(arr, pivot_idx + 1, end);
+            end = pivot_idx - 1;
+        }
+    }
+
+    insertion_sort(arr, start, end);
+}
+
+
+/*---------------------------------------------------------------------------
+ * RADIX SORT
+ */
+
+
+/* Sorts the values with an LSD radix sort.  The values are at [0, n), the
+ * second array is at [n, 2n), and the histograms of all passes are at
+ * [2n, 2n + RADIX_PASSES * RADIX_BUCKETS).  All histograms are built in a
+ * single pass over the input.  The sign bit is flipped so that negative
+ * values sort first.
+ */
+void radix_sort(sort_array *arr, int n) {
+    int counts = 2 * n;
+    int src = 0, dst = n;
+    int pass, bucket, i, total, tmp;
+    uint32_t key;
+
+    for (i = 0; i < RADIX_PASSES * RADIX_BUCKETS; i++)
+        set_value(arr, counts + i, 0);
+
+    for (i = 0; i < n; i++) {
+        key = (uint32_t) get_value(arr, i) ^ 0x80000000U;
+        for (pass = 0; pass < RADIX_PASSES; pass++) {
+            bucket = counts + pass * RADIX_BUCKETS +
+                     ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1));
+            set_value(arr, bucket, get_value(arr, bucket) + 1);
+        }
+    }
+
+    for (pass = 0; pass < RADIX_PASSES; pass++) {
+        int hist = counts + pass * RADIX_BUCKETS;
+
+        /* Turn the counts into starting offsets. */
+        total = 0;
+        for (bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+            tmp = get_value(arr, hist + bucket);
+            set_value(arr, hist + bucket, total);
+            total += tmp;
+        }
+
+        for (i = 0; i < n; i++) {
+            int value = get_value(arr, src + i);
+            key = (uint32_t) value ^ 0x80000000U;
+            bucket = hist + ((key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1));
+
+            tmp = get_value(arr, bucket);
+            set_value(arr, dst + tmp, value);
+            set_value(arr, bucket, tmp + 1);
+        }
+
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    /* RADIX_PASSES is even, so the values end up back at [0, n). */
+    assert(src == 0);
+}
+
+
+void sort_values(sort_array *arr, sort_kernel kernel, int num_values) {
+    switch (kernel) {
+    case SORT_LOMUTO:
+        quicksort(arr, 0, num_values - 1);
+        break;
+
+    case SORT_HOARE:
+        quicksort_hoare(arr, 0, num_values - 1);
+        break;
+
+    case SORT_INTROSORT:
+        introsort(arr, num_values);
+        break;
+
+    case SORT_BLOCK:
+        block_quicksort(arr, 0, num_values - 1);
+        break;
+
+    case SORT_RADIX:
+        radix_sort(arr, num_values);
+        break;
+    }
 }
 
 
@@ -83,13 +523,70 @@ int compare_int_ptrs(const void *v1, const void *v2) {
 }
 
 
+/* Prints the options specific to this program, then the cache options. */
+void sort_usage(const char *progname) {
+    printf("usage: %s [-k lomuto|hoare|introsort|block|radix] [-n]\n"
+           "       [cache-options ...]\n\n", progname);
+    printf("\t-k selects the sorting kernel; the default is lomuto.\n");
+    printf("\t-n sorts in native memory instead of the simulator, and\n");
+    printf("\t   reports the wall-clock time of the sort.\n");
+    printf("\n");
+    usage(progname);
+}
+
+
 int main(int argc, const char **argv) {
     int *inputs;
-    int i, error;
-    membase_t *p_mem;
+    int i, error, arg, native = 0, mem_size;
+    sort_kernel kernel = SORT_LOMUTO;
+    double start, seconds;
+    sort_array arr;
+    membase_t *p_mem = NULL;
+    mem_hierarchy_t *p_hier = NULL;
+
+    /* Consume our own options; the rest are handed to make_cached_memory. */
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-k") == 0) {
+            if (arg + 1 == argc) {
+                printf("ERROR:  -k requires a sorting kernel.\n");
+                sort_usage(argv[0]);
+                return 1;
+            }
+            arg++;
+            for (i = 0; i < NUM_KERNELS; i++) {
+                if (strcmp(argv[arg], kernel_names[i]) == 0)
+                    break;
+            }
+            if (i == NUM_KERNELS) {
+                printf("ERROR:  unknown sorting kernel \"%s\".\n", argv[arg]);
+                sort_usage(argv[0]);
+                return 1;
+            }
+            kernel = (sort_kernel) i;
+        }
+        else if (strcmp(argv[arg], "-n") == 0) {
+            native = 1;
+        }
+        else {
+            break;
+        }
+    }
 
-    /* Set up the simulated memory. */
-    p_mem = make_cached_memory(argc, argv, NUM_ELEMS * sizeof(int));
+    mem_size = sort_memory_size(kernel, NUM_ELEMS);
+
+    bzero(&arr, sizeof(arr));
+    if (native) {
+        printf("Using native memory.\n\n");
+        arr.values = malloc(mem_size * sizeof(int));
+    }
+    else {
+        /* Set up the simulated memory. */
+        argv[arg - 1] = argv[0];
+        p_hier = make_cached_memory(argc - arg + 1, argv + arg - 1,
+                                    mem_size * sizeof(int));
+        p_mem = p_hier->top;
+        arr.p_mem = p_mem;
+    }
 
     /* Generate random floats to sort. */
 
@@ -105,14 +602,17 @@ int main(int argc, const char **argv) {
      */
     for (i = 0; i < NUM_ELEMS; i++)
         inputs[i] = rand();
-    
+
     for (i = 0; i < NUM_ELEMS; i++)
-        write_int(p_mem, i, inputs[i]);
+        set_value(&arr, i, inputs[i]);
 
-    /* Quicksort the array of integers. */
+    /* Sort the array of integers. */
 
-    printf("Quicksorting the array of integers.\n");
-    quicksort(p_mem, 0, NUM_ELEMS - 1);
+    printf("Sorting the array of integers using the %s kernel.\n",
+           kernel_names[kernel]);
+    start = get_seconds();
+    sort_values(&arr, kernel, NUM_ELEMS);
+    seconds = get_seconds() - start;
 
     /* Sort the inputs so that we can check the heap's results. */
 
@@ -122,7 +622,7 @@ int main(int argc, const char **argv) {
 
     error = 0;
     for (i = 0; i < NUM_ELEMS; i++) {
-        int val = read_int(p_mem, i);
+        int val = get_value(&arr, i);
         if (val != inputs[i]) {
             printf("ERROR:  sorted arrays don't match at index %d!  "
                    "data[i] = %d, verify[i] = %d\n", i, val, inputs[i]);
@@ -135,11 +635,21 @@ int main(int argc, const char **argv) {
         abort();
     }
 
-    /* Print out the results of the quicksort. */
+    /* Print out the results of the sort. */
 
-    printf("\nMemory-Access Statistics:\n\n");
-    p_mem->print_stats(p_mem);
-    printf("\n");
+    if (native) {
+        printf("\nWall-clock time:  %.3f seconds\n\n", seconds);
+        free(arr.values);
+    }
+    else {
+        printf("\nMemory-Access Statistics:\n\n");
+        p_mem->print_stats(p_mem);
+        printf("\n");
+
+        free_hierarchy(p_hier);
+    }
+
+    free(inputs);
 
     return 0;
 }
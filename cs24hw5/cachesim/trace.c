@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+
+/* The number of entries to accumulate before writing them to the file. */
+#define TRACE_BUFFER_ENTRIES 65536
+
+/* The largest number of bytes a single entry may describe. */
+#define TRACE_MAX_LENGTH 0xFFFF
+
+
+/* Local functions used by the trace implementation. */
+
+unsigned char trace_read_byte(membase_t *mb, addr_t address);
+void trace_write_byte(membase_t *mb, addr_t address, unsigned char value);
+void trace_print_stats(membase_t *mb);
+void trace_reset_stats(membase_t *mb);
+void trace_free(membase_t *mb);
+
+void record_access(trace_t *p_trace, addr_t address, uint16_t flags);
+void flush_pending(trace_t *p_trace);
+void flush_buffer(trace_t *p_trace);
+
+
+/* Initializes a trace level that records all accesses into the specified
+ * file, and passes them on to next_mem.  The mem_size is recorded in the
+ * trace so that the trace can be replayed against a memory of the same size.
+ * Returns nonzero on success, or 0 if the file couldn't be created.
+ */
+int init_trace(trace_t *p_trace, const char *filename, uint32_t mem_size,
+               membase_t *next_mem) {
+    trace_header_t header;
+
+    assert(p_trace != NULL);
+    assert(filename != NULL);
+    assert(next_mem != NULL);
+
+    bzero(p_trace, sizeof(trace_t));
+
+    p_trace->fp = fopen(filename, "wb");
+    if (p_trace->fp == NULL) {
+        perror(filename);
+        return 0;
+    }
+
+    /* Write a header with no entries; the count is filled in at the end. */
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.mem_size = mem_size;
+    fwrite(&header, sizeof(header), 1, p_trace->fp);
+
+    p_trace->next_memory = next_mem;
+    p_trace->buffer = malloc(TRACE_BUFFER_ENTRIES * sizeof(trace_entry_t));
+
+    p_trace->read_byte = trace_read_byte;
+    p_trace->write_byte = trace_write_byte;
+    p_trace->print_stats = trace_print_stats;
+    p_trace->reset_stats = trace_reset_stats;
+    p_trace->free = trace_free;
+
+    return 1;
+}
+
+
+/* Records the read, then passes it on to the next level. */
+unsigned char trace_read_byte(membase_t *mb, addr_t address) {
+    trace_t *p_trace = (trace_t *) mb;
+
+    p_trace->num_reads++;
+    record_access(p_trace, address, 0);
+    return read_byte(p_trace->next_memory, address);
+}
+
+
+/* Records the write, then passes it on to the next level. */
+void trace_write_byte(membase_t *mb, addr_t address, unsigned char value) {
+    trace_t *p_trace = (trace_t *) mb;
+
+    p_trace->num_writes++;
+    record_access(p_trace, address, TRACE_WRITE);
+    write_byte(p_trace->next_memory, address, value);
+}
+
+
+/* Prints how much has been traced, then the next level's statistics. */
+void trace_print_stats(membase_t *mb) {
+    trace_t *p_trace = (trace_t *) mb;
+
+    printf(" * Trace reads=%ld writes=%ld entries=%ld\n",
+           p_trace->num_reads, p_trace->num_writes,
+           p_trace->num_entries + p_trace->num_buffered +
+           p_trace->has_pending);
+
+    p_trace->next_memory->print_stats(p_trace->next_memory);
+}
+
+
+/* Resets the statistics for the trace level and the levels below it.  This
+ * does not discard any entries that were already recorded.
+ */
+void trace_reset_stats(membase_t *mb) {
+    trace_t *p_trace = (trace_t *) mb;
+
+    p_trace->num_reads = 0;
+    p_trace->num_writes = 0;
+
+    p_trace->next_memory->reset_stats(p_trace->next_memory);
+}
+
+
+/* Writes out any remaining entries, fills in the final entry count in the
+ * header, and closes the trace file.  Like cache_free(), this does *not*
+ * pass the call on to the next level of the memory.
+ */
+void trace_free(membase_t *mb) {
+    trace_t *p_trace = (trace_t *) mb;
+    size_t offset = offsetof(trace_header_t, num_entries);
+
+    flush_pending(p_trace);
+    flush_buffer(p_trace);
+
+    fseek(p_trace->fp, offset, SEEK_SET);
+    fwrite(&p_trace->num_entries, sizeof(uint64_t), 1, p_trace->fp);
+    fclose(p_trace->fp);
+
+    free(p_trace->buffer);
+}
+
+
+/*---------------------------------------------------------------------------
+ * TRACE HELPER FUNCTIONS
+ */
+
+
+/* Adds a one-byte access to the trace.  If it continues the pending entry,
+ * the pending entry is simply extended; otherwise the pending entry is
+ * retired and a new one is started.
+ */
+void record_access(trace_t *p_trace, addr_t address, uint16_t flags) {
+    trace_entry_t *p_entry = &p_trace->pending;
+
+    if (p_trace->has_pending && p_entry->flags == flags &&
+        p_entry->address + p_entry->length == address &&
+        p_entry->length < TRACE_MAX_LENGTH) {
+        p_entry->length++;
+        return;
+    }
+
+    flush_pending(p_trace);
+
+    p_entry->address = address;
+    p_entry->length = 1;
+    p_entry->flags = flags;
+    p_trace->has_pending = 1;
+}
+
+
+/* Moves the pending entry (if any) into the output buffer. */
+void flush_pending(trace_t *p_trace) {
+    if (!p_trace->has_pending)
+        return;
+
+    if (p_trace->num_buffered == TRACE_BUFFER_ENTRIES)
+        flush_buffer(p_trace);
+
+    p_trace->buffer[p_trace->num_buffered] = p_trace->pending;
+    p_trace->num_buffered++;
+    p_trace->has_pending = 0;
+}
+
+
+/* Writes the output buffer to the trace file. */
+void flush_buffer(trace_t *p_trace) {
+    fwrite(p_trace->buffer, sizeof(trace_entry_t), p_trace->num_buffered,
+           p_trace->fp);
+    p_trace->num_entries += p_trace->num_buffered;
+    p_trace->num_buffered = 0;
+}
+
+
+/*---------------------------------------------------------------------------
+ * TRACE FILES
+ */
+
+
+/* Maps a trace file into memory, read-only.  Returns nonzero on success, or
+ * 0 if the file couldn't be opened or isn't a valid trace.
+ */
+int open_trace(const char *filename, trace_file_t *p_file) {
+    const trace_header_t *p_header;
+    struct stat st;
+    int fd;
+
+    assert(p_file != NULL);
+    bzero(p_file, sizeof(trace_file_t));
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(filename);
+        if (fd != -1)
+            close(fd);
+        return 0;
+    }
+
+    if (st.st_size < sizeof(trace_header_t)) {
+        printf("ERROR:  %s is too small to be a trace file.\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    p_file->map_size = st.st_size;
+    p_file->map = mmap(NULL, p_file->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p_file->map == MAP_FAILED) {
+        perror(filename);
+        return 0;
+    }
+
+    p_header = (const trace_header_t *) p_file->map;
+    if (memcmp(p_header->magic, TRACE_MAGIC, sizeof(p_header->magic)) != 0 ||
+        p_header->num_entries > (p_file->map_size - sizeof(trace_header_t)) /
+                                sizeof(trace_entry_t)) {
+        printf("ERROR:  %s is not a complete trace file.\n", filename);
+        munmap(p_file->map, p_file->map_size);
+        return 0;
+    }
+
+    p_file->mem_size = p_header->mem_size;
+    p_file->num_entries = p_header->num_entries;
+    p_file->entries = (const trace_entry_t *) (p_header + 1);
+
+    /* The trace is always replayed from start to finish. */
+    madvise(p_file->map, p_file->map_size, MADV_SEQUENTIAL);
+
+    return 1;
+}
+
+
+/* Unmaps a trace file. */
+void close_trace(trace_file_t *p_file) {
+    munmap(p_file->map, p_file->map_size);
+    bzero(p_file, sizeof(trace_file_t));
+}
+
+
+/* Issues every access in the trace against the specified memory.  The values
+ * of the bytes aren't recorded in the trace, so writes always store 0; this
+ * makes no difference to the access statistics of the memory.
+ */
+void replay_trace(const trace_file_t *p_file, membase_t *mb) {
+    uint64_t i;
+    addr_t addr, end;
+
+    for (i = 0; i < p_file->num_entries; i++) {
+        const trace_entry_t *p_entry = p_file->entries + i;
+
+        end = p_entry->address + p_entry->length;
+        if (p_entry->flags & TRACE_WRITE) {
+            for (addr = p_entry->address; addr < end; addr++)
+                write_byte(mb, addr, 0);
+        }
+        else {
+            for (addr = p_entry->address; addr < end; addr++)
+                read_byte(mb, addr);
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "membase.h"
+
+
+/* This flag is set in a trace entry's flags if the access was a write. */
+#define TRACE_WRITE 0x0001
+
+
+/* A single entry in an access trace.  Byte accesses of the same kind to
+ * consecutive addresses are coalesced into one entry, so that e.g. a
+ * read_int() call is recorded as a single 4-byte read.
+ */
+typedef struct trace_entry_t {
+    /* The address of the first byte accessed. */
+    addr_t address;
+
+    /* The number of consecutive bytes accessed. */
+    uint16_t length;
+
+    /* TRACE_WRITE if the bytes were written, 0 if they were read. */
+    uint16_t flags;
+} trace_entry_t;
+
+
+/* This is the header at the start of every trace file.  The entries follow
+ * immediately after the header.
+ */
+typedef struct trace_header_t {
+    /* Always TRACE_MAGIC, so that garbage files can be rejected. */
+    char magic[8];
+
+    /* The size of the memory that the traced program used. */
+    uint32_t mem_size;
+
+    /* Unused; keeps the entry count 8-byte aligned. */
+    uint32_t reserved;
+
+    /* The number of entries in the trace. */
+    uint64_t num_entries;
+} trace_header_t;
+
+#define TRACE_MAGIC "CS24TRC1"
+
+
+/* This struct is a memory level that passes every access through to the next
+ * level of the memory, while recording the access into a trace file.  The
+ * struct starts with the same members as membase_t so that it can be placed
+ * anywhere in a memory hierarchy, although it is normally placed at the top.
+ */
+typedef struct trace_t {
+    /* The number of reads that occurred at this level of the memory. */
+    uint64_t num_reads;
+
+    /* The number of writes that occurred at this level of the memory. */
+    uint64_t num_writes;
+
+    /* The function to read a byte through the trace. */
+    unsigned char (*read_byte)(membase_t *mb, addr_t address);
+
+    /* The function to write a byte through the trace. */
+    void (*write_byte)(membase_t *mb, addr_t address, unsigned char value);
+
+    /* The function to print the trace's access statistics. */
+    void (*print_stats)(struct membase_t *mb);
+
+    /* The function to reset the trace's access statistics. */
+    void (*reset_stats)(struct membase_t *mb);
+
+    /* The function to finish the trace file and release the buffers. */
+    void (*free)(membase_t *mb);
+
+
+    /* The memory that accesses are passed on to. */
+    membase_t *next_memory;
+
+    /* The file that the trace is being written to. */
+    FILE *fp;
+
+    /* The entry currently being coalesced, if has_pending is nonzero. */
+    trace_entry_t pending;
+    int has_pending;
+
+    /* Entries waiting to be written out to the file. */
+    trace_entry_t *buffer;
+    int num_buffered;
+
+    /* The total number of entries written to the trace so far. */
+    uint64_t num_entries;
+
+} trace_t;
+
+
+int init_trace(trace_t *p_trace, const char *filename, uint32_t mem_size,
+               membase_t *next_mem);
+
+
+/* A trace file that has been mapped read-only into memory.  Since the mapping
+ * is never modified, any number of threads may replay the same trace at once.
+ */
+typedef struct trace_file_t {
+    /* The size of the memory that the traced program used. */
+    uint32_t mem_size;
+
+    /* The number of entries in the trace. */
+    uint64_t num_entries;
+
+    /* The entries of the trace, within the mapping. */
+    const trace_entry_t *entries;
+
+    /* The mapping itself, so that it can be unmapped. */
+    void *map;
+    size_t map_size;
+} trace_file_t;
+
+
+int open_trace(const char *filename, trace_file_t *p_file);
+void close_trace(trace_file_t *p_file);
+
+void replay_trace(const trace_file_t *p_file, membase_t *mb);
+
+
+#endif /* TRACE_H */
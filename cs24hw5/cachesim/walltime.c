@@ -0,0 +1,13 @@
+#include <time.h>
+
+#include "walltime.h"
+
+
+/* Returns the current value of a monotonic wall-clock, in seconds.  Only the
+ * difference between two values is meaningful.
+ */
+double get_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,11 @@
+#ifndef WALLTIME_H
+#define WALLTIME_H
+
+
+/* Returns the current value of a monotonic wall-clock, in seconds.  Only the
+ * difference between two values is meaningful.
+ */
+double get_seconds();
+
+
+#endif /* WALLTIME_H */
@@ -0,0 +1,325 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+/* The first chunk of an arena is this large, and each chunk after that is
+ * twice the size of the one before, up to CHUNK_MAX bytes.
+ */
+#define CHUNK_MIN 65536
+#define CHUNK_MAX (4 << 20)
+
+/* Small size classes are multiples of ARENA_ALIGN up to 2^FINE_MAX_LOG
+ * bytes.  Above that, each power of 2 is divided into CLASSES_PER_DOUBLING
+ * evenly spaced classes, so that no block is rounded up by more than 25%.
+ */
+#define FINE_MAX_LOG 9
+#define FINE_MAX (1 << FINE_MAX_LOG)
+#define NUM_FINE_CLASSES (FINE_MAX / ARENA_ALIGN)
+#define CLASSES_PER_DOUBLING 4
+
+
+/* The header at the start of each chunk, and of each large block.  The
+ * header takes up a whole cache line, so that the memory after it starts on
+ * a cache-line boundary.
+ */
+struct arena_chunk {
+    /* The neighbouring chunks, or large blocks, in the arena's list.  Only
+     * large blocks use prev, since they can be freed individually.
+     */
+    struct arena_chunk *next;
+    struct arena_chunk *prev;
+
+    /* The number of bytes obtained from the system for this chunk or block,
+     * including the header.
+     */
+    size_t size;
+} __attribute__((aligned(ARENA_LINE)));
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+void * alloc_from_system(size_t size);
+int size_class(size_t size);
+size_t class_size(int cls);
+void * carve_block(mm_arena *arena, size_t size);
+void * alloc_large(mm_arena *arena, size_t size);
+void free_large(mm_arena *arena, void *ptr, size_t size);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates cache-line aligned memory from the system. */
+void * alloc_from_system(size_t size) {
+    void *mem;
+
+    if (posix_memalign(&mem, ARENA_LINE, size) != 0) {
+        fprintf(stderr, "Out of memory allocating %lu bytes for an arena.\n",
+                (unsigned long) size);
+        abort();
+    }
+
+    return mem;
+}
+
+
+/* Returns the size class of a small block of the specified size. */
+int size_class(size_t size) {
+    int log;
+    size_t step;
+
+    assert(size <= ARENA_SMALL_MAX);
+
+    if (size == 0)
+        size = 1;
+
+    if (size <= FINE_MAX)
+        return (int) ((size + ARENA_ALIGN - 1) / ARENA_ALIGN) - 1;
+
+    /* Find the power of 2 just below the size, and which quarter of the way
+     * up to the next power of 2 the size falls in.
+     */
+    log = 63 - __builtin_clzll((unsigned long long) size - 1);
+    step = ((size_t) 1 << log) / CLASSES_PER_DOUBLING;
+
+    return NUM_FINE_CLASSES + (log - FINE_MAX_LOG) * CLASSES_PER_DOUBLING +
+           (int) ((size + step - 1) / step) - CLASSES_PER_DOUBLING - 1;
+}
+
+
+/* Returns the number of bytes in blocks of the specified size class. */
+size_t class_size(int cls) {
+    size_t base;
+    int k;
+
+    assert(cls >= 0 && cls < ARENA_NUM_CLASSES);
+
+    if (cls < NUM_FINE_CLASSES)
+        return (size_t) (cls + 1) * ARENA_ALIGN;
+
+    k = cls - NUM_FINE_CLASSES;
+    base = (size_t) FINE_MAX << (k / CLASSES_PER_DOUBLING);
+    return base + (k % CLASSES_PER_DOUBLING + 1) * (base / CLASSES_PER_DOUBLING);
+}
+
+
+/* Carves a new block of the specified class size out of the arena's current
+ * chunk, starting a new chunk if the current one doesn't have room.
+ */
+void * carve_block(mm_arena *arena, size_t size) {
+    arena_chunk *chunk;
+    size_t align = (size % ARENA_LINE == 0) ? ARENA_LINE : ARENA_ALIGN;
+    char *block;
+
+    block = (char *) (((size_t) arena->next + align - 1) & ~(align - 1));
+    if (arena->next == NULL || block + size > arena->end) {
+        /* The rest of the current chunk is left unused. */
+        chunk = alloc_from_system(arena->next_chunk_size);
+        chunk->size = arena->next_chunk_size;
+        chunk->prev = NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->reserved_bytes += chunk->size;
+
+        arena->next = (char *) (chunk + 1);
+        arena->end = (char *) chunk + chunk->size;
+        if (arena->next_chunk_size < CHUNK_MAX)
+            arena->next_chunk_size *= 2;
+
+        block = arena->next;
+    }
+
+    arena->next = block + size;
+    return block;
+}
+
+
+/* Allocates a large block on its own, and adds it to the arena's list. */
+void * alloc_large(mm_arena *arena, size_t size) {
+    arena_chunk *chunk = alloc_from_system(sizeof(arena_chunk) + size);
+
+    chunk->size = sizeof(arena_chunk) + size;
+    chunk->prev = NULL;
+    chunk->next = arena->large;
+    if (arena->large != NULL)
+        arena->large->prev = chunk;
+    arena->large = chunk;
+
+    arena->reserved_bytes += chunk->size;
+    arena->allocated_bytes += size;
+    return chunk + 1;
+}
+
+
+/* Removes a large block from the arena's list, and frees it. */
+void free_large(mm_arena *arena, void *ptr, size_t size) {
+    arena_chunk *chunk = (arena_chunk *) ptr - 1;
+
+    if (chunk->prev != NULL)
+        chunk->prev->next = chunk->next;
+    else
+        arena->large = chunk->next;
+    if (chunk->next != NULL)
+        chunk->next->prev = chunk->prev;
+
+    arena->reserved_bytes -= chunk->size;
+    arena->allocated_bytes -= size;
+    free(chunk);
+}
+
+
+/* Initializes an empty arena. */
+void arena_init(mm_arena *arena) {
+    bzero(arena, sizeof(mm_arena));
+    arena->next_chunk_size = CHUNK_MIN;
+}
+
+
+/* Releases all memory held by an arena, leaving it empty. */
+void arena_clear(mm_arena *arena) {
+    arena_chunk *chunk, *next;
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    for (chunk = arena->large; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    arena_init(arena);
+}
+
+
+/* Allocates a block of the specified size. */
+void * arena_alloc(mm_arena *arena, size_t size) {
+    void *block;
+    int cls;
+
+    arena->requested_bytes += size;
+
+    if (size > ARENA_SMALL_MAX)
+        return alloc_large(arena, size);
+
+    cls = size_class(size);
+    arena->allocated_bytes += class_size(cls);
+
+    block = arena->free_lists[cls];
+    if (block != NULL) {
+        arena->free_lists[cls] = *(void **) block;
+        return block;
+    }
+
+    return carve_block(arena, class_size(cls));
+}
+
+
+/* Allocates a zero-filled block of the specified size. */
+void * arena_zalloc(mm_arena *arena, size_t size) {
+    void *block = arena_alloc(arena, size);
+
+    bzero(block, size);
+    return block;
+}
+
+
+/* Frees a block that was allocated with the specified size. */
+void arena_free(mm_arena *arena, void *ptr, size_t size) {
+    int cls;
+
+    if (ptr == NULL)
+        return;
+
+    arena->requested_bytes -= size;
+
+    if (size > ARENA_SMALL_MAX) {
+        free_large(arena, ptr, size);
+        return;
+    }
+
+    cls = size_class(size);
+    arena->allocated_bytes -= class_size(cls);
+
+#ifdef DEBUG_ZERO
+    /* Clear out what we are about to free, to expose issues quickly. */
+    bzero(ptr, size);
+#endif
+
+    *(void **) ptr = arena->free_lists[cls];
+    arena->free_lists[cls] = ptr;
+}
+
+
+/* Resizes a block, moving it if necessary, and returns its new address. */
+void * arena_realloc(mm_arena *arena, void *ptr, size_t old_size,
+                     size_t new_size) {
+    void *block;
+
+    if (ptr == NULL)
+        return arena_alloc(arena, new_size);
+
+    /* If both sizes round up to the same class, the block already fits. */
+    if (old_size <= ARENA_SMALL_MAX && new_size <= ARENA_SMALL_MAX &&
+        size_class(old_size) == size_class(new_size)) {
+        arena->requested_bytes += new_size - old_size;
+        return ptr;
+    }
+
+    block = arena_alloc(arena, new_size);
+    memcpy(block, ptr, old_size < new_size ? old_size : new_size);
+    arena_free(arena, ptr, old_size);
+
+    return block;
+}
+
+
+/* Moves all of the memory held by src into dst, leaving src empty.  Any room
+ * left in src's current chunk is not used again.
+ */
+void arena_merge(mm_arena *dst, mm_arena *src) {
+    arena_chunk *chunk;
+    void **p_block;
+    int cls;
+
+    if (src->chunks != NULL) {
+        for (chunk = src->chunks; chunk->next != NULL; chunk = chunk->next)
+            ;
+        chunk->next = dst->chunks;
+        dst->chunks = src->chunks;
+    }
+
+    if (src->large != NULL) {
+        for (chunk = src->large; chunk->next != NULL; chunk = chunk->next)
+            ;
+        chunk->next = dst->large;
+        if (dst->large != NULL)
+            dst->large->prev = chunk;
+        dst->large = src->large;
+    }
+
+    for (cls = 0; cls < ARENA_NUM_CLASSES; cls++) {
+        if (src->free_lists[cls] == NULL)
+            continue;
+
+        p_block = &src->free_lists[cls];
+        while (*p_block != NULL)
+            p_block = (void **) *p_block;
+        *p_block = dst->free_lists[cls];
+        dst->free_lists[cls] = src->free_lists[cls];
+    }
+
+    dst->reserved_bytes += src->reserved_bytes;
+    dst->allocated_bytes += src->allocated_bytes;
+    dst->requested_bytes += src->requested_bytes;
+
+    arena_init(src);
+}
@@ -0,0 +1,107 @@
+/* This file declares the arena allocator used by the optimized multimaps.
+ *
+ * Each multimap owns an arena, and allocates its nodes, value arrays and
+ * value indexes from it.  Small blocks are carved out of large chunks, and
+ * are rounded up to one of a set of size classes; freed blocks go onto a
+ * free list for their class, to be reused by later allocations of the same
+ * class.  Large blocks are allocated individually, but are still tracked by
+ * the arena.  Clearing the arena releases everything at once, without
+ * visiting the individual blocks.
+ *
+ * Blocks are not tagged with their sizes, so the caller must pass the size
+ * it asked for when freeing or resizing a block.  An arena must not be used
+ * by more than one thread at a time.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+
+/* Blocks of up to this many bytes are carved out of chunks; larger blocks
+ * are allocated individually.
+ */
+#define ARENA_SMALL_MAX 16384
+
+/* The number of size classes for small blocks:  multiples of 16 bytes up to
+ * 512 bytes, and then four classes between each power of 2 up to
+ * ARENA_SMALL_MAX.
+ */
+#define ARENA_NUM_CLASSES 52
+
+/* Every block is aligned to ARENA_ALIGN bytes.  Blocks whose size is a
+ * multiple of ARENA_LINE bytes are also aligned to a cache line.
+ */
+#define ARENA_ALIGN 16
+#define ARENA_LINE 64
+
+
+/* A chunk of memory that small blocks are carved from, or a large block;
+ * this is private to arena.c.
+ */
+typedef struct arena_chunk arena_chunk;
+
+
+/* A collection of memory blocks that are all released together. */
+typedef struct mm_arena {
+    /* The chunks that small blocks are carved from, most recent first, and
+     * the unused part of the most recent chunk.
+     */
+    arena_chunk *chunks;
+    char *next;
+    char *end;
+
+    /* The size of the next chunk to allocate; chunks grow as the arena
+     * grows, so that large arenas don't need many chunks.
+     */
+    size_t next_chunk_size;
+
+    /* The freed small blocks of each size class, waiting to be reused. */
+    void *free_lists[ARENA_NUM_CLASSES];
+
+    /* The large blocks, each allocated separately. */
+    arena_chunk *large;
+
+    /* The number of bytes obtained from the system, the number of bytes in
+     * blocks that are currently allocated (after rounding up to their size
+     * class), and the number of bytes that were asked for.
+     */
+    size_t reserved_bytes;
+    size_t allocated_bytes;
+    size_t requested_bytes;
+} mm_arena;
+
+
+/* Initializes an empty arena. */
+void arena_init(mm_arena *arena);
+
+/* Releases all memory held by an arena, leaving it empty.  This takes time
+ * proportional to the number of chunks and large blocks, not to the number
+ * of blocks allocated.
+ */
+void arena_clear(mm_arena *arena);
+
+/* Allocates a block of the specified size.  The contents are uninitialized. */
+void * arena_alloc(mm_arena *arena, size_t size);
+
+/* Allocates a zero-filled block of the specified size. */
+void * arena_zalloc(mm_arena *arena, size_t size);
+
+/* Frees a block that was allocated with the specified size.  Freeing NULL
+ * does nothing.
+ */
+void arena_free(mm_arena *arena, void *ptr, size_t size);
+
+/* Resizes a block, moving it if necessary, and returns its new address.  As
+ * with realloc(), ptr may be NULL.
+ */
+void * arena_realloc(mm_arena *arena, void *ptr, size_t old_size,
+                     size_t new_size);
+
+/* Moves all of the memory held by src into dst, leaving src empty.  This is
+ * used to combine arenas that separate threads allocated from.
+ */
+void arena_merge(mm_arena *dst, mm_arena *src);
+
+#endif
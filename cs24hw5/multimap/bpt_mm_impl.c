@@ -0,0 +1,925 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "bulkload.h"
+#include "keysearch.h"
+#include "multimap.h"
+#include "snapshot.h"
+#include "valueset.h"
+
+
+/* The number of key slots in each node.  16 ints fill exactly one 64-byte
+ * cache line, and can be searched with four SSE2 comparisons.  A node is
+ * split as soon as it fills up, so in steady state a node holds at most
+ * NODE_KEYS - 1 keys.
+ */
+#define NODE_KEYS KEYSEARCH_MAX
+
+/* Every node is aligned to a cache line, so that its keys occupy a single
+ * line and can be loaded with aligned SIMD loads.  The node types are padded
+ * out to a whole number of lines, which makes the arena line-align them.
+ */
+#define NODE_ALIGN 64
+
+/* Inner nodes hold at least NODE_KEYS / 2 - 1 keys, so a tree over 2^32 keys
+ * is at most 12 levels deep; this is enough room to record any search path.
+ */
+#define MAX_TREE_DEPTH 16
+
+/* mm_add_values_bulk() rebuilds the whole tree when a batch has at least
+ * 1/REBUILD_FRACTION as many distinct keys as the tree already holds, and
+ * otherwise inserts the batch's keys into the existing tree one at a time.
+ */
+#define REBUILD_FRACTION 16
+
+/* mm_contains_pairs_batch() walks this many probes down the tree together. */
+#define PROBE_GROUP 16
+
+
+/*============================================================================
+ * TYPES
+ *
+ *   These types are defined in the implementation file so that they can
+ *   be kept hidden to code outside this source file.  This is not for any
+ *   security reason, but rather just so we can enforce that our testing
+ *   programs are generic and don't have any access to implementation details.
+ *============================================================================*/
+
+
+/* An inner node of the B+ tree.  children[i] holds the keys k where
+ * keys[i-1] <= k < keys[i]; i.e. the child to follow is the number of keys
+ * in the node that are less than or equal to the key being looked up.
+ */
+typedef struct inner_node {
+    /* The separator keys, in increasing order.  This must come first so that
+     * it starts on a cache-line boundary.
+     */
+    int keys[NODE_KEYS];
+
+    /* The number of keys in use; there are num_keys + 1 children. */
+    int num_keys;
+
+    /* The children of this node.  These are inner nodes, or leaf nodes if
+     * this node is at the lowest inner level of the tree.
+     */
+    void *children[NODE_KEYS + 1];
+} __attribute__((aligned(NODE_ALIGN))) inner_node;
+
+
+/* A leaf node of the B+ tree, holding a sorted range of keys and their
+ * values.  The leaves are linked together in key order, so that the whole
+ * multimap can be traversed without going back up the tree.
+ */
+typedef struct leaf_node {
+    /* The keys in this leaf, in increasing order.  This must come first so
+     * that it starts on a cache-line boundary.
+     */
+    int keys[NODE_KEYS];
+
+    /* The number of keys in use. */
+    int num_keys;
+
+    /* The next leaf in key order, or NULL if this is the last leaf. */
+    struct leaf_node *next;
+
+    /* values[i] holds the values associated with keys[i]. */
+    value_set values[NODE_KEYS];
+} __attribute__((aligned(NODE_ALIGN))) leaf_node;
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    /* The root of the tree, or NULL if the multimap is empty. */
+    void *root;
+
+    /* The number of levels in the tree.  This is 1 when the root is a leaf,
+     * and 0 when the multimap is empty.
+     */
+    int height;
+
+    /* The number of distinct keys in the multimap, and the number of
+     * (key, value) pairs that have been added.
+     */
+    unsigned int num_keys;
+    unsigned long long num_pairs;
+
+    /* The nodes and their values are all allocated from this arena, so that
+     * they can all be released at once.
+     */
+    mm_arena arena;
+    /* If the multimap was opened from a snapshot, and no pairs have been
+     * added to it since, the snapshot that its pairs are read from.
+     */
+    mm_snapshot *snapshot;
+};
+
+
+/* An iterator over the pairs of a multimap, or of its snapshot. */
+struct mm_iter {
+    /* Nonzero if the multimap was read from a snapshot, in which case only
+     * snap is used.
+     */
+    int from_snapshot;
+    snap_iter snap;
+
+    /* The leaf and key whose values are being returned, and the index of the
+     * next of those values.  The iterator moves along the leaf list, so it
+     * never needs to go back up the tree.
+     */
+    leaf_node *leaf;
+    int key_index;
+    unsigned int value_index;
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *
+ *   Declarations of helper functions that are local to this module.  Again,
+ *   these are not visible outside of this module.
+ *============================================================================*/
+
+void * alloc_node(multimap *mm, size_t size);
+inner_node * alloc_inner_node(multimap *mm);
+leaf_node * alloc_leaf_node(multimap *mm);
+
+leaf_node * find_leaf(multimap *mm, int key);
+leaf_node * first_leaf(multimap *mm);
+value_set * find_values(multimap *mm, int key);
+value_set * find_or_insert(multimap *mm, int key);
+
+leaf_node * split_leaf(multimap *mm, leaf_node *leaf);
+inner_node * split_inner(multimap *mm, inner_node *node, int *p_separator);
+void insert_separator(inner_node *node, int index, int separator, void *child);
+
+void prefetch_node(const void *node, size_t size);
+
+void free_subtree(multimap *mm, void *node, int height);
+
+void build_tree(multimap *mm, const int *keys, const value_set *sets,
+                unsigned int n, value_set **slots);
+void merge_and_rebuild(multimap *mm, const bulk_batch *batch,
+                       value_set **sets);
+
+void thaw_snapshot(multimap *mm);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Allocates a cache-line aligned node of the specified size from the
+ * multimap's arena, and zeros out its contents so that we know what the
+ * initial value of everything will be.
+ */
+void * alloc_node(multimap *mm, size_t size) {
+    void *node;
+
+    assert(size % NODE_ALIGN == 0);
+
+    node = arena_zalloc(&mm->arena, size);
+    assert((size_t) node % NODE_ALIGN == 0);
+
+    return node;
+}
+
+
+/* Allocates an empty inner node. */
+inner_node * alloc_inner_node(multimap *mm) {
+    return (inner_node *) alloc_node(mm, sizeof(inner_node));
+}
+
+
+/* Allocates an empty leaf node. */
+leaf_node * alloc_leaf_node(multimap *mm) {
+    return (leaf_node *) alloc_node(mm, sizeof(leaf_node));
+}
+
+
+/* Descends from the root to the leaf that would hold the specified key.
+ * Returns NULL if the multimap is empty.
+ */
+leaf_node * find_leaf(multimap *mm, int key) {
+    void *node = mm->root;
+    int level;
+
+    for (level = mm->height; level > 1; level--) {
+        inner_node *inner = (inner_node *) node;
+        node = inner->children[count_keys_less_equal(inner->keys,
+                                                     inner->num_keys, key)];
+    }
+
+    return (leaf_node *) node;
+}
+
+
+/* Returns the leftmost leaf of the tree, or NULL if the multimap is empty. */
+leaf_node * first_leaf(multimap *mm) {
+    void *node = mm->root;
+    int level;
+
+    for (level = mm->height; level > 1; level--)
+        node = ((inner_node *) node)->children[0];
+
+    return (leaf_node *) node;
+}
+
+
+/* Returns the values associated with the specified key, or NULL if the key
+ * is not in the multimap.
+ */
+value_set * find_values(multimap *mm, int key) {
+    leaf_node *leaf;
+    int i;
+
+    leaf = find_leaf(mm, key);
+    if (leaf == NULL)
+        return NULL;
+
+    i = count_keys_less(leaf->keys, leaf->num_keys, key);
+    if (i == leaf->num_keys || leaf->keys[i] != key)
+        return NULL;
+
+    return leaf->values + i;
+}
+
+
+/* Splits a full leaf in half, moving its upper half of keys into a new leaf
+ * that follows it in the leaf list.  Returns the new leaf; its first key is
+ * the separator to insert into the parent.
+ */
+leaf_node * split_leaf(multimap *mm, leaf_node *leaf) {
+    leaf_node *right = alloc_leaf_node(mm);
+    int half = leaf->num_keys / 2;
+
+    assert(leaf->num_keys == NODE_KEYS);
+
+    right->num_keys = leaf->num_keys - half;
+    memcpy(right->keys, leaf->keys + half, right->num_keys * sizeof(int));
+    memcpy(right->values, leaf->values + half,
+           right->num_keys * sizeof(value_set));
+    leaf->num_keys = half;
+
+    right->next = leaf->next;
+    leaf->next = right;
+
+    return right;
+}
+
+
+/* Splits a full inner node.  The lower half of the keys stay in node, the
+ * middle key is stored into *p_separator to be moved up into the parent, and
+ * the upper half are moved into a new node, which is returned.
+ */
+inner_node * split_inner(multimap *mm, inner_node *node, int *p_separator) {
+    inner_node *right = alloc_inner_node(mm);
+    int half = node->num_keys / 2;
+
+    assert(node->num_keys == NODE_KEYS);
+
+    *p_separator = node->keys[half];
+
+    right->num_keys = node->num_keys - half - 1;
+    memcpy(right->keys, node->keys + half + 1, right->num_keys * sizeof(int));
+    memcpy(right->children, node->children + half + 1,
+           (right->num_keys + 1) * sizeof(void *));
+    node->num_keys = half;
+
+    return right;
+}
+
+
+/* Inserts a separator key at the specified index of an inner node, with the
+ * new child to its right.  The node must not already be full.
+ */
+void insert_separator(inner_node *node, int index, int separator, void *child) {
+    assert(node->num_keys < NODE_KEYS);
+
+    memmove(node->keys + index + 1, node->keys + index,
+            (node->num_keys - index) * sizeof(int));
+    memmove(node->children + index + 2, node->children + index + 1,
+            (node->num_keys - index) * sizeof(void *));
+
+    node->keys[index] = separator;
+    node->children[index + 1] = child;
+    node->num_keys++;
+}
+
+
+/* Prefetches every cache line of a node. */
+void prefetch_node(const void *node, size_t size) {
+    size_t offset;
+
+    for (offset = 0; offset < size; offset += NODE_ALIGN)
+        __builtin_prefetch((const char *) node + offset);
+}
+
+
+/* This helper function returns the nodes of a subtree of the specified
+ * height to the multimap's arena.  The value sets in its leaves are left
+ * alone, since the caller has moved them elsewhere.
+ */
+void free_subtree(multimap *mm, void *node, int height) {
+    int i;
+
+    if (node == NULL)
+        return;
+
+    if (height > 1) {
+        inner_node *inner = (inner_node *) node;
+        for (i = 0; i <= inner->num_keys; i++)
+            free_subtree(mm, inner->children[i], height - 1);
+    }
+
+    arena_free(&mm->arena, node,
+               height > 1 ? sizeof(inner_node) : sizeof(leaf_node));
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm = malloc(sizeof(multimap));
+    mm->root = NULL;
+    mm->height = 0;
+    mm->num_keys = 0;
+    mm->num_pairs = 0;
+    arena_init(&mm->arena);
+    mm->snapshot = NULL;
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.  Every node and value set came from the multimap's arena,
+ * so they are all released together without walking the tree.
+ */
+void clear_multimap(multimap *mm) {
+    assert(mm != NULL);
+    arena_clear(&mm->arena);
+    mm->root = NULL;
+    mm->height = 0;
+    mm->num_keys = 0;
+    mm->num_pairs = 0;
+
+    if (mm->snapshot != NULL) {
+        snap_close(mm->snapshot);
+        mm->snapshot = NULL;
+    }
+}
+
+
+/* Loads the pairs of the snapshot that the multimap was opened from into the
+ * multimap's own data structures, so that more pairs can be added to it.
+ */
+void thaw_snapshot(multimap *mm) {
+    mm_snapshot *snap = mm->snapshot;
+
+    mm->snapshot = NULL;
+    snap_add_to_multimap(snap, mm);
+    snap_close(snap);
+}
+
+
+/* Opens a snapshot file as a multimap, which reads its pairs from the mapped
+ * file until pairs are added to it.
+ */
+multimap * mm_open_snapshot(const char *path) {
+    mm_snapshot *snap;
+    multimap *mm;
+
+    snap = snap_open(path);
+    if (snap == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->snapshot = snap;
+    return mm;
+}
+
+
+/* Returns the values associated with the specified key, inserting the key
+ * into the tree with an empty set of values if it isn't there already.
+ */
+value_set * find_or_insert(multimap *mm, int key) {
+    inner_node *path[MAX_TREE_DEPTH];
+    int path_index[MAX_TREE_DEPTH];
+    int depth, level, i, separator;
+    void *node, *new_child;
+    leaf_node *leaf;
+
+    if (mm->root == NULL) {
+        mm->root = alloc_leaf_node(mm);
+        mm->height = 1;
+    }
+
+    /* Walk down to the leaf, remembering each inner node and the child that
+     * we followed, since those are where any splits will be propagated.
+     */
+    node = mm->root;
+    depth = 0;
+    for (level = mm->height; level > 1; level--) {
+        inner_node *inner = (inner_node *) node;
+
+        assert(depth < MAX_TREE_DEPTH);
+        path[depth] = inner;
+        path_index[depth] = count_keys_less_equal(inner->keys,
+                                                  inner->num_keys, key);
+        node = inner->children[path_index[depth]];
+        depth++;
+    }
+    leaf = (leaf_node *) node;
+
+    i = count_keys_less(leaf->keys, leaf->num_keys, key);
+    if (i < leaf->num_keys && leaf->keys[i] == key)
+        return leaf->values + i;
+
+    /* Otherwise, make room for a new key in the leaf. */
+    memmove(leaf->keys + i + 1, leaf->keys + i,
+            (leaf->num_keys - i) * sizeof(int));
+    memmove(leaf->values + i + 1, leaf->values + i,
+            (leaf->num_keys - i) * sizeof(value_set));
+    leaf->keys[i] = key;
+    vs_init(leaf->values + i);
+    leaf->num_keys++;
+    mm->num_keys++;
+
+    if (leaf->num_keys < NODE_KEYS)
+        return leaf->values + i;
+
+    /* The leaf is full, so split it, and keep splitting inner nodes up the
+     * path for as long as adding the new separator fills them.  The key's
+     * value set may move in the split, so it is looked up again afterward.
+     */
+    new_child = split_leaf(mm, leaf);
+    separator = ((leaf_node *) new_child)->keys[0];
+
+    while (depth > 0) {
+        inner_node *parent = path[--depth];
+
+        insert_separator(parent, path_index[depth], separator, new_child);
+        if (parent->num_keys < NODE_KEYS)
+            return find_values(mm, key);
+
+        new_child = split_inner(mm, parent, &separator);
+    }
+
+    /* The root itself was split, so the tree grows a level. */
+    inner_node *root = alloc_inner_node(mm);
+    root->keys[0] = separator;
+    root->num_keys = 1;
+    root->children[0] = mm->root;
+    root->children[1] = new_child;
+
+    mm->root = root;
+    mm->height++;
+
+    return find_values(mm, key);
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL)
+        thaw_snapshot(mm);
+
+    vs_add(find_or_insert(mm, key), &mm->arena, value);
+    mm->num_pairs++;
+}
+
+
+/* Builds a tree bottom-up from n keys in increasing order and their value
+ * sets, replacing the multimap's current tree, which must already have been
+ * freed.  Leaves and inner nodes are filled as far as possible without being
+ * full, and the sizes of the nodes at each level are evened out.  The value
+ * set of keys[i] is stored into slots[i].
+ */
+void build_tree(multimap *mm, const int *keys, const value_set *sets,
+                unsigned int n, value_set **slots) {
+    void **level;
+    int *level_min;
+    unsigned int count, num_parents, p, c, first, last, i;
+    leaf_node *leaf, *prev = NULL;
+    inner_node *inner;
+
+    mm->root = NULL;
+    mm->height = 0;
+    mm->num_keys = n;
+
+    if (n == 0)
+        return;
+
+    /* level[] holds the nodes of the level being built, and level_min[] the
+     * smallest key under each one, which becomes its separator in the parent.
+     */
+    count = (n + NODE_KEYS - 2) / (NODE_KEYS - 1);
+    level = malloc(count * sizeof(void *));
+    level_min = malloc(count * sizeof(int));
+
+    for (p = 0; p < count; p++) {
+        first = (unsigned int) ((unsigned long long) n * p / count);
+        last = (unsigned int) ((unsigned long long) n * (p + 1) / count);
+
+        leaf = alloc_leaf_node(mm);
+        leaf->num_keys = last - first;
+        memcpy(leaf->keys, keys + first, leaf->num_keys * sizeof(int));
+        memcpy(leaf->values, sets + first, leaf->num_keys * sizeof(value_set));
+        for (i = first; i < last; i++)
+            slots[i] = leaf->values + (i - first);
+
+        if (prev != NULL)
+            prev->next = leaf;
+        prev = leaf;
+
+        level[p] = leaf;
+        level_min[p] = keys[first];
+    }
+    mm->height = 1;
+
+    /* Build each level of inner nodes over the one below it, in place. */
+    while (count > 1) {
+        num_parents = (count + NODE_KEYS - 1) / NODE_KEYS;
+
+        for (p = 0; p < num_parents; p++) {
+            first = (unsigned int) ((unsigned long long) count * p /
+                                    num_parents);
+            last = (unsigned int) ((unsigned long long) count * (p + 1) /
+                                   num_parents);
+
+            inner = alloc_inner_node(mm);
+            inner->num_keys = last - first - 1;
+            for (c = first; c < last; c++) {
+                inner->children[c - first] = level[c];
+                if (c > first)
+                    inner->keys[c - first - 1] = level_min[c];
+            }
+
+            level[p] = inner;
+            level_min[p] = level_min[first];
+        }
+
+        count = num_parents;
+        mm->height++;
+    }
+
+    mm->root = level[0];
+
+    free(level);
+    free(level_min);
+}
+
+
+/* Merges a batch's keys with the keys already in the tree, and rebuilds the
+ * tree bottom-up over all of them.  The value sets of existing keys are moved
+ * into the new tree, and new keys get empty sets.  The set for each of the
+ * batch's runs is stored into sets[run].
+ */
+void merge_and_rebuild(multimap *mm, const bulk_batch *batch,
+                       value_set **sets) {
+    unsigned int total, num_merged, *run_entry, run;
+    int *keys, key;
+    value_set *merged, **slots;
+    leaf_node *leaf;
+    int j;
+
+    total = mm->num_keys + batch->num_runs;
+    keys = malloc(total * sizeof(int));
+    merged = malloc(total * sizeof(value_set));
+    slots = malloc(total * sizeof(value_set *));
+    run_entry = malloc(batch->num_runs * sizeof(unsigned int));
+
+    /* Walk along the leaves, copying out each existing key in between the
+     * batch's keys.
+     */
+    leaf = first_leaf(mm);
+    j = 0;
+    num_merged = 0;
+    for (run = 0; run <= batch->num_runs; run++) {
+        while (leaf != NULL) {
+            if (j == leaf->num_keys) {
+                leaf = leaf->next;
+                j = 0;
+                continue;
+            }
+            if (run < batch->num_runs && leaf->keys[j] >= RUN_KEY(batch, run))
+                break;
+
+            keys[num_merged] = leaf->keys[j];
+            merged[num_merged++] = leaf->values[j++];
+        }
+
+        if (run == batch->num_runs)
+            break;
+
+        key = RUN_KEY(batch, run);
+        keys[num_merged] = key;
+        if (leaf != NULL && leaf->keys[j] == key)
+            merged[num_merged] = leaf->values[j++];
+        else
+            vs_init(merged + num_merged);
+        run_entry[run] = num_merged++;
+    }
+
+    free_subtree(mm, mm->root, mm->height);
+    build_tree(mm, keys, merged, num_merged, slots);
+
+    for (run = 0; run < batch->num_runs; run++)
+        sets[run] = slots[run_entry[run]];
+
+    free(keys);
+    free(merged);
+    free(slots);
+    free(run_entry);
+}
+
+
+/* Adds n (key, value) pairs to the multimap.  The batch is sorted by key, so
+ * that each distinct key is only looked up once, and all of a key's new
+ * values are added to its set at once.
+ */
+void mm_add_values_bulk(multimap *mm, const int *keys, const int *values,
+                        unsigned int n) {
+    bulk_batch batch;
+    value_set **sets;
+    unsigned int run;
+
+    assert(mm != NULL);
+
+    if (n == 0)
+        return;
+
+    if (mm->snapshot != NULL)
+        thaw_snapshot(mm);
+
+    init_bulk_batch(&batch, keys, values, n);
+    sets = malloc(batch.num_runs * sizeof(value_set *));
+
+    if (batch.num_runs >= mm->num_keys / REBUILD_FRACTION) {
+        merge_and_rebuild(mm, &batch, sets);
+    }
+    else {
+        /* Insert all of the keys before looking up their sets, since leaf
+         * splits move the sets around.
+         */
+        for (run = 0; run < batch.num_runs; run++)
+            find_or_insert(mm, RUN_KEY(&batch, run));
+        for (run = 0; run < batch.num_runs; run++)
+            sets[run] = find_values(mm, RUN_KEY(&batch, run));
+    }
+
+    fill_value_sets(&batch, sets, &mm->arena);
+    mm->num_pairs += n;
+
+    free(sets);
+    clear_bulk_batch(&batch);
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    if (mm->snapshot != NULL)
+        return snap_contains_key(mm->snapshot, key);
+
+    return find_values(mm, key) != NULL;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    value_set *values;
+
+    if (mm->snapshot != NULL)
+        return snap_contains_pair(mm->snapshot, key, value);
+
+    values = find_values(mm, key);
+    if (values == NULL)
+        return 0;
+
+    return vs_contains(values, value);
+}
+
+
+/* Probes the multimap for n (key, value) pairs, setting bit i % 64 of
+ * results[i / 64] if the i-th pair is present.  The probes are taken in
+ * groups, which are walked down the tree together one level at a time; since
+ * every leaf is at the same depth, they all take the same number of steps.
+ * The next node of every probe in the group is prefetched before any of them
+ * is visited, so the probes' cache misses overlap instead of each one
+ * stalling in turn.
+ */
+void mm_contains_pairs_batch(multimap *mm, const int *keys, const int *values,
+                             unsigned int n, unsigned long long *results) {
+    void *nodes[PROBE_GROUP];
+    value_set *sets[PROBE_GROUP];
+    unsigned int base, count, i;
+    int level, j;
+
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL) {
+        snap_contains_pairs_batch(mm->snapshot, keys, values, n, results);
+        return;
+    }
+
+    bzero(results, (n + 63) / 64 * sizeof(unsigned long long));
+    if (mm->root == NULL)
+        return;
+
+    for (base = 0; base < n; base += PROBE_GROUP) {
+        count = (n - base < PROBE_GROUP) ? n - base : PROBE_GROUP;
+
+        for (i = 0; i < count; i++)
+            nodes[i] = mm->root;
+
+        /* Inner nodes are prefetched whole, since the child pointer to follow
+         * is on a different line from the keys.  Only the keys of a leaf are
+         * needed to find a probe's key.
+         */
+        for (level = mm->height; level > 1; level--) {
+            for (i = 0; i < count; i++) {
+                inner_node *inner = (inner_node *) nodes[i];
+
+                nodes[i] = inner->children[
+                    count_keys_less_equal(inner->keys, inner->num_keys,
+                                          keys[base + i])];
+                if (level > 2)
+                    prefetch_node(nodes[i], sizeof(inner_node));
+                else
+                    __builtin_prefetch(nodes[i]);
+            }
+        }
+
+        /* Find each probe's key in its leaf, and prefetch its value set. */
+        for (i = 0; i < count; i++) {
+            leaf_node *leaf = (leaf_node *) nodes[i];
+
+            j = count_keys_less(leaf->keys, leaf->num_keys, keys[base + i]);
+            if (j < leaf->num_keys && leaf->keys[j] == keys[base + i]) {
+                sets[i] = leaf->values + j;
+                __builtin_prefetch(sets[i]);
+            }
+            else {
+                sets[i] = NULL;
+            }
+        }
+
+        /* Start loading every probe's values before checking any of them. */
+        for (i = 0; i < count; i++) {
+            if (sets[i] != NULL)
+                vs_prefetch(sets[i], values[base + i]);
+        }
+
+        for (i = 0; i < count; i++) {
+            if (sets[i] != NULL && vs_contains(sets[i], values[base + i]))
+                results[(base + i) / 64] |= 1ULL << ((base + i) % 64);
+        }
+    }
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.  This is a linear scan along the leaves.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    leaf_node *leaf;
+    unsigned int j;
+    int i;
+
+    if (mm->snapshot != NULL) {
+        snap_traverse(mm->snapshot, f);
+        return;
+    }
+
+    for (leaf = first_leaf(mm); leaf != NULL; leaf = leaf->next) {
+        for (i = 0; i < leaf->num_keys; i++) {
+            value_set *values = leaf->values + i;
+            for (j = 0; j < values->num_values; j++)
+                f(leaf->keys[i], values->values[j]);
+        }
+    }
+}
+
+
+/* Passes each pair with lo <= key <= hi to the specified function, in key
+ * order.  This descends to the leaf that would hold lo, and then scans along
+ * the leaves until it passes hi.
+ */
+int mm_range(multimap *mm, int lo, int hi, mm_range_func f, void *arg) {
+    leaf_node *leaf;
+    value_set *values;
+    unsigned int j;
+    int i, stop;
+
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL)
+        return snap_range(mm->snapshot, lo, hi, f, arg);
+
+    leaf = find_leaf(mm, lo);
+    if (leaf == NULL)
+        return 0;
+
+    i = count_keys_less(leaf->keys, leaf->num_keys, lo);
+    for (; leaf != NULL; leaf = leaf->next, i = 0) {
+        for (; i < leaf->num_keys; i++) {
+            if (leaf->keys[i] > hi)
+                return 0;
+
+            values = leaf->values + i;
+            for (j = 0; j < values->num_values; j++) {
+                stop = f(leaf->keys[i], values->values[j], arg);
+                if (stop)
+                    return stop;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* Returns an iterator positioned at the first pair whose key is at least the
+ * specified key.
+ */
+mm_iter * mm_iter_seek(multimap *mm, int key) {
+    mm_iter *iter = malloc(sizeof(mm_iter));
+
+    assert(mm != NULL);
+
+    iter->from_snapshot = (mm->snapshot != NULL);
+    if (iter->from_snapshot) {
+        snap_iter_seek(&iter->snap, mm->snapshot, key);
+        return iter;
+    }
+
+    iter->leaf = find_leaf(mm, key);
+    iter->key_index = 0;
+    iter->value_index = 0;
+    if (iter->leaf != NULL) {
+        iter->key_index = count_keys_less(iter->leaf->keys,
+                                          iter->leaf->num_keys, key);
+    }
+
+    return iter;
+}
+
+
+/* Stores the iterator's next pair, and returns zero once there are none. */
+int mm_iter_next(mm_iter *iter, int *p_key, int *p_value) {
+    leaf_node *leaf;
+
+    if (iter->from_snapshot)
+        return snap_iter_next(&iter->snap, p_key, p_value);
+
+    /* Skip past keys whose values are used up, and leaves whose keys are. */
+    while (iter->leaf != NULL) {
+        leaf = iter->leaf;
+        if (iter->key_index == leaf->num_keys) {
+            iter->leaf = leaf->next;
+            iter->key_index = 0;
+        }
+        else if (iter->value_index ==
+                 leaf->values[iter->key_index].num_values) {
+            iter->key_index++;
+            iter->value_index = 0;
+        }
+        else {
+            *p_key = leaf->keys[iter->key_index];
+            *p_value = leaf->values[iter->key_index].values[iter->value_index++];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Releases an iterator. */
+void mm_iter_free(mm_iter *iter) {
+    free(iter);
+}
+
+
+/* Reports how much memory the multimap is using.  This is everything held by
+ * the multimap's arena, plus the multimap structure itself.
+ */
+void mm_get_memory_usage(multimap *mm, mm_memory_usage *usage) {
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL) {
+        snap_get_memory_usage(mm->snapshot, usage);
+        return;
+    }
+
+    usage->num_pairs = mm->num_pairs;
+    usage->reserved_bytes = mm->arena.reserved_bytes + sizeof(multimap);
+    usage->used_bytes = mm->arena.allocated_bytes + sizeof(multimap);
+}
@@ -0,0 +1,314 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bulkload.h"
+
+
+/* Batches with at least this many pairs are sorted and filled using one
+ * thread per CPU, up to MAX_BULK_THREADS threads.  Setting the environment
+ * variable MM_BULK_THREADS overrides the number of threads for every batch.
+ */
+#define BULK_PARALLEL_MIN (1 << 20)
+#define MAX_BULK_THREADS 16
+
+/* Keys are sorted 8 bits at a time, least significant digit first. */
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+
+/* One thread's share of a radix-sort pass:  the pairs from lo up to hi of
+ * the source arrays.
+ */
+typedef struct sort_task {
+    const int *src_keys, *src_values;
+    int *dst_keys, *dst_values;
+    unsigned int lo, hi;
+    int shift;
+
+    /* The number of pairs in this share with each digit, and then the
+     * position in the destination arrays where the next pair with each digit
+     * is to be written.
+     */
+    unsigned int counts[RADIX_SIZE];
+} sort_task;
+
+
+/* One thread's share of fill_value_sets():  runs first_run up to last_run,
+ * allocating from the specified arena.
+ */
+typedef struct fill_task {
+    const bulk_batch *batch;
+    value_set **sets;
+    mm_arena *arena;
+    unsigned int first_run, last_run;
+} fill_task;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int bulk_num_threads(unsigned int n);
+void run_tasks(void * (*func)(void *), void *tasks, size_t task_size,
+               int num_tasks);
+
+unsigned int key_digit(int key, int shift);
+void * count_digits(void *arg);
+void * scatter_digits(void *arg);
+void sort_batch(bulk_batch *batch);
+void find_runs(bulk_batch *batch);
+
+void * fill_runs(void *arg);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the number of threads to use for a batch of n pairs. */
+int bulk_num_threads(unsigned int n) {
+    const char *env = getenv("MM_BULK_THREADS");
+    long cpus;
+
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env) < MAX_BULK_THREADS ? atoi(env) : MAX_BULK_THREADS;
+
+    if (n < BULK_PARALLEL_MIN)
+        return 1;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return cpus < MAX_BULK_THREADS ? (int) cpus : MAX_BULK_THREADS;
+}
+
+
+/* Calls func on each of num_tasks tasks, each task_size bytes long, in
+ * parallel.  The first task is run on the calling thread.
+ */
+void run_tasks(void * (*func)(void *), void *tasks, size_t task_size,
+               int num_tasks) {
+    pthread_t threads[MAX_BULK_THREADS];
+    int i;
+
+    assert(num_tasks >= 1 && num_tasks <= MAX_BULK_THREADS);
+
+    for (i = 1; i < num_tasks; i++) {
+        if (pthread_create(&threads[i], NULL, func,
+                           (char *) tasks + i * task_size) != 0) {
+            /* Couldn't start a thread, so just do its work here. */
+            func((char *) tasks + i * task_size);
+            threads[i] = pthread_self();
+        }
+    }
+
+    func(tasks);
+
+    for (i = 1; i < num_tasks; i++) {
+        if (!pthread_equal(threads[i], pthread_self()))
+            pthread_join(threads[i], NULL);
+    }
+}
+
+
+/* Returns the digit of a key that a radix-sort pass with the specified shift
+ * sorts on.  The sign bit is flipped so that negative keys sort first.
+ */
+unsigned int key_digit(int key, int shift) {
+    return (((unsigned int) key ^ 0x80000000u) >> shift) & (RADIX_SIZE - 1);
+}
+
+
+/* Counts the digits of one share of the pairs. */
+void * count_digits(void *arg) {
+    sort_task *task = (sort_task *) arg;
+    unsigned int i;
+
+    bzero(task->counts, sizeof(task->counts));
+    for (i = task->lo; i < task->hi; i++)
+        task->counts[key_digit(task->src_keys[i], task->shift)]++;
+
+    return NULL;
+}
+
+
+/* Moves one share of the pairs to their sorted positions in the destination
+ * arrays.  Since each share writes to its own positions, in the same order
+ * as the pairs appear in the source, the sort is stable.
+ */
+void * scatter_digits(void *arg) {
+    sort_task *task = (sort_task *) arg;
+    unsigned int i, pos;
+
+    for (i = task->lo; i < task->hi; i++) {
+        pos = task->counts[key_digit(task->src_keys[i], task->shift)]++;
+        task->dst_keys[pos] = task->src_keys[i];
+        task->dst_values[pos] = task->src_values[i];
+    }
+
+    return NULL;
+}
+
+
+/* Sorts the pairs of a batch by key, with an LSD radix sort.  Passes where
+ * every key has the same digit, such as the upper digits when all keys are
+ * small, are skipped.
+ */
+void sort_batch(bulk_batch *batch) {
+    sort_task tasks[MAX_BULK_THREADS];
+    int *tmp_keys, *tmp_values, *swap;
+    unsigned int n = batch->num_pairs, digit, total, pos;
+    int shift, t, skip;
+
+    tmp_keys = malloc(n * sizeof(int));
+    tmp_values = malloc(n * sizeof(int));
+
+    for (t = 0; t < batch->num_threads; t++) {
+        tasks[t].lo = (unsigned int) ((unsigned long long) n * t /
+                                      batch->num_threads);
+        tasks[t].hi = (unsigned int) ((unsigned long long) n * (t + 1) /
+                                      batch->num_threads);
+    }
+
+    for (shift = 0; shift < 32; shift += RADIX_BITS) {
+        for (t = 0; t < batch->num_threads; t++) {
+            tasks[t].src_keys = batch->keys;
+            tasks[t].src_values = batch->values;
+            tasks[t].dst_keys = tmp_keys;
+            tasks[t].dst_values = tmp_values;
+            tasks[t].shift = shift;
+        }
+        run_tasks(count_digits, tasks, sizeof(sort_task), batch->num_threads);
+
+        /* Turn the counts into starting positions; each share of a digit's
+         * pairs goes after the shares of the threads before it.
+         */
+        skip = 0;
+        pos = 0;
+        for (digit = 0; digit < RADIX_SIZE; digit++) {
+            total = 0;
+            for (t = 0; t < batch->num_threads; t++) {
+                unsigned int count = tasks[t].counts[digit];
+                tasks[t].counts[digit] = pos;
+                pos += count;
+                total += count;
+            }
+            if (total == n)
+                skip = 1;
+        }
+        if (skip)
+            continue;
+
+        run_tasks(scatter_digits, tasks, sizeof(sort_task),
+                  batch->num_threads);
+
+        swap = batch->keys;
+        batch->keys = tmp_keys;
+        tmp_keys = swap;
+
+        swap = batch->values;
+        batch->values = tmp_values;
+        tmp_values = swap;
+    }
+
+    free(tmp_keys);
+    free(tmp_values);
+}
+
+
+/* Splits the sorted pairs of a batch into runs with the same key. */
+void find_runs(bulk_batch *batch) {
+    unsigned int i;
+
+    batch->starts = malloc((batch->num_pairs + 1) * sizeof(unsigned int));
+    batch->num_runs = 0;
+
+    for (i = 0; i < batch->num_pairs; i++) {
+        if (i == 0 || batch->keys[i] != batch->keys[i - 1])
+            batch->starts[batch->num_runs++] = i;
+    }
+    batch->starts[batch->num_runs] = batch->num_pairs;
+}
+
+
+/* Copies and sorts n pairs into a batch. */
+void init_bulk_batch(bulk_batch *batch, const int *keys, const int *values,
+                     unsigned int n) {
+    batch->num_pairs = n;
+    batch->num_threads = bulk_num_threads(n);
+
+    batch->keys = malloc(n * sizeof(int));
+    batch->values = malloc(n * sizeof(int));
+    memcpy(batch->keys, keys, n * sizeof(int));
+    memcpy(batch->values, values, n * sizeof(int));
+
+    sort_batch(batch);
+    find_runs(batch);
+}
+
+
+/* Releases the memory held by a batch. */
+void clear_bulk_batch(bulk_batch *batch) {
+    free(batch->keys);
+    free(batch->values);
+    free(batch->starts);
+    bzero(batch, sizeof(bulk_batch));
+}
+
+
+/* Adds the values of one thread's share of the runs to their sets. */
+void * fill_runs(void *arg) {
+    fill_task *task = (fill_task *) arg;
+    const bulk_batch *batch = task->batch;
+    unsigned int run;
+
+    for (run = task->first_run; run < task->last_run; run++) {
+        vs_add_many(task->sets[run], task->arena, batch->values + batch->starts[run],
+                    batch->starts[run + 1] - batch->starts[run]);
+    }
+
+    return NULL;
+}
+
+
+/* Adds the values of each run of the batch to sets[run].  Arenas can't be
+ * shared between threads, so each extra thread allocates from an arena of
+ * its own, which is merged into the sets' arena once the threads finish.
+ */
+void fill_value_sets(const bulk_batch *batch, value_set **sets,
+                     mm_arena *arena) {
+    fill_task tasks[MAX_BULK_THREADS];
+    mm_arena thread_arenas[MAX_BULK_THREADS];
+    unsigned int run = 0;
+    int t;
+
+    /* Give each thread about the same number of pairs, rather than the same
+     * number of runs, since runs can be very different lengths.
+     */
+    for (t = 0; t < batch->num_threads; t++) {
+        unsigned long long end = (unsigned long long) batch->num_pairs *
+                                 (t + 1) / batch->num_threads;
+
+        tasks[t].batch = batch;
+        tasks[t].sets = sets;
+        tasks[t].arena = arena;
+        if (t > 0) {
+            arena_init(thread_arenas + t);
+            tasks[t].arena = thread_arenas + t;
+        }
+        tasks[t].first_run = run;
+        while (run < batch->num_runs && batch->starts[run] < end)
+            run++;
+        tasks[t].last_run = run;
+    }
+    assert(run == batch->num_runs);
+
+    run_tasks(fill_runs, tasks, sizeof(fill_task), batch->num_threads);
+
+    for (t = 1; t < batch->num_threads; t++)
+        arena_merge(arena, thread_arenas + t);
+}
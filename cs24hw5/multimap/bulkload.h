@@ -0,0 +1,54 @@
+/* This file declares the helpers shared by the optimized multimaps'
+ * implementations of mm_add_values_bulk().
+ *
+ * A batch of pairs is copied and radix-sorted by key, and then split into
+ * runs of pairs with the same key.  The multimap implementation creates or
+ * finds the value set for each run's key, and then fill_value_sets() adds
+ * each run's values to its set.  Large batches are sorted and filled using
+ * several threads.
+ */
+
+#ifndef BULKLOAD_H
+#define BULKLOAD_H
+
+#include "valueset.h"
+
+
+/* A batch of (key, value) pairs, sorted by key. */
+typedef struct bulk_batch {
+    /* The keys and values of the pairs, sorted by key.  Pairs with the same
+     * key are in the order they were passed in.
+     */
+    int *keys;
+    int *values;
+    unsigned int num_pairs;
+
+    /* Run i is the pairs from starts[i] up to starts[i + 1]; all pairs in a
+     * run have the same key, and each run has a different key.
+     */
+    unsigned int *starts;
+    unsigned int num_runs;
+
+    /* The number of threads to use when processing the batch. */
+    int num_threads;
+} bulk_batch;
+
+
+/* Copies and sorts n pairs into a batch. */
+void init_bulk_batch(bulk_batch *batch, const int *keys, const int *values,
+                     unsigned int n);
+
+/* Releases the memory held by a batch. */
+void clear_bulk_batch(bulk_batch *batch);
+
+/* Returns the key of a batch's run. */
+#define RUN_KEY(batch, run) ((batch)->keys[(batch)->starts[run]])
+
+/* Adds the values of each run of the batch to sets[run], which were all
+ * allocated from the specified arena.  The sets must all be distinct, since
+ * they may be filled by different threads.
+ */
+void fill_value_sets(const bulk_batch *batch, value_set **sets,
+                     mm_arena *arena);
+
+#endif
@@ -0,0 +1,1345 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keysearch.h"
+#include "multimap.h"
+#include "snapshot.h"
+
+
+/* This is a thread-safe implementation of the multimap.  Any number of
+ * threads may probe and traverse the multimap while other threads add pairs
+ * to it, and the probing threads never take a lock or write to shared
+ * memory other than their own reader slot.
+ *
+ *  - Keys are kept in a copy-on-write B+ tree.  A writer never modifies a
+ *    node that readers can see; it copies the nodes along the path to the
+ *    leaf it changes and then publishes the new tree with a single atomic
+ *    pointer store.  Readers see either the old tree or the new one.
+ *
+ *  - Each key's values are kept in an append-only array, whose length is
+ *    published after each value is written, and once a key has more than a
+ *    few values, also in an insert-only hash table of its distinct values.
+ *    Arrays and tables that fill up are copied into larger ones, which are
+ *    then published in the same way.
+ *
+ *  - Memory that readers may still be using, such as replaced tree nodes
+ *    and outgrown arrays, is freed with epoch-based reclamation.  Each
+ *    reading thread announces the epoch in which it started reading, and
+ *    retired memory is only freed once every reader that might still hold a
+ *    pointer to it has finished.
+ *
+ *  - Writers are serialized by a mutex per multimap.
+ *
+ * A multimap opened from a snapshot reads the snapshot until the first pair
+ * is added, when the writer loads the snapshot's pairs into the tree and
+ * then stops publishing the snapshot.  The snapshot stays mapped until the
+ * multimap is cleared, since readers may still be using it.
+ *
+ * An iterator holds a read of the multimap from mm_iter_seek() until
+ * mm_iter_free(), so it must be freed by the thread that created it, and
+ * retired memory isn't reclaimed while it is open.
+ *
+ * clear_multimap() must not be called while other threads are using the
+ * multimap.
+ */
+
+
+/* The number of key slots in each node; see bpt_mm_impl.c.  A node is split
+ * as soon as it fills up, so in steady state a node holds at most
+ * NODE_KEYS - 1 keys.
+ */
+#define NODE_KEYS KEYSEARCH_MAX
+#define NODE_ALIGN 64
+
+/* Enough room to record any search path; see bpt_mm_impl.c. */
+#define MAX_TREE_DEPTH 16
+
+/* Keys with at most this many values are probed by scanning their values;
+ * keys with more also get a hash table.
+ */
+#define SMALL_MAX 16
+
+/* The value used to mark an empty hash-table slot.  Whether the table
+ * contains this value itself is recorded separately.
+ */
+#define EMPTY_SLOT INT_MIN
+
+/* The maximum number of threads that can be using concurrent multimaps at
+ * once.  A thread's reader slot is released when the thread exits.
+ */
+#define MAX_READER_THREADS 256
+
+/* Retired memory is reclaimed once this many allocations have been retired
+ * since the last reclamation.
+ */
+#define RECLAIM_THRESHOLD 256
+
+/* The path-copying insert retires at most this many allocations:  the old
+ * version of the tree, and one node per level.
+ */
+#define MAX_RETIRED_PER_INSERT (MAX_TREE_DEPTH + 2)
+
+
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/*============================================================================
+ * TYPES
+ *
+ *   These types are defined in the implementation file so that they can
+ *   be kept hidden to code outside this source file.  This is not for any
+ *   security reason, but rather just so we can enforce that our testing
+ *   programs are generic and don't have any access to implementation details.
+ *============================================================================*/
+
+
+/* An append-only array of the values associated with a key.  Values past
+ * num_values may be in the middle of being written, and must not be read.
+ */
+typedef struct value_array {
+    unsigned int capacity;
+    unsigned int num_values;
+    int values[];
+} value_array;
+
+
+/* An insert-only, open-addressed hash table of the distinct values
+ * associated with a key.  Slots only ever change from EMPTY_SLOT to a value,
+ * so readers can probe the table while the writer inserts into it.
+ */
+typedef struct value_table {
+    /* The number of slots, which is a power of 2, and the shift that turns
+     * a hash code into a slot number.
+     */
+    unsigned int size;
+    unsigned int shift;
+
+    /* The number of values in the table, and whether the key has the value
+     * EMPTY_SLOT.
+     */
+    unsigned int num_distinct;
+    int has_empty_value;
+
+    int slots[];
+} value_table;
+
+
+/* A key in the multimap and its values.  Entries are shared by every
+ * version of the tree, and are only freed by clear_multimap().
+ */
+typedef struct key_entry {
+    int key;
+
+    /* The key's values.  The writer replaces these pointers when the array
+     * or table fills up; the table is NULL while the key has few values.
+     */
+    value_array *values;
+    value_table *table;
+} key_entry;
+
+
+/* An inner node of the B+ tree; see bpt_mm_impl.c.  Once a node is
+ * reachable from a published tree, it is never modified.
+ */
+typedef struct inner_node {
+    int keys[NODE_KEYS];
+    int num_keys;
+    void *children[NODE_KEYS + 1];
+} inner_node;
+
+
+/* A leaf node of the B+ tree.  Leaves aren't linked together, since copying
+ * a leaf would then mean copying the leaf before it too.
+ */
+typedef struct leaf_node {
+    int keys[NODE_KEYS];
+    int num_keys;
+    key_entry *entries[NODE_KEYS];
+} leaf_node;
+
+
+/* A published version of the tree.  The root and height are published
+ * together, so that readers always see a consistent pair.
+ */
+typedef struct tree_version {
+    void *root;
+    int height;
+} tree_version;
+
+
+/* The path from the root of a version of the tree down to a leaf, used to
+ * step from leaf to leaf since the leaves aren't linked.  nodes[i] is the
+ * inner node at depth i, and indexes[i] is the child that the path follows.
+ */
+typedef struct tree_path {
+    int depth;
+    inner_node *nodes[MAX_TREE_DEPTH];
+    int indexes[MAX_TREE_DEPTH];
+} tree_path;
+
+
+/* An allocation that has been removed from the multimap, and the global
+ * epoch at the time it was removed.
+ */
+typedef struct retired_ptr {
+    void *ptr;
+    unsigned long long epoch;
+} retired_ptr;
+
+
+/* The state of one reading thread.  Each slot has its own cache line, so
+ * that readers don't slow each other down by writing to their slots.
+ */
+typedef struct reader_slot {
+    /* The global epoch when the thread started its current read, or 0 if
+     * the thread isn't reading.
+     */
+    unsigned long long epoch;
+
+    /* Nonzero if the slot belongs to a thread. */
+    int in_use;
+
+    /* How many reads the owning thread has started and not finished, since
+     * a traversal callback may probe the multimap itself.
+     */
+    int depth;
+} __attribute__((aligned(64))) reader_slot;
+
+
+/* The entry-point of the multimap data structure. */
+struct multimap {
+    /* The current version of the tree, or NULL if the multimap is empty. */
+    tree_version *tree;
+
+    /* Held by any thread that is adding pairs to the multimap. */
+    pthread_mutex_t write_lock;
+
+    /* Allocations that readers may still be using, waiting to be freed. */
+    retired_ptr *retired;
+    unsigned int num_retired;
+    unsigned int max_retired;
+    unsigned int reclaim_at;
+
+    /* If the multimap was opened from a snapshot, and no pairs have been
+     * added to it since, the snapshot that its pairs are read from.  Once
+     * pairs are added, the snapshot is moved to old_snapshot.
+     */
+    mm_snapshot *snapshot;
+    mm_snapshot *old_snapshot;
+};
+
+
+/* An iterator over the pairs of a multimap, or of its snapshot. */
+struct mm_iter {
+    /* Nonzero if the multimap was read from a snapshot, in which case only
+     * snap is used.
+     */
+    int from_snapshot;
+    snap_iter snap;
+
+    /* The path to the current leaf of the version of the tree that was
+     * current when the iterator was created, or a NULL leaf once the
+     * iterator has passed the last leaf.
+     */
+    tree_path path;
+    leaf_node *leaf;
+    int key_index;
+
+    /* The values of the current key as they were when the iterator reached
+     * it, and the index of the next of them.
+     */
+    const value_array *array;
+    unsigned int num_values;
+    unsigned int value_index;
+};
+
+
+/*============================================================================
+ * GLOBAL STATE
+ *
+ *   Epochs and reader slots are shared by every concurrent multimap.
+ *============================================================================*/
+
+unsigned long long global_epoch = 1;
+
+reader_slot reader_slots[MAX_READER_THREADS];
+
+/* Releases a thread's reader slot when the thread exits. */
+pthread_key_t reader_slot_key;
+pthread_once_t reader_slot_once = PTHREAD_ONCE_INIT;
+
+/* The calling thread's reader slot, or NULL if it doesn't have one yet. */
+__thread reader_slot *my_reader_slot;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *
+ *   Declarations of helper functions that are local to this module.  Again,
+ *   these are not visible outside of this module.
+ *============================================================================*/
+
+void create_reader_slot_key(void);
+void release_reader_slot(void *slot);
+reader_slot * get_reader_slot(void);
+tree_version * begin_read(multimap *mm);
+void end_read(void);
+
+void retire(multimap *mm, void *ptr);
+void reclaim(multimap *mm);
+
+void * alloc_node(size_t size);
+
+value_array * alloc_value_array(unsigned int capacity);
+value_table * alloc_value_table(unsigned int min_size);
+unsigned int table_slot(const value_table *table, int value);
+int table_contains(const value_table *table, int value);
+int table_insert(value_table *table, int value);
+void table_add(multimap *mm, key_entry *entry, int value);
+
+key_entry * new_entry(int key);
+int entry_contains(const key_entry *entry, int value);
+void entry_add(multimap *mm, key_entry *entry, int value);
+void free_entry(key_entry *entry);
+
+key_entry * find_entry(const tree_version *tree, int key);
+void insert_entry(multimap *mm, key_entry *entry);
+void add_pair_locked(multimap *mm, int key, int value);
+void thaw_snapshot_locked(multimap *mm);
+
+leaf_node * split_leaf(leaf_node *leaf);
+inner_node * split_inner(inner_node *node, int *p_separator);
+void insert_separator(inner_node *node, int index, int separator, void *child);
+
+void free_subtree(void *node, int height);
+void count_subtree_memory(void *node, int height, mm_memory_usage *usage);
+void traverse_subtree(void *node, int height, void (*f)(int key, int value));
+
+leaf_node * seek_leaf(const tree_version *tree, int key, tree_path *path);
+leaf_node * next_leaf(tree_path *path);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Creates the thread-specific key whose destructor releases reader slots. */
+void create_reader_slot_key(void) {
+    pthread_key_create(&reader_slot_key, release_reader_slot);
+}
+
+
+/* Releases the reader slot of a thread that is exiting. */
+void release_reader_slot(void *slot) {
+    reader_slot *rs = (reader_slot *) slot;
+
+    STORE_RELEASE(&rs->epoch, 0ULL);
+    STORE_RELEASE(&rs->in_use, 0);
+}
+
+
+/* Returns the calling thread's reader slot, claiming a free one the first
+ * time the thread reads any concurrent multimap.
+ */
+reader_slot * get_reader_slot(void) {
+    int i;
+
+    if (my_reader_slot != NULL)
+        return my_reader_slot;
+
+    pthread_once(&reader_slot_once, create_reader_slot_key);
+
+    for (i = 0; i < MAX_READER_THREADS; i++) {
+        if (__sync_bool_compare_and_swap(&reader_slots[i].in_use, 0, 1)) {
+            my_reader_slot = reader_slots + i;
+            my_reader_slot->depth = 0;
+            pthread_setspecific(reader_slot_key, my_reader_slot);
+            return my_reader_slot;
+        }
+    }
+
+    fprintf(stderr, "More than %d threads are using concurrent multimaps.\n",
+            MAX_READER_THREADS);
+    abort();
+}
+
+
+/* Starts a read of the multimap, and returns the current version of the
+ * tree, which stays valid until end_read() is called.
+ */
+tree_version * begin_read(multimap *mm) {
+    reader_slot *slot = get_reader_slot();
+
+    if (slot->depth++ == 0) {
+        /* Announce the epoch before loading any pointers.  If the epoch is
+         * advanced in between, the announced epoch is just older than it
+         * needs to be, which only delays reclamation.
+         */
+        __atomic_store_n(&slot->epoch, LOAD_ACQUIRE(&global_epoch),
+                         __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    return LOAD_ACQUIRE(&mm->tree);
+}
+
+
+/* Finishes a read of the multimap. */
+void end_read(void) {
+    reader_slot *slot = my_reader_slot;
+
+    assert(slot != NULL && slot->depth > 0);
+    if (--slot->depth == 0)
+        STORE_RELEASE(&slot->epoch, 0ULL);
+}
+
+
+/* Records an allocation that has just been removed from the multimap, to be
+ * freed once no reader can still be using it.  Must be called with the write
+ * lock held.
+ */
+void retire(multimap *mm, void *ptr) {
+    if (mm->num_retired == mm->max_retired) {
+        mm->max_retired = (mm->max_retired == 0) ? 64 : 2 * mm->max_retired;
+        mm->retired = realloc(mm->retired,
+                              mm->max_retired * sizeof(retired_ptr));
+    }
+
+    mm->retired[mm->num_retired].ptr = ptr;
+    mm->retired[mm->num_retired].epoch = LOAD_ACQUIRE(&global_epoch);
+    mm->num_retired++;
+
+    if (mm->num_retired >= mm->reclaim_at)
+        reclaim(mm);
+}
+
+
+/* Frees every retired allocation that no reader can still be using.  An
+ * allocation retired in epoch e can be freed once every active reader
+ * started in a later epoch, since those readers started after it was
+ * removed.  Must be called with the write lock held.
+ */
+void reclaim(multimap *mm) {
+    unsigned long long oldest = ULLONG_MAX, epoch;
+    unsigned int i, kept;
+
+    /* Advance the epoch so that new readers can't hold anything retired so
+     * far, and make sure the removals are visible before looking at the
+     * readers' epochs.
+     */
+    __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (i = 0; i < MAX_READER_THREADS; i++) {
+        if (!LOAD_ACQUIRE(&reader_slots[i].in_use))
+            continue;
+        epoch = __atomic_load_n(&reader_slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    kept = 0;
+    for (i = 0; i < mm->num_retired; i++) {
+        if (mm->retired[i].epoch < oldest)
+            free(mm->retired[i].ptr);
+        else
+            mm->retired[kept++] = mm->retired[i];
+    }
+    mm->num_retired = kept;
+
+    /* If a slow reader is holding on to a lot of memory, don't scan the
+     * readers again until a good number more allocations are retired.
+     */
+    mm->reclaim_at = kept + RECLAIM_THRESHOLD;
+}
+
+
+/* Allocates a cache-line aligned node of the specified size, and zeros out
+ * its contents so that we know what the initial value of everything will be.
+ */
+void * alloc_node(size_t size) {
+    void *node;
+
+    if (posix_memalign(&node, NODE_ALIGN, size) != 0) {
+        fprintf(stderr, "Out of memory allocating a multimap node.\n");
+        abort();
+    }
+    bzero(node, size);
+
+    return node;
+}
+
+
+/* Allocates an empty value array with room for the specified number of
+ * values.
+ */
+value_array * alloc_value_array(unsigned int capacity) {
+    value_array *array = malloc(sizeof(value_array) + capacity * sizeof(int));
+
+    array->capacity = capacity;
+    array->num_values = 0;
+    return array;
+}
+
+
+/* Allocates an empty hash table with at least the specified number of
+ * slots.
+ */
+value_table * alloc_value_table(unsigned int min_size) {
+    unsigned int size = 16, shift = 28, i;
+    value_table *table;
+
+    while (size < min_size) {
+        size *= 2;
+        shift--;
+    }
+
+    table = malloc(sizeof(value_table) + size * sizeof(int));
+    table->size = size;
+    table->shift = shift;
+    table->num_distinct = 0;
+    table->has_empty_value = 0;
+    for (i = 0; i < size; i++)
+        table->slots[i] = EMPTY_SLOT;
+
+    return table;
+}
+
+
+/* Returns the slot where a value's probe sequence starts; see valueset.c. */
+unsigned int table_slot(const value_table *table, int value) {
+    return ((unsigned int) value * 2654435761u) >> table->shift;
+}
+
+
+/* Returns nonzero if the hash table contains the value.  This may be called
+ * while the writer is inserting into the table.
+ */
+int table_contains(const value_table *table, int value) {
+    unsigned int mask = table->size - 1;
+    unsigned int slot = table_slot(table, value);
+    int current;
+
+    if (value == EMPTY_SLOT)
+        return LOAD_ACQUIRE(&table->has_empty_value);
+
+    while ((current = LOAD_ACQUIRE(&table->slots[slot])) != EMPTY_SLOT) {
+        if (current == value)
+            return 1;
+        slot = (slot + 1) & mask;
+    }
+
+    return 0;
+}
+
+
+/* Inserts a value into a hash table if it isn't already there.  Returns zero
+ * if the value is new but the table is too full to take it.
+ */
+int table_insert(value_table *table, int value) {
+    unsigned int mask = table->size - 1;
+    unsigned int slot = table_slot(table, value);
+
+    if (value == EMPTY_SLOT) {
+        STORE_RELEASE(&table->has_empty_value, 1);
+        return 1;
+    }
+
+    while (table->slots[slot] != EMPTY_SLOT) {
+        if (table->slots[slot] == value)
+            return 1;
+        slot = (slot + 1) & mask;
+    }
+
+    /* Keep the table at most half full, so probe sequences stay short. */
+    if (2 * (table->num_distinct + 1) > table->size)
+        return 0;
+
+    STORE_RELEASE(&table->slots[slot], value);
+    table->num_distinct++;
+    return 1;
+}
+
+
+/* Adds a value to a key's hash table, replacing the table with one twice the
+ * size if it is full.  Must be called with the write lock held.
+ */
+void table_add(multimap *mm, key_entry *entry, int value) {
+    value_table *table = entry->table, *bigger;
+    unsigned int i;
+
+    if (table_insert(table, value))
+        return;
+
+    bigger = alloc_value_table(2 * table->size);
+    bigger->has_empty_value = table->has_empty_value;
+    for (i = 0; i < table->size; i++) {
+        if (table->slots[i] != EMPTY_SLOT)
+            table_insert(bigger, table->slots[i]);
+    }
+    table_insert(bigger, value);
+
+    STORE_RELEASE(&entry->table, bigger);
+    retire(mm, table);
+}
+
+
+/* Allocates an entry for a key with no values. */
+key_entry * new_entry(int key) {
+    key_entry *entry = malloc(sizeof(key_entry));
+
+    entry->key = key;
+    entry->values = alloc_value_array(2);
+    entry->table = NULL;
+    return entry;
+}
+
+
+/* Returns nonzero if a key's values contain the specified value.  This may
+ * be called while the writer is adding values to the entry.
+ */
+int entry_contains(const key_entry *entry, int value) {
+    const value_table *table = LOAD_ACQUIRE(&entry->table);
+    const value_array *array;
+    unsigned int n, i;
+
+    if (table != NULL)
+        return table_contains(table, value);
+
+    array = LOAD_ACQUIRE(&entry->values);
+    n = LOAD_ACQUIRE(&array->num_values);
+    for (i = 0; i < n; i++) {
+        if (array->values[i] == value)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Adds a value to a key's entry.  Must be called with the write lock held. */
+void entry_add(multimap *mm, key_entry *entry, int value) {
+    value_array *array = entry->values, *bigger;
+    value_table *table;
+    unsigned int i;
+
+    /* If the array is full, copy it into one twice the size.  Readers still
+     * using the old array see all of the values it had.
+     */
+    if (array->num_values == array->capacity) {
+        bigger = alloc_value_array(2 * array->capacity);
+        memcpy(bigger->values, array->values, array->num_values * sizeof(int));
+        bigger->num_values = array->num_values;
+
+        STORE_RELEASE(&entry->values, bigger);
+        retire(mm, array);
+        array = bigger;
+    }
+
+    /* Write the value before publishing the new length. */
+    array->values[array->num_values] = value;
+    STORE_RELEASE(&array->num_values, array->num_values + 1);
+
+    if (entry->table != NULL) {
+        table_add(mm, entry, value);
+    }
+    else if (array->num_values > SMALL_MAX) {
+        /* Too many values to scan; build a table of them and publish it. */
+        table = alloc_value_table(4 * array->num_values);
+        for (i = 0; i < array->num_values; i++)
+            table_insert(table, array->values[i]);
+        STORE_RELEASE(&entry->table, table);
+    }
+}
+
+
+/* Frees an entry and its values. */
+void free_entry(key_entry *entry) {
+    free(entry->values);
+    free(entry->table);
+    free(entry);
+}
+
+
+/* Returns the entry for the specified key in a version of the tree, or NULL
+ * if the key isn't there.
+ */
+key_entry * find_entry(const tree_version *tree, int key) {
+    void *node;
+    leaf_node *leaf;
+    int level, i;
+
+    if (tree == NULL)
+        return NULL;
+
+    node = tree->root;
+    for (level = tree->height; level > 1; level--) {
+        inner_node *inner = (inner_node *) node;
+        node = inner->children[count_keys_less_equal(inner->keys,
+                                                     inner->num_keys, key)];
+    }
+
+    leaf = (leaf_node *) node;
+    i = count_keys_less(leaf->keys, leaf->num_keys, key);
+    if (i == leaf->num_keys || leaf->keys[i] != key)
+        return NULL;
+
+    return leaf->entries[i];
+}
+
+
+/* Splits a full leaf in half, moving its upper half of keys into a new leaf,
+ * which is returned; its first key is the separator for the parent.
+ */
+leaf_node * split_leaf(leaf_node *leaf) {
+    leaf_node *right = alloc_node(sizeof(leaf_node));
+    int half = leaf->num_keys / 2;
+
+    assert(leaf->num_keys == NODE_KEYS);
+
+    right->num_keys = leaf->num_keys - half;
+    memcpy(right->keys, leaf->keys + half, right->num_keys * sizeof(int));
+    memcpy(right->entries, leaf->entries + half,
+           right->num_keys * sizeof(key_entry *));
+    leaf->num_keys = half;
+
+    return right;
+}
+
+
+/* Splits a full inner node; see bpt_mm_impl.c. */
+inner_node * split_inner(inner_node *node, int *p_separator) {
+    inner_node *right = alloc_node(sizeof(inner_node));
+    int half = node->num_keys / 2;
+
+    assert(node->num_keys == NODE_KEYS);
+
+    *p_separator = node->keys[half];
+
+    right->num_keys = node->num_keys - half - 1;
+    memcpy(right->keys, node->keys + half + 1, right->num_keys * sizeof(int));
+    memcpy(right->children, node->children + half + 1,
+           (right->num_keys + 1) * sizeof(void *));
+    node->num_keys = half;
+
+    return right;
+}
+
+
+/* Inserts a separator key at the specified index of an inner node, with the
+ * new child to its right.  The node must not already be full.
+ */
+void insert_separator(inner_node *node, int index, int separator, void *child) {
+    assert(node->num_keys < NODE_KEYS);
+
+    memmove(node->keys + index + 1, node->keys + index,
+            (node->num_keys - index) * sizeof(int));
+    memmove(node->children + index + 2, node->children + index + 1,
+            (node->num_keys - index) * sizeof(void *));
+
+    node->keys[index] = separator;
+    node->children[index + 1] = child;
+    node->num_keys++;
+}
+
+
+/* Inserts an entry for a key that isn't in the tree yet, by copying the path
+ * from the root to the key's leaf, and publishing a new version of the tree
+ * with the copied path.  Must be called with the write lock held.
+ */
+void insert_entry(multimap *mm, key_entry *entry) {
+    tree_version *old = mm->tree, *tree;
+    inner_node *path[MAX_TREE_DEPTH];
+    int path_index[MAX_TREE_DEPTH];
+    void *replaced[MAX_RETIRED_PER_INSERT];
+    int depth, level, i, separator = 0, num_replaced;
+    void *left, *right;
+    leaf_node *leaf;
+
+    tree = malloc(sizeof(tree_version));
+
+    if (old == NULL) {
+        leaf = alloc_node(sizeof(leaf_node));
+        leaf->keys[0] = entry->key;
+        leaf->entries[0] = entry;
+        leaf->num_keys = 1;
+
+        tree->root = leaf;
+        tree->height = 1;
+        STORE_RELEASE(&mm->tree, tree);
+        return;
+    }
+
+    /* Walk down to the leaf, remembering the path. */
+    left = old->root;
+    depth = 0;
+    for (level = old->height; level > 1; level--) {
+        inner_node *inner = (inner_node *) left;
+
+        assert(depth < MAX_TREE_DEPTH);
+        path[depth] = inner;
+        path_index[depth] = count_keys_less_equal(inner->keys,
+                                                  inner->num_keys, entry->key);
+        left = inner->children[path_index[depth]];
+        depth++;
+    }
+
+    num_replaced = 0;
+    replaced[num_replaced++] = old;
+    replaced[num_replaced++] = left;
+
+    /* Copy the leaf, insert the key into the copy, and split it if full. */
+    leaf = alloc_node(sizeof(leaf_node));
+    memcpy(leaf, left, sizeof(leaf_node));
+
+    i = count_keys_less(leaf->keys, leaf->num_keys, entry->key);
+    assert(i == leaf->num_keys || leaf->keys[i] != entry->key);
+
+    memmove(leaf->keys + i + 1, leaf->keys + i,
+            (leaf->num_keys - i) * sizeof(int));
+    memmove(leaf->entries + i + 1, leaf->entries + i,
+            (leaf->num_keys - i) * sizeof(key_entry *));
+    leaf->keys[i] = entry->key;
+    leaf->entries[i] = entry;
+    leaf->num_keys++;
+
+    left = leaf;
+    right = NULL;
+    if (leaf->num_keys == NODE_KEYS) {
+        right = split_leaf(leaf);
+        separator = ((leaf_node *) right)->keys[0];
+    }
+
+    /* Copy each node on the path, pointing it at the copy of its child, and
+     * splitting it if the child split and filled it up.
+     */
+    while (depth > 0) {
+        inner_node *parent, *copy;
+
+        depth--;
+        parent = path[depth];
+        replaced[num_replaced++] = parent;
+
+        copy = alloc_node(sizeof(inner_node));
+        memcpy(copy, parent, sizeof(inner_node));
+        copy->children[path_index[depth]] = left;
+
+        if (right != NULL) {
+            insert_separator(copy, path_index[depth], separator, right);
+            right = NULL;
+            if (copy->num_keys == NODE_KEYS)
+                right = split_inner(copy, &separator);
+        }
+
+        left = copy;
+    }
+
+    tree->height = old->height;
+    if (right != NULL) {
+        /* The root itself was split, so the tree grows a level. */
+        inner_node *root = alloc_node(sizeof(inner_node));
+        root->keys[0] = separator;
+        root->num_keys = 1;
+        root->children[0] = left;
+        root->children[1] = right;
+
+        left = root;
+        tree->height++;
+    }
+    tree->root = left;
+
+    /* Publish the new tree, and only then retire the nodes it replaced. */
+    STORE_RELEASE(&mm->tree, tree);
+
+    for (i = 0; i < num_replaced; i++)
+        retire(mm, replaced[i]);
+}
+
+
+/* Adds a (key, value) pair.  Must be called with the write lock held. */
+void add_pair_locked(multimap *mm, int key, int value) {
+    key_entry *entry = find_entry(mm->tree, key);
+
+    if (entry != NULL) {
+        entry_add(mm, entry, value);
+    }
+    else {
+        /* Give a new key its value before publishing it, so that readers
+         * never see a key without any values.
+         */
+        entry = new_entry(key);
+        entry_add(mm, entry, value);
+        insert_entry(mm, entry);
+    }
+}
+
+
+/* This helper function frees a subtree of the specified height, including
+ * the entries in its leaves.
+ */
+void free_subtree(void *node, int height) {
+    int i;
+
+    if (height > 1) {
+        inner_node *inner = (inner_node *) node;
+        for (i = 0; i <= inner->num_keys; i++)
+            free_subtree(inner->children[i], height - 1);
+    }
+    else {
+        leaf_node *leaf = (leaf_node *) node;
+        for (i = 0; i < leaf->num_keys; i++)
+            free_entry(leaf->entries[i]);
+    }
+
+#ifdef DEBUG_ZERO
+    /* Clear out what we are about to free, to expose issues quickly. */
+    bzero(node, height > 1 ? sizeof(inner_node) : sizeof(leaf_node));
+#endif
+
+    free(node);
+}
+
+
+/* Initialize a multimap data structure. */
+multimap * init_multimap() {
+    multimap *mm = malloc(sizeof(multimap));
+
+    mm->tree = NULL;
+    pthread_mutex_init(&mm->write_lock, NULL);
+    mm->retired = NULL;
+    mm->num_retired = 0;
+    mm->max_retired = 0;
+    mm->reclaim_at = RECLAIM_THRESHOLD;
+    mm->snapshot = NULL;
+    mm->old_snapshot = NULL;
+
+    return mm;
+}
+
+
+/* Release all dynamically allocated memory associated with the multimap
+ * data structure.  No other thread may be using the multimap.
+ */
+void clear_multimap(multimap *mm) {
+    unsigned int i;
+
+    assert(mm != NULL);
+
+    if (mm->tree != NULL) {
+        free_subtree(mm->tree->root, mm->tree->height);
+        free(mm->tree);
+        mm->tree = NULL;
+    }
+
+    for (i = 0; i < mm->num_retired; i++)
+        free(mm->retired[i].ptr);
+    free(mm->retired);
+
+    mm->retired = NULL;
+    mm->num_retired = 0;
+    mm->max_retired = 0;
+    mm->reclaim_at = RECLAIM_THRESHOLD;
+
+    if (mm->snapshot != NULL)
+        snap_close(mm->snapshot);
+    if (mm->old_snapshot != NULL)
+        snap_close(mm->old_snapshot);
+    mm->snapshot = NULL;
+    mm->old_snapshot = NULL;
+}
+
+
+/* Loads the pairs of the snapshot that the multimap was opened from into the
+ * tree, and then switches readers over to the tree.  Must be called with the
+ * write lock held.
+ */
+void thaw_snapshot_locked(multimap *mm) {
+    mm_snapshot *snap = mm->snapshot;
+    unsigned long long j;
+    unsigned int i;
+
+    for (i = 0; i < snap->num_keys; i++) {
+        for (j = snap->offsets[i]; j < snap->offsets[i + 1]; j++)
+            add_pair_locked(mm, snap->keys[i], snap->values[j]);
+    }
+
+    STORE_RELEASE(&mm->snapshot, NULL);
+    mm->old_snapshot = snap;
+}
+
+
+/* Opens a snapshot file as a multimap, which reads its pairs from the mapped
+ * file until pairs are added to it.
+ */
+multimap * mm_open_snapshot(const char *path) {
+    mm_snapshot *snap;
+    multimap *mm;
+
+    snap = snap_open(path);
+    if (snap == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->snapshot = snap;
+    return mm;
+}
+
+
+/* Adds the specified (key, value) pair to the multimap. */
+void mm_add_value(multimap *mm, int key, int value) {
+    assert(mm != NULL);
+
+    pthread_mutex_lock(&mm->write_lock);
+    if (mm->snapshot != NULL)
+        thaw_snapshot_locked(mm);
+    add_pair_locked(mm, key, value);
+    pthread_mutex_unlock(&mm->write_lock);
+}
+
+
+/* Adds n (key, value) pairs to the multimap, taking the write lock once for
+ * the whole batch.
+ */
+void mm_add_values_bulk(multimap *mm, const int *keys, const int *values,
+                        unsigned int n) {
+    unsigned int i;
+
+    assert(mm != NULL);
+
+    pthread_mutex_lock(&mm->write_lock);
+    if (mm->snapshot != NULL && n > 0)
+        thaw_snapshot_locked(mm);
+    for (i = 0; i < n; i++)
+        add_pair_locked(mm, keys[i], values[i]);
+    pthread_mutex_unlock(&mm->write_lock);
+}
+
+
+/* Returns nonzero if the multimap contains the specified key-value, zero
+ * otherwise.
+ */
+int mm_contains_key(multimap *mm, int key) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    int found;
+
+    if (snap != NULL)
+        return snap_contains_key(snap, key);
+
+    found = find_entry(begin_read(mm), key) != NULL;
+    end_read();
+
+    return found;
+}
+
+
+/* Returns nonzero if the multimap contains the specified (key, value) pair,
+ * zero otherwise.
+ */
+int mm_contains_pair(multimap *mm, int key, int value) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    key_entry *entry;
+    int found;
+
+    if (snap != NULL)
+        return snap_contains_pair(snap, key, value);
+
+    entry = find_entry(begin_read(mm), key);
+    found = (entry != NULL && entry_contains(entry, value));
+    end_read();
+
+    return found;
+}
+
+
+/* Probes the multimap for n (key, value) pairs, setting bit i % 64 of
+ * results[i / 64] if the i-th pair is present.  All of the probes see the
+ * same version of the tree.
+ */
+void mm_contains_pairs_batch(multimap *mm, const int *keys, const int *values,
+                             unsigned int n, unsigned long long *results) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    tree_version *tree;
+    key_entry *entry;
+    unsigned int i;
+
+    if (snap != NULL) {
+        snap_contains_pairs_batch(snap, keys, values, n, results);
+        return;
+    }
+
+    bzero(results, (n + 63) / 64 * sizeof(unsigned long long));
+
+    tree = begin_read(mm);
+    for (i = 0; i < n; i++) {
+        entry = find_entry(tree, keys[i]);
+        if (entry != NULL && entry_contains(entry, values[i]))
+            results[i / 64] |= 1ULL << (i % 64);
+    }
+    end_read();
+}
+
+
+/* This helper function is used by mm_get_memory_usage() to add up the memory
+ * used by a subtree of the specified height.
+ */
+void count_subtree_memory(void *node, int height, mm_memory_usage *usage) {
+    key_entry *entry;
+    int i;
+
+    if (height > 1) {
+        inner_node *inner = (inner_node *) node;
+        for (i = 0; i <= inner->num_keys; i++)
+            count_subtree_memory(inner->children[i], height - 1, usage);
+        usage->used_bytes += sizeof(inner_node);
+        return;
+    }
+
+    leaf_node *leaf = (leaf_node *) node;
+    for (i = 0; i < leaf->num_keys; i++) {
+        entry = leaf->entries[i];
+        usage->num_pairs += entry->values->num_values;
+        usage->used_bytes += sizeof(key_entry) + sizeof(value_array) +
+                             entry->values->capacity * sizeof(int);
+        if (entry->table != NULL) {
+            usage->used_bytes += sizeof(value_table) +
+                                 entry->table->size * sizeof(int);
+        }
+    }
+    usage->used_bytes += sizeof(leaf_node);
+}
+
+
+/* This helper function is used by mm_traverse() to traverse every pair in a
+ * subtree of the specified height.
+ */
+void traverse_subtree(void *node, int height, void (*f)(int key, int value)) {
+    const value_array *array;
+    unsigned int n, j;
+    int i;
+
+    if (height > 1) {
+        inner_node *inner = (inner_node *) node;
+        for (i = 0; i <= inner->num_keys; i++)
+            traverse_subtree(inner->children[i], height - 1, f);
+        return;
+    }
+
+    leaf_node *leaf = (leaf_node *) node;
+    for (i = 0; i < leaf->num_keys; i++) {
+        array = LOAD_ACQUIRE(&leaf->entries[i]->values);
+        n = LOAD_ACQUIRE(&array->num_values);
+        for (j = 0; j < n; j++)
+            f(leaf->keys[i], array->values[j]);
+    }
+}
+
+
+/* Performs an in-order traversal of the multimap, passing each (key, value)
+ * pair to the specified function.  The traversal sees the keys of a single
+ * version of the tree; values added to those keys while the traversal runs
+ * may or may not be seen.
+ */
+void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    tree_version *tree;
+
+    if (snap != NULL) {
+        snap_traverse(snap, f);
+        return;
+    }
+
+    tree = begin_read(mm);
+    if (tree != NULL)
+        traverse_subtree(tree->root, tree->height, f);
+    end_read();
+}
+
+
+/* Returns the leaf of a version of the tree that would hold the specified
+ * key, or NULL if the tree is empty, and records the path down to it.
+ */
+leaf_node * seek_leaf(const tree_version *tree, int key, tree_path *path) {
+    void *node;
+    int level, i;
+
+    path->depth = 0;
+    if (tree == NULL)
+        return NULL;
+
+    node = tree->root;
+    for (level = tree->height; level > 1; level--) {
+        inner_node *inner = (inner_node *) node;
+        i = count_keys_less_equal(inner->keys, inner->num_keys, key);
+
+        path->nodes[path->depth] = inner;
+        path->indexes[path->depth] = i;
+        path->depth++;
+
+        node = inner->children[i];
+    }
+
+    return (leaf_node *) node;
+}
+
+
+/* Moves a path on to the next leaf, and returns that leaf, or NULL if the
+ * path was at the last leaf.  The path backs up to the deepest node with a
+ * child to the right, and then follows leftmost children back down.
+ */
+leaf_node * next_leaf(tree_path *path) {
+    void *node;
+    int d = path->depth - 1;
+
+    while (d >= 0 && path->indexes[d] == path->nodes[d]->num_keys)
+        d--;
+    if (d < 0)
+        return NULL;
+
+    path->indexes[d]++;
+    node = path->nodes[d]->children[path->indexes[d]];
+    for (d++; d < path->depth; d++) {
+        path->nodes[d] = (inner_node *) node;
+        path->indexes[d] = 0;
+        node = path->nodes[d]->children[0];
+    }
+
+    return (leaf_node *) node;
+}
+
+
+/* Passes each pair with lo <= key <= hi to the specified function, in key
+ * order.  Like mm_traverse(), the query sees the keys of a single version of
+ * the tree.
+ */
+int mm_range(multimap *mm, int lo, int hi, mm_range_func f, void *arg) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    const value_array *array;
+    tree_path path;
+    leaf_node *leaf;
+    unsigned int n, j;
+    int i, stop = 0;
+
+    if (snap != NULL)
+        return snap_range(snap, lo, hi, f, arg);
+
+    leaf = seek_leaf(begin_read(mm), lo, &path);
+    if (leaf != NULL)
+        i = count_keys_less(leaf->keys, leaf->num_keys, lo);
+
+    for (; !stop && leaf != NULL; leaf = next_leaf(&path), i = 0) {
+        for (; !stop && i < leaf->num_keys; i++) {
+            if (leaf->keys[i] > hi)
+                goto done;
+
+            array = LOAD_ACQUIRE(&leaf->entries[i]->values);
+            n = LOAD_ACQUIRE(&array->num_values);
+            for (j = 0; !stop && j < n; j++)
+                stop = f(leaf->keys[i], array->values[j], arg);
+        }
+    }
+
+done:
+    end_read();
+    return stop;
+}
+
+
+/* Returns an iterator positioned at the first pair whose key is at least the
+ * specified key.  Unless the multimap is read from a snapshot, the iterator
+ * holds a read of the multimap until it is freed.
+ */
+mm_iter * mm_iter_seek(multimap *mm, int key) {
+    mm_snapshot *snap = LOAD_ACQUIRE(&mm->snapshot);
+    mm_iter *iter = malloc(sizeof(mm_iter));
+
+    iter->from_snapshot = (snap != NULL);
+    if (iter->from_snapshot) {
+        snap_iter_seek(&iter->snap, snap, key);
+        return iter;
+    }
+
+    iter->leaf = seek_leaf(begin_read(mm), key, &iter->path);
+    iter->key_index = 0;
+    if (iter->leaf != NULL) {
+        iter->key_index = count_keys_less(iter->leaf->keys,
+                                          iter->leaf->num_keys, key);
+    }
+    iter->array = NULL;
+    iter->num_values = 0;
+    iter->value_index = 0;
+
+    return iter;
+}
+
+
+/* Stores the iterator's next pair, and returns zero once there are none. */
+int mm_iter_next(mm_iter *iter, int *p_key, int *p_value) {
+    leaf_node *leaf;
+
+    if (iter->from_snapshot)
+        return snap_iter_next(&iter->snap, p_key, p_value);
+
+    while (iter->value_index == iter->num_values) {
+        /* Move on to the next key, which may be in the next leaf. */
+        if (iter->array != NULL)
+            iter->key_index++;
+        while (iter->leaf != NULL &&
+               iter->key_index == iter->leaf->num_keys) {
+            iter->leaf = next_leaf(&iter->path);
+            iter->key_index = 0;
+        }
+        if (iter->leaf == NULL)
+            return 0;
+
+        leaf = iter->leaf;
+        iter->array = LOAD_ACQUIRE(&leaf->entries[iter->key_index]->values);
+        iter->num_values = LOAD_ACQUIRE(&iter->array->num_values);
+        iter->value_index = 0;
+    }
+
+    *p_key = iter->leaf->keys[iter->key_index];
+    *p_value = iter->array->values[iter->value_index++];
+    return 1;
+}
+
+
+/* Releases an iterator, finishing its read of the multimap. */
+void mm_iter_free(mm_iter *iter) {
+    if (!iter->from_snapshot)
+        end_read();
+    free(iter);
+}
+
+
+/* Reports how much memory the multimap is using, by walking the current
+ * tree with the write lock held.  Each block is a separate malloc() block,
+ * and malloc()'s own overhead for each block is not included; neither is
+ * retired memory that is waiting to be reclaimed.
+ */
+void mm_get_memory_usage(multimap *mm, mm_memory_usage *usage) {
+    assert(mm != NULL);
+
+    pthread_mutex_lock(&mm->write_lock);
+
+    if (mm->snapshot != NULL) {
+        snap_get_memory_usage(mm->snapshot, usage);
+        pthread_mutex_unlock(&mm->write_lock);
+        return;
+    }
+
+    usage->num_pairs = 0;
+    usage->used_bytes = sizeof(multimap) +
+                        mm->max_retired * sizeof(retired_ptr);
+    if (mm->tree != NULL) {
+        usage->used_bytes += sizeof(tree_version);
+        count_subtree_memory(mm->tree->root, mm->tree->height, usage);
+    }
+    usage->reserved_bytes = usage->used_bytes;
+
+    pthread_mutex_unlock(&mm->write_lock);
+}
@@ -0,0 +1,61 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "keysearch.h"
+
+
+/* Returns how many of the first num_keys entries of a node's sorted key array
+ * are less than key.  This is the index where key is, or would be inserted.
+ * keys must be a cache-line aligned array of KEYSEARCH_MAX ints.
+ */
+int count_keys_less(const int *keys, int num_keys, int key) {
+#ifdef __SSE2__
+    __m128i probe = _mm_set1_epi32(key);
+    unsigned int mask = 0;
+    int i;
+
+    /* Compare four keys at a time, collecting one bit per key.  Slots past
+     * num_keys are compared too, but masked off below.
+     */
+    for (i = 0; i < num_keys; i += 4) {
+        __m128i block = _mm_load_si128((const __m128i *) (keys + i));
+        __m128i less = _mm_cmplt_epi32(block, probe);
+        mask |= (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(less)) << i;
+    }
+
+    return __builtin_popcount(mask & ((1u << num_keys) - 1));
+#else
+    int i = 0;
+    while (i < num_keys && keys[i] < key)
+        i++;
+    return i;
+#endif
+}
+
+
+/* Returns how many of the first num_keys entries of a node's sorted key array
+ * are less than or equal to key.  For an inner node, this is the index of the
+ * child to follow.  keys must be a cache-line aligned array of KEYSEARCH_MAX
+ * ints.
+ */
+int count_keys_less_equal(const int *keys, int num_keys, int key) {
+#ifdef __SSE2__
+    __m128i probe = _mm_set1_epi32(key);
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < num_keys; i += 4) {
+        __m128i block = _mm_load_si128((const __m128i *) (keys + i));
+        __m128i greater = _mm_cmpgt_epi32(block, probe);
+        mask |= (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(greater)) << i;
+    }
+
+    return __builtin_popcount(~mask & ((1u << num_keys) - 1));
+#else
+    int i = 0;
+    while (i < num_keys && keys[i] <= key)
+        i++;
+    return i;
+#endif
+}
@@ -0,0 +1,26 @@
+/* This file declares the functions used by the B+ tree multimaps to search
+ * the sorted keys of a node.  Each node's keys fill one 64-byte cache line,
+ * which is searched with SSE2 comparisons where they are available.
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+
+/* The largest number of keys that can be searched; the key arrays passed to
+ * these functions must hold this many ints, even if fewer are in use.
+ */
+#define KEYSEARCH_MAX 16
+
+
+/* Returns how many of the first num_keys entries of a node's sorted key array
+ * are less than key.
+ */
+int count_keys_less(const int *keys, int num_keys, int key);
+
+/* Returns how many of the first num_keys entries of a node's sorted key array
+ * are less than or equal to key.
+ */
+int count_keys_less_equal(const int *keys, int num_keys, int key);
+
+#endif
@@ -4,6 +4,13 @@
 #include <string.h>
 
 #include "multimap.h"
+#include "snapshot.h"
+
+
+/* The number of nodes that an iterator's stack initially has room for.  The
+ * tree isn't balanced, so the stack grows if it needs to.
+ */
+#define ITER_STACK_SIZE 64
 
 
 /*============================================================================
@@ -51,6 +58,31 @@ typedef struct multimap_node {
 /* The entry-point of the multimap data structure. */
 struct multimap {
     multimap_node *root;
+    /* If the multimap was opened from a snapshot, and no pairs have been
+     * added to it since, the snapshot that its pairs are read from.
+     */
+    mm_snapshot *snapshot;
+};
+
+
+/* An iterator over the pairs of a multimap, or of its snapshot. */
+struct mm_iter {
+    /* Nonzero if the multimap was read from a snapshot, in which case only
+     * snap is used.
+     */
+    int from_snapshot;
+    snap_iter snap;
+
+    /* The node whose values are being returned, and the next of them. */
+    multimap_node *node;
+    multimap_value *value;
+
+    /* The nodes still to be visited whose left subtrees have already been
+     * visited, with the next one on top.
+     */
+    multimap_node **stack;
+    unsigned int depth;
+    unsigned int max_depth;
 };
 
 
@@ -69,6 +101,14 @@ multimap_node * find_mm_node(multimap_node *root, int key,
 void free_multimap_values(multimap_value *values);
 void free_multimap_node(multimap_node *node);
 
+void count_node_memory(multimap_node *node, mm_memory_usage *usage);
+
+void thaw_snapshot(multimap *mm);
+
+void iter_push(mm_iter *iter, multimap_node *node);
+void iter_start(mm_iter *iter, multimap *mm, int key);
+multimap_node * iter_next_node(mm_iter *iter);
+
 
 /*============================================================================
  * FUNCTION IMPLEMENTATIONS
@@ -179,6 +219,7 @@ void free_multimap_node(multimap_node *node) {
 multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     mm->root = NULL;
+    mm->snapshot = NULL;
     return mm;
 }
 
@@ -190,6 +231,40 @@ void clear_multimap(multimap *mm) {
     assert(mm != NULL);
     free_multimap_node(mm->root);
     mm->root = NULL;
+
+    if (mm->snapshot != NULL) {
+        snap_close(mm->snapshot);
+        mm->snapshot = NULL;
+    }
+}
+
+
+/* Loads the pairs of the snapshot that the multimap was opened from into the
+ * multimap's own data structures, so that more pairs can be added to it.
+ */
+void thaw_snapshot(multimap *mm) {
+    mm_snapshot *snap = mm->snapshot;
+
+    mm->snapshot = NULL;
+    snap_add_to_multimap(snap, mm);
+    snap_close(snap);
+}
+
+
+/* Opens a snapshot file as a multimap, which reads its pairs from the mapped
+ * file until pairs are added to it.
+ */
+multimap * mm_open_snapshot(const char *path) {
+    mm_snapshot *snap;
+    multimap *mm;
+
+    snap = snap_open(path);
+    if (snap == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->snapshot = snap;
+    return mm;
 }
 
 
@@ -200,6 +275,9 @@ void mm_add_value(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->snapshot != NULL)
+        thaw_snapshot(mm);
+
     /* Look up the node with the specified key.  Create if not found. */
     node = find_mm_node(mm->root, key, /* create */ 1);
     if (mm->root == NULL)
@@ -223,10 +301,23 @@ void mm_add_value(multimap *mm, int key, int value) {
 }
 
 
+/* Adds n (key, value) pairs to the multimap, one at a time. */
+void mm_add_values_bulk(multimap *mm, const int *keys, const int *values,
+                        unsigned int n) {
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        mm_add_value(mm, keys[i], values[i]);
+}
+
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
 int mm_contains_key(multimap *mm, int key) {
+    if (mm->snapshot != NULL)
+        return snap_contains_key(mm->snapshot, key);
+
     return find_mm_node(mm->root, key, /* create */ 0) != NULL;
 }
 
@@ -238,6 +329,9 @@ int mm_contains_pair(multimap *mm, int key, int value) {
     multimap_node *node;
     multimap_value *curr;
 
+    if (mm->snapshot != NULL)
+        return snap_contains_pair(mm->snapshot, key, value);
+
     node = find_mm_node(mm->root, key, /* create */ 0);
     if (node == NULL)
         return 0;
@@ -254,6 +348,60 @@ int mm_contains_pair(multimap *mm, int key, int value) {
 }
 
 
+/* Probes the multimap for n (key, value) pairs, one at a time, setting bit
+ * i % 64 of results[i / 64] if the i-th pair is present.
+ */
+void mm_contains_pairs_batch(multimap *mm, const int *keys, const int *values,
+                             unsigned int n, unsigned long long *results) {
+    unsigned int i;
+
+    bzero(results, (n + 63) / 64 * sizeof(unsigned long long));
+    for (i = 0; i < n; i++) {
+        if (mm_contains_pair(mm, keys[i], values[i]))
+            results[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+
+/* This helper function is used by mm_get_memory_usage() to add up the memory
+ * used by a subtree.
+ */
+void count_node_memory(multimap_node *node, mm_memory_usage *usage) {
+    multimap_value *curr;
+
+    if (node == NULL)
+        return;
+
+    count_node_memory(node->left_child, usage);
+    count_node_memory(node->right_child, usage);
+
+    usage->used_bytes += sizeof(multimap_node);
+    for (curr = node->values; curr != NULL; curr = curr->next) {
+        usage->num_pairs++;
+        usage->used_bytes += sizeof(multimap_value);
+    }
+}
+
+
+/* Reports how much memory the multimap is using, by walking the tree.  Each
+ * node and value is a separate malloc() block, and malloc()'s own overhead
+ * for each block is not included.
+ */
+void mm_get_memory_usage(multimap *mm, mm_memory_usage *usage) {
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL) {
+        snap_get_memory_usage(mm->snapshot, usage);
+        return;
+    }
+
+    usage->num_pairs = 0;
+    usage->used_bytes = sizeof(multimap);
+    count_node_memory(mm->root, usage);
+    usage->reserved_bytes = usage->used_bytes;
+}
+
+
 /* This helper function is used by mm_traverse() to traverse every pair within
  * the multimap.
  */
@@ -279,6 +427,132 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    mm_traverse_helper(mm->root, f);
+    if (mm->snapshot != NULL)
+        snap_traverse(mm->snapshot, f);
+    else
+        mm_traverse_helper(mm->root, f);
+}
+
+
+/* Pushes a node onto an iterator's stack, growing the stack if it is full. */
+void iter_push(mm_iter *iter, multimap_node *node) {
+    if (iter->depth == iter->max_depth) {
+        iter->max_depth *= 2;
+        iter->stack = realloc(iter->stack,
+                              iter->max_depth * sizeof(multimap_node *));
+    }
+    iter->stack[iter->depth++] = node;
 }
 
+
+/* Positions an iterator before the first node whose key is at least the
+ * specified key, by stacking each node on the path from the root that is at
+ * least the key.
+ */
+void iter_start(mm_iter *iter, multimap *mm, int key) {
+    multimap_node *node;
+
+    iter->from_snapshot = (mm->snapshot != NULL);
+    if (iter->from_snapshot) {
+        snap_iter_seek(&iter->snap, mm->snapshot, key);
+        iter->stack = NULL;
+        return;
+    }
+
+    iter->node = NULL;
+    iter->value = NULL;
+    iter->depth = 0;
+    iter->max_depth = ITER_STACK_SIZE;
+    iter->stack = malloc(iter->max_depth * sizeof(multimap_node *));
+
+    node = mm->root;
+    while (node != NULL) {
+        if (node->key >= key) {
+            iter_push(iter, node);
+            node = node->left_child;
+        }
+        else {
+            node = node->right_child;
+        }
+    }
+}
+
+
+/* Returns the next node of an in-order walk, or NULL if there are no more. */
+multimap_node * iter_next_node(mm_iter *iter) {
+    multimap_node *node, *next;
+
+    if (iter->depth == 0)
+        return NULL;
+
+    node = iter->stack[--iter->depth];
+    for (next = node->right_child; next != NULL; next = next->left_child)
+        iter_push(iter, next);
+
+    return node;
+}
+
+
+/* Passes each pair with lo <= key <= hi to the specified function, in key
+ * order.
+ */
+int mm_range(multimap *mm, int lo, int hi, mm_range_func f, void *arg) {
+    mm_iter iter;
+    multimap_node *node;
+    multimap_value *curr;
+    int stop = 0;
+
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL)
+        return snap_range(mm->snapshot, lo, hi, f, arg);
+
+    iter_start(&iter, mm, lo);
+    while (!stop && (node = iter_next_node(&iter)) != NULL &&
+           node->key <= hi) {
+        for (curr = node->values; !stop && curr != NULL; curr = curr->next)
+            stop = f(node->key, curr->value, arg);
+    }
+
+    free(iter.stack);
+    return stop;
+}
+
+
+/* Returns an iterator positioned at the first pair whose key is at least the
+ * specified key.
+ */
+mm_iter * mm_iter_seek(multimap *mm, int key) {
+    mm_iter *iter = malloc(sizeof(mm_iter));
+
+    assert(mm != NULL);
+
+    iter_start(iter, mm, key);
+    return iter;
+}
+
+
+/* Stores the iterator's next pair, and returns zero once there are none. */
+int mm_iter_next(mm_iter *iter, int *p_key, int *p_value) {
+    if (iter->from_snapshot)
+        return snap_iter_next(&iter->snap, p_key, p_value);
+
+    while (iter->value == NULL) {
+        iter->node = iter_next_node(iter);
+        if (iter->node == NULL)
+            return 0;
+        iter->value = iter->node->values;
+    }
+
+    *p_key = iter->node->key;
+    *p_value = iter->value->value;
+    iter->value = iter->value->next;
+    return 1;
+}
+
+
+/* Releases an iterator. */
+void mm_iter_free(mm_iter *iter) {
+    free(iter->stack);
+    free(iter);
+}
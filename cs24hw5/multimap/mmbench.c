@@ -0,0 +1,555 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "multimap.h"
+#include "perfcount.h"
+
+
+/* The defaults for the command-line options; see usage(). */
+#define DEFAULT_PAIRS 1000000
+#define DEFAULT_OPS 500000
+#define DEFAULT_MAX_KEY 100000
+#define DEFAULT_MAX_VAL 50
+#define DEFAULT_SKEW 0.99
+
+/* The range workload runs num_ops / RANGE_OPS_DIVISOR queries, each over
+ * RANGE_WIDTH consecutive keys.
+ */
+#define RANGE_WIDTH 10
+#define RANGE_OPS_DIVISOR 10
+
+/* The number of full traversals timed by the traversal workload. */
+#define TRAVERSE_REPEATS 3
+
+/* The number of back-to-back clock readings used to estimate the cost of
+ * reading the clock, which is included in every latency.
+ */
+#define CLOCK_SAMPLES 1001
+
+
+/* The settings for one run of the benchmark. */
+typedef struct bench_config {
+    /* The name of the multimap implementation, printed on every row. */
+    const char *label;
+
+    int num_pairs;
+    int num_ops;
+    int max_key;
+    int max_val;
+    double skew;
+
+    /* Nonzero if the table header should be printed. */
+    int print_header;
+} bench_config;
+
+
+/* Generates keys in [0, max_key), either uniformly or with a Zipfian
+ * distribution.  The popular Zipfian keys are spread over the key range
+ * rather than being the smallest keys, so that they don't all sit next to
+ * each other in the multimap.
+ */
+typedef struct key_gen {
+    int max_key;
+    unsigned int seed;
+
+    /* For Zipfian keys, the probability that a key's rank is at most i, and
+     * the key given to each rank.  Both are NULL for uniform keys.
+     */
+    double *cdf;
+    int *rank_keys;
+} key_gen;
+
+
+/* The latency of each operation in the current workload, in nanoseconds. */
+long long *latencies;
+
+/* The hardware counters, which are read around each workload. */
+perf_counters counters;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+long long now_ns(void);
+long long clock_overhead_ns(void);
+int compare_latencies(const void *a, const void *b);
+long long percentile(int n, double fraction);
+
+void init_uniform_keys(key_gen *gen, int max_key, unsigned int seed);
+void init_zipf_keys(key_gen *gen, int max_key, double skew,
+                    unsigned int seed);
+void clear_key_gen(key_gen *gen);
+int next_key(key_gen *gen);
+
+void print_header(const bench_config *cfg);
+void report(const bench_config *cfg, const char *workload, int num_ops,
+            long long total_ns, int have_latencies, long long result);
+
+void bench_insert(const bench_config *cfg, multimap *mm);
+void bench_probes(const bench_config *cfg, multimap *mm, const char *workload,
+                  key_gen *gen);
+void bench_mixed(const bench_config *cfg, multimap *mm, const char *workload,
+                 key_gen *gen, int write_percent);
+int count_range_pair(int key, int value, void *arg);
+void bench_range(const bench_config *cfg, multimap *mm);
+void count_traversed_pair(int key, int value);
+void bench_traverse(const bench_config *cfg, multimap *mm);
+void bench_memory(const bench_config *cfg, multimap *mm);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns the current time in nanoseconds, from a clock that never jumps. */
+long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* Returns the median time between two back-to-back clock readings. */
+long long clock_overhead_ns(void) {
+    long long t0;
+    int i;
+
+    for (i = 0; i < CLOCK_SAMPLES; i++) {
+        t0 = now_ns();
+        latencies[i] = now_ns() - t0;
+    }
+
+    return percentile(CLOCK_SAMPLES, 0.5);
+}
+
+
+/* Comparison function for sorting latencies with qsort(). */
+int compare_latencies(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+
+/* Returns the latency that the specified fraction of the first n latencies
+ * are at or below, using the nearest-rank method.  The latencies must
+ * already be sorted.
+ */
+long long percentile(int n, double fraction) {
+    long long rank = (long long) ceil(fraction * n);
+
+    if (rank < 1)
+        rank = 1;
+    return latencies[rank - 1];
+}
+
+
+/* Initializes a generator of uniformly distributed keys. */
+void init_uniform_keys(key_gen *gen, int max_key, unsigned int seed) {
+    gen->max_key = max_key;
+    gen->seed = seed;
+    gen->cdf = NULL;
+    gen->rank_keys = NULL;
+}
+
+
+/* Initializes a generator of Zipfian keys, where the key of rank r (from 1)
+ * is chosen with probability proportional to 1 / r^skew.
+ */
+void init_zipf_keys(key_gen *gen, int max_key, double skew,
+                    unsigned int seed) {
+    double sum = 0;
+    int i, j, tmp;
+
+    init_uniform_keys(gen, max_key, seed);
+    gen->cdf = malloc(max_key * sizeof(double));
+    gen->rank_keys = malloc(max_key * sizeof(int));
+
+    for (i = 0; i < max_key; i++) {
+        sum += 1.0 / pow(i + 1, skew);
+        gen->cdf[i] = sum;
+    }
+    for (i = 0; i < max_key; i++)
+        gen->cdf[i] /= sum;
+
+    /* Shuffle the keys among the ranks. */
+    for (i = 0; i < max_key; i++)
+        gen->rank_keys[i] = i;
+    for (i = max_key - 1; i > 0; i--) {
+        j = rand_r(&gen->seed) % (i + 1);
+        tmp = gen->rank_keys[i];
+        gen->rank_keys[i] = gen->rank_keys[j];
+        gen->rank_keys[j] = tmp;
+    }
+}
+
+
+/* Releases the memory used by a key generator. */
+void clear_key_gen(key_gen *gen) {
+    free(gen->cdf);
+    free(gen->rank_keys);
+    gen->cdf = NULL;
+    gen->rank_keys = NULL;
+}
+
+
+/* Returns the next key from a generator.  A Zipfian key is chosen by binary
+ * searching the cumulative distribution for a uniform random number.
+ */
+int next_key(key_gen *gen) {
+    double u;
+    int lo, hi, mid;
+
+    if (gen->cdf == NULL)
+        return rand_r(&gen->seed) % gen->max_key;
+
+    u = (double) rand_r(&gen->seed) / ((double) RAND_MAX + 1.0);
+    lo = 0;
+    hi = gen->max_key - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (gen->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return gen->rank_keys[lo];
+}
+
+
+/* Prints the settings of the run and the column headings of the table. */
+void print_header(const bench_config *cfg) {
+    printf("Multimap benchmark:  %d pairs loaded, %d operations per workload."
+           "\n", cfg->num_pairs, cfg->num_ops);
+    printf("Keys in range [0, %d), values in range [0, %d); Zipfian skew"
+           " %.2f.\n", cfg->max_key, cfg->max_val, cfg->skew);
+    printf("Latencies are per operation and include about %lld ns of clock"
+           " overhead.\n", clock_overhead_ns());
+    if (counters.available) {
+        printf("Hardware counters are per operation, and include the clock"
+               " and key generation.\n");
+    }
+    else {
+        printf("Hardware counters are unavailable on this system.\n");
+    }
+    printf("The result column (hits, or pairs seen) should match across"
+           " backends.\n\n");
+
+    printf("%-10s %-14s %9s %9s %8s %8s %8s %8s %8s %8s %8s %10s\n",
+           "backend", "workload", "ops", "Mops/s", "p50 ns", "p99 ns",
+           "p999 ns", "cyc/op", "ins/op", "miss/op", "brmis/op", "result");
+}
+
+
+/* Prints one row of the table.  If have_latencies is nonzero, the first
+ * num_ops latencies are sorted to find the percentiles.
+ */
+void report(const bench_config *cfg, const char *workload, int num_ops,
+            long long total_ns, int have_latencies, long long result) {
+    int i;
+
+    printf("%-10s %-14s %9d %9.3f ", cfg->label, workload, num_ops,
+           total_ns > 0 ? (double) num_ops * 1000.0 / (double) total_ns : 0.0);
+
+    if (have_latencies) {
+        qsort(latencies, num_ops, sizeof(long long), compare_latencies);
+        printf("%8lld %8lld %8lld ", percentile(num_ops, 0.5),
+               percentile(num_ops, 0.99), percentile(num_ops, 0.999));
+    }
+    else {
+        printf("%8s %8s %8s ", "-", "-", "-");
+    }
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (!counters.available)
+            printf("%8s ", "n/a");
+        else if (i < PERF_CACHE_MISSES)
+            printf("%8.0f ", (double) counters.counts[i] / num_ops);
+        else
+            printf("%8.3f ", (double) counters.counts[i] / num_ops);
+    }
+
+    printf("%10lld\n", result);
+}
+
+
+/* Loads the multimap with uniformly distributed pairs, one at a time. */
+void bench_insert(const bench_config *cfg, multimap *mm) {
+    key_gen gen;
+    unsigned int seed = 17;
+    long long t0, total_ns = 0;
+    int i, key, value;
+
+    init_uniform_keys(&gen, cfg->max_key, 11);
+
+    perf_start(&counters);
+    for (i = 0; i < cfg->num_pairs; i++) {
+        key = next_key(&gen);
+        value = rand_r(&seed) % cfg->max_val;
+
+        t0 = now_ns();
+        mm_add_value(mm, key, value);
+        latencies[i] = now_ns() - t0;
+        total_ns += latencies[i];
+    }
+    perf_stop(&counters);
+
+    report(cfg, "insert", cfg->num_pairs, total_ns, 1, cfg->num_pairs);
+}
+
+
+/* Probes the multimap for pairs whose keys come from the generator. */
+void bench_probes(const bench_config *cfg, multimap *mm, const char *workload,
+                  key_gen *gen) {
+    unsigned int seed = 19;
+    long long t0, total_ns = 0, hits = 0;
+    int i, key, value;
+
+    perf_start(&counters);
+    for (i = 0; i < cfg->num_ops; i++) {
+        key = next_key(gen);
+        value = rand_r(&seed) % cfg->max_val;
+
+        t0 = now_ns();
+        hits += (mm_contains_pair(mm, key, value) != 0);
+        latencies[i] = now_ns() - t0;
+        total_ns += latencies[i];
+    }
+    perf_stop(&counters);
+
+    report(cfg, workload, cfg->num_ops, total_ns, 1, hits);
+}
+
+
+/* Runs a mix of probes and additions, where write_percent percent of the
+ * operations add a pair.  The keys of both come from the generator.
+ */
+void bench_mixed(const bench_config *cfg, multimap *mm, const char *workload,
+                 key_gen *gen, int write_percent) {
+    unsigned int seed = 23;
+    long long t0, total_ns = 0, hits = 0;
+    int i, key, value, write;
+
+    perf_start(&counters);
+    for (i = 0; i < cfg->num_ops; i++) {
+        key = next_key(gen);
+        value = rand_r(&seed) % cfg->max_val;
+        write = (rand_r(&seed) % 100 < write_percent);
+
+        t0 = now_ns();
+        if (write)
+            mm_add_value(mm, key, value);
+        else
+            hits += (mm_contains_pair(mm, key, value) != 0);
+        latencies[i] = now_ns() - t0;
+        total_ns += latencies[i];
+    }
+    perf_stop(&counters);
+
+    report(cfg, workload, cfg->num_ops, total_ns, 1, hits);
+}
+
+
+/* Counts the pairs passed to it by mm_range(). */
+int count_range_pair(int key, int value, void *arg) {
+    (*(long long *) arg)++;
+    return 0;
+}
+
+
+/* Runs range queries over RANGE_WIDTH keys, starting at uniformly
+ * distributed keys.
+ */
+void bench_range(const bench_config *cfg, multimap *mm) {
+    key_gen gen;
+    long long t0, total_ns = 0, pairs = 0;
+    int i, lo, num_queries = cfg->num_ops / RANGE_OPS_DIVISOR;
+
+    if (num_queries == 0)
+        return;
+
+    init_uniform_keys(&gen, cfg->max_key, 29);
+
+    perf_start(&counters);
+    for (i = 0; i < num_queries; i++) {
+        lo = next_key(&gen);
+
+        t0 = now_ns();
+        mm_range(mm, lo, lo + RANGE_WIDTH - 1, count_range_pair, &pairs);
+        latencies[i] = now_ns() - t0;
+        total_ns += latencies[i];
+    }
+    perf_stop(&counters);
+
+    report(cfg, "range", num_queries, total_ns, 1, pairs);
+}
+
+
+/* The number of pairs seen by count_traversed_pair(). */
+long long traversed_pairs;
+
+void count_traversed_pair(int key, int value) {
+    traversed_pairs++;
+}
+
+
+/* Times full traversals of the multimap.  The row counts each pair visited
+ * as an operation, so it has no per-operation latencies.
+ */
+void bench_traverse(const bench_config *cfg, multimap *mm) {
+    long long t0, total_ns;
+    int i;
+
+    traversed_pairs = 0;
+
+    perf_start(&counters);
+    t0 = now_ns();
+    for (i = 0; i < TRAVERSE_REPEATS; i++)
+        mm_traverse(mm, count_traversed_pair);
+    total_ns = now_ns() - t0;
+    perf_stop(&counters);
+
+    if (traversed_pairs > INT_MAX)
+        traversed_pairs = INT_MAX;
+    report(cfg, "traverse", (int) traversed_pairs, total_ns, 0,
+           traversed_pairs / TRAVERSE_REPEATS);
+}
+
+
+/* Reports the multimap's memory footprint per pair. */
+void bench_memory(const bench_config *cfg, multimap *mm) {
+    mm_memory_usage usage;
+
+    mm_get_memory_usage(mm, &usage);
+    if (usage.num_pairs == 0)
+        return;
+
+    printf("%-10s %-14s %9llu  %.1f bytes/pair reserved, %.1f bytes/pair"
+           " used\n", cfg->label, "memory", usage.num_pairs,
+           (double) usage.reserved_bytes / (double) usage.num_pairs,
+           (double) usage.used_bytes / (double) usage.num_pairs);
+}
+
+
+void usage(const char *program) {
+    printf("usage:  %s [-l label] [-n pairs] [-o ops] [-k max_key]"
+           " [-v max_value]\n", program);
+    printf("\t\t[-s skew] [-H]\n\n");
+    printf("\tBenchmarks a multimap implementation under several workloads,"
+           " and reports\n");
+    printf("\tthroughput, latency percentiles and hardware counters for"
+           " each.\n\n");
+    printf("\t-l label      name to print for this implementation\n");
+    printf("\t-n pairs      pairs to load before the other workloads"
+           " (default:  %d)\n", DEFAULT_PAIRS);
+    printf("\t-o ops        operations per workload (default:  %d)\n",
+           DEFAULT_OPS);
+    printf("\t-k max_key    keys are in [0, max_key) (default:  %d)\n",
+           DEFAULT_MAX_KEY);
+    printf("\t-v max_value  values are in [0, max_value) (default:  %d)\n",
+           DEFAULT_MAX_VAL);
+    printf("\t-s skew       Zipfian skew of the hot-key workloads"
+           " (default:  %.2f)\n", DEFAULT_SKEW);
+    printf("\t-H            don't print the header, e.g. when appending"
+           " to another run\n");
+}
+
+
+int main(int argc, char **argv) {
+    bench_config cfg;
+    key_gen uniform, zipf;
+    multimap *mm;
+    int opt, max_ops;
+
+    cfg.label = argv[0];
+    cfg.num_pairs = DEFAULT_PAIRS;
+    cfg.num_ops = DEFAULT_OPS;
+    cfg.max_key = DEFAULT_MAX_KEY;
+    cfg.max_val = DEFAULT_MAX_VAL;
+    cfg.skew = DEFAULT_SKEW;
+    cfg.print_header = 1;
+
+    while ((opt = getopt(argc, argv, "l:n:o:k:v:s:H")) != -1) {
+        switch (opt) {
+        case 'l':
+            cfg.label = optarg;
+            break;
+        case 'n':
+            cfg.num_pairs = atoi(optarg);
+            break;
+        case 'o':
+            cfg.num_ops = atoi(optarg);
+            break;
+        case 'k':
+            cfg.max_key = atoi(optarg);
+            break;
+        case 'v':
+            cfg.max_val = atoi(optarg);
+            break;
+        case 's':
+            cfg.skew = atof(optarg);
+            break;
+        case 'H':
+            cfg.print_header = 0;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind != argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (cfg.num_pairs < 1 || cfg.num_ops < 1 || cfg.max_key < 1 ||
+        cfg.max_val < 1) {
+        printf("ERROR:  pairs, ops, max_key and max_value must be"
+               " positive\n\n");
+        usage(argv[0]);
+        exit(1);
+    }
+    if (cfg.skew < 0) {
+        printf("ERROR:  skew must not be negative\n\n");
+        usage(argv[0]);
+        exit(1);
+    }
+
+    max_ops = cfg.num_pairs > cfg.num_ops ? cfg.num_pairs : cfg.num_ops;
+    if (max_ops < CLOCK_SAMPLES)
+        max_ops = CLOCK_SAMPLES;
+    latencies = malloc(max_ops * sizeof(long long));
+
+    perf_open(&counters);
+    init_uniform_keys(&uniform, cfg.max_key, 31);
+    init_zipf_keys(&zipf, cfg.max_key, cfg.skew, 37);
+
+    mm = init_multimap();
+    if (cfg.print_header)
+        print_header(&cfg);
+
+    bench_insert(&cfg, mm);
+    bench_memory(&cfg, mm);
+    bench_probes(&cfg, mm, "probe-uniform", &uniform);
+    bench_probes(&cfg, mm, "probe-zipf", &zipf);
+    bench_range(&cfg, mm);
+    bench_traverse(&cfg, mm);
+    bench_mixed(&cfg, mm, "mixed-95/5", &zipf, 5);
+    bench_mixed(&cfg, mm, "mixed-50/50", &zipf, 50);
+
+    clear_multimap(mm);
+    free(mm);
+
+    clear_key_gen(&uniform);
+    clear_key_gen(&zipf);
+    perf_close(&counters);
+    free(latencies);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "multimap.h"
+#include "realtime.h"
+
+
+/* The multimap is populated with this many pairs before the readers start,
+ * with keys in [0, MAX_KEY) and values in [0, MAX_VAL).
+ */
+#define NUM_PAIRS 1000000
+#define MAX_KEY 100000
+#define MAX_VAL 50
+
+/* How long each round of readers runs for. */
+#define ROUND_US 1000000
+
+/* Every CHECK_INTERVAL probes, a reader probes a pair that it knows is in
+ * the multimap, and counts an error if the probe misses.
+ */
+#define CHECK_INTERVAL 16
+
+/* The concurrent writer adds pairs with keys in [0, WRITER_MAX_KEY), so that
+ * many of its pairs add new keys to the multimap.
+ */
+#define WRITER_MAX_KEY (4 * MAX_KEY)
+
+/* The most reader threads that can be run. */
+#define MAX_THREADS 256
+
+
+/* The pairs that were added to the multimap before any reader started. */
+int *known_keys, *known_values;
+
+/* Set once the current round should stop. */
+int stop_round;
+
+
+/* The work and results of a single reader or writer thread. */
+typedef struct thread_state {
+    pthread_t thread;
+    multimap *mm;
+    unsigned int seed;
+
+    long long int num_ops;
+    long long int num_hits;
+    long long int num_errors;
+} thread_state;
+
+
+/* Returns the current wall-clock time in microseconds. */
+long long int get_time_us() {
+    struct timespec ts;
+
+    clock_get_realtime(&ts);
+    return (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+/* Probes the multimap with random pairs until the round stops, regularly
+ * checking that a pair known to be in the multimap is found.
+ */
+void * reader_main(void *arg) {
+    thread_state *state = (thread_state *) arg;
+    int i, key, value;
+
+    while (!__atomic_load_n(&stop_round, __ATOMIC_RELAXED)) {
+        for (i = 0; i < CHECK_INTERVAL; i++) {
+            key = rand_r(&state->seed) % MAX_KEY;
+            value = rand_r(&state->seed) % MAX_VAL;
+            if (mm_contains_pair(state->mm, key, value))
+                state->num_hits++;
+        }
+
+        i = rand_r(&state->seed) % NUM_PAIRS;
+        if (!mm_contains_pair(state->mm, known_keys[i], known_values[i]))
+            state->num_errors++;
+
+        state->num_ops += CHECK_INTERVAL + 1;
+    }
+
+    return NULL;
+}
+
+
+/* Adds random pairs to the multimap until the round stops. */
+void * writer_main(void *arg) {
+    thread_state *state = (thread_state *) arg;
+    int key, value;
+
+    while (!__atomic_load_n(&stop_round, __ATOMIC_RELAXED)) {
+        key = rand_r(&state->seed) % WRITER_MAX_KEY;
+        value = rand_r(&state->seed) % MAX_VAL;
+        mm_add_value(state->mm, key, value);
+        state->num_ops++;
+    }
+
+    return NULL;
+}
+
+
+/* Runs the specified number of readers against the multimap for one round,
+ * along with a writer if with_writer is nonzero.  Returns the total number
+ * of probes per second, and adds any errors to *p_errors.
+ */
+double run_round(multimap *mm, int num_readers, int with_writer,
+                 long long int *p_errors) {
+    thread_state readers[MAX_THREADS], writer;
+    long long int start_us, elapsed_us, total_ops = 0;
+    int i;
+
+    stop_round = 0;
+
+    for (i = 0; i < num_readers; i++) {
+        readers[i].mm = mm;
+        readers[i].seed = 1000 + i;
+        readers[i].num_ops = readers[i].num_hits = readers[i].num_errors = 0;
+    }
+    writer.mm = mm;
+    writer.seed = 7;
+    writer.num_ops = 0;
+
+    start_us = get_time_us();
+
+    for (i = 0; i < num_readers; i++) {
+        if (pthread_create(&readers[i].thread, NULL, reader_main,
+                           readers + i) != 0) {
+            printf("ERROR:  couldn't start reader thread %d\n", i);
+            exit(1);
+        }
+    }
+    if (with_writer &&
+        pthread_create(&writer.thread, NULL, writer_main, &writer) != 0) {
+        printf("ERROR:  couldn't start writer thread\n");
+        exit(1);
+    }
+
+    usleep(ROUND_US);
+    __atomic_store_n(&stop_round, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < num_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        total_ops += readers[i].num_ops;
+        *p_errors += readers[i].num_errors;
+    }
+    if (with_writer)
+        pthread_join(writer.thread, NULL);
+
+    elapsed_us = get_time_us() - start_us;
+
+    if (with_writer) {
+        printf("    (writer added %lld pairs, %.3f M/sec)\n", writer.num_ops,
+               (double) writer.num_ops / (double) elapsed_us);
+    }
+
+    return (double) total_ops * 1000000.0 / (double) elapsed_us;
+}
+
+
+/* Reports how reader throughput scales from 1 up to max_threads reader
+ * threads, with or without a concurrent writer.  Each round starts from a
+ * freshly populated multimap.
+ */
+void test_scaling(int max_threads, int with_writer, long long int *p_errors) {
+    multimap *mm;
+    double base = 0, rate;
+    int threads, i;
+
+    printf("Reader scaling, %s concurrent writer:\n",
+           with_writer ? "with a" : "without a");
+
+    for (threads = 1; ; threads = (2 * threads < max_threads) ?
+                                  2 * threads : max_threads) {
+        mm = init_multimap();
+        mm_add_values_bulk(mm, known_keys, known_values, NUM_PAIRS);
+        for (i = 0; i < 1000; i++)
+            mm_contains_pair(mm, known_keys[i], known_values[i]);
+
+        rate = run_round(mm, threads, with_writer, p_errors);
+        if (threads == 1)
+            base = rate;
+
+        printf("  %3d reader%s:  %8.3f M probes/sec\t\tspeedup:  %.2fx\n",
+               threads, threads == 1 ? " " : "s", rate / 1000000.0,
+               rate / base);
+
+        clear_multimap(mm);
+        free(mm);
+
+        if (threads == max_threads)
+            break;
+    }
+
+    printf("\n");
+}
+
+
+void usage(const char *program) {
+    printf("usage:  %s [max_threads]\n\n", program);
+    printf("\tMeasures how multimap probe throughput scales with the number"
+           " of reader\n");
+    printf("\tthreads, from 1 up to max_threads (default:  the number of"
+           " CPUs).\n");
+}
+
+
+int main(int argc, char **argv) {
+    long long int errors = 0;
+    int max_threads, i;
+
+    if (argc > 2) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (argc == 2) {
+        max_threads = atoi(argv[1]);
+        if (max_threads < 1 || max_threads > MAX_THREADS) {
+            printf("ERROR:  max_threads must be in the range [1, %d]\n\n",
+                   MAX_THREADS);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    else {
+        max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (max_threads < 1)
+            max_threads = 1;
+        if (max_threads > MAX_THREADS)
+            max_threads = MAX_THREADS;
+    }
+
+    srand(11);
+    known_keys = malloc(NUM_PAIRS * sizeof(int));
+    known_values = malloc(NUM_PAIRS * sizeof(int));
+    for (i = 0; i < NUM_PAIRS; i++) {
+        known_keys[i] = rand() % MAX_KEY;
+        known_values[i] = rand() % MAX_VAL;
+    }
+
+    printf("Multimap populated with %d pairs; keys in range [0, %d), values"
+           " in range [0, %d).\n\n", NUM_PAIRS, MAX_KEY, MAX_VAL);
+
+    test_scaling(max_threads, 0, &errors);
+    test_scaling(max_threads, 1, &errors);
+
+    printf("%lld probes of known pairs failed.\n", errors);
+
+    free(known_keys);
+    free(known_values);
+    return errors == 0 ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "multimap.h"
 #include "realtime.h"
@@ -24,6 +25,12 @@
  */
 #define EXCLUDE_SLOW_TESTS 0
 
+/* The number of probes passed to each mm_contains_pairs_batch() call. */
+#define PROBE_BATCH 256
+
+/* The file that test_snapshot_perf() saves snapshots to. */
+#define SNAPSHOT_PATH "mmperf.snapshot"
+
 
 /* Populate the multimap with a specific number of key/value pairs.  The keys
  * can be generated in one of three ways, either randomly, incrementing, or
@@ -116,6 +123,80 @@ int probe_multimap(multimap *mm, int num_probes, int max_key, int max_val) {
 }
 
 
+/* Returns the current wall-clock time in microseconds. */
+long long int get_time_us() {
+    struct timespec ts;
+
+    clock_get_realtime(&ts);
+    return (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+/* Reports how much memory the multimap is using for its pairs.  The overhead
+ * is what each pair costs beyond the 8 bytes of its key and value.
+ */
+void print_memory_usage(multimap *mm) {
+    mm_memory_usage usage;
+    double per_pair;
+
+    mm_get_memory_usage(mm, &usage);
+    if (usage.num_pairs == 0)
+        return;
+
+    per_pair = (double) usage.reserved_bytes / (double) usage.num_pairs;
+    printf("Memory:  %.1f MB reserved, %.1f MB in use\t\t"
+           "%.1f bytes per pair (%.1f bytes overhead)\n",
+           (double) usage.reserved_bytes / 1048576.0,
+           (double) usage.used_bytes / 1048576.0, per_pair,
+           per_pair - 2 * sizeof(int));
+}
+
+
+/* Probes the multimap with randomly generated pairs, first one at a time with
+ * mm_contains_pair(), and then in batches with mm_contains_pairs_batch(), and
+ * reports the time per probe of each.  The pairs come from a separate
+ * random-number generator, so that the other tests' pairs don't change.
+ */
+void test_batch_probe_perf(multimap *mm, int num_probes, int max_key,
+                           int max_val) {
+    unsigned int seed = 17;
+    unsigned long long results[(PROBE_BATCH + 63) / 64];
+    int i, j, n, *keys, *values, one_hits, batch_hits;
+    long long int start_us, one_us, batch_us;
+
+    keys = malloc(num_probes * sizeof(int));
+    values = malloc(num_probes * sizeof(int));
+    for (i = 0; i < num_probes; i++) {
+        keys[i] = rand_r(&seed) % max_key;
+        values[i] = rand_r(&seed) % max_val;
+    }
+
+    start_us = get_time_us();
+    for (i = 0, one_hits = 0; i < num_probes; i++) {
+        if (mm_contains_pair(mm, keys[i], values[i]))
+            one_hits++;
+    }
+    one_us = get_time_us() - start_us;
+
+    start_us = get_time_us();
+    for (i = 0, batch_hits = 0; i < num_probes; i += PROBE_BATCH) {
+        n = (num_probes - i < PROBE_BATCH) ? num_probes - i : PROBE_BATCH;
+        mm_contains_pairs_batch(mm, keys + i, values + i, n, results);
+        for (j = 0; j < (n + 63) / 64; j++)
+            batch_hits += __builtin_popcountll(results[j]);
+    }
+    batch_us = get_time_us() - start_us;
+
+    printf("Single probes:  %d hits, %.3f \u03BCs per probe\t\t"
+           "Batches of %d:  %d hits, %.3f \u03BCs per probe\n\n",
+           one_hits, (double) one_us / (double) num_probes, PROBE_BATCH,
+           batch_hits, (double) batch_us / (double) num_probes);
+
+    free(keys);
+    free(values);
+}
+
+
 /* Performs a single performance test against the multimap:
  *   1)  Generates key/value pairs to add to the map, using either incrementing,
  *       decrementing, or random key generation, and the specified maximum key
@@ -143,6 +224,7 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
     mm = init_multimap();
 
     populate_multimap(mm, num_pairs, keygen_mode, max_key, max_val);
+    print_memory_usage(mm);
 
     clock_get_realtime(&ts);
     start_us = (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
@@ -159,7 +241,9 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
     total_seconds = (double) (end_us - start_us) / 1000000.0;
     us_per_probe = (double) (end_us - start_us) / (double) num_probes;
     printf("Total wall-clock time:  %.2f seconds\t\t\u03BCs per probe:"
-           "  %.3f \u03BCs\n\n", total_seconds, us_per_probe);
+           "  %.3f \u03BCs\n", total_seconds, us_per_probe);
+
+    test_batch_probe_perf(mm, num_probes, max_key, max_val);
 
     /* Free it!  We're done. */
     clear_multimap(mm);
@@ -167,6 +251,147 @@ void test_multimap_perf(int num_pairs, int num_probes, int keygen_mode,
 }
 
 
+/* Saves the multimap to a snapshot, and measures how long it takes to save,
+ * to open again, and to probe once opened.
+ */
+void test_snapshot_perf(multimap *mm, int num_probes, int max_key,
+                        int max_val) {
+    multimap *snap;
+    unsigned int seed = 23;
+    int i, hits;
+    long long int start_us, save_us, open_us, probe_us;
+
+    start_us = get_time_us();
+    if (mm_save_snapshot(mm, SNAPSHOT_PATH) != 0) {
+        perror("Couldn't save snapshot");
+        return;
+    }
+    save_us = get_time_us() - start_us;
+
+    start_us = get_time_us();
+    snap = mm_open_snapshot(SNAPSHOT_PATH);
+    open_us = get_time_us() - start_us;
+    if (snap == NULL) {
+        printf("Couldn't open snapshot.\n");
+        unlink(SNAPSHOT_PATH);
+        return;
+    }
+
+    start_us = get_time_us();
+    for (i = 0, hits = 0; i < num_probes; i++) {
+        int key = rand_r(&seed) % max_key;
+        if (mm_contains_pair(snap, key, rand_r(&seed) % max_val))
+            hits++;
+    }
+    probe_us = get_time_us() - start_us;
+
+    printf("Snapshot:  saved in %.2f seconds, opened in %.3f ms\t\t"
+           "%d hits, %.3f \u03BCs per probe\n", (double) save_us / 1000000.0,
+           (double) open_us / 1000.0, hits,
+           (double) probe_us / (double) num_probes);
+
+    clear_multimap(snap);
+    free(snap);
+    unlink(SNAPSHOT_PATH);
+}
+
+
+/* Counts the pairs passed to it by mm_range(). */
+int count_range_pair(int key, int value, void *arg) {
+    (*(long long int *) arg)++;
+    return 0;
+}
+
+
+/* Measures narrow range queries over a multimap, each over width keys
+ * starting at a random key, with mm_range() and then with an iterator.
+ */
+void test_range_perf(multimap *mm, int num_queries, int max_key, int width) {
+    unsigned int seed = 29;
+    long long int start_us, range_us, iter_us, range_pairs, iter_pairs;
+    mm_iter *iter;
+    int i, lo, key, value;
+
+    range_pairs = 0;
+    start_us = get_time_us();
+    for (i = 0; i < num_queries; i++) {
+        lo = rand_r(&seed) % max_key;
+        mm_range(mm, lo, lo + width - 1, count_range_pair, &range_pairs);
+    }
+    range_us = get_time_us() - start_us;
+
+    seed = 29;
+    iter_pairs = 0;
+    start_us = get_time_us();
+    for (i = 0; i < num_queries; i++) {
+        lo = rand_r(&seed) % max_key;
+        iter = mm_iter_seek(mm, lo);
+        while (mm_iter_next(iter, &key, &value) && key < lo + width)
+            iter_pairs++;
+        mm_iter_free(iter);
+    }
+    iter_us = get_time_us() - start_us;
+
+    printf("Range queries over %d keys:  %lld pairs\t\t\u03BCs per query:"
+           "  %.3f \u03BCs (mm_range), %.3f \u03BCs (iterator)\n", width,
+           range_pairs, (double) range_us / (double) num_queries,
+           (double) iter_us / (double) num_queries);
+
+    if (iter_pairs != range_pairs)
+        printf("ERROR:  the iterator found %lld pairs\n", iter_pairs);
+}
+
+
+/* Measures how long it takes to load the same randomly generated pairs into
+ * a multimap, first with one mm_add_value() call per pair, and then with a
+ * single call to mm_add_values_bulk().
+ */
+void test_load_perf(int num_pairs, int max_key, int max_val) {
+    multimap *mm;
+    int i, *keys, *values;
+    long long int start_us, one_us, bulk_us;
+
+    printf("Testing multimap load performance:  %d pairs.\n", num_pairs);
+    printf("Keys in range [0, %d), values in range [0, %d).\n",
+           max_key, max_val);
+
+    keys = malloc(num_pairs * sizeof(int));
+    values = malloc(num_pairs * sizeof(int));
+    for (i = 0; i < num_pairs; i++) {
+        keys[i] = rand() % max_key;
+        values[i] = rand() % max_val;
+    }
+
+    mm = init_multimap();
+    start_us = get_time_us();
+    for (i = 0; i < num_pairs; i++)
+        mm_add_value(mm, keys[i], values[i]);
+    one_us = get_time_us() - start_us;
+    clear_multimap(mm);
+    free(mm);
+
+    mm = init_multimap();
+    start_us = get_time_us();
+    mm_add_values_bulk(mm, keys, values, num_pairs);
+    bulk_us = get_time_us() - start_us;
+    print_memory_usage(mm);
+    test_snapshot_perf(mm, SCALE * 100000, max_key, max_val);
+    test_range_perf(mm, SCALE * 10000, max_key, 10);
+    clear_multimap(mm);
+    free(mm);
+
+    printf("One pair at a time:  %.2f seconds\t\t\u03BCs per pair:"
+           "  %.3f \u03BCs\n", (double) one_us / 1000000.0,
+           (double) one_us / (double) num_pairs);
+    printf("Bulk load:           %.2f seconds\t\t\u03BCs per pair:"
+           "  %.3f \u03BCs\n\n", (double) bulk_us / 1000000.0,
+           (double) bulk_us / (double) num_pairs);
+
+    free(keys);
+    free(values);
+}
+
+
 int main() {
     srand(11);
 
@@ -204,6 +429,11 @@ int main() {
     test_multimap_perf(100000, SCALE * 5000, MODE_DECR, 100000, 50);
 #endif
 
+    /* Arguments:  num_pairs, max_key, max_value */
+
+    test_load_perf(15000000, 100000, 50);
+    test_load_perf(10000000, 5000000, 1000);
+
     return 0;
 }
 
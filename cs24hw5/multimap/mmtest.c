@@ -1,5 +1,8 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "multimap.h"
 
@@ -58,6 +61,655 @@ void check_order(int key, int value) {
     printf("\n");
 }
 
+/* The number of keys inserted by test_sorted_insertion(). */
+#define NUM_SORTED_KEYS 5000
+
+int traversed_pairs;
+
+void count_in_order(int key, int value) {
+    if (prev_key != -1 && key < prev_key)
+        failures++;
+    prev_key = key;
+    traversed_pairs++;
+}
+
+
+/* Inserts keys in increasing or decreasing order, which is the worst case for
+ * an unbalanced tree, and checks that every key and pair can be found again
+ * and that traversal is still in order.
+ */
+void test_sorted_insertion(int step) {
+    multimap *mm;
+    int i, key, errors;
+
+    printf("\nInserting %d keys in %s order.\n", NUM_SORTED_KEYS,
+           step > 0 ? "increasing" : "decreasing");
+
+    mm = init_multimap();
+    for (i = 0; i < NUM_SORTED_KEYS; i++) {
+        key = step > 0 ? i : NUM_SORTED_KEYS - 1 - i;
+        mm_add_value(mm, key, 2 * key);
+    }
+
+    errors = 0;
+    for (key = 0; key < NUM_SORTED_KEYS; key++) {
+        if (!mm_contains_key(mm, key) || !mm_contains_pair(mm, key, 2 * key) ||
+            mm_contains_pair(mm, key, 2 * key + 1)) {
+            errors++;
+        }
+    }
+    if (mm_contains_key(mm, -1) || mm_contains_key(mm, NUM_SORTED_KEYS))
+        errors++;
+
+    prev_key = -1;
+    traversed_pairs = 0;
+    mm_traverse(mm, count_in_order);
+    if (traversed_pairs != NUM_SORTED_KEYS)
+        errors++;
+
+    printf(" * Probes and traversal:  %s\n", errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* The number of values added to one key by test_many_values(). */
+#define NUM_KEY_VALUES 5000
+
+/* The ways test_many_values() can generate the values for its key. */
+#define VALUES_DENSE 0
+#define VALUES_SPARSE 1
+#define VALUES_EXTREME 2
+
+/* Returns the i-th value that test_many_values() adds for a given mode.
+ * Dense values fall in a narrow range with many duplicates, sparse values
+ * are spread out across the whole range of ints, and the extreme values
+ * include INT_MIN and INT_MAX.  Every generated value is even, so that odd
+ * values can be probed for as values that are not in the map.
+ */
+int many_value(int mode, int i) {
+    if (mode == VALUES_DENSE)
+        return 2 * (i % 700);
+    if (mode == VALUES_SPARSE)
+        return (int) ((unsigned int) i * 2654435761u) & ~1;
+
+    switch (i % 4) {
+    case 0:  return INT_MIN;
+    case 1:  return INT_MAX - 1;
+    case 2:  return -2 * i;
+    default: return 2 * i;
+    }
+}
+
+
+void count_pairs(int key, int value) {
+    traversed_pairs++;
+}
+
+
+/* Adds many values to a single key, whose values are dense, sparse or at
+ * the extremes of the range of ints, and checks that every value can be
+ * found, that no other values are found, and that duplicates are kept.
+ */
+void test_many_values(int mode) {
+    const char *mode_str[] = { "dense", "sparse", "extreme" };
+    multimap *mm;
+    int i, n, errors;
+
+    printf("\nAdding %s values to one key.\n", mode_str[mode]);
+
+    mm = init_multimap();
+    mm_add_value(mm, 1, 1);
+    mm_add_value(mm, 3, 3);
+
+    /* Check after each power of 2, so that every size of value set is
+     * probed along the way.
+     */
+    errors = 0;
+    for (n = 1; n <= NUM_KEY_VALUES; n++) {
+        mm_add_value(mm, 2, many_value(mode, n - 1));
+        if ((n & (n - 1)) != 0 && n != NUM_KEY_VALUES)
+            continue;
+
+        for (i = 0; i < n; i++) {
+            if (!mm_contains_pair(mm, 2, many_value(mode, i)) ||
+                mm_contains_pair(mm, 2, many_value(mode, i) + 1)) {
+                errors++;
+            }
+        }
+        if (mm_contains_pair(mm, 2, 1) || !mm_contains_pair(mm, 3, 3))
+            errors++;
+    }
+
+    traversed_pairs = 0;
+    mm_traverse(mm, count_pairs);
+    if (traversed_pairs != NUM_KEY_VALUES + 2)
+        errors++;
+
+    printf(" * Probes and traversal:  %s\n", errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* The number of pairs added by test_bulk_load(), and the ranges of their
+ * keys and values.
+ */
+#define NUM_BULK_PAIRS 100000
+#define MAX_BULK_KEY 20000
+#define MAX_BULK_VALUE 500
+
+int *recorded_pairs;
+int num_recorded;
+
+void record_pair(int key, int value) {
+    if (num_recorded > 0 && key < recorded_pairs[2 * num_recorded - 2])
+        failures++;
+
+    recorded_pairs[2 * num_recorded] = key;
+    recorded_pairs[2 * num_recorded + 1] = value;
+    num_recorded++;
+}
+
+
+int compare_pairs(const void *a, const void *b) {
+    const int *p = (const int *) a, *q = (const int *) b;
+
+    if (p[0] != q[0])
+        return (p[0] > q[0]) - (p[0] < q[0]);
+    return (p[1] > q[1]) - (p[1] < q[1]);
+}
+
+
+/* Traverses a multimap into a newly allocated array of (key, value) pairs,
+ * sorted by key and then value, since the order of each key's values is
+ * unspecified.
+ */
+int * record_multimap(multimap *mm, int num_pairs) {
+    recorded_pairs = malloc(2 * (num_pairs + 1) * sizeof(int));
+    num_recorded = 0;
+    mm_traverse(mm, record_pair);
+
+    if (num_recorded != num_pairs)
+        failures++;
+
+    qsort(recorded_pairs, num_recorded, 2 * sizeof(int), compare_pairs);
+    return recorded_pairs;
+}
+
+
+/* Loads the same pairs into one multimap with mm_add_value(), and into
+ * another with a series of calls to mm_add_values_bulk():  a batch into the
+ * empty map, a small batch of mostly new keys, and then a large batch that
+ * is split across several threads.  The two maps must hold the same pairs.
+ */
+void test_bulk_load() {
+    multimap *one, *bulk;
+    int *keys, *values, *one_pairs, *bulk_pairs;
+    int i, errors;
+
+    printf("\nBulk-loading %d pairs.\n", NUM_BULK_PAIRS);
+
+    keys = malloc(NUM_BULK_PAIRS * sizeof(int));
+    values = malloc(NUM_BULK_PAIRS * sizeof(int));
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = rand() % MAX_BULK_KEY - MAX_BULK_KEY / 2;
+        values[i] = rand() % MAX_BULK_VALUE;
+    }
+
+    /* The small batch's keys are all new, and larger than any other key. */
+    for (i = NUM_BULK_PAIRS / 2; i < NUM_BULK_PAIRS / 2 + 100; i++)
+        keys[i] = MAX_BULK_KEY + i % 50;
+
+    one = init_multimap();
+    for (i = 0; i < NUM_BULK_PAIRS; i++)
+        mm_add_value(one, keys[i], values[i]);
+    one_pairs = record_multimap(one, NUM_BULK_PAIRS);
+    clear_multimap(one);
+    free(one);
+
+    bulk = init_multimap();
+    mm_add_values_bulk(bulk, keys, values, NUM_BULK_PAIRS / 2);
+    mm_add_values_bulk(bulk, keys + NUM_BULK_PAIRS / 2, values +
+                       NUM_BULK_PAIRS / 2, 100);
+
+    setenv("MM_BULK_THREADS", "4", 1);
+    mm_add_values_bulk(bulk, keys + NUM_BULK_PAIRS / 2 + 100, values +
+                       NUM_BULK_PAIRS / 2 + 100, NUM_BULK_PAIRS / 2 - 100);
+    unsetenv("MM_BULK_THREADS");
+
+    bulk_pairs = record_multimap(bulk, NUM_BULK_PAIRS);
+
+    errors = 0;
+    for (i = 0; i < 2 * NUM_BULK_PAIRS; i++) {
+        if (one_pairs[i] != bulk_pairs[i])
+            errors++;
+    }
+    for (i = 0; i < 1000; i++) {
+        if (!mm_contains_pair(bulk, keys[i], values[i]))
+            errors++;
+    }
+    if (mm_contains_key(bulk, MAX_BULK_KEY + 50) ||
+        !mm_contains_key(bulk, MAX_BULK_KEY + 49)) {
+        errors++;
+    }
+
+    printf(" * Bulk-loaded pairs match:  %s\n", errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(bulk);
+    free(bulk);
+    free(keys);
+    free(values);
+    free(one_pairs);
+    free(bulk_pairs);
+}
+
+
+/* The number of probes made by test_batch_probes(); this is deliberately
+ * not a multiple of the size of a results word.
+ */
+#define NUM_BATCH_PROBES 1000
+
+/* Checks that mm_contains_pairs_batch() gives the same answers as
+ * mm_contains_pair() for each probe, on an empty map and a populated one.
+ */
+void test_batch_probes() {
+    multimap *mm;
+    int keys[NUM_BATCH_PROBES], values[NUM_BATCH_PROBES];
+    unsigned long long results[(NUM_BATCH_PROBES + 63) / 64];
+    int i, found, errors;
+
+    printf("\nProbing multimap with a batch of %d pairs.\n",
+           NUM_BATCH_PROBES);
+
+    errors = 0;
+    mm = init_multimap();
+
+    for (i = 0; i < NUM_BATCH_PROBES; i++) {
+        keys[i] = rand() % 200;
+        values[i] = rand() % 20;
+    }
+
+    /* Set every bit first, to check that misses are cleared. */
+    memset(results, 0xff, sizeof(results));
+    mm_contains_pairs_batch(mm, keys, values, NUM_BATCH_PROBES, results);
+    for (i = 0; i < NUM_BATCH_PROBES; i++) {
+        if ((results[i / 64] >> (i % 64)) & 1)
+            errors++;
+    }
+
+    for (i = 0; i < 5000; i++)
+        mm_add_value(mm, rand() % 150, rand() % 20);
+
+    memset(results, 0xff, sizeof(results));
+    mm_contains_pairs_batch(mm, keys, values, NUM_BATCH_PROBES, results);
+    for (i = 0; i < NUM_BATCH_PROBES; i++) {
+        found = (results[i / 64] >> (i % 64)) & 1;
+        if (found != (mm_contains_pair(mm, keys[i], values[i]) != 0))
+            errors++;
+    }
+
+    printf(" * Batch results match:  %s\n", errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(mm);
+    free(mm);
+}
+
+
+/* The number of keys added to each multimap by test_separate_maps(). */
+#define NUM_SEPARATE_KEYS 2000
+
+/* Fills two multimaps at the same time, and checks that clearing one leaves
+ * the other intact.  Also checks the memory usage that they report.
+ */
+void test_separate_maps() {
+    multimap *first, *second;
+    mm_memory_usage usage;
+    int i, errors;
+
+    printf("\nUsing two multimaps at once.\n");
+
+    errors = 0;
+    first = init_multimap();
+    second = init_multimap();
+
+    for (i = 0; i < NUM_SEPARATE_KEYS; i++) {
+        mm_add_value(first, i, 1);
+        mm_add_value(second, i, 2);
+    }
+
+    mm_get_memory_usage(first, &usage);
+    if (usage.num_pairs != NUM_SEPARATE_KEYS ||
+        usage.used_bytes < NUM_SEPARATE_KEYS * 2 * sizeof(int) ||
+        usage.reserved_bytes < usage.used_bytes) {
+        errors++;
+    }
+    printf(" * %llu pairs use %llu bytes (%llu reserved)\n", usage.num_pairs,
+           usage.used_bytes, usage.reserved_bytes);
+
+    clear_multimap(first);
+    mm_get_memory_usage(first, &usage);
+    if (usage.num_pairs != 0)
+        errors++;
+    free(first);
+
+    for (i = 0; i < NUM_SEPARATE_KEYS; i++)
+        mm_add_value(second, i, 3);
+
+    for (i = 0; i < NUM_SEPARATE_KEYS; i++) {
+        if (mm_contains_pair(second, i, 1) || !mm_contains_pair(second, i, 2) ||
+            !mm_contains_pair(second, i, 3)) {
+            errors++;
+        }
+    }
+
+    mm_get_memory_usage(second, &usage);
+    if (usage.num_pairs != 2 * NUM_SEPARATE_KEYS)
+        errors++;
+
+    printf(" * Clearing one multimap leaves the other intact:  %s\n",
+           errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(second);
+    free(second);
+}
+
+
+/* The file that test_snapshot() saves a snapshot to. */
+#define SNAPSHOT_PATH "mmtest.snapshot"
+
+/* Saves a multimap to a snapshot, opens it again, and checks that the opened
+ * multimap holds the same pairs, both before and after more pairs are added
+ * to it.
+ */
+void test_snapshot() {
+    multimap *mm, *snap;
+    int *keys, *values, *mm_pairs, *snap_pairs;
+    unsigned long long results[(NUM_BATCH_PROBES + 63) / 64];
+    int probe_keys[NUM_BATCH_PROBES], probe_values[NUM_BATCH_PROBES];
+    int i, found, errors;
+    FILE *file;
+
+    printf("\nSaving and reopening a snapshot of %d pairs.\n",
+           NUM_BULK_PAIRS);
+
+    errors = 0;
+
+    keys = malloc(NUM_BULK_PAIRS * sizeof(int));
+    values = malloc(NUM_BULK_PAIRS * sizeof(int));
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = rand() % MAX_BULK_KEY - MAX_BULK_KEY / 2;
+        values[i] = rand() % MAX_BULK_VALUE - MAX_BULK_VALUE / 2;
+    }
+
+    mm = init_multimap();
+    mm_add_values_bulk(mm, keys, values, NUM_BULK_PAIRS);
+    if (mm_save_snapshot(mm, SNAPSHOT_PATH) != 0) {
+        printf(" * Couldn't write %s\n", SNAPSHOT_PATH);
+        failures++;
+        clear_multimap(mm);
+        free(mm);
+        free(keys);
+        free(values);
+        return;
+    }
+
+    snap = mm_open_snapshot(SNAPSHOT_PATH);
+    if (snap == NULL) {
+        printf(" * Couldn't open %s\n", SNAPSHOT_PATH);
+        failures++;
+        clear_multimap(mm);
+        free(mm);
+        free(keys);
+        free(values);
+        unlink(SNAPSHOT_PATH);
+        return;
+    }
+
+    /* The opened snapshot must traverse and probe just like the original. */
+    mm_pairs = record_multimap(mm, NUM_BULK_PAIRS);
+    snap_pairs = record_multimap(snap, NUM_BULK_PAIRS);
+    for (i = 0; i < 2 * NUM_BULK_PAIRS; i++) {
+        if (mm_pairs[i] != snap_pairs[i])
+            errors++;
+    }
+    free(snap_pairs);
+
+    for (i = 0; i < NUM_BATCH_PROBES; i++) {
+        probe_keys[i] = rand() % MAX_BULK_KEY - MAX_BULK_KEY / 2;
+        probe_values[i] = rand() % MAX_BULK_VALUE - MAX_BULK_VALUE / 2;
+        if (mm_contains_key(snap, probe_keys[i]) !=
+            mm_contains_key(mm, probe_keys[i]) ||
+            mm_contains_pair(snap, probe_keys[i], probe_values[i]) !=
+            mm_contains_pair(mm, probe_keys[i], probe_values[i])) {
+            errors++;
+        }
+    }
+
+    memset(results, 0xff, sizeof(results));
+    mm_contains_pairs_batch(snap, probe_keys, probe_values, NUM_BATCH_PROBES,
+                            results);
+    for (i = 0; i < NUM_BATCH_PROBES; i++) {
+        found = (results[i / 64] >> (i % 64)) & 1;
+        if (found != (mm_contains_pair(mm, probe_keys[i],
+                                       probe_values[i]) != 0)) {
+            errors++;
+        }
+    }
+
+    /* Adding a pair turns the snapshot into an ordinary multimap. */
+    mm_add_value(snap, MAX_BULK_KEY, 1);
+    if (!mm_contains_pair(snap, MAX_BULK_KEY, 1) ||
+        !mm_contains_pair(snap, keys[0], values[0])) {
+        errors++;
+    }
+    mm_add_value(mm, MAX_BULK_KEY, 1);
+
+    free(mm_pairs);
+    mm_pairs = record_multimap(mm, NUM_BULK_PAIRS + 1);
+    snap_pairs = record_multimap(snap, NUM_BULK_PAIRS + 1);
+    for (i = 0; i < 2 * (NUM_BULK_PAIRS + 1); i++) {
+        if (mm_pairs[i] != snap_pairs[i])
+            errors++;
+    }
+
+    /* Files that aren't snapshots must be rejected. */
+    file = fopen(SNAPSHOT_PATH, "w");
+    fprintf(file, "This is not a snapshot.\n");
+    fclose(file);
+    if (mm_open_snapshot(SNAPSHOT_PATH) != NULL)
+        errors++;
+    unlink(SNAPSHOT_PATH);
+
+    printf(" * Snapshot matches the original:  %s\n",
+           errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(mm);
+    free(mm);
+    clear_multimap(snap);
+    free(snap);
+    free(keys);
+    free(values);
+    free(mm_pairs);
+    free(snap_pairs);
+}
+
+
+/* test_range_queries() runs this many random range queries against each
+ * multimap, over ranges of up to MAX_RANGE_WIDTH keys, and stops one query
+ * early after EARLY_STOP_PAIRS pairs.
+ */
+#define NUM_RANGE_QUERIES 200
+#define MAX_RANGE_WIDTH 300
+#define EARLY_STOP_PAIRS 10
+
+/* The pairs collected from a range query, and how many to collect before
+ * asking the query to stop; a limit of 0 means no limit.
+ */
+typedef struct pair_buffer {
+    int *pairs;
+    int count;
+    int limit;
+} pair_buffer;
+
+int collect_pair(int key, int value, void *arg) {
+    pair_buffer *buf = (pair_buffer *) arg;
+
+    if (buf->count > 0 && key < buf->pairs[2 * buf->count - 2])
+        failures++;
+
+    buf->pairs[2 * buf->count] = key;
+    buf->pairs[2 * buf->count + 1] = value;
+    buf->count++;
+
+    return buf->count == buf->limit;
+}
+
+
+/* Returns the number of collected pairs that differ from the count pairs
+ * starting at expected, once the collected pairs are sorted.
+ */
+int compare_collected(pair_buffer *buf, const int *expected, int count) {
+    int i, errors = 0;
+
+    if (buf->count != count)
+        return 1;
+
+    qsort(buf->pairs, buf->count, 2 * sizeof(int), compare_pairs);
+    for (i = 0; i < 2 * count; i++) {
+        if (buf->pairs[i] != expected[i])
+            errors++;
+    }
+
+    return errors;
+}
+
+
+/* Checks range queries and iterators over a multimap against its pairs,
+ * sorted by key and then value.  Returns the number of errors found.
+ */
+int check_ranges(multimap *mm, const int *pairs, int num_pairs) {
+    pair_buffer buf;
+    mm_iter *iter;
+    int q, lo, hi, first, last, key, value, errors = 0;
+
+    buf.pairs = malloc(2 * (num_pairs + 1) * sizeof(int));
+
+    for (q = 0; q < NUM_RANGE_QUERIES; q++) {
+        lo = rand() % (MAX_BULK_KEY + 200) - MAX_BULK_KEY / 2 - 100;
+        hi = lo + rand() % MAX_RANGE_WIDTH;
+
+        for (first = 0; first < num_pairs && pairs[2 * first] < lo; first++)
+            ;
+        for (last = first; last < num_pairs && pairs[2 * last] <= hi; last++)
+            ;
+
+        buf.count = 0;
+        buf.limit = 0;
+        if (mm_range(mm, lo, hi, collect_pair, &buf) != 0)
+            errors++;
+        errors += compare_collected(&buf, pairs + 2 * first, last - first);
+
+        /* The iterator must produce the same pairs, and then carry on past
+         * the range.
+         */
+        buf.count = 0;
+        iter = mm_iter_seek(mm, lo);
+        while (mm_iter_next(iter, &key, &value) && key <= hi) {
+            buf.pairs[2 * buf.count] = key;
+            buf.pairs[2 * buf.count + 1] = value;
+            buf.count++;
+        }
+        if (last < num_pairs && key != pairs[2 * last])
+            errors++;
+        mm_iter_free(iter);
+        errors += compare_collected(&buf, pairs + 2 * first, last - first);
+    }
+
+    /* The whole multimap, and a query that is stopped early. */
+    buf.count = 0;
+    buf.limit = 0;
+    mm_range(mm, INT_MIN, INT_MAX, collect_pair, &buf);
+    errors += compare_collected(&buf, pairs, num_pairs);
+
+    buf.count = 0;
+    buf.limit = EARLY_STOP_PAIRS;
+    if (mm_range(mm, INT_MIN, INT_MAX, collect_pair, &buf) != 1 ||
+        buf.count != EARLY_STOP_PAIRS) {
+        errors++;
+    }
+
+    /* An iterator that starts past the last key has nothing to return. */
+    iter = mm_iter_seek(mm, pairs[2 * num_pairs - 2] + 1);
+    if (mm_iter_next(iter, &key, &value))
+        errors++;
+    mm_iter_free(iter);
+
+    free(buf.pairs);
+    return errors;
+}
+
+
+/* Checks range queries and iterators over a multimap loaded partly in bulk
+ * and partly one pair at a time, and over a snapshot of it.
+ */
+void test_range_queries() {
+    multimap *mm, *snap;
+    int *keys, *values, *pairs;
+    int i, errors;
+
+    printf("\nRunning %d range queries over %d pairs.\n", NUM_RANGE_QUERIES,
+           NUM_BULK_PAIRS);
+
+    keys = malloc(NUM_BULK_PAIRS * sizeof(int));
+    values = malloc(NUM_BULK_PAIRS * sizeof(int));
+    for (i = 0; i < NUM_BULK_PAIRS; i++) {
+        keys[i] = rand() % MAX_BULK_KEY - MAX_BULK_KEY / 2;
+        values[i] = rand() % MAX_BULK_VALUE - MAX_BULK_VALUE / 2;
+    }
+
+    mm = init_multimap();
+    mm_add_values_bulk(mm, keys, values, NUM_BULK_PAIRS / 2);
+    for (i = NUM_BULK_PAIRS / 2; i < NUM_BULK_PAIRS; i++)
+        mm_add_value(mm, keys[i], values[i]);
+
+    pairs = record_multimap(mm, NUM_BULK_PAIRS);
+    errors = check_ranges(mm, pairs, NUM_BULK_PAIRS);
+    printf(" * Range queries and iterators:  %s\n",
+           errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    errors = 0;
+    snap = NULL;
+    if (mm_save_snapshot(mm, SNAPSHOT_PATH) == 0)
+        snap = mm_open_snapshot(SNAPSHOT_PATH);
+    unlink(SNAPSHOT_PATH);
+    if (snap != NULL) {
+        errors = check_ranges(snap, pairs, NUM_BULK_PAIRS);
+        clear_multimap(snap);
+        free(snap);
+    }
+    else {
+        errors = 1;
+    }
+    printf(" * Range queries and iterators over a snapshot:  %s\n",
+           errors == 0 ? "PASS" : "FAIL");
+    failures += errors;
+
+    clear_multimap(mm);
+    free(mm);
+    free(keys);
+    free(values);
+    free(pairs);
+}
 
 
 int main() {
@@ -122,6 +774,19 @@ int main() {
     clear_multimap(mm);
     free(mm);
 
+    test_sorted_insertion(1);
+    test_sorted_insertion(-1);
+
+    test_many_values(VALUES_DENSE);
+    test_many_values(VALUES_SPARSE);
+    test_many_values(VALUES_EXTREME);
+
+    test_bulk_load();
+    test_batch_probes();
+    test_separate_maps();
+    test_snapshot();
+    test_range_queries();
+
     printf("\nFinal results:  %d failures\n", failures);
 
     return 0;
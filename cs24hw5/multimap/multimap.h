@@ -12,6 +12,30 @@
 
 typedef struct multimap multimap;
 
+/* An external iterator over the pairs of a multimap; see mm_iter_seek(). */
+typedef struct mm_iter mm_iter;
+
+/* A function that mm_range() passes pairs to, along with the argument that
+ * was passed to mm_range().  Returning nonzero stops the query early.
+ */
+typedef int (*mm_range_func)(int key, int value, void *arg);
+
+
+/* How much memory a multimap is using, as reported by mm_get_memory_usage(). */
+typedef struct mm_memory_usage {
+    /* The number of (key, value) pairs that have been added to the multimap,
+     * including duplicates.
+     */
+    unsigned long long num_pairs;
+
+    /* The number of bytes obtained from the system to hold the multimap, and
+     * the number of those bytes that are in use by its data structures.  The
+     * rest is free space waiting to be reused.
+     */
+    unsigned long long reserved_bytes;
+    unsigned long long used_bytes;
+} mm_memory_usage;
+
 
 /* Allocate and initialize a multimap data structure. */
 multimap * init_multimap();
@@ -24,6 +48,13 @@ void clear_multimap(multimap *mm);
 /* Adds the specified (key, value) pair to the multimap. */
 void mm_add_value(multimap *mm, int key, int value);
 
+/* Adds n (key, value) pairs to the multimap, where the i-th pair is
+ * (keys[i], values[i]).  The result is the same as calling mm_add_value() on
+ * each pair, but large batches can be loaded much faster this way.
+ */
+void mm_add_values_bulk(multimap *mm, const int *keys, const int *values,
+                        unsigned int n);
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
@@ -34,6 +65,60 @@ int mm_contains_key(multimap *mm, int key);
  */
 int mm_contains_pair(multimap *mm, int key, int value);
 
+/* Probes the multimap for n (key, value) pairs at once, where the i-th pair
+ * is (keys[i], values[i]).  Bit i % 64 of results[i / 64] is set if the
+ * multimap contains the i-th pair, and cleared if it doesn't; results must
+ * have room for (n + 63) / 64 words.  Implementations may interleave the
+ * probes so that their cache misses overlap.
+ */
+void mm_contains_pairs_batch(multimap *mm, const int *keys, const int *values,
+                             unsigned int n, unsigned long long *results);
+
+/* Reports how much memory the multimap is using.  Dividing reserved_bytes by
+ * num_pairs gives the cost of each pair, which can be compared with the 8
+ * bytes that a pair's key and value take up on their own.
+ */
+void mm_get_memory_usage(multimap *mm, mm_memory_usage *usage);
+
+/* Passes each (key, value) pair with lo <= key <= hi to the specified
+ * function, in key order, along with arg.  Only the part of the multimap
+ * that holds those keys is visited.  Returns zero if every pair in the range
+ * was passed to the function, or the nonzero value that the function
+ * returned to stop early.
+ */
+int mm_range(multimap *mm, int lo, int hi, mm_range_func f, void *arg);
+
+/* Returns an iterator positioned at the first pair whose key is at least the
+ * specified key.  The iterator must be released with mm_iter_free(), and is
+ * invalidated if pairs are added to the multimap, except that iterators over
+ * the concurrent multimap stay valid (but may not see the new pairs).
+ */
+mm_iter * mm_iter_seek(multimap *mm, int key);
+
+/* Stores the iterator's next pair into *p_key and *p_value and returns
+ * nonzero, or returns zero if there are no more pairs.  Pairs come in key
+ * order; the values of each key come in no particular order.
+ */
+int mm_iter_next(mm_iter *iter, int *p_key, int *p_value);
+
+/* Releases an iterator. */
+void mm_iter_free(mm_iter *iter);
+
+/* Writes the multimap's pairs to a snapshot file, which mm_open_snapshot()
+ * can open much faster than the pairs could be added again.  Returns 0 on
+ * success, or -1 with errno set if the file couldn't be written.  The
+ * multimap must not be added to while it is being saved.
+ */
+int mm_save_snapshot(multimap *mm, const char *path);
+
+/* Opens a snapshot file written by mm_save_snapshot() as a multimap.  The
+ * file is mapped into memory and queried in place, without being loaded
+ * into the multimap's own data structures, until pairs are added to the
+ * multimap.  Returns NULL if the file can't be opened or isn't a valid
+ * snapshot.  The multimap is released with clear_multimap() as usual.
+ */
+multimap * mm_open_snapshot(const char *path);
+
 /* Performs an in-order traversal of the multimap, passing each (key, value)
  * pair to the specified function.
  */
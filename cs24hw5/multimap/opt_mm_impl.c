@@ -3,7 +3,35 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+#include "bulkload.h"
 #include "multimap.h"
+#include "snapshot.h"
+#include "valueset.h"
+
+
+/* Set this to 0 and rebuild to use a plain binary search tree, which
+ * degrades to a linked list when keys are inserted in sorted order.  When
+ * nonzero, the tree is kept height-balanced as an AVL tree.  This can also be
+ * set from the compiler command-line with -DMM_BALANCED=0.
+ */
+#ifndef MM_BALANCED
+#define MM_BALANCED 1
+#endif
+
+/* An AVL tree with 2^32 nodes is at most 46 levels deep, so this is enough
+ * room to record the path from the root to any node.
+ */
+#define MAX_TREE_DEPTH 64
+
+/* mm_add_values_bulk() rebuilds the whole tree when a batch has at least
+ * 1/REBUILD_FRACTION as many distinct keys as the tree already holds, and
+ * otherwise inserts the batch's keys into the existing tree one at a time.
+ */
+#define REBUILD_FRACTION 16
+
+/* mm_contains_pairs_batch() walks this many probes down the tree together. */
+#define PROBE_GROUP 16
 
 
 /*============================================================================
@@ -22,17 +50,8 @@ typedef struct multimap_node {
     /* The key-value that this multimap node represents. */
     int key;
 
-    /* An array of the values associated with this key in the multimap. */
-    int *values;
-
-    /* The current size of the array. Doubles once filled up. */
-    unsigned int size;
-
-    /* 
-     * The next "free" index of the values array. This index is where the 
-     * next new value will be added to.
-     */
-    unsigned int last_index;
+    /* The values associated with this key in the multimap. */
+    value_set values;
 
     /* The left child of the multimap node.  This will reference nodes that
      * hold keys that are strictly less than this node's key.
@@ -43,12 +62,56 @@ typedef struct multimap_node {
      * hold keys that are strictly greater than this node's key.
      */
     struct multimap_node *right_child;
+
+    /* The height of the subtree rooted at this node; a leaf has height 1.
+     * This is only maintained when MM_BALANCED is nonzero.
+     */
+    int height;
 } multimap_node;
 
 
 /* The entry-point of the multimap data structure. */
 struct multimap {
     multimap_node *root;
+
+    /* The number of nodes in the tree, i.e. the number of distinct keys, and
+     * the number of (key, value) pairs that have been added.
+     */
+    unsigned int num_keys;
+    unsigned long long num_pairs;
+
+    /* The nodes and their values are all allocated from this arena, so that
+     * they can all be released at once.
+     */
+    mm_arena arena;
+    /* If the multimap was opened from a snapshot, and no pairs have been
+     * added to it since, the snapshot that its pairs are read from.
+     */
+    mm_snapshot *snapshot;
+};
+
+
+/* An iterator over the pairs of a multimap, or of its snapshot. */
+struct mm_iter {
+    /* Nonzero if the multimap was read from a snapshot, in which case only
+     * snap is used.
+     */
+    int from_snapshot;
+    snap_iter snap;
+
+    /* The node whose values are being returned, and the index of the next of
+     * them.
+     */
+    multimap_node *node;
+    unsigned int value_index;
+
+    /* The nodes still to be visited whose left subtrees have already been
+     * visited, with the next one on top.  Without balancing the tree can be
+     * arbitrarily deep, so the stack grows as needed.
+     */
+    multimap_node **stack;
+    unsigned int depth;
+    unsigned int max_depth;
 };
 
 
@@ -59,84 +122,41 @@ struct multimap {
  *   these are not visible outside of this module.
  *============================================================================*/
 
-multimap_node * alloc_mm_node();
-
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found);
+multimap_node * alloc_mm_node(multimap *mm);
 
-int * resize_array(int *values_arr, int new_size);
+multimap_node * find_mm_node(multimap *mm, int key, int create_if_not_found);
 
-void free_multimap_node(multimap_node *node);
+multimap_node * find_or_insert_balanced(multimap *mm, int key);
 
-void alloc_slabs(void);
+int node_height(multimap_node *node);
+void update_height(multimap_node *node);
+multimap_node * rotate_left(multimap_node *node);
+multimap_node * rotate_right(multimap_node *node);
+multimap_node * rebalance(multimap_node *node);
 
-void resize_slabs(void);
+void flatten_tree(multimap_node *node, multimap_node **nodes,
+                  unsigned int *p_count);
+multimap_node * build_balanced_tree(multimap_node **nodes, unsigned int n);
 
-/* Global variables for slab allocation. */
+void thaw_snapshot(multimap *mm);
 
-/* Array of slabs where each slab is an array of multimap_node structs. */
-multimap_node **slabs = NULL;
-unsigned int num_slabs;
-unsigned int max_num_slabs;
+void iter_push(mm_iter *iter, multimap_node *node);
+void iter_start(mm_iter *iter, multimap *mm, int key);
+multimap_node * iter_next_node(mm_iter *iter);
 
-/* 
- * These variables track the current state of each slab. We let each slab 
- * contain up to 1000000 multimap_nodes. num_nodes_in_slab corresponds to
- * how many multimap_nodes are in the slab, so we know when to reallocate
- * once num_nodes_in_slab == max_nodes_in_slab.
- */
 
-static const unsigned int max_nodes_in_slab = 1000000;
-unsigned int num_nodes_in_slab;
 /*============================================================================
  * FUNCTION IMPLEMENTATIONS
  *============================================================================*/
 
-/* 
- * Allocates the initial memory pool of slabs. Initially, there is only room
- * for one slab.
- */
-void alloc_slabs() {
-    slabs = malloc(sizeof(multimap_node *));
-    slabs[0] = malloc(max_nodes_in_slab * sizeof(multimap_node));
-    max_num_slabs = 1;
-    num_slabs = 1;
-    num_nodes_in_slab = 0;
-}
-
-/* 
- * Uses realloc to double the amount of slabs the slabs array can hold. 
- */
-void resize_slabs(void) {
-    max_num_slabs *= 2;
-    slabs = realloc(slabs, max_num_slabs * sizeof(multimap_node *));
-}
-
-/* Allocates a multimap node, and zeros out its contents so that we know what
- * the initial value of everything will be.
+/* Allocates a multimap node from the multimap's arena, and zeros out its
+ * contents so that we know what the initial value of everything will be.
  */
-multimap_node * alloc_mm_node(void) {
-    /* Check to see if we need to move on over to a new slab. */
-    if (num_nodes_in_slab == max_nodes_in_slab) {
-        /* Check to see if we need to resize our slabs array. */
-        if (max_num_slabs == num_slabs) {
-            resize_slabs();
-        }
-        /* Allocate a new slab. */
-        slabs[num_slabs] = malloc(max_nodes_in_slab * sizeof(multimap_node));
-        num_nodes_in_slab = 0;
-        num_slabs++;
-    }
+multimap_node * alloc_mm_node(multimap *mm) {
+    multimap_node *node = arena_zalloc(&mm->arena, sizeof(multimap_node));
 
-    /* Allocate node into slab. */
-    multimap_node *node = slabs[num_slabs - 1] + num_nodes_in_slab;
-    num_nodes_in_slab++;
-    bzero(node, sizeof(multimap_node));
-
-    /* Initialize the values array to be of size 1 upon creation. */
-    node->values = (int *) malloc(sizeof(int));
-    node->size = 1;
-    node->last_index = 0;
+    vs_init(&node->values);
+    mm->num_keys++;
 
     return node;
 }
@@ -145,24 +165,22 @@ multimap_node * alloc_mm_node(void) {
 /* This helper function searches for the multimap node that contains the
  * specified key.  If such a node doesn't exist, the function can initialize
  * a new node and add this into the structure, or it will simply return NULL.
- * The one exception is the root - if the root is NULL then the function will
- * return a new root node.
+ * If the multimap is empty, the new node becomes its root.
  */
-multimap_node * find_mm_node(multimap_node *root, int key,
-                             int create_if_not_found) {
+multimap_node * find_mm_node(multimap *mm, int key, int create_if_not_found) {
     multimap_node *node;
 
     /* If the entire multimap is empty, the root will be NULL. */
-    if (root == NULL) {
+    if (mm->root == NULL) {
         if (create_if_not_found) {
-            root = alloc_mm_node();
-            root->key = key;
+            mm->root = alloc_mm_node(mm);
+            mm->root->key = key;
         }
-        return root;
+        return mm->root;
     }
 
     /* Now we know the multimap has at least a root node, so start there. */
-    node = root;
+    node = mm->root;
     while (1) {
         if (node->key == key)
             break;
@@ -170,7 +188,7 @@ multimap_node * find_mm_node(multimap_node *root, int key,
         if (node->key > key) {   /* Follow left child */
             if (node->left_child == NULL && create_if_not_found) {
                 /* No left child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
+                multimap_node *new = alloc_mm_node(mm);
                 new->key = key;
 
                 node->left_child = new;
@@ -180,7 +198,7 @@ multimap_node * find_mm_node(multimap_node *root, int key,
         else {                   /* Follow right child */
             if (node->right_child == NULL && create_if_not_found) {
                 /* No right child, but caller wants us to create a new node. */
-                multimap_node *new = alloc_mm_node();
+                multimap_node *new = alloc_mm_node(mm);
                 new->key = key;
 
                 node->right_child = new;
@@ -196,27 +214,165 @@ multimap_node * find_mm_node(multimap_node *root, int key,
 }
 
 
+/* This helper function searches for the multimap node that contains the
+ * specified key, creating and inserting it if it doesn't exist.  Unlike
+ * find_mm_node(), the tree is then rebalanced as an AVL tree, so that its
+ * height stays logarithmic even when keys arrive in sorted order.
+ */
+multimap_node * find_or_insert_balanced(multimap *mm, int key) {
+    multimap_node **path[MAX_TREE_DEPTH];
+    multimap_node **link, *new;
+    int depth, old_height;
 
-/* This helper function frees a multimap node, including its children and
- * value-list.
+    /* Walk down from the root, remembering each link that we follow, since
+     * those are the subtrees that may need rebalancing afterward.
+     */
+    depth = 0;
+    link = &mm->root;
+    while (*link != NULL) {
+        if ((*link)->key == key)
+            return *link;
+
+        assert(depth < MAX_TREE_DEPTH);
+        path[depth++] = link;
+
+        if ((*link)->key > key)
+            link = &(*link)->left_child;
+        else
+            link = &(*link)->right_child;
+    }
+
+    new = alloc_mm_node(mm);
+    new->key = key;
+    new->height = 1;
+    *link = new;
+
+    /* Walk back up, fixing heights and rotating where the two subtrees of a
+     * node differ in height by more than 1.  Once a subtree's height stops
+     * changing, nothing above it can be out of balance.
+     */
+    while (depth > 0) {
+        link = path[--depth];
+        old_height = (*link)->height;
+
+        *link = rebalance(*link);
+        if ((*link)->height == old_height)
+            break;
+    }
+
+    return new;
+}
+
+
+/* Returns the height of a subtree, where an empty subtree has height 0. */
+int node_height(multimap_node *node) {
+    return node == NULL ? 0 : node->height;
+}
+
+
+/* Recomputes a node's height from the heights of its children. */
+void update_height(multimap_node *node) {
+    int left = node_height(node->left_child);
+    int right = node_height(node->right_child);
+
+    node->height = 1 + (left > right ? left : right);
+}
+
+
+/* Rotates the subtree rooted at node to the left, and returns the new root
+ * of the subtree (node's old right child).
+ */
+multimap_node * rotate_left(multimap_node *node) {
+    multimap_node *right = node->right_child;
+
+    node->right_child = right->left_child;
+    right->left_child = node;
+
+    update_height(node);
+    update_height(right);
+
+    return right;
+}
+
+
+/* Rotates the subtree rooted at node to the right, and returns the new root
+ * of the subtree (node's old left child).
  */
-void free_multimap_node(multimap_node *node) {
+multimap_node * rotate_right(multimap_node *node) {
+    multimap_node *left = node->left_child;
+
+    node->left_child = left->right_child;
+    left->right_child = node;
+
+    update_height(node);
+    update_height(left);
+
+    return left;
+}
+
+
+/* Restores the AVL property at a node whose subtrees differ in height by at
+ * most 2, and returns the new root of the subtree.
+ */
+multimap_node * rebalance(multimap_node *node) {
+    int balance;
+
+    update_height(node);
+    balance = node_height(node->left_child) - node_height(node->right_child);
+
+    if (balance > 1) {
+        /* Left-heavy.  If the left child leans right, straighten it first. */
+        if (node_height(node->left_child->left_child) <
+            node_height(node->left_child->right_child)) {
+            node->left_child = rotate_left(node->left_child);
+        }
+        return rotate_right(node);
+    }
+
+    if (balance < -1) {
+        /* Right-heavy.  If the right child leans left, straighten it first. */
+        if (node_height(node->right_child->right_child) <
+            node_height(node->right_child->left_child)) {
+            node->right_child = rotate_right(node->right_child);
+        }
+        return rotate_left(node);
+    }
+
+    return node;
+}
+
+
+/* Stores the nodes of a subtree into an array, in key order, starting at
+ * index *p_count, and advances *p_count past them.
+ */
+void flatten_tree(multimap_node *node, multimap_node **nodes,
+                  unsigned int *p_count) {
     if (node == NULL)
         return;
 
-    /* Free the children first. */
-    free_multimap_node(node->left_child);
-    free_multimap_node(node->right_child);
+    flatten_tree(node->left_child, nodes, p_count);
+    nodes[(*p_count)++] = node;
+    flatten_tree(node->right_child, nodes, p_count);
+}
 
-    /* Free the array of values. */
-    free(node->values);
-    
 
-#ifdef DEBUG_ZERO
-    /* Clear out what we are about to free, to expose issues quickly. */
-    bzero(node, sizeof(multimap_node));
-#endif
+/* Links an array of nodes, sorted by key, into a perfectly balanced tree, and
+ * returns its root.  The tree is also a valid AVL tree.
+ */
+multimap_node * build_balanced_tree(multimap_node **nodes, unsigned int n) {
+    multimap_node *node;
+    unsigned int mid;
 
+    if (n == 0)
+        return NULL;
+
+    mid = n / 2;
+    node = nodes[mid];
+    node->left_child = build_balanced_tree(nodes, mid);
+    node->right_child = build_balanced_tree(nodes + mid + 1, n - mid - 1);
+    update_height(node);
+
+    return node;
 }
 
 
@@ -224,30 +380,58 @@ void free_multimap_node(multimap_node *node) {
 multimap * init_multimap() {
     multimap *mm = malloc(sizeof(multimap));
     mm->root = NULL;
-    alloc_slabs();
+    mm->num_keys = 0;
+    mm->num_pairs = 0;
+    arena_init(&mm->arena);
+    mm->snapshot = NULL;
     return mm;
 }
 
 
 /* Release all dynamically allocated memory associated with the multimap
- * data structure.
+ * data structure.  Every node and value set came from the multimap's arena,
+ * so they are all released together without walking the tree.
  */
 void clear_multimap(multimap *mm) {
     assert(mm != NULL);
-    free_multimap_node(mm->root);
+    arena_clear(&mm->arena);
     mm->root = NULL;
+    mm->num_keys = 0;
+    mm->num_pairs = 0;
 
-    /* Free each slab. Implicitly frees each multimap_node. */
-    for (unsigned int i = 0; i < num_slabs; i++) {
-        free(slabs[i]);
+    if (mm->snapshot != NULL) {
+        snap_close(mm->snapshot);
+        mm->snapshot = NULL;
     }
+}
+
+
+/* Loads the pairs of the snapshot that the multimap was opened from into the
+ * multimap's own data structures, so that more pairs can be added to it.
+ */
+void thaw_snapshot(multimap *mm) {
+    mm_snapshot *snap = mm->snapshot;
 
-    /* Reset global variables. */
-    free(slabs);
-    slabs = NULL;
-    num_slabs = 0;
-    max_num_slabs = 0;
-    num_nodes_in_slab = 0;
+    mm->snapshot = NULL;
+    snap_add_to_multimap(snap, mm);
+    snap_close(snap);
+}
+
+
+/* Opens a snapshot file as a multimap, which reads its pairs from the mapped
+ * file until pairs are added to it.
+ */
+multimap * mm_open_snapshot(const char *path) {
+    mm_snapshot *snap;
+    multimap *mm;
+
+    snap = snap_open(path);
+    if (snap == NULL)
+        return NULL;
+
+    mm = init_multimap();
+    mm->snapshot = snap;
+    return mm;
 }
 
 
@@ -257,49 +441,112 @@ void mm_add_value(multimap *mm, int key, int value) {
 
     assert(mm != NULL);
 
+    if (mm->snapshot != NULL)
+        thaw_snapshot(mm);
+
     /* Look up the node with the specified key.  Create if not found. */
-    node = find_mm_node(mm->root, key, /* create */ 1);
-    if (mm->root == NULL)
-        mm->root = node;
+#if MM_BALANCED
+    node = find_or_insert_balanced(mm, key);
+#else
+    node = find_mm_node(mm, key, /* create */ 1);
+#endif
 
     assert(node != NULL);
     assert(node->key == key);
 
-    /* Add the new value to the multimap node's value array. */
-    int last_index = node->last_index;
-    int curr_size = node->size;
-
-    /* 
-     * Test to see if we need to resize the array. If we do need to resize, 
-     * we simply double the size. 
-     */
-    if (last_index == curr_size) {
-        node->size *= 2;
-        node->values = resize_array(node->values, node->size);
-    }
-
-    /* Add in the value to the array. */
-    node->values[last_index] = value;
-    node->last_index++;
+    /* Add the new value to the multimap node's value set. */
+    vs_add(&node->values, &mm->arena, value);
+    mm->num_pairs++;
 }
 
-/* 
- * Resizes values array for a multimap_node using realloc. Takes in the 
- * current array and an integer argument corresponding to the desired new 
- * size. Copies the current array into a new array of size new_size and 
- * returns the new, bigger array.
+/* Adds n (key, value) pairs to the multimap.  The batch is sorted by key, so
+ * that each distinct key is only looked up once, and all of a key's new
+ * values are added to its set at once.
  */
+void mm_add_values_bulk(multimap *mm, const int *keys, const int *values,
+                        unsigned int n) {
+    bulk_batch batch;
+    value_set **sets;
+    multimap_node **old_nodes, **nodes, *node;
+    unsigned int num_old, num_nodes, run, i;
+    int key;
+
+    assert(mm != NULL);
+
+    if (n == 0)
+        return;
+
+    if (mm->snapshot != NULL)
+        thaw_snapshot(mm);
+
+    init_bulk_batch(&batch, keys, values, n);
+    sets = malloc(batch.num_runs * sizeof(value_set *));
+
+    if (batch.num_runs >= mm->num_keys / REBUILD_FRACTION) {
+        /* Merge the batch's keys with the tree's nodes, in order, creating
+         * nodes for the new keys, and then rebuild the tree bottom-up.
+         */
+        old_nodes = malloc(mm->num_keys * sizeof(multimap_node *));
+        num_old = 0;
+        flatten_tree(mm->root, old_nodes, &num_old);
+
+        nodes = malloc((num_old + batch.num_runs) * sizeof(multimap_node *));
+        num_nodes = 0;
+        i = 0;
+        for (run = 0; run < batch.num_runs; run++) {
+            key = RUN_KEY(&batch, run);
+
+            while (i < num_old && old_nodes[i]->key < key)
+                nodes[num_nodes++] = old_nodes[i++];
 
-int * resize_array(int *values_arr, int new_size) {
-    int *new_values_arr = realloc(values_arr, sizeof(int) * new_size);
-    return new_values_arr;
+            if (i < num_old && old_nodes[i]->key == key) {
+                node = old_nodes[i++];
+            }
+            else {
+                node = alloc_mm_node(mm);
+                node->key = key;
+            }
+
+            nodes[num_nodes++] = node;
+            sets[run] = &node->values;
+        }
+        while (i < num_old)
+            nodes[num_nodes++] = old_nodes[i++];
+
+        mm->root = build_balanced_tree(nodes, num_nodes);
+
+        free(old_nodes);
+        free(nodes);
+    }
+    else {
+        /* Only a few new keys, so find or insert each one in the tree. */
+        for (run = 0; run < batch.num_runs; run++) {
+            key = RUN_KEY(&batch, run);
+#if MM_BALANCED
+            node = find_or_insert_balanced(mm, key);
+#else
+            node = find_mm_node(mm, key, /* create */ 1);
+#endif
+            sets[run] = &node->values;
+        }
+    }
+
+    fill_value_sets(&batch, sets, &mm->arena);
+    mm->num_pairs += n;
+
+    free(sets);
+    clear_bulk_batch(&batch);
 }
 
+
 /* Returns nonzero if the multimap contains the specified key-value, zero
  * otherwise.
  */
 int mm_contains_key(multimap *mm, int key) {
-    return find_mm_node(mm->root, key, /* create */ 0) != NULL;
+    if (mm->snapshot != NULL)
+        return snap_contains_key(mm->snapshot, key);
+
+    return find_mm_node(mm, key, /* create */ 0) != NULL;
 }
 
 
@@ -308,22 +555,79 @@ int mm_contains_key(multimap *mm, int key) {
  */
 int mm_contains_pair(multimap *mm, int key, int value) {
     multimap_node *node;
-    int *curr;
 
-    node = find_mm_node(mm->root, key, /* create */ 0);
+    if (mm->snapshot != NULL)
+        return snap_contains_pair(mm->snapshot, key, value);
+
+    node = find_mm_node(mm, key, /* create */ 0);
     if (node == NULL)
         return 0;
 
-    curr = node->values;
+    return vs_contains(&node->values, value);
+}
 
-    /* Iterate through values array, searching for specific value. */
-    for (unsigned int i = 0; i < node->last_index; i++) {
-        if (curr[i] == value) {
-            return 1;
-        }
+
+/* Probes the multimap for n (key, value) pairs, setting bit i % 64 of
+ * results[i / 64] if the i-th pair is present.  The probes are taken in
+ * groups, which are walked down the tree together one level at a time.  The
+ * next node of every probe in the group is prefetched before any of them is
+ * visited, so the probes' cache misses overlap instead of each one stalling
+ * in turn.
+ */
+void mm_contains_pairs_batch(multimap *mm, const int *keys, const int *values,
+                             unsigned int n, unsigned long long *results) {
+    multimap_node *nodes[PROBE_GROUP], *node;
+    unsigned int base, count, i;
+    int active, key;
+
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL) {
+        snap_contains_pairs_batch(mm->snapshot, keys, values, n, results);
+        return;
     }
 
-    return 0;
+    bzero(results, (n + 63) / 64 * sizeof(unsigned long long));
+
+    for (base = 0; base < n; base += PROBE_GROUP) {
+        count = (n - base < PROBE_GROUP) ? n - base : PROBE_GROUP;
+
+        for (i = 0; i < count; i++)
+            nodes[i] = mm->root;
+
+        /* Move each probe that hasn't found its key or fallen off the tree
+         * down one level per round, until none are left.
+         */
+        do {
+            active = 0;
+            for (i = 0; i < count; i++) {
+                node = nodes[i];
+                key = keys[base + i];
+                if (node == NULL || node->key == key)
+                    continue;
+
+                node = (node->key > key) ? node->left_child : node->right_child;
+                nodes[i] = node;
+                if (node != NULL) {
+                    __builtin_prefetch(node);
+                    active = 1;
+                }
+            }
+        } while (active);
+
+        /* Start loading every probe's values before checking any of them. */
+        for (i = 0; i < count; i++) {
+            if (nodes[i] != NULL)
+                vs_prefetch(&nodes[i]->values, values[base + i]);
+        }
+
+        for (i = 0; i < count; i++) {
+            if (nodes[i] != NULL &&
+                vs_contains(&nodes[i]->values, values[base + i])) {
+                results[(base + i) / 64] |= 1ULL << ((base + i) % 64);
+            }
+        }
+    }
 }
 
 
@@ -338,9 +642,9 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
 
     mm_traverse_helper(node->left_child, f);
 
-    curr = node->values;
+    curr = node->values.values;
 
-    for (unsigned int i = 0; i < node->last_index; i++) {
+    for (unsigned int i = 0; i < node->values.num_values; i++) {
         f(node->key, curr[i]);
     }
 
@@ -352,6 +656,154 @@ void mm_traverse_helper(multimap_node *node, void (*f)(int key, int value)) {
  * pair to the specified function.
  */
 void mm_traverse(multimap *mm, void (*f)(int key, int value)) {
-    mm_traverse_helper(mm->root, f);
+    if (mm->snapshot != NULL)
+        snap_traverse(mm->snapshot, f);
+    else
+        mm_traverse_helper(mm->root, f);
 }
 
+
+/* Pushes a node onto an iterator's stack, growing the stack if it is full. */
+void iter_push(mm_iter *iter, multimap_node *node) {
+    if (iter->depth == iter->max_depth) {
+        iter->max_depth *= 2;
+        iter->stack = realloc(iter->stack,
+                              iter->max_depth * sizeof(multimap_node *));
+    }
+    iter->stack[iter->depth++] = node;
+}
+
+
+/* Positions an iterator before the first node whose key is at least the
+ * specified key.  The walk down from the root stacks each node that is at
+ * least the key, i.e. each node that we go left from, so the top of the
+ * stack is the first node to visit and the rest follow it in order.
+ */
+void iter_start(mm_iter *iter, multimap *mm, int key) {
+    multimap_node *node;
+
+    iter->from_snapshot = (mm->snapshot != NULL);
+    if (iter->from_snapshot) {
+        snap_iter_seek(&iter->snap, mm->snapshot, key);
+        iter->stack = NULL;
+        return;
+    }
+
+    iter->node = NULL;
+    iter->value_index = 0;
+    iter->depth = 0;
+    iter->max_depth = MAX_TREE_DEPTH;
+    iter->stack = malloc(iter->max_depth * sizeof(multimap_node *));
+
+    node = mm->root;
+    while (node != NULL) {
+        if (node->key >= key) {
+            iter_push(iter, node);
+            node = node->left_child;
+        }
+        else {
+            node = node->right_child;
+        }
+    }
+}
+
+
+/* Returns the next node of an in-order walk, or NULL if there are no more.
+ * The nodes of the popped node's right subtree come before anything else on
+ * the stack, so the path down the left side of that subtree is stacked.
+ */
+multimap_node * iter_next_node(mm_iter *iter) {
+    multimap_node *node, *next;
+
+    if (iter->depth == 0)
+        return NULL;
+
+    node = iter->stack[--iter->depth];
+    for (next = node->right_child; next != NULL; next = next->left_child)
+        iter_push(iter, next);
+
+    return node;
+}
+
+
+/* Passes each pair with lo <= key <= hi to the specified function, in key
+ * order.  Only the nodes along the path to lo, and the nodes in the range,
+ * are visited.
+ */
+int mm_range(multimap *mm, int lo, int hi, mm_range_func f, void *arg) {
+    mm_iter iter;
+    multimap_node *node;
+    unsigned int i;
+    int stop = 0;
+
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL)
+        return snap_range(mm->snapshot, lo, hi, f, arg);
+
+    iter_start(&iter, mm, lo);
+    while (!stop && (node = iter_next_node(&iter)) != NULL &&
+           node->key <= hi) {
+        for (i = 0; !stop && i < node->values.num_values; i++)
+            stop = f(node->key, node->values.values[i], arg);
+    }
+
+    free(iter.stack);
+    return stop;
+}
+
+
+/* Returns an iterator positioned at the first pair whose key is at least the
+ * specified key.
+ */
+mm_iter * mm_iter_seek(multimap *mm, int key) {
+    mm_iter *iter = malloc(sizeof(mm_iter));
+
+    assert(mm != NULL);
+
+    iter_start(iter, mm, key);
+    return iter;
+}
+
+
+/* Stores the iterator's next pair, and returns zero once there are none. */
+int mm_iter_next(mm_iter *iter, int *p_key, int *p_value) {
+    if (iter->from_snapshot)
+        return snap_iter_next(&iter->snap, p_key, p_value);
+
+    while (iter->node == NULL ||
+           iter->value_index == iter->node->values.num_values) {
+        iter->node = iter_next_node(iter);
+        if (iter->node == NULL)
+            return 0;
+        iter->value_index = 0;
+    }
+
+    *p_key = iter->node->key;
+    *p_value = iter->node->values.values[iter->value_index++];
+    return 1;
+}
+
+
+/* Releases an iterator. */
+void mm_iter_free(mm_iter *iter) {
+    free(iter->stack);
+    free(iter);
+}
+
+
+/* Reports how much memory the multimap is using.  This is everything held by
+ * the multimap's arena, plus the multimap structure itself.
+ */
+void mm_get_memory_usage(multimap *mm, mm_memory_usage *usage) {
+    assert(mm != NULL);
+
+    if (mm->snapshot != NULL) {
+        snap_get_memory_usage(mm->snapshot, usage);
+        return;
+    }
+
+    usage->num_pairs = mm->num_pairs;
+    usage->reserved_bytes = mm->arena.reserved_bytes + sizeof(multimap);
+    usage->used_bytes = mm->arena.allocated_bytes + sizeof(multimap);
+}
@@ -0,0 +1,149 @@
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "perfcount.h"
+
+
+#ifdef __linux__
+
+/* The hardware event counted by each counter. */
+static const unsigned long long perf_events[PERF_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+
+/* The layout of a read() from the group leader, with the read_format used
+ * below.
+ */
+typedef struct perf_group_read {
+    unsigned long long nr;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+    unsigned long long values[PERF_NUM_COUNTERS];
+} perf_group_read;
+
+#endif
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+void perf_close_fds(perf_counters *pc);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Closes whichever of the counters were opened. */
+void perf_close_fds(perf_counters *pc) {
+    int i;
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pc->fds[i] >= 0)
+            close(pc->fds[i]);
+        pc->fds[i] = -1;
+    }
+}
+
+
+/* Opens the counters as a single group, so that they are all scheduled onto
+ * the hardware together and their counts cover the same instructions.  Only
+ * user-mode events are counted, which most systems allow without privileges.
+ */
+void perf_open(perf_counters *pc) {
+    int i;
+
+    memset(pc, 0, sizeof(perf_counters));
+    for (i = 0; i < PERF_NUM_COUNTERS; i++)
+        pc->fds[i] = -1;
+
+#ifdef __linux__
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_events[i];
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        pc->fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1,
+                                   (i == 0) ? -1 : pc->fds[0], 0);
+        if (pc->fds[i] < 0) {
+            perf_close_fds(pc);
+            return;
+        }
+    }
+
+    pc->available = 1;
+#endif
+}
+
+
+/* Resets the counters to zero and starts them. */
+void perf_start(perf_counters *pc) {
+    if (!pc->available)
+        return;
+
+#ifdef __linux__
+    ioctl(pc->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+
+/* Stops the counters, and stores their counts.  If the group only ran for
+ * part of the time it was enabled, the counts are scaled up to estimate the
+ * whole time.
+ */
+void perf_stop(perf_counters *pc) {
+#ifdef __linux__
+    perf_group_read data;
+    double scale = 1.0;
+#endif
+    int i;
+
+    if (!pc->available)
+        return;
+
+#ifdef __linux__
+    ioctl(pc->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    if (read(pc->fds[0], &data, sizeof(data)) != sizeof(data) ||
+        data.nr != PERF_NUM_COUNTERS) {
+        memset(pc->counts, 0, sizeof(pc->counts));
+        return;
+    }
+
+    if (data.time_running > 0 && data.time_running < data.time_enabled)
+        scale = (double) data.time_enabled / (double) data.time_running;
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++)
+        pc->counts[i] = (unsigned long long) (data.values[i] * scale);
+#else
+    for (i = 0; i < PERF_NUM_COUNTERS; i++)
+        pc->counts[i] = 0;
+#endif
+}
+
+
+/* Closes the counters. */
+void perf_close(perf_counters *pc) {
+    perf_close_fds(pc);
+    pc->available = 0;
+}
@@ -0,0 +1,49 @@
+/* This file declares a small wrapper around the Linux perf_event_open()
+ * interface, used by mmbench to count hardware events while a workload
+ * runs.  On other systems, or when the kernel doesn't allow the counters to
+ * be opened (e.g. in a container, or with a strict perf_event_paranoid
+ * setting), the counters are simply reported as unavailable.
+ */
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+
+/* The events that are counted, in the order their counts are stored. */
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_CACHE_MISSES 2
+#define PERF_BRANCH_MISSES 3
+#define PERF_NUM_COUNTERS 4
+
+
+/* A group of hardware counters for the calling thread. */
+typedef struct perf_counters {
+    /* The file descriptor of each counter; the first is the group leader. */
+    int fds[PERF_NUM_COUNTERS];
+
+    /* Nonzero if every counter was opened. */
+    int available;
+
+    /* The counts from the last perf_stop(), scaled up if the kernel had to
+     * share the hardware counters with other events.
+     */
+    unsigned long long counts[PERF_NUM_COUNTERS];
+} perf_counters;
+
+
+/* Opens the counters.  If they can't all be opened, pc->available is set to
+ * zero and the other functions do nothing.
+ */
+void perf_open(perf_counters *pc);
+
+/* Resets the counters to zero and starts them. */
+void perf_start(perf_counters *pc);
+
+/* Stops the counters, and stores their counts in pc->counts. */
+void perf_stop(perf_counters *pc);
+
+/* Closes the counters. */
+void perf_close(perf_counters *pc);
+
+#endif
@@ -0,0 +1,523 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "multimap.h"
+#include "snapshot.h"
+
+
+/* snap_add_to_multimap() passes the pairs to mm_add_values_bulk() in batches
+ * of at most this many, to limit how much memory it needs at once.
+ */
+#define LOAD_BATCH (1 << 24)
+
+
+/* The pairs collected by mm_save_snapshot() while it iterates over a
+ * multimap.
+ */
+typedef struct snapshot_builder {
+    int *keys;
+    unsigned long long *offsets;
+    unsigned int num_keys;
+    unsigned int max_keys;
+
+    int *values;
+    unsigned long long num_pairs;
+    unsigned long long max_pairs;
+} snapshot_builder;
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int snap_collect_pair(snapshot_builder *builder, int key, int value);
+int snap_compare_values(const void *a, const void *b);
+unsigned long long snap_align(unsigned long long offset);
+int snap_write_section(FILE *file, const void *data, size_t size,
+                       unsigned long long offset);
+
+unsigned int snap_lower_bound(const mm_snapshot *snap, int key);
+long long snap_find_key(const mm_snapshot *snap, int key);
+int snap_search_values(const int *values, unsigned long long n, int value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Adds a pair from the iteration to the builder.  Pairs arrive in key order,
+ * so a key that differs from the last one starts a new key.  Returns zero if
+ * the builder's arrays couldn't be grown, leaving them as they were.
+ */
+int snap_collect_pair(snapshot_builder *builder, int key, int value) {
+    unsigned long long *offsets;
+    unsigned int max_keys;
+    unsigned long long max_pairs;
+    int *keys, *values;
+
+    if (builder->num_keys == 0 ||
+        builder->keys[builder->num_keys - 1] != key) {
+        if (builder->num_keys == builder->max_keys) {
+            max_keys = (builder->max_keys == 0) ? 1024 :
+                       2 * builder->max_keys;
+            keys = realloc(builder->keys, max_keys * sizeof(int));
+            if (keys == NULL)
+                return 0;
+            builder->keys = keys;
+
+            offsets = realloc(builder->offsets,
+                              (max_keys + 1) * sizeof(unsigned long long));
+            if (offsets == NULL)
+                return 0;
+            builder->offsets = offsets;
+            builder->max_keys = max_keys;
+        }
+        builder->keys[builder->num_keys] = key;
+        builder->offsets[builder->num_keys] = builder->num_pairs;
+        builder->num_keys++;
+    }
+
+    if (builder->num_pairs == builder->max_pairs) {
+        max_pairs = (builder->max_pairs == 0) ? 4096 :
+                    2 * builder->max_pairs;
+        values = realloc(builder->values, max_pairs * sizeof(int));
+        if (values == NULL)
+            return 0;
+        builder->values = values;
+        builder->max_pairs = max_pairs;
+    }
+    builder->values[builder->num_pairs++] = value;
+    return 1;
+}
+
+
+/* Comparison function for sorting values with qsort(). */
+int snap_compare_values(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+
+/* Rounds a file offset up to the start of the next section. */
+unsigned long long snap_align(unsigned long long offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(unsigned long long)
+           (SNAPSHOT_ALIGN - 1);
+}
+
+
+/* Pads the file out to the specified offset, and then writes a section.
+ * Returns zero if anything couldn't be written.
+ */
+int snap_write_section(FILE *file, const void *data, size_t size,
+                       unsigned long long offset) {
+    static const char zeros[SNAPSHOT_ALIGN];
+    long pos = ftell(file);
+
+    if (pos < 0 || (unsigned long long) pos > offset)
+        return 0;
+    if (fwrite(zeros, 1, offset - pos, file) != offset - pos)
+        return 0;
+
+    return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+
+/* Writes the multimap's pairs to a snapshot file.  The file is written under
+ * a temporary name and then renamed, so that a process opening the snapshot
+ * never sees a partly written file.  Returns 0 on success, or -1 with errno
+ * set if the file couldn't be written.
+ */
+int mm_save_snapshot(multimap *mm, const char *path) {
+    snapshot_builder builder;
+    snapshot_header header;
+    char *tmp_path = NULL;
+    FILE *file = NULL;
+    mm_iter *iter;
+    unsigned int i;
+    int key, value, ok, saved_errno;
+
+    bzero(&builder, sizeof(builder));
+
+    /* Collect the pairs in key order.  The builder needs room for the final
+     * offset even if the multimap is empty.
+     */
+    ok = 0;
+    iter = mm_iter_seek(mm, INT_MIN);
+    if (iter != NULL) {
+        ok = 1;
+        while (ok && mm_iter_next(iter, &key, &value))
+            ok = snap_collect_pair(&builder, key, value);
+        mm_iter_free(iter);
+    }
+    if (ok && builder.num_keys == 0) {
+        builder.offsets = calloc(1, sizeof(unsigned long long));
+        ok = (builder.offsets != NULL);
+    }
+    if (!ok) {
+        errno = ENOMEM;
+        goto done;
+    }
+
+    /* The iteration doesn't order each key's values, but the snapshot keeps
+     * them sorted so that they can be binary-searched.
+     */
+    builder.offsets[builder.num_keys] = builder.num_pairs;
+    for (i = 0; i < builder.num_keys; i++) {
+        qsort(builder.values + builder.offsets[i],
+              builder.offsets[i + 1] - builder.offsets[i], sizeof(int),
+              snap_compare_values);
+    }
+
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.num_keys = builder.num_keys;
+    header.num_pairs = builder.num_pairs;
+    header.keys_offset = snap_align(sizeof(header));
+    header.offsets_offset =
+        snap_align(header.keys_offset + builder.num_keys * sizeof(int));
+    header.values_offset =
+        snap_align(header.offsets_offset +
+                   (builder.num_keys + 1) * sizeof(unsigned long long));
+    header.file_size = header.values_offset + builder.num_pairs * sizeof(int);
+
+    tmp_path = malloc(strlen(path) + 5);
+    if (tmp_path == NULL) {
+        ok = 0;
+        errno = ENOMEM;
+        goto done;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    ok = 0;
+    file = fopen(tmp_path, "wb");
+    if (file != NULL) {
+        ok = snap_write_section(file, &header, sizeof(header), 0) &&
+             snap_write_section(file, builder.keys,
+                                builder.num_keys * sizeof(int),
+                                header.keys_offset) &&
+             snap_write_section(file, builder.offsets,
+                                (builder.num_keys + 1) *
+                                sizeof(unsigned long long),
+                                header.offsets_offset) &&
+             snap_write_section(file, builder.values,
+                                builder.num_pairs * sizeof(int),
+                                header.values_offset);
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && (rename(tmp_path, path) == 0);
+    }
+
+done:
+    saved_errno = errno;
+    if (file != NULL && !ok)
+        unlink(tmp_path);
+
+    free(tmp_path);
+    free(builder.keys);
+    free(builder.offsets);
+    free(builder.values);
+
+    errno = saved_errno;
+    return ok ? 0 : -1;
+}
+
+
+/* Maps a snapshot file into memory, and checks that it can be queried
+ * safely.  The header must describe a file of the right size.  The keys must
+ * be strictly increasing, since the searches depend on it.  The value
+ * offsets must run from 0 to num_pairs, and be strictly increasing too,
+ * since every key has at least one value; then every key's values are
+ * within the file.  This reads the keys and offsets, but not the values,
+ * which are trusted to be sorted within each key; a file whose values
+ * aren't sorted only gives wrong answers.
+ */
+mm_snapshot * snap_open(const char *path) {
+    const snapshot_header *header;
+    mm_snapshot *snap;
+    struct stat st;
+    unsigned int i;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    header = (const snapshot_header *) map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->file_size != (unsigned long long) st.st_size ||
+        header->num_pairs > header->file_size / sizeof(int) ||
+        header->keys_offset != snap_align(sizeof(snapshot_header)) ||
+        header->offsets_offset != snap_align(header->keys_offset +
+                                             header->num_keys * sizeof(int)) ||
+        header->values_offset !=
+            snap_align(header->offsets_offset + (header->num_keys + 1ULL) *
+                       sizeof(unsigned long long)) ||
+        header->file_size != header->values_offset +
+                             header->num_pairs * sizeof(int)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    snap = malloc(sizeof(mm_snapshot));
+    if (snap == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    snap->map = map;
+    snap->map_size = st.st_size;
+    snap->keys = (const int *) ((const char *) map + header->keys_offset);
+    snap->offsets = (const unsigned long long *)
+                    ((const char *) map + header->offsets_offset);
+    snap->values = (const int *) ((const char *) map + header->values_offset);
+    snap->num_keys = header->num_keys;
+    snap->num_pairs = header->num_pairs;
+
+    if (snap->offsets[0] != 0 ||
+        snap->offsets[snap->num_keys] != snap->num_pairs) {
+        snap_close(snap);
+        return NULL;
+    }
+
+    for (i = 0; i < snap->num_keys; i++) {
+        if (snap->offsets[i] >= snap->offsets[i + 1] ||
+            (i > 0 && snap->keys[i - 1] >= snap->keys[i])) {
+            snap_close(snap);
+            return NULL;
+        }
+    }
+
+    return snap;
+}
+
+
+/* Unmaps a snapshot, and frees the structure describing it. */
+void snap_close(mm_snapshot *snap) {
+    munmap(snap->map, snap->map_size);
+    free(snap);
+}
+
+
+/* Returns the index of the first key in the snapshot that is at least the
+ * specified key, or num_keys if there isn't one.  The search narrows the
+ * range without branching on the comparisons, which are unpredictable.
+ */
+unsigned int snap_lower_bound(const mm_snapshot *snap, int key) {
+    const int *base = snap->keys;
+    unsigned int n = snap->num_keys;
+
+    if (n == 0)
+        return 0;
+
+    while (n > 1) {
+        unsigned int half = n / 2;
+        base = (base[half - 1] < key) ? base + half : base;
+        n -= half;
+    }
+
+    return (base - snap->keys) + (*base < key);
+}
+
+
+/* Returns the index of a key in the snapshot, or -1 if it isn't there. */
+long long snap_find_key(const mm_snapshot *snap, int key) {
+    unsigned int i = snap_lower_bound(snap, key);
+
+    if (i == snap->num_keys || snap->keys[i] != key)
+        return -1;
+
+    return i;
+}
+
+
+/* Returns nonzero if a sorted array of n values contains the value. */
+int snap_search_values(const int *values, unsigned long long n, int value) {
+    const int *base = values;
+
+    if (n == 0)
+        return 0;
+
+    while (n > 1) {
+        unsigned long long half = n / 2;
+        base = (base[half] <= value) ? base + half : base;
+        n -= half;
+    }
+
+    return *base == value;
+}
+
+
+/* Returns nonzero if the snapshot contains the specified key. */
+int snap_contains_key(const mm_snapshot *snap, int key) {
+    return snap_find_key(snap, key) >= 0;
+}
+
+
+/* Returns nonzero if the snapshot contains the specified (key, value) pair. */
+int snap_contains_pair(const mm_snapshot *snap, int key, int value) {
+    long long i = snap_find_key(snap, key);
+
+    if (i < 0)
+        return 0;
+
+    return snap_search_values(snap->values + snap->offsets[i],
+                              snap->offsets[i + 1] - snap->offsets[i], value);
+}
+
+
+/* Probes the snapshot for n (key, value) pairs, setting bit i % 64 of
+ * results[i / 64] if the i-th pair is present.
+ */
+void snap_contains_pairs_batch(const mm_snapshot *snap, const int *keys,
+                               const int *values, unsigned int n,
+                               unsigned long long *results) {
+    unsigned int i;
+
+    bzero(results, (n + 63) / 64 * sizeof(unsigned long long));
+    for (i = 0; i < n; i++) {
+        if (snap_contains_pair(snap, keys[i], values[i]))
+            results[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+
+/* Passes each (key, value) pair of the snapshot to the specified function,
+ * in key order.
+ */
+void snap_traverse(const mm_snapshot *snap, void (*f)(int key, int value)) {
+    unsigned long long j;
+    unsigned int i;
+
+    for (i = 0; i < snap->num_keys; i++) {
+        for (j = snap->offsets[i]; j < snap->offsets[i + 1]; j++)
+            f(snap->keys[i], snap->values[j]);
+    }
+}
+
+
+/* Passes each pair of the snapshot with lo <= key <= hi to the specified
+ * function, stopping early if it returns nonzero.
+ */
+int snap_range(const mm_snapshot *snap, int lo, int hi, mm_range_func f,
+               void *arg) {
+    unsigned long long j;
+    unsigned int i;
+    int stop;
+
+    for (i = snap_lower_bound(snap, lo);
+         i < snap->num_keys && snap->keys[i] <= hi; i++) {
+        for (j = snap->offsets[i]; j < snap->offsets[i + 1]; j++) {
+            stop = f(snap->keys[i], snap->values[j], arg);
+            if (stop)
+                return stop;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Positions an iterator at the first pair whose key is at least the
+ * specified key.
+ */
+void snap_iter_seek(snap_iter *iter, const mm_snapshot *snap, int key) {
+    iter->snap = snap;
+    iter->key_index = snap_lower_bound(snap, key);
+    if (iter->key_index < snap->num_keys)
+        iter->value_index = snap->offsets[iter->key_index];
+}
+
+
+/* Stores the iterator's next pair and returns nonzero, or returns zero if
+ * there are no more pairs.
+ */
+int snap_iter_next(snap_iter *iter, int *p_key, int *p_value) {
+    const mm_snapshot *snap = iter->snap;
+
+    if (iter->key_index >= snap->num_keys)
+        return 0;
+
+    /* Every key has at least one value, so the next key's first value is
+     * always there.
+     */
+    if (iter->value_index == snap->offsets[iter->key_index + 1]) {
+        iter->key_index++;
+        if (iter->key_index == snap->num_keys)
+            return 0;
+    }
+
+    *p_key = snap->keys[iter->key_index];
+    *p_value = snap->values[iter->value_index++];
+    return 1;
+}
+
+
+/* Reports the memory used by a snapshot, which is the size of its mapping.
+ * The mapped pages are shared with any other process that has the same
+ * snapshot open.
+ */
+void snap_get_memory_usage(const mm_snapshot *snap, mm_memory_usage *usage) {
+    usage->num_pairs = snap->num_pairs;
+    usage->reserved_bytes = snap->map_size + sizeof(mm_snapshot);
+    usage->used_bytes = usage->reserved_bytes;
+}
+
+
+/* Adds every pair of a snapshot to a multimap. */
+void snap_add_to_multimap(const mm_snapshot *snap, multimap *mm) {
+    unsigned long long start, end, j;
+    unsigned int i = 0;
+    size_t size;
+    int *keys;
+
+    if (snap->num_pairs == 0)
+        return;
+
+    /* The multimaps have no way to report running out of memory while
+     * adding pairs, so this is fatal, as it is for their own nodes.
+     */
+    size = (snap->num_pairs < LOAD_BATCH ? snap->num_pairs : LOAD_BATCH) *
+           sizeof(int);
+    keys = malloc(size);
+    if (keys == NULL) {
+        fprintf(stderr, "Out of memory allocating %lu bytes for a snapshot.\n",
+                (unsigned long) size);
+        abort();
+    }
+
+    for (start = 0; start < snap->num_pairs; start = end) {
+        end = start + LOAD_BATCH;
+        if (end > snap->num_pairs)
+            end = snap->num_pairs;
+
+        /* Expand the keys of this batch's pairs from the offsets. */
+        for (j = start; j < end; j++) {
+            while (snap->offsets[i + 1] <= j)
+                i++;
+            keys[j - start] = snap->keys[i];
+        }
+
+        mm_add_values_bulk(mm, keys, snap->values + start,
+                           (unsigned int) (end - start));
+    }
+
+    free(keys);
+}
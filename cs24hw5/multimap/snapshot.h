@@ -0,0 +1,125 @@
+/* This file declares the snapshot files that multimaps can be saved to with
+ * mm_save_snapshot(), and opened from with mm_open_snapshot().
+ *
+ * A snapshot holds no pointers, so it can be mapped into memory and queried
+ * in place, and processes that open the same snapshot share its pages.  The
+ * file is laid out as:
+ *
+ *   - A header, described by snapshot_header below.
+ *
+ *   - The distinct keys, as ints in increasing order.
+ *
+ *   - num_keys + 1 value offsets, as unsigned long longs.  The values of the
+ *     i-th key are values[offsets[i]] up to values[offsets[i + 1]].
+ *
+ *   - The values, as ints.  Each key's values are sorted, and include any
+ *     duplicates that were added to the multimap.
+ *
+ * Each section starts on a 64-byte boundary.  Numbers are stored in the byte
+ * order of the machine that wrote the file, and a snapshot written on a
+ * machine with a different byte order is rejected.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+#include "multimap.h"
+
+
+/* The first bytes of every snapshot file, including the format version. */
+#define SNAPSHOT_MAGIC "MMSNAP01"
+
+/* Stored in the header so that files from machines with a different byte
+ * order can be recognized.
+ */
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+/* Each section of the file starts on a multiple of this many bytes. */
+#define SNAPSHOT_ALIGN 64
+
+
+/* The header at the start of a snapshot file. */
+typedef struct snapshot_header {
+    char magic[8];
+    unsigned int byte_order;
+    unsigned int num_keys;
+    unsigned long long num_pairs;
+
+    /* The offsets of the keys, value offsets and values, from the start of
+     * the file, and the total size of the file.
+     */
+    unsigned long long keys_offset;
+    unsigned long long offsets_offset;
+    unsigned long long values_offset;
+    unsigned long long file_size;
+} snapshot_header;
+
+
+/* A snapshot file that has been mapped into memory. */
+typedef struct mm_snapshot {
+    /* The mapping of the whole file. */
+    void *map;
+    size_t map_size;
+
+    /* The sections of the file; see the description above. */
+    const int *keys;
+    const unsigned long long *offsets;
+    const int *values;
+
+    unsigned int num_keys;
+    unsigned long long num_pairs;
+} mm_snapshot;
+
+
+/* A position in a snapshot, used by the multimaps' iterators when they are
+ * iterating over a snapshot.
+ */
+typedef struct snap_iter {
+    const mm_snapshot *snap;
+
+    /* The key being iterated over, and the next of its values. */
+    unsigned int key_index;
+    unsigned long long value_index;
+} snap_iter;
+
+
+/* Maps a snapshot file into memory.  Returns NULL if the file can't be
+ * opened, or isn't a snapshot written on this kind of machine.
+ */
+mm_snapshot * snap_open(const char *path);
+
+/* Unmaps a snapshot, and frees the structure describing it. */
+void snap_close(mm_snapshot *snap);
+
+/* Queries a snapshot; these behave like the multimap.h functions of the same
+ * names.
+ */
+int snap_contains_key(const mm_snapshot *snap, int key);
+int snap_contains_pair(const mm_snapshot *snap, int key, int value);
+void snap_contains_pairs_batch(const mm_snapshot *snap, const int *keys,
+                               const int *values, unsigned int n,
+                               unsigned long long *results);
+void snap_traverse(const mm_snapshot *snap, void (*f)(int key, int value));
+void snap_get_memory_usage(const mm_snapshot *snap, mm_memory_usage *usage);
+int snap_range(const mm_snapshot *snap, int lo, int hi, mm_range_func f,
+               void *arg);
+
+/* Positions an iterator at the first pair of the snapshot whose key is at
+ * least the specified key.
+ */
+void snap_iter_seek(snap_iter *iter, const mm_snapshot *snap, int key);
+
+/* Stores the iterator's next pair and returns nonzero, or returns zero if
+ * there are no more pairs.
+ */
+int snap_iter_next(snap_iter *iter, int *p_key, int *p_value);
+
+/* Adds every pair of a snapshot to a multimap, with mm_add_values_bulk().
+ * This is how a multimap opened from a snapshot is converted into an
+ * ordinary one, the first time that pairs are added to it.
+ */
+void snap_add_to_multimap(const mm_snapshot *snap, multimap *mm);
+
+#endif
@@ -0,0 +1,526 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "valueset.h"
+
+
+/* Sets with at most this many values are simply scanned. */
+#define SMALL_MAX 16
+
+/* In VS_SORTED mode, new values are appended to an unsorted tail, which is
+ * merged into the sorted prefix once it reaches this length.
+ */
+#define TAIL_MAX 16
+
+/* Sets with more than this many values, that aren't dense enough for a
+ * bitmap, are indexed with a hash table instead of being kept sorted, since
+ * merging into a large sorted array gets expensive.
+ */
+#define SORTED_MAX 512
+
+/* A set is dense enough for a bitmap when the bitmap would take no more than
+ * this many bits per value in the set, i.e. no more than the values array.
+ */
+#define BITMAP_DENSITY 32
+
+/* The value used to mark an empty hash-table slot.  Whether the set contains
+ * this value itself is recorded separately.
+ */
+#define EMPTY_SLOT INT_MIN
+
+
+/* The index of a VS_BITMAP or VS_HASH set. */
+struct value_index {
+    /* VS_BITMAP:  the value represented by bit 0 of the bitmap.
+     * VS_HASH:  the shift that turns a hash code into a slot number.
+     */
+    int base;
+
+    /* The number of words of the bitmap, or the number of slots of the hash
+     * table, which is always a power of 2.
+     */
+    unsigned int size;
+
+    /* VS_HASH:  the number of distinct values in the table, and whether the
+     * set contains EMPTY_SLOT.
+     */
+    unsigned int num_distinct;
+    int has_empty_value;
+
+    /* The bitmap words, or the hash-table slots. */
+    unsigned int data[];
+};
+
+
+/*============================================================================
+ * HELPER FUNCTION DECLARATIONS
+ *============================================================================*/
+
+int is_dense(const value_set *vs);
+size_t index_bytes(const value_index *index);
+void rebuild(value_set *vs, mm_arena *arena);
+
+int scan_values(const int *values, unsigned int n, int value);
+int compare_ints(const void *a, const void *b);
+int sorted_contains(const int *values, unsigned int n, int value);
+void merge_tail(value_set *vs);
+
+void build_bitmap(value_set *vs, mm_arena *arena);
+int bitmap_contains(const value_index *index, int value);
+int bitmap_add(value_index *index, int value);
+
+void build_hash(value_set *vs, mm_arena *arena, unsigned int num_slots);
+unsigned int hash_slot(const value_index *index, int value);
+int hash_contains(const value_index *index, int value);
+void hash_add(value_set *vs, mm_arena *arena, int value);
+
+
+/*============================================================================
+ * FUNCTION IMPLEMENTATIONS
+ *============================================================================*/
+
+/* Returns nonzero if the range of the set's values is small enough to be
+ * covered by a bitmap.
+ */
+int is_dense(const value_set *vs) {
+    long long range = (long long) vs->max_value - vs->min_value + 1;
+    return range <= (long long) BITMAP_DENSITY * vs->num_values;
+}
+
+
+/* Returns the number of bytes that an index was allocated with. */
+size_t index_bytes(const value_index *index) {
+    return sizeof(value_index) + index->size * sizeof(unsigned int);
+}
+
+
+/* Chooses the best mode for the set's current contents, and rebuilds the
+ * set's index for that mode from the values array.
+ */
+void rebuild(value_set *vs, mm_arena *arena) {
+    if (vs->index != NULL)
+        arena_free(arena, vs->index, index_bytes(vs->index));
+    vs->index = NULL;
+    vs->num_sorted = 0;
+
+    if (vs->num_values <= SMALL_MAX) {
+        vs->mode = VS_SMALL;
+    }
+    else if (is_dense(vs)) {
+        vs->mode = VS_BITMAP;
+        build_bitmap(vs, arena);
+    }
+    else if (vs->num_values <= SORTED_MAX) {
+        vs->mode = VS_SORTED;
+        qsort(vs->values, vs->num_values, sizeof(int), compare_ints);
+        vs->num_sorted = vs->num_values;
+    }
+    else {
+        vs->mode = VS_HASH;
+        build_hash(vs, arena, 2 * vs->num_values);
+    }
+}
+
+
+/* Returns nonzero if the first n entries of the array contain the value.
+ * This compares several values at a time where SSE2 is available.
+ */
+int scan_values(const int *values, unsigned int n, int value) {
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    __m128i probe = _mm_set1_epi32(value);
+
+    /* Check 16 values per iteration, only branching once for all of them. */
+    for (; i + 16 <= n; i += 16) {
+        const __m128i *p = (const __m128i *) (values + i);
+        __m128i eq =
+            _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p), probe),
+                             _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), probe)),
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), probe),
+                             _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), probe)));
+
+        if (_mm_movemask_epi8(eq) != 0)
+            return 1;
+    }
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (values + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(block, probe)) != 0)
+            return 1;
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (values[i] == value)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* Comparison function for sorting values with qsort(). */
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+
+/* Returns nonzero if a sorted array of n values contains the value.  The
+ * search narrows the range without branching on the comparisons, which are
+ * unpredictable.
+ */
+int sorted_contains(const int *values, unsigned int n, int value) {
+    const int *base = values;
+
+    if (n == 0)
+        return 0;
+
+    while (n > 1) {
+        unsigned int half = n / 2;
+        base = (base[half] <= value) ? base + half : base;
+        n -= half;
+    }
+
+    return *base == value;
+}
+
+
+/* Sorts the unsorted tail of a VS_SORTED set and merges it into the sorted
+ * prefix, from the back so that it can be done in place.
+ */
+void merge_tail(value_set *vs) {
+    int tail[TAIL_MAX];
+    unsigned int num_tail = vs->num_values - vs->num_sorted;
+    int i, j, k, t;
+
+    assert(num_tail <= TAIL_MAX);
+
+    /* Insertion-sort the tail into a separate buffer. */
+    for (i = 0; i < (int) num_tail; i++) {
+        t = vs->values[vs->num_sorted + i];
+        for (j = i; j > 0 && tail[j - 1] > t; j--)
+            tail[j] = tail[j - 1];
+        tail[j] = t;
+    }
+
+    i = (int) vs->num_sorted - 1;
+    j = (int) num_tail - 1;
+    k = (int) vs->num_values - 1;
+    while (j >= 0) {
+        if (i >= 0 && vs->values[i] > tail[j])
+            vs->values[k--] = vs->values[i--];
+        else
+            vs->values[k--] = tail[j--];
+    }
+
+    vs->num_sorted = vs->num_values;
+}
+
+
+/* Builds a bitmap over the set's values.  The bitmap covers some room on
+ * either side of the current range, so that sets whose range slowly widens
+ * don't need to be rebuilt on every addition.
+ */
+void build_bitmap(value_set *vs, mm_arena *arena) {
+    long long range, lo, hi;
+    unsigned int words, i;
+    value_index *index;
+
+    range = (long long) vs->max_value - vs->min_value + 1;
+    lo = vs->min_value - range / 4;
+    hi = vs->max_value + range / 4;
+    if (lo < INT_MIN)
+        lo = INT_MIN;
+    if (hi > INT_MAX)
+        hi = INT_MAX;
+
+    words = (unsigned int) ((hi - lo) / 32 + 1);
+
+    index = arena_zalloc(arena,
+                         sizeof(value_index) + words * sizeof(unsigned int));
+    index->base = (int) lo;
+    index->size = words;
+
+    for (i = 0; i < vs->num_values; i++)
+        bitmap_add(index, vs->values[i]);
+
+    vs->index = index;
+}
+
+
+/* Returns nonzero if the bitmap's bit for the value is set. */
+int bitmap_contains(const value_index *index, int value) {
+    unsigned int bit = (unsigned int) value - (unsigned int) index->base;
+    if (bit / 32 >= index->size)
+        return 0;
+    return (index->data[bit / 32] >> (bit % 32)) & 1;
+}
+
+
+/* Sets the bitmap's bit for the value.  Returns zero if the value is outside
+ * the range that the bitmap covers.
+ */
+int bitmap_add(value_index *index, int value) {
+    unsigned int bit = (unsigned int) value - (unsigned int) index->base;
+    if (value < index->base || bit / 32 >= index->size)
+        return 0;
+    index->data[bit / 32] |= 1u << (bit % 32);
+    return 1;
+}
+
+
+/* Builds a hash table of the set's distinct values, with at least the
+ * specified number of slots.
+ */
+void build_hash(value_set *vs, mm_arena *arena, unsigned int num_slots) {
+    unsigned int size = 16, shift = 28, i;
+    value_index *index;
+
+    while (size < num_slots) {
+        size *= 2;
+        shift--;
+    }
+
+    index = arena_alloc(arena,
+                        sizeof(value_index) + size * sizeof(unsigned int));
+    index->base = shift;
+    index->size = size;
+    index->num_distinct = 0;
+    index->has_empty_value = 0;
+    for (i = 0; i < size; i++)
+        index->data[i] = (unsigned int) EMPTY_SLOT;
+
+    vs->index = index;
+    for (i = 0; i < vs->num_values; i++)
+        hash_add(vs, arena, vs->values[i]);
+}
+
+
+/* Returns the slot where a value's probe sequence starts.  This is a
+ * multiplicative hash, which keeps the well-mixed high bits of the product.
+ */
+unsigned int hash_slot(const value_index *index, int value) {
+    return ((unsigned int) value * 2654435761u) >> index->base;
+}
+
+
+/* Returns nonzero if the hash table contains the value. */
+int hash_contains(const value_index *index, int value) {
+    unsigned int mask = index->size - 1;
+    unsigned int slot = hash_slot(index, value);
+
+    if (value == EMPTY_SLOT)
+        return index->has_empty_value;
+
+    /* Linear probing; the table is never more than half full, so there is
+     * always an empty slot to stop at.
+     */
+    while (index->data[slot] != (unsigned int) EMPTY_SLOT) {
+        if (index->data[slot] == (unsigned int) value)
+            return 1;
+        slot = (slot + 1) & mask;
+    }
+
+    return 0;
+}
+
+
+/* Adds a value to the set's hash table if it isn't already there, doubling
+ * the table once it is half full.
+ */
+void hash_add(value_set *vs, mm_arena *arena, int value) {
+    value_index *index = vs->index;
+    unsigned int mask = index->size - 1;
+    unsigned int slot = hash_slot(index, value);
+
+    if (value == EMPTY_SLOT) {
+        index->has_empty_value = 1;
+        return;
+    }
+
+    while (index->data[slot] != (unsigned int) EMPTY_SLOT) {
+        if (index->data[slot] == (unsigned int) value)
+            return;
+        slot = (slot + 1) & mask;
+    }
+
+    index->data[slot] = (unsigned int) value;
+    index->num_distinct++;
+
+    if (2 * index->num_distinct > index->size) {
+        /* Rehash from the values array; the set must be large for the table
+         * to fill up, so this is amortized over many additions.
+         */
+        unsigned int num_slots = 2 * index->size;
+        arena_free(arena, index, index_bytes(index));
+        build_hash(vs, arena, num_slots);
+    }
+}
+
+
+/* Initializes an empty value set. */
+void vs_init(value_set *vs) {
+    bzero(vs, sizeof(value_set));
+    vs->mode = VS_SMALL;
+}
+
+
+/* Releases all memory held by a value set, leaving it empty. */
+void vs_clear(value_set *vs, mm_arena *arena) {
+    arena_free(arena, vs->values, vs->max_values * sizeof(int));
+    if (vs->index != NULL)
+        arena_free(arena, vs->index, index_bytes(vs->index));
+    vs_init(vs);
+}
+
+
+/* Adds a value to the set. */
+void vs_add(value_set *vs, mm_arena *arena, int value) {
+    unsigned int old_max = vs->max_values;
+
+    if (vs->num_values == vs->max_values) {
+        vs->max_values = (vs->max_values == 0) ? 1 : vs->max_values * 2;
+        vs->values = arena_realloc(arena, vs->values, old_max * sizeof(int),
+                                   vs->max_values * sizeof(int));
+    }
+
+    vs->values[vs->num_values] = value;
+    vs->num_values++;
+
+    if (vs->num_values == 1 || value < vs->min_value)
+        vs->min_value = value;
+    if (vs->num_values == 1 || value > vs->max_value)
+        vs->max_value = value;
+
+    switch (vs->mode) {
+    case VS_SMALL:
+        if (vs->num_values > SMALL_MAX)
+            rebuild(vs, arena);
+        break;
+
+    case VS_SORTED:
+        if (vs->num_values > SORTED_MAX || is_dense(vs))
+            rebuild(vs, arena);
+        else if (vs->num_values - vs->num_sorted == TAIL_MAX)
+            merge_tail(vs);
+        break;
+
+    case VS_BITMAP:
+        /* A value outside the bitmap means that the range has widened; the
+         * set may no longer be dense enough for a bitmap.
+         */
+        if (!bitmap_add(vs->index, value))
+            rebuild(vs, arena);
+        break;
+
+    case VS_HASH:
+        if (is_dense(vs))
+            rebuild(vs, arena);
+        else
+            hash_add(vs, arena, value);
+        break;
+    }
+}
+
+
+/* Adds n values to the set. */
+void vs_add_many(value_set *vs, mm_arena *arena, const int *values,
+                 unsigned int n) {
+    unsigned int old_max = vs->max_values, i;
+
+    /* Adding a few values to a large set is cheaper one at a time than
+     * rebuilding the set's index.
+     */
+    if (n < vs->num_values) {
+        for (i = 0; i < n; i++)
+            vs_add(vs, arena, values[i]);
+        return;
+    }
+
+    if (n == 0)
+        return;
+
+    if (vs->num_values + n > vs->max_values) {
+        if (vs->max_values == 0)
+            vs->max_values = 1;
+        while (vs->max_values < vs->num_values + n)
+            vs->max_values *= 2;
+        vs->values = arena_realloc(arena, vs->values, old_max * sizeof(int),
+                                   vs->max_values * sizeof(int));
+    }
+
+    memcpy(vs->values + vs->num_values, values, n * sizeof(int));
+
+    if (vs->num_values == 0)
+        vs->min_value = vs->max_value = values[0];
+    for (i = 0; i < n; i++) {
+        if (values[i] < vs->min_value)
+            vs->min_value = values[i];
+        if (values[i] > vs->max_value)
+            vs->max_value = values[i];
+    }
+    vs->num_values += n;
+
+    rebuild(vs, arena);
+}
+
+
+/* Returns nonzero if the set contains the specified value, zero otherwise. */
+int vs_contains(const value_set *vs, int value) {
+    if (vs->num_values == 0 || value < vs->min_value || value > vs->max_value)
+        return 0;
+
+    switch (vs->mode) {
+    case VS_SMALL:
+        return scan_values(vs->values, vs->num_values, value);
+
+    case VS_SORTED:
+        return sorted_contains(vs->values, vs->num_sorted, value) ||
+               scan_values(vs->values + vs->num_sorted,
+                           vs->num_values - vs->num_sorted, value);
+
+    case VS_BITMAP:
+        return bitmap_contains(vs->index, value);
+
+    case VS_HASH:
+        return hash_contains(vs->index, value);
+    }
+
+    return 0;
+}
+
+
+/* Prefetches the memory that vs_contains() will first need to look at. */
+void vs_prefetch(const value_set *vs, int value) {
+    if (vs->num_values == 0 || value < vs->min_value || value > vs->max_value)
+        return;
+
+    switch (vs->mode) {
+    case VS_SMALL:
+        __builtin_prefetch(vs->values);
+        break;
+
+    case VS_SORTED:
+        /* The first probe of the binary search is the middle value. */
+        __builtin_prefetch(vs->values + vs->num_sorted / 2);
+        break;
+
+    case VS_BITMAP:
+    case VS_HASH:
+        /* The index header has to be read before the word or slot for the
+         * value can be found; for small indexes they share a cache line.
+         */
+        __builtin_prefetch(vs->index);
+        break;
+    }
+}
@@ -0,0 +1,99 @@
+/* This file declares the value-set type used by the optimized multimaps to
+ * hold the values associated with a single key.
+ *
+ * A value set is a multiset:  adding the same value twice stores it twice,
+ * so that traversal reports every (key, value) pair that was added.  All of
+ * the values are always kept in the values array, in no particular order,
+ * and callers may read that array directly to traverse the set.  Depending on
+ * how many values there are and how they are spread out, the set also keeps
+ * them sorted, or maintains a bitmap or hash index over them, so that
+ * vs_contains() doesn't need to scan every value.
+ *
+ * A set's memory is allocated from the arena passed to the functions that
+ * change it, which must be the same arena every time.
+ */
+
+#ifndef VALUESET_H
+#define VALUESET_H
+
+#include "arena.h"
+
+
+/* The ways that a value set can answer membership queries. */
+typedef enum {
+    /* A few values, scanned linearly. */
+    VS_SMALL,
+
+    /* The values array is sorted, apart from a short unsorted tail of recent
+     * additions, and is binary-searched.
+     */
+    VS_SORTED,
+
+    /* A bitmap covering the range of the values, for dense sets. */
+    VS_BITMAP,
+
+    /* A hash table of the distinct values, for large sparse sets. */
+    VS_HASH
+} vs_mode;
+
+
+/* The bitmap or hash table of a set; this is private to valueset.c. */
+typedef struct value_index value_index;
+
+
+/* The values associated with one key of a multimap. */
+typedef struct value_set {
+    /* All of the values in the set, including duplicates. */
+    int *values;
+
+    /* The number of values in the array, and the allocated size of the
+     * array.  The array doubles in size once it is filled up.
+     */
+    unsigned int num_values;
+    unsigned int max_values;
+
+    /* The smallest and largest values in the set, which are used to reject
+     * out-of-range probes and to decide whether the set is dense.
+     */
+    int min_value;
+    int max_value;
+
+    /* In VS_SORTED mode, the length of the sorted prefix of values. */
+    unsigned int num_sorted;
+
+    /* How membership queries are answered, and the index used by the
+     * VS_BITMAP and VS_HASH modes.
+     */
+    vs_mode mode;
+    value_index *index;
+} value_set;
+
+
+/* Initializes an empty value set. */
+void vs_init(value_set *vs);
+
+/* Releases all memory held by a value set back to the arena that it was
+ * allocated from, leaving it empty.  This isn't needed when the whole arena
+ * is about to be cleared.
+ */
+void vs_clear(value_set *vs, mm_arena *arena);
+
+/* Adds a value to the set, allocating from the specified arena. */
+void vs_add(value_set *vs, mm_arena *arena, int value);
+
+/* Adds n values to the set.  The values array is grown once for the whole
+ * batch, and for large batches the index is rebuilt once at the end rather
+ * than being updated for each value.
+ */
+void vs_add_many(value_set *vs, mm_arena *arena, const int *values,
+                 unsigned int n);
+
+/* Returns nonzero if the set contains the specified value, zero otherwise. */
+int vs_contains(const value_set *vs, int value);
+
+/* Prefetches the memory that vs_contains() will first need to look at, so
+ * that a later probe for the value doesn't stall on it.
+ */
+void vs_prefetch(const value_set *vs, int value);
+
+#endif